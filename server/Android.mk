@@ -31,6 +31,7 @@ LOCAL_AIDL_INCLUDES := $(LOCAL_PATH)/binder
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/binder
 LOCAL_SRC_FILES := \
         binder/android/net/INetd.aidl \
+        binder/android/net/ResolverInfo.cpp \
         binder/android/net/UidRange.cpp
 
 include $(BUILD_SHARED_LIBRARY)
@@ -74,10 +75,17 @@ LOCAL_STATIC_LIBRARIES := \
 
 LOCAL_SRC_FILES := \
         BandwidthController.cpp \
+        BroadcastCoalescer.cpp \
+        BroadcastWriter.cpp \
         ClatdController.cpp \
+        ClatdSupervisor.cpp \
         CommandListener.cpp \
         Controllers.cpp \
+        DnsAddressSorter.cpp \
+        DnsEventReporter.cpp \
+        DnsPrefetcher.cpp \
         DnsProxyListener.cpp \
+        DnsResponseEncoder.cpp \
         DummyNetwork.cpp \
         DumpWriter.cpp \
         EventReporter.cpp \
@@ -87,6 +95,7 @@ LOCAL_SRC_FILES := \
         InterfaceController.cpp \
         LocalNetwork.cpp \
         MDnsSdListener.cpp \
+        MetricsAggregator.cpp \
         NatController.cpp \
         NetdCommand.cpp \
         NetdConstants.cpp \
@@ -100,10 +109,14 @@ LOCAL_SRC_FILES := \
         QtiConnectivityAdapter.cpp \
         ResolverController.cpp \
         RouteController.cpp \
+        RtnetlinkEvent.cpp \
         SockDiag.cpp \
         SoftapController.cpp \
         StrictController.cpp \
+        SysctlWriter.cpp \
         TetherController.cpp \
+        TetherCounters.cpp \
+        TetherOffloadController.cpp \
         UidRanges.cpp \
         VirtualNetwork.cpp \
         main.cpp \
@@ -151,6 +164,7 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := netd_unit_test
 LOCAL_CFLAGS := -Wall -Werror -Wunused-parameter
 LOCAL_C_INCLUDES := \
+        bionic/libc/dns/include \
         system/netd/include \
         system/netd/server \
         system/netd/server/binder \
@@ -159,10 +173,24 @@ LOCAL_C_INCLUDES := \
 LOCAL_SRC_FILES := \
         NetdConstants.cpp IptablesBaseTest.cpp \
         BandwidthController.cpp BandwidthControllerTest.cpp \
+        BroadcastCoalescer.cpp BroadcastCoalescerTest.cpp DumpWriter.cpp \
+        BroadcastWriter.cpp BroadcastWriterTest.cpp \
+        ClatdSupervisor.cpp ClatdSupervisorTest.cpp \
+        DnsAddressSorter.cpp DnsAddressSorterTest.cpp \
+        DnsPrefetcher.cpp DnsPrefetcherTest.cpp \
+        DnsResponseEncoder.cpp DnsResponseEncoderTest.cpp \
         FirewallControllerTest.cpp FirewallController.cpp \
+        IdletimerController.cpp IdletimerControllerTest.cpp \
+        MetricsAggregator.cpp MetricsAggregatorTest.cpp \
+        MpscRingTest.cpp \
         NatControllerTest.cpp NatController.cpp \
+        RequestTableTest.cpp \
+        RtnetlinkEvent.cpp RtnetlinkEventTest.cpp \
         SockDiagTest.cpp SockDiag.cpp \
         StrictController.cpp StrictControllerTest.cpp \
+        SysctlWriter.cpp SysctlWriterTest.cpp \
+        TetherCounters.cpp TetherCountersTest.cpp \
+        TetherOffloadController.cpp TetherOffloadControllerTest.cpp \
         UidRanges.cpp \
 
 LOCAL_MODULE_TAGS := tests
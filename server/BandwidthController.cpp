@@ -56,6 +56,8 @@
 #include "NatController.h"  /* For LOCAL_TETHER_COUNTERS_CHAIN */
 #include "ResponseCode.h"
 #include "QtiConnectivityAdapter.h"
+#include "TetherCounters.h"
+#include "TetherOffloadController.h"
 
 /* Alphabetical */
 #define ALERT_IPT_TEMPLATE "%s %s -m quota2 ! --quota %" PRId64" --name %s"
@@ -196,7 +198,9 @@ static const std::vector<std::string> IPT_BASIC_ACCOUNTING_COMMANDS = {
 
 }  // namespace
 
-BandwidthController::BandwidthController(void) {
+BandwidthController::BandwidthController(TetherCounters* tetherCounters,
+                                         TetherOffloadController* tetherOffloadCtrl)
+        : mTetherCounters(tetherCounters), mTetherOffloadCtrl(tetherOffloadCtrl) {
 }
 
 int BandwidthController::runIpxtablesCmd(const char *cmd, IptJumpOp jumpHandling,
@@ -1357,6 +1361,16 @@ int BandwidthController::addForwardChainStats(const TetherStats& filter,
     return 0;
 }
 
+bool BandwidthController::matchesFilter(const TetherStats& filter, const TetherStats& stats) {
+    if (filter.intIface[0] && filter.extIface[0]) {
+        return filter.intIface == stats.intIface && filter.extIface == stats.extIface;
+    }
+    if (filter.intIface[0] || filter.extIface[0]) {
+        return filter.intIface == stats.intIface || filter.extIface == stats.extIface;
+    }
+    return true;
+}
+
 char *BandwidthController::TetherStats::getStatsLine(void) const {
     char *msg;
     asprintf(&msg, "%s %s %" PRId64" %" PRId64" %" PRId64" %" PRId64, intIface.c_str(), extIface.c_str(),
@@ -1384,19 +1398,44 @@ int BandwidthController::getTetherStats(SocketClient *cli, TetherStats& filter,
 
     TetherStatsList statsList;
 
-    for (const auto binary : {IPTABLES_PATH, IP6TABLES_PATH}) {
-        fullCmd = getTetherStatsCommand(binary);
-        iptOutput = popenFunction(fullCmd.c_str(), "r");
-        if (!iptOutput) {
-                ALOGE("Failed to run %s err=%s", fullCmd.c_str(), strerror(errno));
-                extraProcessingInfo += "Failed to run iptables.";
+    if (mTetherCounters && mTetherCounters->isEnabled()) {
+        /* One snapshot of all pairs, with nothing to parse. */
+        TetherStatsList counterStatsList;
+        if (mTetherCounters->getTetherStats(&counterStatsList)) {
+            extraProcessingInfo += "Failed to read tether counters.";
             return -1;
         }
+        for (const auto& stats : counterStatsList) {
+            if (matchesFilter(filter, stats)) {
+                addStats(statsList, stats);
+            }
+        }
+    } else {
+        for (const auto binary : {IPTABLES_PATH, IP6TABLES_PATH}) {
+            fullCmd = getTetherStatsCommand(binary);
+            iptOutput = popenFunction(fullCmd.c_str(), "r");
+            if (!iptOutput) {
+                    ALOGE("Failed to run %s err=%s", fullCmd.c_str(), strerror(errno));
+                    extraProcessingInfo += "Failed to run iptables.";
+                return -1;
+            }
 
-        res = addForwardChainStats(filter, statsList, iptOutput, extraProcessingInfo);
-        pclose(iptOutput);
-        if (res != 0) {
-            return res;
+            res = addForwardChainStats(filter, statsList, iptOutput, extraProcessingInfo);
+            pclose(iptOutput);
+            if (res != 0) {
+                return res;
+            }
+        }
+    }
+
+    /* Offloaded flows skip the iptables counters, so their traffic is added separately. */
+    if (mTetherOffloadCtrl) {
+        TetherStatsList offloadStatsList;
+        mTetherOffloadCtrl->getTetherStats(&offloadStatsList);
+        for (const auto& stats : offloadStatsList) {
+            if (matchesFilter(filter, stats)) {
+                addStats(statsList, stats);
+            }
         }
     }
 
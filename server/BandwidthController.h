@@ -26,6 +26,9 @@
 
 #include "NetdConstants.h"
 
+class TetherCounters;
+class TetherOffloadController;
+
 class BandwidthController {
 public:
     android::RWLock lock;
@@ -66,7 +69,10 @@ public:
         }
     };
 
-    BandwidthController();
+    // If tetherCounters is enabled, getTetherStats() reads its objects instead of iptables. If
+    // tetherOffloadCtrl is not null, getTetherStats() includes the traffic it offloaded.
+    explicit BandwidthController(TetherCounters* tetherCounters = nullptr,
+                                 TetherOffloadController* tetherOffloadCtrl = nullptr);
 
     int setupIptablesHooks(void);
 
@@ -200,6 +206,9 @@ protected:
                                     TetherStatsList& statsList, FILE *fp,
                                     std::string &extraProcessingInfo);
 
+    /* Whether stats belong to the pair, interface or everything that filter selects. */
+    static bool matchesFilter(const TetherStats& filter, const TetherStats& stats);
+
 
     /*
      * stats should never have only intIface initialized. Other 3 combos are ok.
@@ -247,6 +256,9 @@ protected:
 
     std::list<QuotaInfo> quotaIfaces;
 
+    TetherCounters* const mTetherCounters;
+    TetherOffloadController* const mTetherOffloadCtrl;
+
     // For testing.
     friend class BandwidthControllerTest;
     static int (*execFunction)(int, char **, int *, bool, bool);
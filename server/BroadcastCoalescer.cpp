@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+
+#define LOG_TAG "Netd"
+
+#include <android-base/stringprintf.h>
+#include <cutils/log.h>
+#include <sysutils/SocketClient.h>
+#include <sysutils/SocketListener.h>
+
+#include "BroadcastCoalescer.h"
+#include "BroadcastWriter.h"
+#include "DumpWriter.h"
+
+using android::base::StringAppendF;
+
+namespace {
+
+class SendBatchCommand : public SocketClientCommand {
+public:
+    SendBatchCommand(BroadcastWriter *writer, const std::string& batch) :
+            mWriter(writer), mBatch(batch),
+            mEvents(std::count(batch.begin(), batch.end(), '\0')) {}
+
+    void runSocketCommand(SocketClient *client) override {
+        if (mWriter != nullptr) {
+            mWriter->enqueue(client, mBatch, mEvents);
+        } else if (client->sendData(mBatch.data(), mBatch.size())) {
+            SLOGW("Error sending broadcast (%s)", strerror(errno));
+        }
+    }
+
+private:
+    BroadcastWriter *mWriter;
+    const std::string& mBatch;
+    const size_t mEvents;
+};
+
+}  // namespace
+
+BroadcastCoalescer::BroadcastCoalescer(std::chrono::milliseconds window) :
+        mWindow(window), mListener(nullptr), mWriter(nullptr), mCounters(), mBatches(0),
+        mRunning(false), mStopping(false) {}
+
+BroadcastCoalescer::~BroadcastCoalescer() {
+    stop();
+}
+
+int BroadcastCoalescer::start() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mRunning) {
+        return 0;
+    }
+    mStopping = false;
+    if (int ret = pthread_create(&mThread, NULL, BroadcastCoalescer::threadStart, this)) {
+        errno = ret;
+        return -1;
+    }
+    mRunning = true;
+    return 0;
+}
+
+void BroadcastCoalescer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mRunning) {
+            return;
+        }
+        mStopping = true;
+    }
+    mCv.notify_one();
+    pthread_join(mThread, NULL);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mRunning = false;
+}
+
+void BroadcastCoalescer::notify(EventType type, const std::string& key, int code,
+                                const std::string& msg) {
+    bool hold;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mCounters[type].received++;
+
+        if (!key.empty()) {
+            auto existing = mPendingByKey.find(std::make_pair(type, key));
+            if (existing != mPendingByKey.end()) {
+                mPending.erase(existing->second);
+                mPendingByKey.erase(existing);
+                mCounters[type].coalesced++;
+            }
+        }
+
+        mPending.push_back({ type, key, code, msg });
+        if (!key.empty()) {
+            mPendingByKey[std::make_pair(type, key)] = std::prev(mPending.end());
+        }
+        // Don't hold on to the notification if it cannot be superseded, or if there is no thread
+        // to send it later.
+        hold = mRunning && !key.empty();
+    }
+
+    if (hold) {
+        mCv.notify_one();
+    } else {
+        flush();
+    }
+}
+
+void BroadcastCoalescer::flush() {
+    std::lock_guard<std::mutex> lock(mSendLock);
+    sendBatch(takeBatch());
+}
+
+std::string BroadcastCoalescer::takeBatch() {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    std::string batch;
+    for (const Notification& n : mPending) {
+        // Broadcasts are unsolicited and do not include a command number. Each message is
+        // NUL-terminated, exactly as SocketClient::sendMsg() would write it.
+        StringAppendF(&batch, "%d %s", n.code, n.msg.c_str());
+        batch.push_back('\0');
+        mCounters[n.type].sent++;
+    }
+    if (!mPending.empty()) {
+        mBatches++;
+    }
+    mPending.clear();
+    mPendingByKey.clear();
+
+    return batch;
+}
+
+void BroadcastCoalescer::sendBatch(const std::string& batch) {
+    if (batch.empty() || mListener == nullptr) {
+        return;
+    }
+    SendBatchCommand command(mWriter, batch);
+    mListener->runOnEachSocket(&command);
+}
+
+void *BroadcastCoalescer::threadStart(void *obj) {
+    reinterpret_cast<BroadcastCoalescer *>(obj)->run();
+    return NULL;
+}
+
+void BroadcastCoalescer::run() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mLock);
+            mCv.wait(lock, [this] { return mStopping || !mPending.empty(); });
+            if (!mStopping) {
+                // Give later events a chance to supersede the ones we already have. This also
+                // limits us to one write per client per window.
+                mCv.wait_for(lock, mWindow, [this] { return mStopping; });
+            }
+        }
+
+        // Flush whatever is pending, even if we are stopping.
+        flush();
+
+        std::lock_guard<std::mutex> lock(mLock);
+        if (mStopping) {
+            return;
+        }
+    }
+}
+
+const char *BroadcastCoalescer::eventTypeName(EventType type) {
+    switch (type) {
+        case INTERFACE:      return "interface";
+        case ADDRESS:        return "address";
+        case ROUTE:          return "route";
+        case DNS_INFO:       return "dnsinfo";
+        case CLASS_ACTIVITY: return "classactivity";
+        case QUOTA:          return "quota";
+        case STRICT:         return "strict";
+        default:             return "unknown";
+    }
+}
+
+void BroadcastCoalescer::dump(DumpWriter& dw) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    dw.println("Broadcasts: window=%lldms batches=%" PRIu64 " pending=%zu",
+               static_cast<long long>(mWindow.count()), mBatches, mPending.size());
+    dw.incIndent();
+    for (int i = 0; i < NUM_EVENT_TYPES; i++) {
+        const Counters& c = mCounters[i];
+        dw.println("%s: received=%" PRIu64 " coalesced=%" PRIu64 " sent=%" PRIu64,
+                   eventTypeName(static_cast<EventType>(i)), c.received, c.coalesced, c.sent);
+    }
+    dw.decIndent();
+}
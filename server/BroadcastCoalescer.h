@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_BROADCAST_COALESCER_H
+#define NETD_SERVER_BROADCAST_COALESCER_H
+
+#include <pthread.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+class BroadcastWriter;
+class DumpWriter;
+class SocketListener;
+
+/*
+ * Collects unsolicited notifications for framework clients and sends them in batches.
+ *
+ * Notifications are held for a short window. A notification with a non-empty key supersedes any
+ * pending notification of the same type and key (e.g., repeated updates to the same route, or a
+ * link that flaps up and down), so only the latest state is sent. When the window expires, all
+ * pending notifications are serialized back to back, in the format used by
+ * SocketClient::sendMsg(), and written to each client with a single write. If a BroadcastWriter is
+ * set, it performs the writes so that slow clients cannot stall the caller.
+ *
+ * A notification with an empty key (e.g., a quota or strict mode alert) is not held at all. It is
+ * sent right away, in the same batch as the notifications queued before it, so that clients see
+ * all notifications in the order they were made.
+ */
+class BroadcastCoalescer {
+public:
+    enum EventType {
+        INTERFACE,
+        ADDRESS,
+        ROUTE,
+        DNS_INFO,
+        CLASS_ACTIVITY,
+        QUOTA,
+        STRICT,
+        NUM_EVENT_TYPES
+    };
+
+    explicit BroadcastCoalescer(std::chrono::milliseconds window);
+    virtual ~BroadcastCoalescer();
+
+    void setListener(SocketListener *listener) { mListener = listener; }
+    void setWriter(BroadcastWriter *writer) { mWriter = writer; }
+
+    int start();
+    void stop();
+
+    // Queues a notification. If key is empty, the notification is never coalesced, and it is sent
+    // right away together with everything queued before it.
+    void notify(EventType type, const std::string& key, int code, const std::string& msg);
+
+    void dump(DumpWriter& dw);
+
+protected:
+    // Removes all pending notifications and returns them as a batch of NUL-terminated messages.
+    std::string takeBatch();
+
+    // Writes a batch to every connected client.
+    virtual void sendBatch(const std::string& batch);
+
+private:
+    struct Notification {
+        EventType type;
+        std::string key;
+        int code;
+        std::string msg;
+    };
+
+    struct Counters {
+        uint64_t received;
+        uint64_t coalesced;
+        uint64_t sent;
+    };
+
+    static void *threadStart(void *obj);
+    void run();
+    // Sends everything that is pending.
+    void flush();
+    static const char *eventTypeName(EventType type);
+
+    const std::chrono::milliseconds mWindow;
+    SocketListener *mListener;
+    BroadcastWriter *mWriter;
+
+    // Held while a batch is taken and sent, so that a batch taken later is never sent earlier.
+    std::mutex mSendLock;
+    std::mutex mLock;
+    std::condition_variable mCv;
+    std::list<Notification> mPending;
+    std::map<std::pair<EventType, std::string>, std::list<Notification>::iterator> mPendingByKey;
+    Counters mCounters[NUM_EVENT_TYPES];
+    uint64_t mBatches;
+    bool mRunning;
+    bool mStopping;
+    pthread_t mThread;
+};
+
+#endif  // NETD_SERVER_BROADCAST_COALESCER_H
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * BroadcastCoalescerTest.cpp - unit tests for BroadcastCoalescer.cpp
+ */
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "BroadcastCoalescer.h"
+
+namespace {
+
+// Splits a batch into its NUL-terminated messages.
+std::vector<std::string> splitBatch(const std::string& batch) {
+    std::vector<std::string> msgs;
+    size_t start = 0;
+    size_t end;
+    while ((end = batch.find('\0', start)) != std::string::npos) {
+        msgs.push_back(batch.substr(start, end - start));
+        start = end + 1;
+    }
+    EXPECT_EQ(batch.size(), start) << "Batch not NUL-terminated";
+    return msgs;
+}
+
+}  // namespace
+
+class FakeCoalescer : public BroadcastCoalescer {
+public:
+    explicit FakeCoalescer(std::chrono::milliseconds window) : BroadcastCoalescer(window) {}
+    ~FakeCoalescer() { stop(); }
+
+    using BroadcastCoalescer::takeBatch;
+
+    std::vector<std::string> sent;
+
+protected:
+    void sendBatch(const std::string& batch) override {
+        if (!batch.empty()) {
+            sent.push_back(batch);
+        }
+    }
+};
+
+class BroadcastCoalescerTest : public ::testing::Test {
+protected:
+    // Long enough that the flusher thread never fires during a test.
+    FakeCoalescer mCoalescer{std::chrono::milliseconds(3600 * 1000)};
+};
+
+TEST_F(BroadcastCoalescerTest, TestNotStartedSendsImmediately) {
+    mCoalescer.notify(BroadcastCoalescer::QUOTA, "", 600, "limit alert foo wlan0");
+    ASSERT_EQ(1U, mCoalescer.sent.size());
+    EXPECT_EQ(std::vector<std::string>({ "600 limit alert foo wlan0" }),
+              splitBatch(mCoalescer.sent[0]));
+}
+
+TEST_F(BroadcastCoalescerTest, TestCoalescesByTypeAndKey) {
+    ASSERT_EQ(0, mCoalescer.start());
+
+    mCoalescer.notify(BroadcastCoalescer::INTERFACE, "linkstate wlan0", 600,
+                      "Iface linkstate wlan0 up");
+    mCoalescer.notify(BroadcastCoalescer::ROUTE, "2001:db8::/64  wlan0", 614,
+                      "Route updated 2001:db8::/64 dev wlan0");
+    mCoalescer.notify(BroadcastCoalescer::INTERFACE, "linkstate wlan0", 600,
+                      "Iface linkstate wlan0 down");
+    // Same key, different type: not coalesced.
+    mCoalescer.notify(BroadcastCoalescer::ADDRESS, "linkstate wlan0", 614, "Address foo");
+    mCoalescer.notify(BroadcastCoalescer::ROUTE, "2001:db8::/64  wlan0", 614,
+                      "Route removed 2001:db8::/64 dev wlan0");
+
+    std::vector<std::string> expected = {
+        "600 Iface linkstate wlan0 down",
+        "614 Address foo",
+        "614 Route removed 2001:db8::/64 dev wlan0",
+    };
+    EXPECT_EQ(expected, splitBatch(mCoalescer.takeBatch()));
+    EXPECT_EQ("", mCoalescer.takeBatch());
+}
+
+TEST_F(BroadcastCoalescerTest, TestUnkeyedSentImmediatelyInOrder) {
+    ASSERT_EQ(0, mCoalescer.start());
+
+    mCoalescer.notify(BroadcastCoalescer::INTERFACE, "linkstate wlan0", 600,
+                      "Iface linkstate wlan0 up");
+    EXPECT_TRUE(mCoalescer.sent.empty());
+    mCoalescer.notify(BroadcastCoalescer::QUOTA, "", 601, "limit alert foo wlan0");
+    mCoalescer.notify(BroadcastCoalescer::STRICT, "", 617, "10005 deadbeef");
+
+    // The alerts do not wait for the window, and do not overtake what was queued before them.
+    ASSERT_EQ(2U, mCoalescer.sent.size());
+    std::vector<std::string> expected = {
+        "600 Iface linkstate wlan0 up",
+        "601 limit alert foo wlan0",
+    };
+    EXPECT_EQ(expected, splitBatch(mCoalescer.sent[0]));
+    EXPECT_EQ(std::vector<std::string>({ "617 10005 deadbeef" }),
+              splitBatch(mCoalescer.sent[1]));
+    EXPECT_EQ("", mCoalescer.takeBatch());
+}
+
+TEST_F(BroadcastCoalescerTest, TestStopFlushesPending) {
+    ASSERT_EQ(0, mCoalescer.start());
+    mCoalescer.notify(BroadcastCoalescer::INTERFACE, "linkstate wlan0", 600,
+                      "Iface linkstate wlan0 up");
+    mCoalescer.stop();
+
+    ASSERT_EQ(1U, mCoalescer.sent.size());
+    EXPECT_EQ(std::vector<std::string>({ "600 Iface linkstate wlan0 up" }),
+              splitBatch(mCoalescer.sent[0]));
+}
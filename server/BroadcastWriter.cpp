@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <linux/sockios.h>
+
+#define LOG_TAG "Netd"
+
+#include <cutils/log.h>
+#include <sysutils/SocketClient.h>
+
+#include "BroadcastWriter.h"
+#include "DumpWriter.h"
+
+namespace {
+
+const int kMaxEpollEvents = 16;
+
+// The send buffer is charged for the socket buffers that hold the data, not only for the data.
+const size_t kSendOverhead = 2048;
+
+}  // namespace
+
+const size_t BroadcastWriter::kDefaultMaxQueuedBytes;
+const size_t BroadcastWriter::kMaxBatchBytes;
+
+BroadcastWriter::BroadcastWriter(size_t maxQueuedBytes) :
+        mMaxQueuedBytes(maxQueuedBytes), mNextQueueId(0), mEpollFd(-1), mEventFd(-1),
+        mRunning(false), mEventsSent(0), mEventsQueued(0), mEventsDropped(0), mDisconnects(0) {}
+
+BroadcastWriter::~BroadcastWriter() {
+    stop();
+}
+
+int BroadcastWriter::start() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mRunning) {
+        return 0;
+    }
+
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    mEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    epoll_event ev = { .events = EPOLLIN, .data = { .ptr = nullptr } };
+    if (mEpollFd == -1 || mEventFd == -1 ||
+            epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mEventFd, &ev) == -1) {
+        int err = errno;
+        close(mEpollFd);
+        close(mEventFd);
+        mEpollFd = mEventFd = -1;
+        errno = err;
+        return -1;
+    }
+
+    if (int ret = pthread_create(&mThread, NULL, BroadcastWriter::threadStart, this)) {
+        close(mEpollFd);
+        close(mEventFd);
+        mEpollFd = mEventFd = -1;
+        errno = ret;
+        return -1;
+    }
+
+    mRunning = true;
+    return 0;
+}
+
+void BroadcastWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mRunning) {
+            return;
+        }
+    }
+
+    uint64_t one = 1;
+    ::write(mEventFd, &one, sizeof(one));
+    pthread_join(mThread, NULL);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    while (!mQueues.empty()) {
+        auto it = mQueues.begin();
+        dropAllLocked(it->second);
+        removeClientLocked(it->first);
+    }
+    close(mEpollFd);
+    close(mEventFd);
+    mEpollFd = mEventFd = -1;
+    mRunning = false;
+}
+
+void BroadcastWriter::enqueue(SocketClient *client, const std::string& data, size_t events) {
+    std::unique_lock<std::mutex> lock(mLock);
+
+    if (!mRunning) {
+        // There is no writer thread. Write synchronously, as SocketListener would.
+        lock.unlock();
+        if (client->sendData(data.data(), data.size())) {
+            SLOGW("Error sending broadcast (%s)", strerror(errno));
+        }
+        return;
+    }
+
+    auto it = mQueues.find(client);
+    if (it == mQueues.end()) {
+        // Level-triggered, so the writer thread keeps being woken up for as long as the socket is
+        // writable and there is something left to send.
+        epoll_event ev = { .events = EPOLLOUT, .data = { .ptr = client } };
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, client->getSocket(), &ev) == -1) {
+            ALOGE("Failed to watch client socket for writability: %s", strerror(errno));
+            mEventsDropped += events;
+            return;
+        }
+        client->incRef();
+        it = mQueues.insert(std::make_pair(client,
+                ClientQueue{ {}, 0, mNextQueueId++ })).first;
+    }
+
+    ClientQueue& queue = it->second;
+    if (data.size() <= kMaxBatchBytes) {
+        queue.pending.push_back({ data, events });
+    } else {
+        // Split at message boundaries. A single message larger than the limit is kept whole.
+        size_t start = 0;
+        while (start < data.size()) {
+            size_t end = start;
+            size_t count = 0;
+            while (end < data.size()) {
+                size_t nul = data.find('\0', end);
+                size_t next = (nul == std::string::npos) ? data.size() : nul + 1;
+                if (count > 0 && next - start > kMaxBatchBytes) {
+                    break;
+                }
+                end = next;
+                count++;
+            }
+            queue.pending.push_back({ data.substr(start, end - start), count });
+            start = end;
+        }
+    }
+    queue.bytes += data.size();
+    mEventsQueued += events;
+
+    if (queue.bytes <= mMaxQueuedBytes) {
+        return;
+    }
+
+    ALOGW("Disconnecting client pid=%d uid=%d: %zu bytes of broadcasts queued",
+          client->getPid(), client->getUid(), queue.bytes);
+    dropAllLocked(queue);
+    disconnect(client);
+    mDisconnects++;
+    removeClientLocked(client);
+}
+
+bool BroadcastWriter::sendFront(SocketClient *client) {
+    std::string data;
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mQueues.find(client);
+        if (it == mQueues.end()) {
+            return false;
+        }
+        ClientQueue& queue = it->second;
+        if (queue.pending.empty()) {
+            removeClientLocked(client);
+            return false;
+        }
+        data = queue.pending.front().data;
+        id = queue.id;
+        // Keep the client alive if it is removed while we are sending.
+        client->incRef();
+    }
+
+    // Only write a batch that fits. Otherwise, epoll reports the socket writable again once the
+    // client has read enough of what is already queued.
+    int ret = canSend(client, data.size());
+    if (ret == 1) {
+        ret = send(client, data.data(), data.size()) ? -1 : 1;
+    }
+    int err = errno;
+
+    std::lock_guard<std::mutex> lock(mLock);
+    bool more = false;
+    auto it = mQueues.find(client);
+    if (it != mQueues.end() && it->second.id == id) {
+        ClientQueue& queue = it->second;
+        if (ret == -1) {
+            SLOGW("Error sending broadcast to pid=%d (%s)", client->getPid(), strerror(err));
+            dropAllLocked(queue);
+            removeClientLocked(client);
+        } else if (ret == 1) {
+            mEventsSent += queue.pending.front().events;
+            queue.bytes -= queue.pending.front().data.size();
+            queue.pending.pop_front();
+            if (queue.pending.empty()) {
+                removeClientLocked(client);
+            } else {
+                more = true;
+            }
+        }
+    }
+    client->decRef();
+    return more;
+}
+
+void BroadcastWriter::dropAllLocked(ClientQueue& queue) {
+    for (const Pending& pending : queue.pending) {
+        mEventsDropped += pending.events;
+    }
+    queue.pending.clear();
+    queue.bytes = 0;
+}
+
+void BroadcastWriter::removeClientLocked(SocketClient *client) {
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, client->getSocket(), nullptr);
+    mQueues.erase(client);
+    client->decRef();
+}
+
+int BroadcastWriter::canSend(SocketClient *client, size_t len) {
+    int sndbuf;
+    socklen_t optlen = sizeof(sndbuf);
+    int outq;
+    if (getsockopt(client->getSocket(), SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) == -1 ||
+            ioctl(client->getSocket(), SIOCOUTQ, &outq) == -1) {
+        return -1;
+    }
+    // Epoll reports the socket writable once it is no more than a quarter full. Waiting for more
+    // room than that would spin, so write anyway; only a batch larger than the rest of the buffer
+    // can block.
+    if (outq <= sndbuf / 4) {
+        return 1;
+    }
+    return (len + kSendOverhead <= static_cast<size_t>(sndbuf - outq)) ? 1 : 0;
+}
+
+int BroadcastWriter::send(SocketClient *client, const char *data, size_t len) {
+    return client->sendData(data, len);
+}
+
+void BroadcastWriter::disconnect(SocketClient *client) {
+    // The SocketListener sees EOF on the socket and releases the client.
+    shutdown(client->getSocket(), SHUT_RDWR);
+}
+
+void *BroadcastWriter::threadStart(void *obj) {
+    reinterpret_cast<BroadcastWriter *>(obj)->run();
+    return NULL;
+}
+
+void BroadcastWriter::run() {
+    epoll_event events[kMaxEpollEvents];
+    while (true) {
+        int n = epoll_wait(mEpollFd, events, kMaxEpollEvents, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            ALOGE("epoll_wait failed: %s", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == nullptr) {
+                // Woken up by stop().
+                return;
+            }
+
+            SocketClient *client = reinterpret_cast<SocketClient *>(events[i].data.ptr);
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                std::lock_guard<std::mutex> lock(mLock);
+                auto it = mQueues.find(client);
+                if (it != mQueues.end()) {
+                    dropAllLocked(it->second);
+                    removeClientLocked(client);
+                }
+                continue;
+            }
+
+            while (sendFront(client)) {}
+        }
+    }
+}
+
+void BroadcastWriter::dump(DumpWriter& dw) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    dw.println("Broadcast writer: maxQueuedBytes=%zu maxBatchBytes=%zu sent=%" PRIu64
+               " queued=%" PRIu64 " dropped=%" PRIu64 " disconnects=%" PRIu64,
+               mMaxQueuedBytes, kMaxBatchBytes, mEventsSent, mEventsQueued, mEventsDropped,
+               mDisconnects);
+    dw.incIndent();
+    for (const auto& it : mQueues) {
+        dw.println("pid=%d uid=%d: %zu batches, %zu bytes queued",
+                   it.first->getPid(), it.first->getUid(), it.second.pending.size(),
+                   it.second.bytes);
+    }
+    dw.decIndent();
+}
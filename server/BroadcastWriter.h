@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_BROADCAST_WRITER_H
+#define NETD_SERVER_BROADCAST_WRITER_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+class DumpWriter;
+class SocketClient;
+
+/*
+ * Delivers broadcasts to framework clients without ever blocking the caller.
+ *
+ * enqueue() only appends the broadcast to a bounded per-client queue; it is safe to call with
+ * SocketListener's client lock held. A writer thread drains the queues as epoll reports the client
+ * sockets writable, without holding any lock while it writes, so a client that stops reading only
+ * delays its own broadcasts. Each batch is written whole with SocketClient::sendData, which holds
+ * the same lock as the command responses written on other threads, so the two never interleave. A
+ * batch is only written once it fits in the free space of the socket buffer, or once the buffer is
+ * no more than a quarter full, which is when epoll reports the socket writable. Larger batches are
+ * split at message boundaries into batches of at most kMaxBatchBytes, which is far less than three
+ * quarters of a socket buffer, so only a single message larger than that can block the writer
+ * thread, and never with a partial frame left on the socket.
+ *
+ * Broadcasts carry state (interface, address and route changes, quota alerts) that is never sent
+ * again, so none is ever dropped on its own. When a client's queue exceeds its limit, the client is
+ * disconnected instead; the framework reconnects and reads the current state back.
+ */
+class BroadcastWriter {
+public:
+    explicit BroadcastWriter(size_t maxQueuedBytes);
+    virtual ~BroadcastWriter();
+
+    int start();
+    void stop();
+
+    // Queues data, which contains |events| NUL-terminated messages, for the client.
+    void enqueue(SocketClient *client, const std::string& data, size_t events);
+
+    void dump(DumpWriter& dw);
+
+    static const size_t kDefaultMaxQueuedBytes = 256 * 1024;
+    static const size_t kMaxBatchBytes = 16 * 1024;
+
+protected:
+    // Returns 1 if |len| bytes can be written to the client now, 0 if they do not fit in its socket
+    // buffer yet, or -1 with errno set.
+    virtual int canSend(SocketClient *client, size_t len);
+    // Writes all |len| bytes to the client. Returns 0, or -1 with errno set.
+    virtual int send(SocketClient *client, const char *data, size_t len);
+    virtual void disconnect(SocketClient *client);
+
+private:
+    struct Pending {
+        std::string data;
+        size_t events;
+    };
+
+    struct ClientQueue {
+        std::deque<Pending> pending;
+        size_t bytes;
+        // Distinguishes this queue from a later one for the same client.
+        uint64_t id;
+    };
+
+    static void *threadStart(void *obj);
+    void run();
+    // Writes the front of the client's queue if it fits. Returns true if it was written and more
+    // broadcasts are queued.
+    bool sendFront(SocketClient *client);
+    void removeClientLocked(SocketClient *client);
+    void dropAllLocked(ClientQueue& queue);
+
+    const size_t mMaxQueuedBytes;
+
+    std::mutex mLock;
+    std::map<SocketClient *, ClientQueue> mQueues;
+    uint64_t mNextQueueId;
+    int mEpollFd;
+    int mEventFd;
+    pthread_t mThread;
+    bool mRunning;
+
+    uint64_t mEventsSent;
+    uint64_t mEventsQueued;
+    uint64_t mEventsDropped;
+    uint64_t mDisconnects;
+};
+
+#endif  // NETD_SERVER_BROADCAST_WRITER_H
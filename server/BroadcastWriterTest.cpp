@@ -0,0 +1,185 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * BroadcastWriterTest.cpp - unit tests for BroadcastWriter.cpp
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <sysutils/SocketClient.h>
+
+#include "BroadcastWriter.h"
+
+// Records what is written. While not writable, a send does not return, as if the writer thread
+// were stuck on a client that stopped reading. Only batches of up to |space| bytes fit.
+class FakeBroadcastWriter : public BroadcastWriter {
+public:
+    explicit FakeBroadcastWriter(size_t maxQueuedBytes) : BroadcastWriter(maxQueuedBytes) {}
+
+    ~FakeBroadcastWriter() {
+        setWritable(true);
+        stop();
+    }
+
+    void setWritable(bool writable) {
+        std::lock_guard<std::mutex> lock(mFakeLock);
+        mWritable = writable;
+        mCv.notify_all();
+    }
+
+    // Waits until the writer thread is inside send().
+    bool waitForSend() {
+        std::unique_lock<std::mutex> lock(mFakeLock);
+        return mCv.wait_for(lock, kTimeout, [this] { return mSending; });
+    }
+
+    bool waitForOutput(const std::string& output) {
+        std::unique_lock<std::mutex> lock(mFakeLock);
+        return mCv.wait_for(lock, kTimeout, [this, &output] { return mOutput == output; });
+    }
+
+    std::string output() {
+        std::lock_guard<std::mutex> lock(mFakeLock);
+        return mOutput;
+    }
+
+    void setSpace(size_t space) {
+        std::lock_guard<std::mutex> lock(mFakeLock);
+        mSpace = space;
+    }
+
+    int sends = 0;
+    int disconnects = 0;
+
+protected:
+    int canSend(SocketClient *, size_t len) override {
+        std::lock_guard<std::mutex> lock(mFakeLock);
+        return len <= mSpace;
+    }
+
+    int send(SocketClient *, const char *data, size_t len) override {
+        std::unique_lock<std::mutex> lock(mFakeLock);
+        mSending = true;
+        mCv.notify_all();
+        mCv.wait(lock, [this] { return mWritable; });
+        mSending = false;
+        mOutput.append(data, len);
+        sends++;
+        mCv.notify_all();
+        return 0;
+    }
+
+    void disconnect(SocketClient *) override { disconnects++; }
+
+private:
+    static constexpr std::chrono::seconds kTimeout{1};
+
+    std::mutex mFakeLock;
+    std::condition_variable mCv;
+    bool mWritable = true;
+    bool mSending = false;
+    size_t mSpace = 1024;
+    std::string mOutput;
+};
+
+constexpr std::chrono::seconds FakeBroadcastWriter::kTimeout;
+
+class BroadcastWriterTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, mFds));
+        mClient = new SocketClient(mFds[0], false, false);
+    }
+
+    void TearDown() override {
+        mClient->decRef();
+        close(mFds[0]);
+        close(mFds[1]);
+    }
+
+    int mFds[2];
+    SocketClient *mClient;
+};
+
+TEST_F(BroadcastWriterTest, TestWritesInOrder) {
+    FakeBroadcastWriter writer(100);
+    ASSERT_EQ(0, writer.start());
+
+    writer.enqueue(mClient, std::string("600 a\0", 6), 1);
+    writer.enqueue(mClient, std::string("600 b\0", 6), 1);
+    EXPECT_TRUE(writer.waitForOutput(std::string("600 a\0" "600 b\0", 12))) << writer.output();
+}
+
+TEST_F(BroadcastWriterTest, TestWritesOnlyWholeBatches) {
+    FakeBroadcastWriter writer(100);
+    writer.setSpace(10);
+    ASSERT_EQ(0, writer.start());
+
+    // The second batch is held back until it fits, rather than written in part.
+    writer.enqueue(mClient, std::string("600 first\0", 10), 1);
+    writer.enqueue(mClient, std::string("600 second\0", 11), 1);
+    EXPECT_TRUE(writer.waitForOutput(std::string("600 first\0", 10))) << writer.output();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(std::string("600 first\0", 10), writer.output());
+
+    writer.setSpace(11);
+    EXPECT_TRUE(writer.waitForOutput(std::string("600 first\0" "600 second\0", 21)))
+            << writer.output();
+}
+
+TEST_F(BroadcastWriterTest, TestSplitsLargeBatches) {
+    FakeBroadcastWriter writer(BroadcastWriter::kDefaultMaxQueuedBytes);
+    writer.setSpace(BroadcastWriter::kMaxBatchBytes);
+    ASSERT_EQ(0, writer.start());
+
+    // Two messages fit in one batch, the third does not. Nothing is dropped or cut in half.
+    const std::string message = "600 " + std::string(BroadcastWriter::kMaxBatchBytes / 3, 'x');
+    std::string batch;
+    for (int i = 0; i < 3; i++) {
+        batch.append(message);
+        batch.push_back('\0');
+    }
+    writer.enqueue(mClient, batch, 3);
+    EXPECT_TRUE(writer.waitForOutput(batch));
+    EXPECT_EQ(2, writer.sends);
+    EXPECT_EQ(0, writer.disconnects);
+}
+
+TEST_F(BroadcastWriterTest, TestDisconnect) {
+    FakeBroadcastWriter writer(10);
+    ASSERT_EQ(0, writer.start());
+
+    writer.setWritable(false);
+    writer.enqueue(mClient, "1111", 1);
+    ASSERT_TRUE(writer.waitForSend());
+    writer.enqueue(mClient, "2222", 1);
+    EXPECT_EQ(0, writer.disconnects);
+    writer.enqueue(mClient, "3333", 1);
+    EXPECT_EQ(1, writer.disconnects);
+
+    // Everything queued was discarded.
+    writer.setWritable(true);
+    writer.enqueue(mClient, "4444", 1);
+    EXPECT_TRUE(writer.waitForOutput("11114444")) << writer.output();
+}
@@ -13,27 +13,16 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#include <map>
-#include <string>
-
-#include <unistd.h>
 #include <errno.h>
-#include <sys/types.h>
-#include <sys/wait.h>
 
 #define LOG_TAG "ClatdController"
 #include <cutils/log.h>
 
 #include <resolv_netid.h>
 
-#include "NetdConstants.h"
 #include "ClatdController.h"
-#include "Fwmark.h"
-#include "NetdConstants.h"
 #include "NetworkController.h"
 
-static const char* kClatdPath = "/system/bin/clatd";
-
 ClatdController::ClatdController(NetworkController* controller)
         : mNetCtrl(controller) {
 }
@@ -41,23 +30,12 @@ ClatdController::ClatdController(NetworkController* controller)
 ClatdController::~ClatdController() {
 }
 
-// Returns the PID of the clatd running on interface |interface|, or 0 if clatd is not running on
-// |interface|.
-pid_t ClatdController::getClatdPid(char* interface) {
-    auto it = mClatdPids.find(interface);
-    return (it == mClatdPids.end() ? 0 : it->second);
+int ClatdController::start() {
+    return mSupervisor.start();
 }
 
 int ClatdController::startClatd(char* interface) {
-    pid_t pid = getClatdPid(interface);
-
-    if (pid != 0) {
-        ALOGE("clatd pid=%d already started on %s", pid, interface);
-        errno = EBUSY;
-        return -1;
-    }
-
-    // Pass in the interface, a netid to use for DNS lookups, and a fwmark for outgoing packets.
+    // clatd gets a netid to use for DNS lookups, and a fwmark for outgoing packets, from it.
     unsigned netId = mNetCtrl->getNetworkForInterface(interface);
     if (netId == NETID_UNSET) {
         ALOGE("interface %s not assigned to any netId", interface);
@@ -65,82 +43,17 @@ int ClatdController::startClatd(char* interface) {
         return -1;
     }
 
-    char netIdString[UINT32_STRLEN];
-    snprintf(netIdString, sizeof(netIdString), "%u", netId);
-
-    Fwmark fwmark;
-    fwmark.netId = netId;
-    fwmark.explicitlySelected = true;
-    fwmark.protectedFromVpn = true;
-    fwmark.permission = PERMISSION_SYSTEM;
-
-    char fwmarkString[UINT32_HEX_STRLEN];
-    snprintf(fwmarkString, sizeof(fwmarkString), "0x%x", fwmark.intValue);
-
-    ALOGD("starting clatd on %s", interface);
-
-    std::string progname("clatd-");
-    progname += interface;
-
-    if ((pid = fork()) < 0) {
-        ALOGE("fork failed (%s)", strerror(errno));
-        return -1;
-    }
-
-    if (!pid) {
-        char *args[] = {
-            (char *) progname.c_str(),
-            (char *) "-i",
-            interface,
-            (char *) "-n",
-            netIdString,
-            (char *) "-m",
-            fwmarkString,
-            NULL
-        };
-
-        if (execv(kClatdPath, args)) {
-            ALOGE("execv failed (%s)", strerror(errno));
-            _exit(1);
-        }
-        ALOGE("Should never get here!");
-        _exit(1);
-    } else {
-        mClatdPids[interface] = pid;
-        ALOGD("clatd started on %s", interface);
-    }
-
-    return 0;
+    return mSupervisor.startClatd(interface, netId);
 }
 
 int ClatdController::stopClatd(char* interface) {
-    pid_t pid = getClatdPid(interface);
-
-    if (pid == 0) {
-        ALOGE("clatd already stopped");
-        return -1;
-    }
-
-    ALOGD("Stopping clatd pid=%d on %s", pid, interface);
-
-    kill(pid, SIGTERM);
-    waitpid(pid, NULL, 0);
-    mClatdPids.erase(interface);
-
-    ALOGD("clatd on %s stopped", interface);
-
-    return 0;
+    return mSupervisor.stopClatd(interface);
 }
 
 bool ClatdController::isClatdStarted(char* interface) {
-    pid_t waitpid_status;
-    pid_t pid = getClatdPid(interface);
-    if (pid == 0) {
-        return false;
-    }
-    waitpid_status = waitpid(pid, NULL, WNOHANG);
-    if (waitpid_status != 0) {
-        mClatdPids.erase(interface);  // child exited, don't call waitpid on it again
-    }
-    return waitpid_status == 0; // 0 while child is running
+    return mSupervisor.isClatdStarted(interface);
+}
+
+void ClatdController::dump(DumpWriter& dw) {
+    mSupervisor.dump(dw);
 }
@@ -17,8 +17,9 @@
 #ifndef _CLATD_CONTROLLER_H
 #define _CLATD_CONTROLLER_H
 
-#include <map>
+#include "ClatdSupervisor.h"
 
+class DumpWriter;
 class NetworkController;
 
 class ClatdController {
@@ -26,14 +27,18 @@ public:
     explicit ClatdController(NetworkController* controller);
     virtual ~ClatdController();
 
+    // Starts the thread that restarts clatd when it crashes.
+    int start();
+
     int startClatd(char *interface);
     int stopClatd(char* interface);
     bool isClatdStarted(char* interface);
 
+    void dump(DumpWriter& dw);
+
 private:
     NetworkController* const mNetCtrl;
-    std::map<std::string, pid_t> mClatdPids;
-    pid_t getClatdPid(char* interface);
+    ClatdSupervisor mSupervisor;
 };
 
 #endif
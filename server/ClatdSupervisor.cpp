@@ -0,0 +1,478 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#define LOG_TAG "ClatdSupervisor"
+#include <cutils/log.h>
+
+#include "ClatdSupervisor.h"
+#include "DumpWriter.h"
+#include "Fwmark.h"
+#include "NetdConstants.h"
+
+static const char* kClatdPath = "/system/bin/clatd";
+
+constexpr std::chrono::milliseconds ClatdSupervisor::kMinRestartDelay;
+constexpr std::chrono::seconds ClatdSupervisor::kMaxRestartDelay;
+constexpr std::chrono::seconds ClatdSupervisor::kStableRunTime;
+constexpr std::chrono::seconds ClatdSupervisor::kStopTimeout;
+constexpr std::chrono::milliseconds ClatdSupervisor::kReapRetryInterval;
+
+pid_t (*ClatdSupervisor::spawnFunction)(const char*, unsigned, int*) = ClatdSupervisor::spawnClatd;
+int (*ClatdSupervisor::killFunction)(pid_t, int) = kill;
+pid_t (*ClatdSupervisor::waitpidFunction)(pid_t, int*, int) = waitpid;
+
+namespace {
+
+std::string describeStatus(int status) {
+    char buf[32];
+    if (WIFSIGNALED(status)) {
+        snprintf(buf, sizeof(buf), "killed by signal %d", WTERMSIG(status));
+    } else {
+        snprintf(buf, sizeof(buf), "exited with status %d", WEXITSTATUS(status));
+    }
+    return buf;
+}
+
+}  // namespace
+
+ClatdSupervisor::ClatdSupervisor() : mStopFd(-1), mWakeFd(-1) {
+}
+
+ClatdSupervisor::~ClatdSupervisor() {
+    if (mStopFd != -1) {
+        uint64_t one = 1;
+        write(mStopFd, &one, sizeof(one));
+        pthread_join(mThread, NULL);
+        close(mStopFd);
+        close(mWakeFd);
+    }
+    for (auto& entry : mInstances) {
+        closeExitFd(&entry.second);
+    }
+}
+
+int ClatdSupervisor::start() {
+    mStopFd = eventfd(0, EFD_CLOEXEC);
+    if (mStopFd == -1) {
+        return -1;
+    }
+    mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mWakeFd == -1) {
+        int saved = errno;
+        close(mStopFd);
+        mStopFd = -1;
+        errno = saved;
+        return -1;
+    }
+    if (int ret = pthread_create(&mThread, NULL, ClatdSupervisor::threadStart, this)) {
+        close(mStopFd);
+        close(mWakeFd);
+        mStopFd = mWakeFd = -1;
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
+
+void ClatdSupervisor::wakeSupervisor() {
+    if (mWakeFd != -1) {
+        uint64_t one = 1;
+        write(mWakeFd, &one, sizeof(one));
+    }
+}
+
+void ClatdSupervisor::closeExitFd(Instance* instance) {
+    if (instance->exitFd != -1) {
+        close(instance->exitFd);
+        instance->exitFd = -1;
+    }
+    instance->exited = false;
+}
+
+// Starts clatd and returns once exec has succeeded or failed. This says nothing about whether clatd
+// is ready: clatd does not report that, and the framework waits for the interface that it creates.
+pid_t ClatdSupervisor::spawnClatd(const char* interface, unsigned netId, int* exitFd) {
+    // Pass in the interface, a netid to use for DNS lookups, and a fwmark for outgoing packets.
+    char netIdString[UINT32_STRLEN];
+    snprintf(netIdString, sizeof(netIdString), "%u", netId);
+
+    Fwmark fwmark;
+    fwmark.netId = netId;
+    fwmark.explicitlySelected = true;
+    fwmark.protectedFromVpn = true;
+    fwmark.permission = PERMISSION_SYSTEM;
+
+    char fwmarkString[UINT32_HEX_STRLEN];
+    snprintf(fwmarkString, sizeof(fwmarkString), "0x%x", fwmark.intValue);
+
+    std::string progname("clatd-");
+    progname += interface;
+
+    const char* args[] = {
+        progname.c_str(),
+        "-i",
+        interface,
+        "-n",
+        netIdString,
+        "-m",
+        fwmarkString,
+        NULL
+    };
+
+    // The write end of the exec status pipe is closed by a successful exec. Otherwise, the child
+    // writes errno into it.
+    int execPipe[2];
+    if (pipe2(execPipe, O_CLOEXEC) == -1) {
+        return -errno;
+    }
+    // clatd keeps the write end of the exit pipe until it exits. It is close-on-exec in netd, so
+    // that other children started at the same time do not hold it.
+    int exitPipe[2];
+    if (pipe2(exitPipe, O_CLOEXEC) == -1) {
+        int ret = -errno;
+        close(execPipe[0]);
+        close(execPipe[1]);
+        return ret;
+    }
+
+    // The parent is suspended until the child has called execv or _exit, and the child shares its
+    // memory, so the child must not do anything else. It has its own file descriptor table, so
+    // clearing close-on-exec there does not affect netd.
+    pid_t pid = vfork();
+    if (pid == -1) {
+        int ret = -errno;
+        close(execPipe[0]);
+        close(execPipe[1]);
+        close(exitPipe[0]);
+        close(exitPipe[1]);
+        return ret;
+    }
+    if (pid == 0) {
+        fcntl(exitPipe[1], F_SETFD, 0);
+        execv(kClatdPath, const_cast<char**>(args));
+        int childErrno = errno;
+        write(execPipe[1], &childErrno, sizeof(childErrno));
+        _exit(127);
+    }
+
+    close(execPipe[1]);
+    close(exitPipe[1]);
+    int childErrno = 0;
+    ssize_t len = TEMP_FAILURE_RETRY(read(execPipe[0], &childErrno, sizeof(childErrno)));
+    close(execPipe[0]);
+    if (len != 0) {
+        close(exitPipe[0]);
+        TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
+        return -(len == sizeof(childErrno) ? childErrno : EIO);
+    }
+    *exitFd = exitPipe[0];
+    return pid;
+}
+
+int ClatdSupervisor::startClatd(const std::string& interface, unsigned netId) {
+    return startClatdAt(interface, netId, Clock::now());
+}
+
+int ClatdSupervisor::startClatdAt(const std::string& interface, unsigned netId,
+                                  Clock::time_point now) {
+    std::lock_guard<std::mutex> guard(mLock);
+
+    auto it = mInstances.find(interface);
+    if (it != mInstances.end()) {
+        ALOGE("clatd pid=%d already started on %s", it->second.pid, interface.c_str());
+        errno = EBUSY;
+        return -1;
+    }
+
+    ALOGD("starting clatd on %s", interface.c_str());
+    int exitFd = -1;
+    pid_t pid = spawnFunction(interface.c_str(), netId, &exitFd);
+    if (pid < 0) {
+        ALOGE("cannot start clatd on %s (%s)", interface.c_str(), strerror(-pid));
+        errno = -pid;
+        return -1;
+    }
+
+    Instance& instance = mInstances[interface];
+    instance.netId = netId;
+    instance.pid = pid;
+    instance.exitFd = exitFd;
+    instance.exited = false;
+    instance.stopping = false;
+    instance.startTime = now;
+    instance.restartDelay = kMinRestartDelay;
+    instance.restarts = 0;
+    ALOGD("clatd pid=%d started on %s", pid, interface.c_str());
+    wakeSupervisor();
+    return 0;
+}
+
+bool ClatdSupervisor::waitForExitLocked(std::unique_lock<std::mutex>& lock,
+                                        const std::string& interface, pid_t pid) {
+    return mReaped.wait_for(lock, kStopTimeout, [this, &interface, pid] {
+        auto it = mInstances.find(interface);
+        return it == mInstances.end() || it->second.pid != pid;
+    });
+}
+
+int ClatdSupervisor::stopClatd(const std::string& interface) {
+    std::unique_lock<std::mutex> lock(mLock);
+
+    auto it = mInstances.find(interface);
+    if (it == mInstances.end() || it->second.stopping) {
+        ALOGE("clatd already stopped");
+        return -1;
+    }
+
+    pid_t pid = it->second.pid;
+    if (pid == 0) {
+        ALOGD("clatd on %s was waiting to be restarted", interface.c_str());
+        mInstances.erase(it);
+        return 0;
+    }
+
+    ALOGD("Stopping clatd pid=%d on %s", pid, interface.c_str());
+    it->second.stopping = true;
+    killFunction(pid, SIGTERM);
+
+    if (mStopFd == -1) {
+        TEMP_FAILURE_RETRY(waitpidFunction(pid, NULL, 0));
+        closeExitFd(&it->second);
+        mInstances.erase(interface);
+    } else if (!waitForExitLocked(lock, interface, pid)) {
+        ALOGW("clatd pid=%d on %s ignored SIGTERM, killing it", pid, interface.c_str());
+        killFunction(pid, SIGKILL);
+        if (!waitForExitLocked(lock, interface, pid)) {
+            // The supervisor forgets about it once it is reaped.
+            ALOGE("clatd pid=%d on %s did not exit", pid, interface.c_str());
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    ALOGD("clatd on %s stopped", interface.c_str());
+
+    return 0;
+}
+
+bool ClatdSupervisor::isClatdStarted(const std::string& interface) {
+    std::lock_guard<std::mutex> guard(mLock);
+
+    auto it = mInstances.find(interface);
+    if (it == mInstances.end() || it->second.stopping) {
+        return false;
+    }
+    if (mStopFd != -1) {
+        // Running, or about to be restarted.
+        return true;
+    }
+    if (waitpidFunction(it->second.pid, NULL, WNOHANG) != 0) {
+        closeExitFd(&it->second);
+        mInstances.erase(it);  // child exited, don't call waitpid on it again
+        return false;
+    }
+    return true;
+}
+
+void ClatdSupervisor::reapChildrenAt(Clock::time_point now) {
+    std::lock_guard<std::mutex> guard(mLock);
+
+    bool reaped = false;
+    for (auto it = mInstances.begin(); it != mInstances.end();) {
+        Instance& instance = it->second;
+        int status = 0;
+        // Only wait for clatd, so that the children that others wait for are left alone.
+        if (instance.pid == 0 || waitpidFunction(instance.pid, &status, WNOHANG) == 0) {
+            ++it;
+            continue;
+        }
+
+        closeExitFd(&instance);
+        if (instance.stopping) {
+            it = mInstances.erase(it);
+            reaped = true;
+            continue;
+        }
+
+        // Quick exits are likely to happen again, so back off. After a long run, clatd most likely
+        // hit a transient problem and is brought back right away.
+        ALOGW("clatd pid=%d on %s %s", instance.pid, it->first.c_str(),
+              describeStatus(status).c_str());
+        instance.pid = 0;
+        if (now - instance.startTime >= kStableRunTime) {
+            instance.restartTime = now;
+            instance.restartDelay = kMinRestartDelay;
+        } else {
+            instance.restartTime = now + instance.restartDelay;
+            instance.restartDelay = std::min<Clock::duration>(instance.restartDelay * 2,
+                                                              kMaxRestartDelay);
+        }
+        ++it;
+    }
+
+    if (reaped) {
+        mReaped.notify_all();
+    }
+}
+
+void ClatdSupervisor::restartDueAt(Clock::time_point now) {
+    std::lock_guard<std::mutex> guard(mLock);
+
+    for (auto& entry : mInstances) {
+        Instance& instance = entry.second;
+        if (instance.pid != 0 || instance.restartTime > now) {
+            continue;
+        }
+        int exitFd = -1;
+        pid_t pid = spawnFunction(entry.first.c_str(), instance.netId, &exitFd);
+        if (pid < 0) {
+            ALOGE("cannot restart clatd on %s (%s)", entry.first.c_str(), strerror(-pid));
+            instance.restartTime = now + instance.restartDelay;
+            instance.restartDelay = std::min<Clock::duration>(instance.restartDelay * 2,
+                                                              kMaxRestartDelay);
+            continue;
+        }
+        instance.pid = pid;
+        instance.exitFd = exitFd;
+        instance.startTime = now;
+        instance.restarts++;
+        ALOGI("clatd pid=%d restarted on %s", pid, entry.first.c_str());
+    }
+}
+
+ClatdSupervisor::Clock::time_point ClatdSupervisor::nextRestartTime() {
+    std::lock_guard<std::mutex> guard(mLock);
+    return nextRestartTimeLocked();
+}
+
+ClatdSupervisor::Clock::time_point ClatdSupervisor::nextRestartTimeLocked() {
+    Clock::time_point next = Clock::time_point::max();
+    for (const auto& entry : mInstances) {
+        if (entry.second.pid == 0) {
+            next = std::min(next, entry.second.restartTime);
+        }
+    }
+    return next;
+}
+
+pid_t ClatdSupervisor::getPid(const std::string& interface) {
+    std::lock_guard<std::mutex> guard(mLock);
+    auto it = mInstances.find(interface);
+    return it == mInstances.end() ? -1 : it->second.pid;
+}
+
+void* ClatdSupervisor::threadStart(void* obj) {
+    reinterpret_cast<ClatdSupervisor*>(obj)->run();
+    return NULL;
+}
+
+void ClatdSupervisor::run() {
+    while (true) {
+        // fds[0] is the stop request, fds[1] the wakeup for new instances, and the rest are the
+        // exit pipes of running instances.
+        std::vector<pollfd> fds = {
+            { mStopFd, POLLIN, 0 },
+            { mWakeFd, POLLIN, 0 },
+        };
+        int timeoutMs = -1;
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+            bool exited = false;
+            for (const auto& entry : mInstances) {
+                if (entry.second.exitFd != -1) {
+                    fds.push_back({ entry.second.exitFd, POLLIN, 0 });
+                }
+                exited |= entry.second.exited;
+            }
+            Clock::time_point next = nextRestartTimeLocked();
+            if (next != Clock::time_point::max()) {
+                auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        next - Clock::now());
+                timeoutMs = std::max<int>(0, delay.count() + 1);
+            }
+            // The exit pipe hangs up while clatd is still exiting, so it may not be waitable yet.
+            if (exited && (timeoutMs == -1 || timeoutMs > kReapRetryInterval.count())) {
+                timeoutMs = kReapRetryInterval.count();
+            }
+        }
+
+        if (TEMP_FAILURE_RETRY(poll(fds.data(), fds.size(), timeoutMs)) == -1) {
+            ALOGE("poll failed: %s", strerror(errno));
+            return;
+        }
+        if (fds[0].revents) {
+            return;
+        }
+        if (fds[1].revents) {
+            uint64_t count;
+            read(mWakeFd, &count, sizeof(count));
+        }
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+            for (size_t i = 2; i < fds.size(); i++) {
+                if (!fds[i].revents) {
+                    continue;
+                }
+                for (auto& entry : mInstances) {
+                    if (entry.second.exitFd == fds[i].fd) {
+                        close(entry.second.exitFd);
+                        entry.second.exitFd = -1;
+                        entry.second.exited = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        Clock::time_point now = Clock::now();
+        reapChildrenAt(now);
+        restartDueAt(now);
+    }
+}
+
+void ClatdSupervisor::dump(DumpWriter& dw) {
+    std::lock_guard<std::mutex> guard(mLock);
+
+    dw.println("Clatd:");
+    dw.incIndent();
+    Clock::time_point now = Clock::now();
+    for (const auto& entry : mInstances) {
+        const Instance& instance = entry.second;
+        if (instance.pid != 0) {
+            dw.println("%s: pid=%d netId=%u restarts=%u%s", entry.first.c_str(), instance.pid,
+                       instance.netId, instance.restarts, instance.stopping ? " (stopping)" : "");
+        } else {
+            auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    instance.restartTime - now);
+            dw.println("%s: restarting in %lldms netId=%u restarts=%u", entry.first.c_str(),
+                       static_cast<long long>(std::max<int64_t>(0, delay.count())),
+                       instance.netId, instance.restarts);
+        }
+    }
+    dw.decIndent();
+}
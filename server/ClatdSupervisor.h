@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_CLATD_SUPERVISOR_H
+#define NETD_SERVER_CLATD_SUPERVISOR_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+class DumpWriter;
+
+/*
+ * Runs one clatd per interface, and keeps it running.
+ *
+ * clatd is started with vfork, which does not copy netd's page tables. The child reports a failed
+ * exec over a close-on-exec pipe, so startClatd() fails right away instead of returning success
+ * for a clatd that is already gone. That pipe only tells whether exec succeeded. clatd has no way
+ * to report that it is ready, and the framework waits for the interface that it creates anyway.
+ *
+ * clatd also inherits the write end of an exit pipe, which the kernel closes when clatd exits. The
+ * supervisor thread polls the read ends and reaps clatd when one of them hangs up. This leaves
+ * SIGCHLD alone, so the other children of netd start with the signal mask that netd started with.
+ * A clatd that exits without being asked to is started again: right away if it had been running
+ * for a while, and otherwise after a delay that doubles with each quick exit.
+ */
+class ClatdSupervisor {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr std::chrono::milliseconds kMinRestartDelay{250};
+    static constexpr std::chrono::seconds kMaxRestartDelay{30};
+    // A clatd that ran for this long is restarted without delay.
+    static constexpr std::chrono::seconds kStableRunTime{60};
+    // How long stopClatd() waits for clatd to exit after SIGTERM, and then after SIGKILL.
+    static constexpr std::chrono::seconds kStopTimeout{1};
+
+    ClatdSupervisor();
+    ~ClatdSupervisor();
+
+    // Starts the supervisor thread. Without it, clatd is neither restarted nor reaped until it is
+    // stopped.
+    int start();
+
+    int startClatd(const std::string& interface, unsigned netId);
+    int stopClatd(const std::string& interface);
+    // Whether clatd is running on |interface|, or about to be restarted.
+    bool isClatdStarted(const std::string& interface);
+
+    void dump(DumpWriter& dw);
+
+    // The supervisor's logic, with time passed in explicitly. Public for testing.
+    int startClatdAt(const std::string& interface, unsigned netId, Clock::time_point now);
+    void reapChildrenAt(Clock::time_point now);
+    void restartDueAt(Clock::time_point now);
+    // Returns when the next restart is due, or Clock::time_point::max() if none is pending.
+    Clock::time_point nextRestartTime();
+    // Returns the PID of the clatd on |interface|, 0 if it is waiting to be restarted, or -1.
+    pid_t getPid(const std::string& interface);
+
+protected:
+    friend class ClatdSupervisorTest;
+
+    // Returns the PID of the new clatd, or a negative errno. On success, |exitFd| is set to the read
+    // end of its exit pipe, or -1 if there is none.
+    static pid_t (*spawnFunction)(const char* interface, unsigned netId, int* exitFd);
+    static int (*killFunction)(pid_t pid, int sig);
+    static pid_t (*waitpidFunction)(pid_t pid, int* status, int options);
+
+private:
+    struct Instance {
+        unsigned netId;
+        // 0 while waiting to be restarted.
+        pid_t pid;
+        // The read end of the exit pipe, or -1 once it has hung up.
+        int exitFd;
+        // Whether the exit pipe hung up, but clatd has not been reaped yet.
+        bool exited;
+        bool stopping;
+        Clock::time_point startTime;
+        Clock::time_point restartTime;
+        Clock::duration restartDelay;
+        unsigned restarts;
+    };
+
+    // How often the supervisor thread tries to reap a clatd whose exit pipe hung up. The pipe is
+    // closed a moment before clatd can be reaped.
+    static constexpr std::chrono::milliseconds kReapRetryInterval{10};
+
+    static pid_t spawnClatd(const char* interface, unsigned netId, int* exitFd);
+    static void closeExitFd(Instance* instance);
+    // Tells the supervisor thread to poll the exit pipes again.
+    void wakeSupervisor();
+    Clock::time_point nextRestartTimeLocked();
+    // Waits until the supervisor thread reaps |pid|. Returns false on timeout.
+    bool waitForExitLocked(std::unique_lock<std::mutex>& lock, const std::string& interface,
+                           pid_t pid);
+
+    static void* threadStart(void* obj);
+    void run();
+
+    std::mutex mLock;
+    // Notified whenever the supervisor thread reaps a clatd that was being stopped.
+    std::condition_variable mReaped;
+    std::map<std::string, Instance> mInstances;
+
+    // Written to stop the supervisor thread, and to make it pick up a new exit pipe.
+    int mStopFd;
+    int mWakeFd;
+    pthread_t mThread;
+};
+
+#endif  // NETD_SERVER_CLATD_SUPERVISOR_H
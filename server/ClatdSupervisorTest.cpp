@@ -0,0 +1,192 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ClatdSupervisorTest.cpp - unit tests for ClatdSupervisor.cpp
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <android-base/stringprintf.h>
+
+#include "ClatdSupervisor.h"
+
+using android::base::StringPrintf;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+typedef ClatdSupervisor::Clock Clock;
+
+class ClatdSupervisorTest : public ::testing::Test {
+public:
+    ClatdSupervisorTest() {
+        ClatdSupervisor::spawnFunction = fakeSpawn;
+        ClatdSupervisor::killFunction = fakeKill;
+        ClatdSupervisor::waitpidFunction = fakeWaitpid;
+        sNextPid = 1000;
+        sSpawnError = 0;
+        sCalls.clear();
+        sExited.clear();
+    }
+
+protected:
+    static pid_t fakeSpawn(const char* interface, unsigned netId, int* exitFd) {
+        sCalls.push_back(StringPrintf("spawn %s %u", interface, netId));
+        *exitFd = -1;
+        return sSpawnError ? -sSpawnError : sNextPid++;
+    }
+
+    static int fakeKill(pid_t pid, int sig) {
+        sCalls.push_back(StringPrintf("kill %d %d", pid, sig));
+        return 0;
+    }
+
+    static pid_t fakeWaitpid(pid_t pid, int* status, int options) {
+        auto it = sExited.find(pid);
+        if (it == sExited.end()) {
+            // Blocking waits only happen after a kill.
+            return (options & WNOHANG) ? 0 : pid;
+        }
+        if (status) {
+            *status = it->second;
+        }
+        sExited.erase(it);
+        return pid;
+    }
+
+    void expectCalls(const std::vector<std::string>& expected) {
+        EXPECT_EQ(expected, sCalls);
+        sCalls.clear();
+    }
+
+    static pid_t sNextPid;
+    static int sSpawnError;
+    static std::vector<std::string> sCalls;
+    // Exit status of the children that have exited, by PID.
+    static std::map<pid_t, int> sExited;
+
+    ClatdSupervisor mSupervisor;
+};
+
+pid_t ClatdSupervisorTest::sNextPid;
+int ClatdSupervisorTest::sSpawnError;
+std::vector<std::string> ClatdSupervisorTest::sCalls;
+std::map<pid_t, int> ClatdSupervisorTest::sExited;
+
+TEST_F(ClatdSupervisorTest, TestRestartsWithBackoff) {
+    const std::string iface = "rmnet0";
+    Clock::time_point now = Clock::now();
+    ASSERT_EQ(0, mSupervisor.startClatdAt(iface, 100, now));
+    expectCalls({ "spawn rmnet0 100" });
+    EXPECT_EQ(1000, mSupervisor.getPid(iface));
+    EXPECT_EQ(Clock::time_point::max(), mSupervisor.nextRestartTime());
+
+    // A quick crash is restarted after the minimum delay.
+    now += seconds(1);
+    sExited[1000] = SIGSEGV;
+    mSupervisor.reapChildrenAt(now);
+    EXPECT_EQ(0, mSupervisor.getPid(iface));
+    EXPECT_TRUE(mSupervisor.isClatdStarted(iface));
+    EXPECT_EQ(now + ClatdSupervisor::kMinRestartDelay, mSupervisor.nextRestartTime());
+    mSupervisor.restartDueAt(now + milliseconds(100));
+    expectCalls({});
+    now += ClatdSupervisor::kMinRestartDelay;
+    mSupervisor.restartDueAt(now);
+    expectCalls({ "spawn rmnet0 100" });
+    EXPECT_EQ(1001, mSupervisor.getPid(iface));
+
+    // The next quick crash waits twice as long.
+    sExited[1001] = 1 << 8;
+    mSupervisor.reapChildrenAt(now);
+    EXPECT_EQ(now + 2 * ClatdSupervisor::kMinRestartDelay, mSupervisor.nextRestartTime());
+    now += 2 * ClatdSupervisor::kMinRestartDelay;
+    mSupervisor.restartDueAt(now);
+    EXPECT_EQ(1002, mSupervisor.getPid(iface));
+
+    // After a long run, clatd is restarted right away.
+    now += ClatdSupervisor::kStableRunTime;
+    sExited[1002] = SIGKILL;
+    mSupervisor.reapChildrenAt(now);
+    EXPECT_EQ(now, mSupervisor.nextRestartTime());
+    mSupervisor.restartDueAt(now);
+    EXPECT_EQ(1003, mSupervisor.getPid(iface));
+    expectCalls({ "spawn rmnet0 100", "spawn rmnet0 100" });
+}
+
+TEST_F(ClatdSupervisorTest, TestBackoffIsBounded) {
+    const std::string iface = "rmnet0";
+    Clock::time_point now = Clock::now();
+    ASSERT_EQ(0, mSupervisor.startClatdAt(iface, 100, now));
+
+    // Failing to start again counts as a quick exit too.
+    sExited[1000] = 1 << 8;
+    mSupervisor.reapChildrenAt(now);
+    sSpawnError = ENOENT;
+    for (int i = 0; i < 20; i++) {
+        now = mSupervisor.nextRestartTime();
+        mSupervisor.restartDueAt(now);
+        EXPECT_EQ(0, mSupervisor.getPid(iface));
+    }
+    EXPECT_EQ(now + ClatdSupervisor::kMaxRestartDelay, mSupervisor.nextRestartTime());
+
+    sSpawnError = 0;
+    mSupervisor.restartDueAt(mSupervisor.nextRestartTime());
+    EXPECT_EQ(1001, mSupervisor.getPid(iface));
+}
+
+TEST_F(ClatdSupervisorTest, TestStartAndStop) {
+    const std::string iface = "rmnet0";
+    sSpawnError = ENOENT;
+    EXPECT_EQ(-1, mSupervisor.startClatd(iface, 100));
+    EXPECT_EQ(ENOENT, errno);
+    EXPECT_FALSE(mSupervisor.isClatdStarted(iface));
+
+    sSpawnError = 0;
+    ASSERT_EQ(0, mSupervisor.startClatd(iface, 100));
+    EXPECT_TRUE(mSupervisor.isClatdStarted(iface));
+    EXPECT_EQ(-1, mSupervisor.startClatd(iface, 100));
+    EXPECT_EQ(EBUSY, errno);
+    EXPECT_EQ(0, mSupervisor.stopClatd(iface));
+    EXPECT_FALSE(mSupervisor.isClatdStarted(iface));
+    EXPECT_EQ(-1, mSupervisor.stopClatd(iface));
+    expectCalls({ "spawn rmnet0 100", "spawn rmnet0 100", StringPrintf("kill 1000 %d", SIGTERM) });
+
+    // Without the supervisor, an exited clatd is noticed when its status is asked for.
+    ASSERT_EQ(0, mSupervisor.startClatd(iface, 100));
+    sExited[1001] = 0;
+    EXPECT_FALSE(mSupervisor.isClatdStarted(iface));
+    EXPECT_EQ(-1, mSupervisor.getPid(iface));
+}
+
+TEST_F(ClatdSupervisorTest, TestStopWhileWaitingToRestart) {
+    const std::string iface = "rmnet0";
+    Clock::time_point now = Clock::now();
+    ASSERT_EQ(0, mSupervisor.startClatdAt(iface, 100, now));
+    sExited[1000] = SIGSEGV;
+    mSupervisor.reapChildrenAt(now);
+
+    // There is nothing to kill, and nothing is restarted afterwards.
+    EXPECT_EQ(0, mSupervisor.stopClatd(iface));
+    EXPECT_EQ(Clock::time_point::max(), mSupervisor.nextRestartTime());
+    mSupervisor.restartDueAt(now + ClatdSupervisor::kMaxRestartDelay);
+    expectCalls({ "spawn rmnet0 100" });
+}
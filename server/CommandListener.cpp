@@ -21,7 +21,6 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <dirent.h>
 #include <errno.h>
 #include <string.h>
 #include <linux/if.h>
@@ -34,7 +33,6 @@
 #define LOG_TAG "CommandListener"
 
 #include <cutils/log.h>
-#include <netutils/ifc.h>
 #include <sysutils/SocketClient.h>
 
 #include "Controllers.h"
@@ -126,6 +124,7 @@ static const char* FILTER_FORWARD[] = {
         OEM_IPTABLES_FILTER_FORWARD,
         FirewallController::LOCAL_FORWARD,
         BandwidthController::LOCAL_FORWARD,
+        TetherOffloadController::LOCAL_FORWARD,
         NatController::LOCAL_FORWARD,
         NULL,
 };
@@ -238,6 +237,8 @@ CommandListener::CommandListener() :
 
     /* Does DROPs in FORWARD by default */
     gCtls->natCtrl.setupIptablesHooks();
+    /* Only ACCEPTs tethered flows that NAT already allows. */
+    gCtls->tetherOffloadCtrl.setupIptablesHooks();
     /*
      * Does REJECT in INPUT, OUTPUT. Does counting also.
      * No DROP/REJECT allowed later in netfilter-flow hook order.
@@ -268,20 +269,17 @@ int CommandListener::InterfaceCmd::runCommand(SocketClient *cli,
     }
 
     if (!strcmp(argv[1], "list")) {
-        DIR *d;
-        struct dirent *de;
-
-        if (!(d = opendir("/sys/class/net"))) {
-            cli->sendMsg(ResponseCode::OperationFailed, "Failed to open sysfs dir", true);
+        std::vector<std::string> names;
+        int ret = InterfaceController::getInterfaceList(&names);
+        if (ret) {
+            errno = -ret;
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to list interfaces", true);
             return 0;
         }
 
-        while((de = readdir(d))) {
-            if (de->d_name[0] == '.')
-                continue;
-            cli->sendMsg(ResponseCode::InterfaceListResult, de->d_name, false);
+        for (const std::string& name : names) {
+            cli->sendMsg(ResponseCode::InterfaceListResult, name.c_str(), false);
         }
-        closedir(d);
         cli->sendMsg(ResponseCode::CommandOkay, "Interface list completed", false);
         return 0;
     } else {
@@ -294,25 +292,17 @@ int CommandListener::InterfaceCmd::runCommand(SocketClient *cli,
         }
 
         if (!strcmp(argv[1], "getcfg")) {
-            struct in_addr addr;
-            int prefixLength;
-            unsigned char hwaddr[6];
-            unsigned flags = 0;
-
-            ifc_init();
-            memset(hwaddr, 0, sizeof(hwaddr));
-
-            if (ifc_get_info(argv[2], &addr.s_addr, &prefixLength, &flags)) {
+            InterfaceController::InterfaceConfig config;
+            int ret = InterfaceController::getInterfaceConfig(argv[2], &config);
+            if (ret) {
+                errno = -ret;
                 cli->sendMsg(ResponseCode::OperationFailed, "Interface not found", true);
-                ifc_close();
                 return 0;
             }
 
-            if (ifc_get_hwaddr(argv[2], (void *) hwaddr)) {
-                ALOGW("Failed to retrieve HW addr for %s (%s)", argv[2], strerror(errno));
-            }
-
-            char *addr_s = strdup(inet_ntoa(addr));
+            const unsigned char *hwaddr = config.hwaddr;
+            const unsigned flags = config.flags;
+            char *addr_s = strdup(inet_ntoa(config.addr));
             const char *updown, *brdcst, *loopbk, *ppp, *running, *multi;
 
             updown =  (flags & IFF_UP)           ? "up" : "down";
@@ -329,15 +319,13 @@ int CommandListener::InterfaceCmd::runCommand(SocketClient *cli,
             char *msg = NULL;
             asprintf(&msg, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x %s %d %s",
                      hwaddr[0], hwaddr[1], hwaddr[2], hwaddr[3], hwaddr[4], hwaddr[5],
-                     addr_s, prefixLength, flag_s);
+                     addr_s, config.prefixLength, flag_s);
 
             cli->sendMsg(ResponseCode::InterfaceGetCfgResult, msg, false);
 
             free(addr_s);
             free(flag_s);
             free(msg);
-
-            ifc_close();
             return 0;
         } else if (!strcmp(argv[1], "setcfg")) {
             // arglist: iface [addr prefixLength] flags
@@ -350,45 +338,36 @@ int CommandListener::InterfaceCmd::runCommand(SocketClient *cli,
             struct in_addr addr;
             int index = 5;
 
-            ifc_init();
-
             if (!inet_aton(argv[3], &addr)) {
                 // Handle flags only case
                 index = 3;
             } else {
-                if (ifc_set_addr(argv[2], 0)) {
+                // Like SIOCSIFADDR did, only replace the address labelled with the interface name.
+                if (int ret = InterfaceController::clearAddresses(argv[2], AF_INET, argv[2])) {
+                    errno = -ret;
                     cli->sendMsg(ResponseCode::OperationFailed, "Failed to clear address", true);
-                    ifc_close();
                     return 0;
                 }
                 if (addr.s_addr != 0) {
-                    if (ifc_add_address(argv[2], argv[3], atoi(argv[4]))) {
+                    if (int ret = InterfaceController::addAddress(argv[2], argv[3],
+                                                                  atoi(argv[4]))) {
+                        errno = -ret;
                         cli->sendMsg(ResponseCode::OperationFailed, "Failed to set address", true);
-                        ifc_close();
                         return 0;
                     }
                 }
             }
 
             /* Process flags */
+            InterfaceController::LinkConfig config;
             for (int i = index; i < argc; i++) {
                 char *flag = argv[i];
                 if (!strcmp(flag, "up")) {
-                    ALOGD("Trying to bring up %s", argv[2]);
-                    if (ifc_up(argv[2])) {
-                        ALOGE("Error upping interface");
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to up interface", true);
-                        ifc_close();
-                        return 0;
-                    }
+                    config.flagsToSet = IFF_UP;
+                    config.flagsToClear = 0;
                 } else if (!strcmp(flag, "down")) {
-                    ALOGD("Trying to bring down %s", argv[2]);
-                    if (ifc_down(argv[2])) {
-                        ALOGE("Error downing interface");
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to down interface", true);
-                        ifc_close();
-                        return 0;
-                    }
+                    config.flagsToSet = 0;
+                    config.flagsToClear = IFF_UP;
                 } else if (!strcmp(flag, "broadcast")) {
                     // currently ignored
                 } else if (!strcmp(flag, "multicast")) {
@@ -401,19 +380,33 @@ int CommandListener::InterfaceCmd::runCommand(SocketClient *cli,
                     // currently ignored
                 } else {
                     cli->sendMsg(ResponseCode::CommandParameterError, "Flag unsupported", false);
-                    ifc_close();
+                    return 0;
+                }
+            }
+
+            if (config.flagsToSet || config.flagsToClear) {
+                const bool up = config.flagsToSet & IFF_UP;
+                ALOGD("Trying to bring %s %s", up ? "up" : "down", argv[2]);
+                InterfaceController::LinkConfigResults results;
+                int ret = InterfaceController::setLinkConfig(argv[2], config, &results);
+                if (ret || results.flags) {
+                    ALOGE("Error %s interface", up ? "upping" : "downing");
+                    errno = ret ? -ret : -results.flags;
+                    cli->sendMsg(ResponseCode::OperationFailed,
+                                 up ? "Failed to up interface" : "Failed to down interface", true);
                     return 0;
                 }
             }
 
             cli->sendMsg(ResponseCode::CommandOkay, "Interface configuration set", false);
-            ifc_close();
             return 0;
         } else if (!strcmp(argv[1], "clearaddrs")) {
             // arglist: iface
             ALOGD("Clearing all IP addresses on %s", argv[2]);
 
-            ifc_clear_addresses(argv[2]);
+            if (int ret = InterfaceController::clearAddresses(argv[2], AF_UNSPEC)) {
+                ALOGE("Failed to clear addresses on %s: %s", argv[2], strerror(-ret));
+            }
 
             cli->sendMsg(ResponseCode::CommandOkay, "Interface IP addresses cleared", false);
             return 0;
@@ -687,10 +680,13 @@ int CommandListener::NatCmd::runCommand(SocketClient *cli,
             natStarted(argv[2], argv[3]);
             /* Ignore ifaces for now. */
             rc = gCtls->bandwidthCtrl.setGlobalAlertInForwardChain();
+            /* Without offload, the pair is still forwarded by the slow path. */
+            gCtls->tetherOffloadCtrl.addPair(argv[2], argv[3]);
         }
     } else if (!strcmp(argv[1], "disable") && argc >= 4) {
         /* Ignore ifaces for now. */
         natStopped(argv[2], argv[3]);
+        gCtls->tetherOffloadCtrl.removePair(argv[2], argv[3]);
         rc = gCtls->bandwidthCtrl.removeGlobalAlertInForwardChain();
         rc |= gCtls->natCtrl.disableNat(argv[2], argv[3]);
     } else {
@@ -1556,6 +1552,10 @@ int CommandListener::FirewallCmd::runCommand(SocketClient *cli, int argc,
 
         ChildChain childChain = parseChildChain(argv[2]);
         int res = gCtls->firewallCtrl.enableChildChains(childChain, true);
+        // The framework enables the dozable chain while the device is idle.
+        if (res == 0 && childChain == DOZABLE) {
+            gCtls->dnsPrefetcher.setDeviceIdle(true);
+        }
         return sendGenericOkFail(cli, res);
     }
 
@@ -1569,6 +1569,9 @@ int CommandListener::FirewallCmd::runCommand(SocketClient *cli, int argc,
 
         ChildChain childChain = parseChildChain(argv[2]);
         int res = gCtls->firewallCtrl.enableChildChains(childChain, false);
+        if (res == 0 && childChain == DOZABLE) {
+            gCtls->dnsPrefetcher.setDeviceIdle(false);
+        }
         return sendGenericOkFail(cli, res);
     }
 
@@ -1818,7 +1821,13 @@ int CommandListener::NetworkCommand::runCommand(SocketClient* client, int argc,
             return syntaxError(client, "Incorrect number of arguments");
         }
         unsigned netId = stringToNetId(argv[2]);
-        if (int ret = gCtls->netCtrl.destroyNetwork(netId)) {
+        int ret = gCtls->netCtrl.destroyNetwork(netId);
+        // destroyNetwork() clears out as much as it can even if it fails.
+        gCtls->eventReporter.getMetrics()->removeNetwork(netId);
+        gCtls->dnsPrefetcher.removeNetwork(netId);
+        gCtls->dnsAddressSorter.removeNetwork(netId);
+        gCtls->resolverCtrl.removeNetwork(netId);
+        if (ret) {
             return operationError(client, "destroyNetwork() failed", ret);
         }
         return success(client);
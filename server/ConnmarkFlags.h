@@ -25,6 +25,10 @@ class ConnmarkFlags {
 public:
     static const unsigned int STRICT_RESOLVED_ACCEPT = 0x01000000;
     static const unsigned int STRICT_RESOLVED_REJECT = 0x02000000;
+    // Tethered flows that TetherOffloadController forwards through its flowtable. The low bits
+    // identify the interface pair.
+    static const unsigned int TETHER_OFFLOAD = 0x04000000;
+    static const unsigned int TETHER_OFFLOAD_PAIR_MASK = 0x0000ffff;
 };
 
 #endif
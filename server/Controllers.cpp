@@ -19,7 +19,11 @@
 namespace android {
 namespace net {
 
-Controllers::Controllers() : clatdCtrl(&netCtrl) {
+Controllers::Controllers()
+        : natCtrl(&tetherCounters),
+          bandwidthCtrl(&tetherCounters, &tetherOffloadCtrl),
+          clatdCtrl(&netCtrl),
+          dnsEventReporter(&eventReporter) {
     InterfaceController::initializeAll();
 }
 
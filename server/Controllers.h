@@ -31,7 +31,12 @@
 #include "FirewallController.h"
 #include "ClatdController.h"
 #include "StrictController.h"
+#include "TetherCounters.h"
+#include "TetherOffloadController.h"
 #include "EventReporter.h"
+#include "DnsAddressSorter.h"
+#include "DnsEventReporter.h"
+#include "DnsPrefetcher.h"
 
 namespace android {
 namespace net {
@@ -41,7 +46,9 @@ struct Controllers {
 
     NetworkController netCtrl;
     TetherController tetherCtrl;
+    TetherCounters tetherCounters;
     NatController natCtrl;
+    TetherOffloadController tetherOffloadCtrl;
     PppController pppCtrl;
     SoftapController softapCtrl;
     BandwidthController bandwidthCtrl;
@@ -51,6 +58,9 @@ struct Controllers {
     ClatdController clatdCtrl;
     StrictController strictCtrl;
     EventReporter eventReporter;
+    DnsEventReporter dnsEventReporter;
+    DnsPrefetcher dnsPrefetcher;
+    DnsAddressSorter dnsAddressSorter;
 };
 
 extern Controllers* gCtls;
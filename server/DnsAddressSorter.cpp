@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "DnsAddressSorter.h"
+#include "DumpWriter.h"
+#include "NetdConstants.h"
+
+constexpr std::chrono::minutes DnsAddressSorter::kReachabilityTtl;
+constexpr size_t DnsAddressSorter::kMaxDestinationsPerApp;
+
+namespace {
+
+// Address scopes, as in RFC 4291 section 2.7.
+constexpr int kScopeLinkLocal = 0x02;
+constexpr int kScopeSiteLocal = 0x05;
+constexpr int kScopeGlobal = 0x0e;
+
+// The default policy table of RFC 6724 section 2.1, longest prefixes first.
+struct PolicyEntry {
+    uint8_t prefix[16];
+    int prefixLen;
+    int precedence;
+    int label;
+};
+
+const PolicyEntry kPolicyTable[] = {
+    // ::1/128
+    { { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 }, 128, 50, 0 },
+    // ::ffff:0:0/96
+    { { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff }, 96, 35, 4 },
+    // ::/96
+    { { 0 }, 96, 1, 3 },
+    // 2001::/32
+    { { 0x20, 0x01, 0, 0 }, 32, 5, 5 },
+    // 2002::/16
+    { { 0x20, 0x02 }, 16, 30, 2 },
+    // 3ffe::/16
+    { { 0x3f, 0xfe }, 16, 1, 12 },
+    // fec0::/10
+    { { 0xfe, 0xc0 }, 10, 1, 11 },
+    // fc00::/7
+    { { 0xfc }, 7, 3, 13 },
+    // ::/0
+    { { 0 }, 0, 40, 1 },
+};
+
+// Returns the number of leading bits that a and b have in common.
+int commonPrefixLen(const in6_addr& a, const in6_addr& b) {
+    int len = 0;
+    for (size_t i = 0; i < sizeof(a.s6_addr); i++) {
+        const uint8_t diff = a.s6_addr[i] ^ b.s6_addr[i];
+        if (diff) {
+            return len + __builtin_clz(diff) - 24;
+        }
+        len += 8;
+    }
+    return len;
+}
+
+const PolicyEntry& lookupPolicy(const in6_addr& addr) {
+    for (const PolicyEntry& entry : kPolicyTable) {
+        if (commonPrefixLen(addr, *reinterpret_cast<const in6_addr*>(entry.prefix)) >=
+                entry.prefixLen) {
+            return entry;
+        }
+    }
+    // Not reached, because ::/0 matches everything.
+    return kPolicyTable[sizeof(kPolicyTable) / sizeof(kPolicyTable[0]) - 1];
+}
+
+int getScope(const in6_addr& addr) {
+    if (IN6_IS_ADDR_MULTICAST(&addr)) {
+        return addr.s6_addr[1] & 0x0f;
+    }
+    if (IN6_IS_ADDR_LOOPBACK(&addr) || IN6_IS_ADDR_LINKLOCAL(&addr)) {
+        return kScopeLinkLocal;
+    }
+    if (IN6_IS_ADDR_SITELOCAL(&addr)) {
+        return kScopeSiteLocal;
+    }
+    if (IN6_IS_ADDR_V4MAPPED(&addr)) {
+        // RFC 6724 section 3.2: loopback and link-local IPv4 addresses have link-local scope, and
+        // all others, including private addresses, have global scope.
+        const uint8_t* v4 = addr.s6_addr + 12;
+        if (v4[0] == 127 || (v4[0] == 169 && v4[1] == 254)) {
+            return kScopeLinkLocal;
+        }
+    }
+    return kScopeGlobal;
+}
+
+// Converts an IPv4 or IPv6 sockaddr to an IPv6 address, mapping IPv4 addresses.
+bool toIn6(const sockaddr* addr, in6_addr* out) {
+    if (addr->sa_family == AF_INET6) {
+        *out = reinterpret_cast<const sockaddr_in6*>(addr)->sin6_addr;
+        return true;
+    }
+    if (addr->sa_family == AF_INET) {
+        memset(out, 0, sizeof(*out));
+        out->s6_addr[10] = 0xff;
+        out->s6_addr[11] = 0xff;
+        memcpy(out->s6_addr + 12, &reinterpret_cast<const sockaddr_in*>(addr)->sin_addr,
+               sizeof(in_addr));
+        return true;
+    }
+    return false;
+}
+
+// Finds the source address that a socket with the given netcontext would use to reach addr, by
+// connecting a UDP socket, which sends no packets. Returns false if there is no route.
+bool findSource(const sockaddr* addr, socklen_t addrlen, const android_net_context& netcontext,
+                in6_addr* source) {
+    int s = socket(addr->sa_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (s == -1) {
+        return false;
+    }
+    bool found = false;
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    if ((netcontext.app_mark == MARK_UNSET ||
+            !setsockopt(s, SOL_SOCKET, SO_MARK, &netcontext.app_mark,
+                        sizeof(netcontext.app_mark))) &&
+            (netcontext.uid == 0 || netcontext.uid == INVALID_UID ||
+            !fchown(s, netcontext.uid, (gid_t) -1)) &&
+            !connect(s, addr, addrlen) &&
+            !getsockname(s, reinterpret_cast<sockaddr*>(&ss), &len)) {
+        found = toIn6(reinterpret_cast<sockaddr*>(&ss), source);
+    }
+    close(s);
+    return found;
+}
+
+// Whether a connect() error means that the destination address cannot be reached on the network.
+// Failures are only known by network, app and address, so errors that may be specific to a
+// port or to an app, such as ECONNREFUSED, or to a single attempt, such as ETIMEDOUT, do not count.
+bool isUnreachableError(int error) {
+    switch (error) {
+        case ENETUNREACH:
+        case EHOSTUNREACH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::string toKey(const in6_addr& addr) {
+    return std::string(reinterpret_cast<const char*>(addr.s6_addr), sizeof(addr.s6_addr));
+}
+
+}  // namespace
+
+bool DnsAddressSorter::isPreferred(const Destination& a, const Destination& b) {
+    in6_addr dstA, dstB;
+    toIn6(a.ai->ai_addr, &dstA);
+    toIn6(b.ai->ai_addr, &dstB);
+    const int scopeA = getScope(dstA);
+    const int scopeB = getScope(dstB);
+    const PolicyEntry& policyA = lookupPolicy(dstA);
+    const PolicyEntry& policyB = lookupPolicy(dstB);
+
+    // Rule 1: Avoid unusable destinations.
+    const bool usableA = a.hasSource && !a.unreachable;
+    const bool usableB = b.hasSource && !b.unreachable;
+    if (usableA != usableB) {
+        return usableA;
+    }
+
+    // Rule 2: Prefer matching scope.
+    const bool scopeMatchA = a.hasSource && scopeA == getScope(a.source);
+    const bool scopeMatchB = b.hasSource && scopeB == getScope(b.source);
+    if (scopeMatchA != scopeMatchB) {
+        return scopeMatchA;
+    }
+
+    // Rules 3, 4 and 7 need information the kernel does not expose per address.
+
+    // Rule 5: Prefer matching label.
+    const bool labelMatchA = a.hasSource && policyA.label == lookupPolicy(a.source).label;
+    const bool labelMatchB = b.hasSource && policyB.label == lookupPolicy(b.source).label;
+    if (labelMatchA != labelMatchB) {
+        return labelMatchA;
+    }
+
+    // Rule 6: Prefer higher precedence.
+    if (policyA.precedence != policyB.precedence) {
+        return policyA.precedence > policyB.precedence;
+    }
+
+    // Rule 8: Prefer smaller scope.
+    if (scopeA != scopeB) {
+        return scopeA < scopeB;
+    }
+
+    // Rule 9: Use longest matching prefix. Only for IPv6, and only up to the length of a typical
+    // IPv6 prefix, beyond which a match says nothing about the network.
+    if (a.hasSource && b.hasSource && a.ai->ai_family == AF_INET6 &&
+            b.ai->ai_family == AF_INET6) {
+        const int prefixLenA = std::min(commonPrefixLen(dstA, a.source), 64);
+        const int prefixLenB = std::min(commonPrefixLen(dstB, b.source), 64);
+        if (prefixLenA != prefixLenB) {
+            return prefixLenA > prefixLenB;
+        }
+    }
+
+    // Rule 10: Otherwise, leave the order unchanged.
+    return a.order < b.order;
+}
+
+void DnsAddressSorter::sort(const android_net_context& netcontext, addrinfo** result) {
+    if (*result == nullptr || (*result)->ai_next == nullptr) {
+        return;
+    }
+
+    const Clock::time_point now = Clock::now();
+    std::vector<Destination> destinations;
+    int order = 0;
+    for (addrinfo* ai = *result; ai; ai = ai->ai_next) {
+        Destination d;
+        d.ai = ai;
+        d.order = order++;
+        d.hasSource = findSource(ai->ai_addr, ai->ai_addrlen, netcontext, &d.source);
+        d.unreachable = isUnreachable(netcontext.app_netid, netcontext.uid, ai->ai_addr, now);
+        destinations.push_back(d);
+    }
+
+    std::sort(destinations.begin(), destinations.end(), isPreferred);
+
+    for (size_t i = 0; i + 1 < destinations.size(); i++) {
+        destinations[i].ai->ai_next = destinations[i + 1].ai;
+    }
+    destinations.back().ai->ai_next = nullptr;
+    *result = destinations.front().ai;
+}
+
+void DnsAddressSorter::removeNetwork(unsigned netId) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mFailures.erase(mFailures.lower_bound(std::make_pair(netId, (uid_t) 0)),
+                    mFailures.upper_bound(std::make_pair(netId, (uid_t) -1)));
+}
+
+bool DnsAddressSorter::hasRoute(int family, const android_net_context& netcontext) {
+    // The same addresses as bionic's _have_ipv4() and _have_ipv6().
+    sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    socklen_t len;
+    if (family == AF_INET) {
+        sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(&ss);
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = htonl(0x08080808);
+        len = sizeof(*sin);
+    } else if (family == AF_INET6) {
+        sockaddr_in6* sin6 = reinterpret_cast<sockaddr_in6*>(&ss);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_addr.s6_addr[0] = 0x20;
+        len = sizeof(*sin6);
+    } else {
+        return false;
+    }
+    in6_addr source;
+    return findSource(reinterpret_cast<sockaddr*>(&ss), len, netcontext, &source);
+}
+
+void DnsAddressSorter::recordConnect(unsigned netId, uid_t uid, const sockaddr* addr,
+                                     int error) {
+    recordConnectAt(netId, uid, addr, error, Clock::now());
+}
+
+void DnsAddressSorter::recordConnectAt(unsigned netId, uid_t uid, const sockaddr* addr, int error,
+                                       Clock::time_point now) {
+    in6_addr dst;
+    if (!toIn6(addr, &dst) || (error != 0 && !isUnreachableError(error))) {
+        return;
+    }
+
+    const auto key = std::make_pair(netId, uid);
+    std::lock_guard<std::mutex> lock(mLock);
+    if (error == 0) {
+        auto failures = mFailures.find(key);
+        if (failures != mFailures.end()) {
+            failures->second.erase(toKey(dst));
+            if (failures->second.empty()) {
+                mFailures.erase(failures);
+            }
+        }
+        return;
+    }
+
+    auto& failures = mFailures[key];
+    if (failures.size() >= kMaxDestinationsPerApp && failures.find(toKey(dst)) ==
+            failures.end()) {
+        auto oldest = std::min_element(failures.begin(), failures.end(),
+                [](const std::pair<const std::string, Clock::time_point>& a,
+                   const std::pair<const std::string, Clock::time_point>& b) {
+                    return a.second < b.second;
+                });
+        failures.erase(oldest);
+    }
+    failures[toKey(dst)] = now;
+}
+
+bool DnsAddressSorter::isUnreachable(unsigned netId, uid_t uid, const sockaddr* addr,
+                                     Clock::time_point now) {
+    in6_addr dst;
+    if (!toIn6(addr, &dst)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    auto failures = mFailures.find(std::make_pair(netId, uid));
+    if (failures == mFailures.end()) {
+        return false;
+    }
+    auto failure = failures->second.find(toKey(dst));
+    if (failure == failures->second.end()) {
+        return false;
+    }
+    if (now - failure->second < kReachabilityTtl) {
+        return true;
+    }
+    failures->second.erase(failure);
+    if (failures->second.empty()) {
+        mFailures.erase(failures);
+    }
+    return false;
+}
+
+void DnsAddressSorter::dump(DumpWriter& dw) {
+    std::lock_guard<std::mutex> lock(mLock);
+    dw.println("DNS address sorter:");
+    dw.incIndent();
+    const Clock::time_point now = Clock::now();
+    for (const auto& failures : mFailures) {
+        char addrstr[INET6_ADDRSTRLEN];
+        for (const auto& failure : failures.second) {
+            inet_ntop(AF_INET6, failure.first.data(), addrstr, sizeof(addrstr));
+            const auto age = std::chrono::duration_cast<std::chrono::seconds>(
+                    now - failure.second);
+            dw.println("netId=%u uid=%u: %s unreachable %llds ago", failures.first.first,
+                       failures.first.second, addrstr, static_cast<long long>(age.count()));
+        }
+    }
+    dw.decIndent();
+}
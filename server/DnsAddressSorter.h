@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_DNS_ADDRESS_SORTER_H
+#define NETD_SERVER_DNS_ADDRESS_SORTER_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <resolv_netid.h>  // struct android_net_context
+
+struct addrinfo;
+class DumpWriter;
+
+/*
+ * Orders getaddrinfo results by RFC 6724 destination address selection, taking into account which
+ * destinations apps recently failed to connect to.
+ *
+ * Bionic already sorts the results of an AF_UNSPEC lookup, but the streaming getaddrinfo command
+ * resolves each family separately, so each batch of results it sends is sorted here instead.
+ * Connect outcomes are reported by FwmarkServer. A destination that a connect() recently found to
+ * be unreachable (ENETUNREACH or EHOSTUNREACH) is treated as unusable by rule 1, so apps try it
+ * last. The outcome is reported by the app itself, so it only affects that app's own lookups.
+ */
+class DnsAddressSorter {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // How long a failure to connect is remembered for.
+    static constexpr std::chrono::minutes kReachabilityTtl{10};
+    static constexpr size_t kMaxDestinationsPerApp = 256;
+
+    // A candidate destination, as seen by the sorting rules.
+    struct Destination {
+        addrinfo* ai;
+        // The source address the kernel would use to reach ai->ai_addr, if it has a route. IPv4
+        // addresses are mapped.
+        bool hasSource;
+        in6_addr source;
+        // Whether the app recently failed to connect to ai->ai_addr.
+        bool unreachable;
+        // Position in the original list, which breaks ties.
+        int order;
+    };
+
+    // Records the outcome of a TCP connect() to addr made by uid on netId. Threadsafe.
+    void recordConnect(unsigned netId, uid_t uid, const sockaddr* addr, int error);
+
+    // Sorts the list in *result in place. The source addresses are found with sockets marked and
+    // owned as the lookup's netcontext, so they match what the app's own connect() would use.
+    void sort(const android_net_context& netcontext, addrinfo** result);
+
+    // Forgets the failures seen on a network that was destroyed. Threadsafe.
+    void removeNetwork(unsigned netId);
+
+    // Whether a socket with the given netcontext has a route to the global unicast addresses of
+    // |family|. This is the test that bionic uses for AI_ADDRCONFIG.
+    static bool hasRoute(int family, const android_net_context& netcontext);
+
+    void dump(DumpWriter& dw);
+
+    // Public for testing.
+    bool isUnreachable(unsigned netId, uid_t uid, const sockaddr* addr, Clock::time_point now);
+    void recordConnectAt(unsigned netId, uid_t uid, const sockaddr* addr, int error,
+                         Clock::time_point now);
+    // Whether a should be tried before b.
+    static bool isPreferred(const Destination& a, const Destination& b);
+
+private:
+    // When each destination last failed, by netId and uid and then by destination address as an
+    // IPv6 address, with IPv4 addresses mapped. A successful connect removes the destination.
+    std::mutex mLock;
+    std::map<std::pair<unsigned, uid_t>, std::map<std::string, Clock::time_point>> mFailures;
+};
+
+#endif  // NETD_SERVER_DNS_ADDRESS_SORTER_H
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * DnsAddressSorterTest.cpp - unit tests for DnsAddressSorter.cpp
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "DnsAddressSorter.h"
+
+using std::chrono::minutes;
+
+namespace {
+
+const unsigned kNetId = 100;
+const uid_t kUid = 10123;
+
+// An addrinfo and its address, kept together.
+struct Candidate {
+    addrinfo ai;
+    sockaddr_storage addr;
+};
+
+void parseAddress(const std::string& str, sockaddr_storage* ss, socklen_t* len) {
+    memset(ss, 0, sizeof(*ss));
+    sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(ss);
+    sockaddr_in6* sin6 = reinterpret_cast<sockaddr_in6*>(ss);
+    if (inet_pton(AF_INET, str.c_str(), &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        *len = sizeof(*sin);
+    } else {
+        ASSERT_EQ(1, inet_pton(AF_INET6, str.c_str(), &sin6->sin6_addr)) << str;
+        sin6->sin6_family = AF_INET6;
+        *len = sizeof(*sin6);
+    }
+}
+
+std::string addressToString(const sockaddr* addr) {
+    char str[INET6_ADDRSTRLEN];
+    const void* src = (addr->sa_family == AF_INET) ?
+            static_cast<const void*>(&reinterpret_cast<const sockaddr_in*>(addr)->sin_addr) :
+            static_cast<const void*>(&reinterpret_cast<const sockaddr_in6*>(addr)->sin6_addr);
+    return inet_ntop(addr->sa_family, src, str, sizeof(str));
+}
+
+}  // namespace
+
+class DnsAddressSorterTest : public ::testing::Test {
+protected:
+    // Adds a destination. An empty source means that there is no route to it.
+    void addDestination(const std::string& dst, const std::string& src) {
+        mCandidates.emplace_back(new Candidate());
+        Candidate* c = mCandidates.back().get();
+        memset(&c->ai, 0, sizeof(c->ai));
+        parseAddress(dst, &c->addr, &c->ai.ai_addrlen);
+        c->ai.ai_family = c->addr.ss_family;
+        c->ai.ai_addr = reinterpret_cast<sockaddr*>(&c->addr);
+
+        DnsAddressSorter::Destination d;
+        d.ai = &c->ai;
+        d.hasSource = !src.empty();
+        if (d.hasSource) {
+            sockaddr_storage ss;
+            socklen_t len;
+            parseAddress(src, &ss, &len);
+            if (ss.ss_family == AF_INET6) {
+                d.source = reinterpret_cast<sockaddr_in6*>(&ss)->sin6_addr;
+            } else {
+                std::string mapped = "::ffff:" + src;
+                inet_pton(AF_INET6, mapped.c_str(), &d.source);
+            }
+        }
+        d.unreachable = mSorter.isUnreachable(kNetId, kUid, d.ai->ai_addr, mNow);
+        d.order = mDestinations.size();
+        mDestinations.push_back(d);
+    }
+
+    std::vector<std::string> sorted() {
+        std::vector<DnsAddressSorter::Destination> destinations = mDestinations;
+        std::sort(destinations.begin(), destinations.end(), DnsAddressSorter::isPreferred);
+        std::vector<std::string> result;
+        for (const auto& d : destinations) {
+            result.push_back(addressToString(d.ai->ai_addr));
+        }
+        return result;
+    }
+
+    void recordConnect(const std::string& dst, int error, uid_t uid = kUid,
+                       unsigned netId = kNetId) {
+        sockaddr_storage ss;
+        socklen_t len;
+        parseAddress(dst, &ss, &len);
+        mSorter.recordConnectAt(netId, uid, reinterpret_cast<sockaddr*>(&ss), error, mNow);
+    }
+
+    bool isUnreachable(const std::string& dst, unsigned netId = kNetId, uid_t uid = kUid) {
+        sockaddr_storage ss;
+        socklen_t len;
+        parseAddress(dst, &ss, &len);
+        return mSorter.isUnreachable(netId, uid, reinterpret_cast<sockaddr*>(&ss), mNow);
+    }
+
+    DnsAddressSorter mSorter;
+    DnsAddressSorter::Clock::time_point mNow = DnsAddressSorter::Clock::now();
+    std::vector<std::unique_ptr<Candidate>> mCandidates;
+    std::vector<DnsAddressSorter::Destination> mDestinations;
+};
+
+TEST_F(DnsAddressSorterTest, TestPrefersIPv6) {
+    addDestination("192.0.2.1", "192.168.1.2");
+    addDestination("2001:db8:1::1", "2001:db8:2::2");
+    addDestination("198.51.100.1", "192.168.1.2");
+    EXPECT_EQ(std::vector<std::string>({ "2001:db8:1::1", "192.0.2.1", "198.51.100.1" }),
+              sorted());
+}
+
+TEST_F(DnsAddressSorterTest, TestAvoidsUnroutableDestinations) {
+    // Without an IPv6 route, IPv4 goes first.
+    addDestination("2001:db8:1::1", "");
+    addDestination("192.0.2.1", "192.168.1.2");
+    EXPECT_EQ(std::vector<std::string>({ "192.0.2.1", "2001:db8:1::1" }), sorted());
+}
+
+TEST_F(DnsAddressSorterTest, TestPolicyTable) {
+    // ULA sources only match ULA destinations, and the precedence of 6to4 and Teredo is low.
+    addDestination("2002:c000:201::1", "2001:db8::2");
+    addDestination("2001:0:4136:e378::1", "2001:db8::2");
+    addDestination("fd00::1", "fd00::2");
+    addDestination("2001:db8::1", "2001:db8::2");
+    EXPECT_EQ(std::vector<std::string>({ "2001:db8::1", "fd00::1", "2002:c000:201::1",
+                                         "2001:0:4136:e378::1" }), sorted());
+}
+
+TEST_F(DnsAddressSorterTest, TestLongestMatchingPrefix) {
+    addDestination("2001:db8:ffff::1", "2001:db8:1:2::2");
+    addDestination("2001:db8:1:3::1", "2001:db8:1:2::2");
+    addDestination("2001:db8:1:2::1", "2001:db8:1:2::2");
+    EXPECT_EQ(std::vector<std::string>({ "2001:db8:1:2::1", "2001:db8:1:3::1",
+                                         "2001:db8:ffff::1" }), sorted());
+}
+
+TEST_F(DnsAddressSorterTest, TestRecentlyUnreachableDestinationsGoLast) {
+    recordConnect("2001:db8:1::1", EHOSTUNREACH);
+    // Errors that say nothing about the reachability of the address itself are ignored.
+    recordConnect("2001:db8:1::2", EINPROGRESS);
+    recordConnect("2001:db8:1::2", ECONNREFUSED);
+    recordConnect("2001:db8:1::2", ETIMEDOUT);
+    EXPECT_TRUE(isUnreachable("2001:db8:1::1"));
+    EXPECT_FALSE(isUnreachable("2001:db8:1::1", kNetId + 1));
+    EXPECT_FALSE(isUnreachable("2001:db8:1::2"));
+
+    addDestination("2001:db8:1::1", "2001:db8:2::2");
+    addDestination("2001:db8:1::2", "2001:db8:2::2");
+    addDestination("192.0.2.1", "192.168.1.2");
+    EXPECT_EQ(std::vector<std::string>({ "2001:db8:1::2", "192.0.2.1", "2001:db8:1::1" }),
+              sorted());
+
+    // A successful connect clears the failure, and so does time.
+    recordConnect("2001:db8:1::1", 0);
+    EXPECT_FALSE(isUnreachable("2001:db8:1::1"));
+    recordConnect("192.0.2.1", ENETUNREACH);
+    EXPECT_TRUE(isUnreachable("192.0.2.1"));
+    mNow += DnsAddressSorter::kReachabilityTtl;
+    EXPECT_FALSE(isUnreachable("192.0.2.1"));
+}
+
+TEST_F(DnsAddressSorterTest, TestFailuresOnlyAffectTheReportingApp) {
+    // An app cannot make a destination go last for other apps.
+    recordConnect("2001:db8:1::1", ENETUNREACH, kUid + 1);
+    EXPECT_TRUE(isUnreachable("2001:db8:1::1", kNetId, kUid + 1));
+    EXPECT_FALSE(isUnreachable("2001:db8:1::1"));
+
+    // Nor clear failures that other apps saw.
+    recordConnect("2001:db8:1::2", EHOSTUNREACH);
+    recordConnect("2001:db8:1::2", 0, kUid + 1);
+    EXPECT_TRUE(isUnreachable("2001:db8:1::2"));
+}
+
+TEST_F(DnsAddressSorterTest, TestFailuresAreBounded) {
+    recordConnect("192.0.2.1", EHOSTUNREACH);
+    mNow += minutes(1);
+    for (size_t i = 0; i < DnsAddressSorter::kMaxDestinationsPerApp; i++) {
+        recordConnect("2001:db8::" + std::to_string(i + 1), EHOSTUNREACH);
+    }
+    // The oldest failure was forgotten to make room.
+    EXPECT_FALSE(isUnreachable("192.0.2.1"));
+    EXPECT_TRUE(isUnreachable("2001:db8::1"));
+}
+
+TEST_F(DnsAddressSorterTest, TestRemoveNetwork) {
+    recordConnect("2001:db8::1", ENETUNREACH);
+    recordConnect("2001:db8::1", ENETUNREACH, kUid + 1);
+    recordConnect("2001:db8::1", ENETUNREACH, kUid, kNetId + 1);
+    mSorter.removeNetwork(kNetId);
+    EXPECT_FALSE(isUnreachable("2001:db8::1"));
+    EXPECT_FALSE(isUnreachable("2001:db8::1", kNetId, kUid + 1));
+    EXPECT_TRUE(isUnreachable("2001:db8::1", kNetId + 1));
+}
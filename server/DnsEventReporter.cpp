@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <string.h>
+
+#include <algorithm>
+
+#define LOG_TAG "Netd"
+
+#include <cutils/log.h>
+#include <utils/String16.h>
+
+#include "DnsEventReporter.h"
+#include "DumpWriter.h"
+#include "EventReporter.h"
+#include "MetricsAggregator.h"
+#include "android/net/INetd.h"
+#include "android/net/metrics/INetdEventListener.h"
+
+using android::String16;
+using android::net::INetd;
+using android::net::metrics::INetdEventListener;
+
+constexpr std::chrono::milliseconds DnsEventReporter::kIdleInterval;
+constexpr std::chrono::milliseconds DnsEventReporter::kMaxDelay;
+
+namespace {
+
+void appendIpAddresses(const DnsEvent& event, std::vector<String16>* ipAddresses) {
+    for (size_t i = 0; i < event.numIpAddresses; i++) {
+        char addrstr[INET6_ADDRSTRLEN];
+        if (inet_ntop(event.ipAddresses[i].family, event.ipAddresses[i].addr, addrstr,
+                      sizeof(addrstr))) {
+            ipAddresses->push_back(String16(addrstr));
+        }
+    }
+}
+
+}  // namespace
+
+void DnsEvent::init(int32_t netId_, int32_t eventType_, int32_t returnCode_, int32_t latencyMs_) {
+    netId = netId_;
+    eventType = eventType_;
+    returnCode = returnCode_;
+    latencyMs = latencyMs_;
+    // What onDnsEvent() was passed at REPORTING_LEVEL_METRICS.
+    uid = -1;
+    ipAddressesCount = -1;
+    numIpAddresses = 0;
+    hostname[0] = '\0';
+}
+
+void DnsEvent::setDetails(const char* hostname_, int32_t uid_) {
+    strlcpy(hostname, hostname_ ? hostname_ : "", sizeof(hostname));
+    uid = uid_;
+    ipAddressesCount = 0;
+}
+
+void DnsEvent::addIpAddress(const sockaddr* addr) {
+    ipAddressesCount++;
+    if (numIpAddresses >= kMaxIpAddresses) {
+        return;
+    }
+    auto& ip = ipAddresses[numIpAddresses];
+    if (addr->sa_family == AF_INET) {
+        memcpy(ip.addr, &reinterpret_cast<const sockaddr_in*>(addr)->sin_addr, sizeof(in_addr));
+    } else if (addr->sa_family == AF_INET6) {
+        memcpy(ip.addr, &reinterpret_cast<const sockaddr_in6*>(addr)->sin6_addr, sizeof(in6_addr));
+    } else {
+        return;
+    }
+    ip.family = addr->sa_family;
+    numIpAddresses++;
+}
+
+DnsEventReporter::DnsEventReporter(EventReporter* eventReporter) :
+        mEventReporter(eventReporter), mRing(new MpscRing<DnsEvent, kRingSize>()), mUnsent(0),
+        mRunning(false), mStopping(false), mQueued(0), mDropped(0), mQueuedToListener(0),
+        mUndelivered(0), mBatches(0) {
+    mBatch.reserve(kRingSize);
+}
+
+DnsEventReporter::~DnsEventReporter() {
+    stop();
+}
+
+int DnsEventReporter::start() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mRunning) {
+        return 0;
+    }
+    mStopping = false;
+    if (int ret = pthread_create(&mThread, NULL, DnsEventReporter::threadStart, this)) {
+        errno = ret;
+        return -1;
+    }
+    mRunning = true;
+    return 0;
+}
+
+void DnsEventReporter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mRunning) {
+            return;
+        }
+        mStopping = true;
+    }
+    mCv.notify_one();
+    pthread_join(mThread, NULL);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mRunning = false;
+}
+
+bool DnsEventReporter::report(const DnsEvent& event) {
+    if (!mRing->tryPush(event)) {
+        mDropped++;
+        return false;
+    }
+    mQueued++;
+    // Only the first event and a full batch need the reporter thread, so the lock is taken at most
+    // twice per batch.
+    const int64_t unsent = ++mUnsent;
+    if (unsent == 1 || unsent == static_cast<int64_t>(kBatchSize)) {
+        wakeUp();
+    }
+    return true;
+}
+
+void DnsEventReporter::wakeUp() {
+    // Taking the lock ensures that the reporter thread is either waiting, or will see mUnsent.
+    { std::lock_guard<std::mutex> lock(mLock); }
+    mCv.notify_one();
+}
+
+void* DnsEventReporter::threadStart(void* obj) {
+    reinterpret_cast<DnsEventReporter*>(obj)->run();
+    return NULL;
+}
+
+void DnsEventReporter::run() {
+    while (true) {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(mLock);
+            mCv.wait(lock, [this] { return mStopping || mUnsent > 0; });
+
+            // Wait for the rest of the burst, if any.
+            const auto full = [this] {
+                return mStopping || mUnsent >= static_cast<int64_t>(kBatchSize);
+            };
+            const auto deadline = std::chrono::steady_clock::now() + kMaxDelay;
+            int64_t unsent = mUnsent;
+            while (!full() && std::chrono::steady_clock::now() < deadline) {
+                mCv.wait_until(lock, std::min(deadline, std::chrono::steady_clock::now() +
+                                                                kIdleInterval), full);
+                if (mUnsent == unsent) {
+                    break;
+                }
+                unsent = mUnsent;
+            }
+            stopping = mStopping;
+        }
+
+        // Send whatever is queued, even if we are stopping.
+        flush();
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void DnsEventReporter::flush() {
+    mBatch.clear();
+    DnsEvent event;
+    while (mBatch.size() < kRingSize && mRing->tryPop(&event)) {
+        mBatch.push_back(event);
+    }
+    mUnsent -= mBatch.size();
+    if (mBatch.empty()) {
+        return;
+    }
+
+    // Aggregate here rather than on the resolver threads, and whether or not the listener is up.
+    MetricsAggregator* metrics = mEventReporter->getMetrics();
+    for (const DnsEvent& e : mBatch) {
+        metrics->recordEvent(e.netId, static_cast<MetricsAggregator::EventType>(e.eventType),
+                             e.returnCode, e.latencyMs, e.uid);
+    }
+
+    android::sp<INetdEventListener> listener = mEventReporter->getNetdEventListener();
+    if (listener == nullptr) {
+        ALOGW("Netd event listener is not available; dropping %zu DNS events.", mBatch.size());
+        mUndelivered += mBatch.size();
+        return;
+    }
+
+    if (mEventReporter->hasListenerCapability(INetd::EVENT_LISTENER_CAPABILITY_DNS_EVENTS)) {
+        if (sendBatch(listener, mBatch)) {
+            mQueuedToListener += mBatch.size();
+            mBatches++;
+            return;
+        }
+        // For example, the batch did not fit in a binder transaction.
+        ALOGW("onDnsEvents failed; sending %zu DNS events one at a time.", mBatch.size());
+    }
+
+    for (const DnsEvent& e : mBatch) {
+        if (sendEvent(listener, e)) {
+            mQueuedToListener++;
+        } else {
+            mUndelivered++;
+        }
+    }
+}
+
+bool DnsEventReporter::sendBatch(const android::sp<INetdEventListener>& listener,
+                                 const std::vector<DnsEvent>& events) {
+    const size_t n = events.size();
+    std::vector<int32_t> netIds(n), eventTypes(n), returnCodes(n), latenciesMs(n);
+    std::vector<int32_t> ipAddressesCounts(n), uids(n), ipAddressesOffsets(n + 1);
+    std::vector<String16> hostnames(n), ipAddresses;
+    for (size_t i = 0; i < n; i++) {
+        const DnsEvent& e = events[i];
+        netIds[i] = e.netId;
+        eventTypes[i] = e.eventType;
+        returnCodes[i] = e.returnCode;
+        latenciesMs[i] = e.latencyMs;
+        hostnames[i] = String16(e.hostname);
+        ipAddressesCounts[i] = e.ipAddressesCount;
+        uids[i] = e.uid;
+        ipAddressesOffsets[i] = ipAddresses.size();
+        appendIpAddresses(e, &ipAddresses);
+    }
+    ipAddressesOffsets[n] = ipAddresses.size();
+
+    return listener->onDnsEvents(netIds, eventTypes, returnCodes, latenciesMs, hostnames,
+                                 ipAddresses, ipAddressesOffsets, ipAddressesCounts,
+                                 uids).isOk();
+}
+
+bool DnsEventReporter::sendEvent(const android::sp<INetdEventListener>& listener,
+                                 const DnsEvent& event) {
+    std::vector<String16> ipAddresses;
+    appendIpAddresses(event, &ipAddresses);
+    return listener->onDnsEvent(event.netId, event.eventType, event.returnCode, event.latencyMs,
+                                String16(event.hostname), ipAddresses, event.ipAddressesCount,
+                                event.uid).isOk();
+}
+
+void DnsEventReporter::dump(DumpWriter& dw) {
+    dw.println("DNS event reporter: queued=%" PRIu64 " dropped=%" PRIu64
+               " queuedToListener=%" PRIu64 " undelivered=%" PRIu64 " batches=%" PRIu64
+               " pending=%zu batching=%s",
+               mQueued.load(), mDropped.load(), mQueuedToListener.load(), mUndelivered.load(),
+               mBatches.load(), mRing->size(),
+               mEventReporter->hasListenerCapability(INetd::EVENT_LISTENER_CAPABILITY_DNS_EVENTS)
+                       ? "true" : "false");
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_DNS_EVENT_REPORTER_H
+#define NETD_SERVER_DNS_EVENT_REPORTER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "MpscRing.h"
+#include "android/net/metrics/INetdEventListener.h"
+
+class DumpWriter;
+class EventReporter;
+
+/*
+ * A DNS lookup to be reported to the netd event listener. Fixed-size, so that resolver threads can
+ * record it without allocating; addresses are kept in binary form and only converted to strings on
+ * the reporter thread.
+ */
+struct DnsEvent {
+    static constexpr size_t kMaxHostnameLen = 256;
+    // Same as INetdEventListener::DNS_REPORTED_IP_ADDRESSES_LIMIT.
+    static constexpr size_t kMaxIpAddresses = 10;
+
+    int32_t netId;
+    int32_t eventType;
+    int32_t returnCode;
+    int32_t latencyMs;
+    int32_t uid;
+    // Total number of addresses returned, which may exceed numIpAddresses.
+    int32_t ipAddressesCount;
+    uint8_t numIpAddresses;
+    struct {
+        uint8_t family;
+        uint8_t addr[16];
+    } ipAddresses[kMaxIpAddresses];
+    char hostname[kMaxHostnameLen];
+
+    // Initializes an event that carries only metrics, as for REPORTING_LEVEL_METRICS.
+    void init(int32_t netId, int32_t eventType, int32_t returnCode, int32_t latencyMs);
+
+    // Adds the hostname and uid, as for REPORTING_LEVEL_FULL. The hostname may be NULL.
+    void setDetails(const char* hostname, int32_t uid);
+
+    // Counts an address in ipAddressesCount and, if there is room, records it.
+    void addIpAddress(const sockaddr* addr);
+};
+
+/*
+ * Reports DNS events to the netd event listener in batches, from a thread of its own.
+ *
+ * Resolver threads call report(), which copies the event into a lock-free ring and returns
+ * immediately. The reporter thread sleeps until an event is queued, and then drains the ring as
+ * soon as kBatchSize events are waiting, or once no event has been queued for kIdleInterval, so
+ * that a burst of lookups is sent together without holding back a lone one. No event waits longer
+ * than kMaxDelay. Everything found is sent with a single INetdEventListener::onDnsEvents() call,
+ * or with one onDnsEvent() call per event if that fails.
+ * INetdEventListener is oneway, so a listener that lacks onDnsEvents() drops the call without
+ * failing it; batches are only sent once the framework has declared, through
+ * INetd::setNetdEventListenerCapabilities(), that its listener implements onDnsEvents().
+ * If the ring is full the event is dropped and counted.
+ */
+class DnsEventReporter {
+public:
+    static constexpr size_t kRingSize = 512;
+    static constexpr size_t kBatchSize = 64;
+    static constexpr std::chrono::milliseconds kIdleInterval{20};
+    static constexpr std::chrono::milliseconds kMaxDelay{1000};
+
+    explicit DnsEventReporter(EventReporter* eventReporter);
+    ~DnsEventReporter();
+
+    int start();
+    void stop();
+
+    // Queues an event for reporting. Threadsafe and non-blocking. Returns false if it was dropped.
+    bool report(const DnsEvent& event);
+
+    void dump(DumpWriter& dw);
+
+private:
+    static void* threadStart(void* obj);
+    void run();
+
+    // Sends everything queued so far. Only called on the reporter thread, or after it has exited.
+    void flush();
+
+    // Send events to the listener. Return false if the binder transaction failed.
+    static bool sendBatch(const android::sp<android::net::metrics::INetdEventListener>& listener,
+                          const std::vector<DnsEvent>& events);
+    static bool sendEvent(const android::sp<android::net::metrics::INetdEventListener>& listener,
+                          const DnsEvent& event);
+
+    EventReporter* const mEventReporter;
+    // Large, so keep it off the stack and out of Controllers.
+    const std::unique_ptr<MpscRing<DnsEvent, kRingSize>> mRing;
+
+    // Only used to wake up the reporter thread; the ring itself is lock-free.
+    void wakeUp();
+
+    // Events pushed but not yet taken by flush(). Unlike the ring's size, every change is seen in
+    // order, so report() knows when the ring was empty and the reporter thread may be asleep. May
+    // briefly be negative, if flush() takes an event before report() counts it.
+    std::atomic<int64_t> mUnsent;
+
+    std::mutex mLock;
+    std::condition_variable mCv;
+    bool mRunning;
+    bool mStopping;
+    pthread_t mThread;
+    std::vector<DnsEvent> mBatch;  // Only used by flush().
+
+    std::atomic<uint64_t> mQueued;
+    std::atomic<uint64_t> mDropped;
+    // Only written by flush(). INetdEventListener is oneway, so a successful call only means that
+    // the events were queued for the listener, not that the listener processed them.
+    std::atomic<uint64_t> mQueuedToListener;
+    std::atomic<uint64_t> mUndelivered;
+    std::atomic<uint64_t> mBatches;
+};
+
+#endif  // NETD_SERVER_DNS_EVENT_REPORTER_H
@@ -0,0 +1,496 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include <resolv_netid.h>
+#include <resolv_params.h>
+#include <resolv_stats.h>
+
+#define LOG_TAG "Netd"
+
+#include <cutils/log.h>
+
+#include "DnsPrefetcher.h"
+#include "DumpWriter.h"
+
+constexpr std::chrono::minutes DnsPrefetcher::kHalfLife;
+constexpr double DnsPrefetcher::kMinScore;
+constexpr double DnsPrefetcher::kForgetScore;
+constexpr size_t DnsPrefetcher::kMaxNamesPerNetwork;
+constexpr double DnsPrefetcher::kPrefetchesPerMinute;
+constexpr std::chrono::seconds DnsPrefetcher::kMinLifetime;
+constexpr std::chrono::seconds DnsPrefetcher::kSlack;
+constexpr std::chrono::seconds DnsPrefetcher::kRetryDelay;
+constexpr std::chrono::minutes DnsPrefetcher::kFailureDelay;
+constexpr std::chrono::minutes DnsPrefetcher::kRelearnDelay;
+
+namespace {
+
+// Literal addresses never reach the DNS, so there is nothing to prefetch.
+bool isLiteralAddress(const char* name) {
+    uint8_t addr[sizeof(in6_addr)];
+    return inet_pton(AF_INET, name, addr) == 1 || inet_pton(AF_INET6, name, addr) == 1;
+}
+
+}  // namespace
+
+DnsPrefetcher::DnsPrefetcher() : mWakeupTime(Clock::time_point::max()), mRunning(false),
+        mStopping(false), mWoken(false), mIdle(false) {
+}
+
+DnsPrefetcher::~DnsPrefetcher() {
+    stop();
+}
+
+int DnsPrefetcher::start() {
+    std::lock_guard<std::mutex> lock(mThreadLock);
+    if (mRunning) {
+        return 0;
+    }
+    mStopping = false;
+    if (int ret = pthread_create(&mThread, NULL, DnsPrefetcher::threadStart, this)) {
+        errno = ret;
+        return -1;
+    }
+    mRunning = true;
+    return 0;
+}
+
+void DnsPrefetcher::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mThreadLock);
+        if (!mRunning) {
+            return;
+        }
+        mStopping = true;
+    }
+    mCv.notify_one();
+    pthread_join(mThread, NULL);
+
+    std::lock_guard<std::mutex> lock(mThreadLock);
+    mRunning = false;
+}
+
+void* DnsPrefetcher::threadStart(void* obj) {
+    reinterpret_cast<DnsPrefetcher*>(obj)->run();
+    return NULL;
+}
+
+void DnsPrefetcher::run() {
+    while (true) {
+        const Clock::time_point next = nextPrefetchTime(Clock::now());
+        {
+            std::unique_lock<std::mutex> lock(mThreadLock);
+            const auto woken = [this] { return mStopping || (mWoken && !mIdle); };
+            if (mIdle || next == Clock::time_point::max()) {
+                mCv.wait(lock, woken);
+            } else {
+                mCv.wait_until(lock, next, woken);
+            }
+            if (mStopping) {
+                return;
+            }
+            mWoken = false;
+            if (mIdle) {
+                continue;
+            }
+        }
+        for (const Prefetch& p : takeDuePrefetches(Clock::now())) {
+            prefetch(p);
+        }
+    }
+}
+
+void DnsPrefetcher::wakeUp() {
+    {
+        std::lock_guard<std::mutex> lock(mThreadLock);
+        mWoken = true;
+    }
+    mCv.notify_one();
+}
+
+void DnsPrefetcher::setDeviceIdle(bool idle) {
+    {
+        std::lock_guard<std::mutex> lock(mThreadLock);
+        if (mIdle == idle) {
+            return;
+        }
+        mIdle = idle;
+        mWoken = true;
+    }
+    mCv.notify_one();
+}
+
+void DnsPrefetcher::prefetch(const Prefetch& p) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = p.family;
+    hints.ai_flags = p.flags;
+    // Only affects the results, not the queries, but avoids getting each address three times.
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* result = NULL;
+    const uint64_t marker = getQueryMarker(p.netcontext.dns_netid);
+    int rv = android_getaddrinfofornetcontext(p.name.c_str(), NULL, &hints, &p.netcontext,
+            &result);
+    const bool cacheHit = (getQueryMarker(p.netcontext.dns_netid) == marker);
+    if (result) {
+        freeaddrinfo(result);
+    }
+    recordPrefetchResult(p, rv == 0, cacheHit, Clock::now());
+}
+
+uint64_t DnsPrefetcher::getQueryMarker(unsigned netId) {
+    int nscount;
+    sockaddr_storage servers[MAXNS];
+    int dcount;
+    char domains[MAXDNSRCH][MAXDNSRCHPATH];
+    __res_params params;
+    __res_stats stats[MAXNS];
+    if (android_net_res_stats_get_info_for_net(netId, &nscount, servers, &dcount, domains,
+            &params, stats) < 0) {
+        return 0;
+    }
+    // Every query sent upstream adds a sample to its server's ring. Hash where each ring is and
+    // what its newest sample is, so that a ring that wrapped around all the way still counts.
+    uint64_t marker = 14695981039346656037ULL;
+    auto mix = [&marker](uint64_t value) {
+        marker = (marker ^ value) * 1099511628211ULL;
+    };
+    for (int i = 0; i < nscount && i < MAXNS; i++) {
+        const __res_stats& s = stats[i];
+        mix(s.sample_count);
+        mix(s.sample_next);
+        // The ring holds params.max_samples samples.
+        if (s.sample_count > 0 && params.max_samples > 0) {
+            const int newest = (s.sample_next + params.max_samples - 1) % params.max_samples;
+            const __res_sample& sample = s.samples[newest];
+            mix(sample.at);
+            mix(sample.rtt);
+            mix(sample.rcode);
+        }
+    }
+    return marker;
+}
+
+bool DnsPrefetcher::wantsCacheResult(const char* name, int family, unsigned netId) {
+    if (name == nullptr) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mLock);
+    auto n = mNetworks.find(netId);
+    if (n == mNetworks.end()) {
+        return false;
+    }
+    auto it = n->second.entries.find(std::make_pair(std::string(name), family));
+    return it != n->second.entries.end() && isLearning(it->second, Clock::now());
+}
+
+void DnsPrefetcher::recordLookup(const char* name, int family, int flags,
+        const android_net_context& netcontext, CacheResult cacheResult) {
+    recordLookupAt(name, family, flags, netcontext, cacheResult, Clock::now());
+}
+
+void DnsPrefetcher::removeNetwork(unsigned netId) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mNetworks.erase(netId);
+}
+
+double DnsPrefetcher::decayedScore(const Entry& entry, Clock::time_point now) {
+    const double halfLives = std::chrono::duration<double>(now - entry.scoreTime).count() /
+            std::chrono::duration<double>(kHalfLife).count();
+    return entry.score * exp2(-halfLives);
+}
+
+bool DnsPrefetcher::isLearning(const Entry& entry, Clock::time_point now) {
+    if (decayedScore(entry, now) < kMinScore) {
+        return false;
+    }
+    if (entry.lifetime == Clock::duration::zero()) {
+        return true;
+    }
+    // Not prefetched at all, or already expiring within kSlack of when it is prefetched.
+    if (entry.lifetime <= kMinLifetime ||
+            (entry.lastRefill != Clock::time_point() &&
+             entry.lifetime - entry.minLifetime <= 2 * kSlack)) {
+        return false;
+    }
+    return true;
+}
+
+void DnsPrefetcher::recordCacheResult(Entry* entry, bool cacheHit, Clock::time_point now) {
+    // A miss bounds the lifetime from above even if an app lookup refilled the entry in between,
+    // but a hit only bounds it from below if none can have.
+    const bool known = (entry->lastRefill != Clock::time_point());
+    const Clock::duration age = now - entry->lastRefill;
+    if (!cacheHit) {
+        if (known) {
+            entry->lifetime = (entry->lifetime == Clock::duration::zero()) ?
+                    age : std::min(entry->lifetime, age);
+            // The TTL got shorter.
+            if (entry->minLifetime >= entry->lifetime) {
+                entry->minLifetime = Clock::duration::zero();
+            }
+        }
+        entry->lastRefill = now;
+        entry->probeInterval = Clock::duration::zero();
+    } else if (!known) {
+        // Still waiting for a refill.
+    } else if (entry->lastBlindLookup > entry->lastRefill + entry->minLifetime) {
+        // An app lookup made after the entry may have expired may have refilled it.
+        entry->lastRefill = Clock::time_point();
+    } else if (entry->lifetime != Clock::duration::zero() && age >= entry->lifetime) {
+        // Still cached at an age at which it had expired before, so the TTL got longer.
+        entry->minLifetime = age;
+        entry->lifetime = Clock::duration::zero();
+    } else {
+        entry->minLifetime = std::max(entry->minLifetime, age);
+    }
+}
+
+void DnsPrefetcher::scheduleNext(Entry* entry, Clock::time_point now) {
+    if (entry->lastRefill == Clock::time_point()) {
+        // The age of the entry is unknown until a prefetch refills it.
+        entry->probeInterval = (entry->probeInterval == Clock::duration::zero()) ?
+                Clock::duration(kMinLifetime) : 2 * entry->probeInterval;
+        entry->nextPrefetch = now + entry->probeInterval;
+        return;
+    }
+    Clock::duration age;
+    if (entry->lifetime == Clock::duration::zero()) {
+        // Not seen to expire yet.
+        age = std::max<Clock::duration>(kMinLifetime, 2 * entry->minLifetime);
+    } else if (entry->lifetime - entry->minLifetime > 2 * kSlack) {
+        age = (entry->minLifetime + entry->lifetime) / 2;
+    } else {
+        // Just before it expires, and then every kSlack until it has.
+        age = entry->minLifetime;
+    }
+    entry->nextPrefetch = std::max(entry->lastRefill + age, now + kSlack);
+}
+
+void DnsPrefetcher::forgetLifetime(Entry* entry) {
+    entry->lastRefill = Clock::time_point();
+    entry->minLifetime = Clock::duration::zero();
+    entry->lifetime = Clock::duration::zero();
+    entry->probeInterval = Clock::duration::zero();
+}
+
+bool DnsPrefetcher::isDue(const Entry& entry, Clock::time_point now) {
+    return !entry.inFlight && entry.nextPrefetch != Clock::time_point() &&
+            decayedScore(entry, now) >= kMinScore;
+}
+
+void DnsPrefetcher::evictLeastPopular(Network* network, Clock::time_point now) {
+    auto victim = network->entries.end();
+    double victimScore = 0;
+    for (auto it = network->entries.begin(); it != network->entries.end(); ++it) {
+        if (it->second.inFlight) {
+            continue;
+        }
+        const double score = decayedScore(it->second, now);
+        if (victim == network->entries.end() || score < victimScore) {
+            victim = it;
+            victimScore = score;
+        }
+    }
+    if (victim != network->entries.end()) {
+        network->entries.erase(victim);
+    }
+}
+
+void DnsPrefetcher::recordLookupAt(const char* name, int family, int flags,
+        const android_net_context& netcontext, CacheResult cacheResult, Clock::time_point now) {
+    if (name == nullptr || *name == '\0' || isLiteralAddress(name)) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mLock);
+    Network& network = mNetworks[netcontext.dns_netid];
+    const auto key = std::make_pair(std::string(name), family);
+    auto it = network.entries.find(key);
+    if (it == network.entries.end()) {
+        if (network.entries.size() >= kMaxNamesPerNetwork) {
+            evictLeastPopular(&network, now);
+        }
+        it = network.entries.insert(std::make_pair(key, Entry())).first;
+    }
+
+    Entry& entry = it->second;
+    entry.score = decayedScore(entry, now) + 1;
+    entry.scoreTime = now;
+    entry.flags = flags;
+    entry.netcontext = netcontext;
+
+    network.stats.lookups++;
+    if (cacheResult == CACHE_HIT ||
+            (cacheResult == CACHE_RESULT_UNKNOWN && entry.lastRefill != Clock::time_point() &&
+             now - entry.lastRefill < entry.minLifetime)) {
+        network.stats.cacheHits++;
+    }
+    if (cacheResult == CACHE_RESULT_UNKNOWN) {
+        entry.lastBlindLookup = now;
+    } else {
+        recordCacheResult(&entry, cacheResult == CACHE_HIT, now);
+    }
+    // Start learning how long the entry lasts, unless it is known to be too short.
+    if (entry.nextPrefetch == Clock::time_point() && !entry.inFlight &&
+            (entry.lifetime == Clock::duration::zero() || entry.lifetime > kMinLifetime)) {
+        entry.nextPrefetch = now;
+    }
+
+    // The prefetcher thread only needs to know if it is sleeping past the entry's prefetch.
+    const bool wake = isDue(entry, now) && entry.nextPrefetch < mWakeupTime;
+    lock.unlock();
+    if (wake) {
+        wakeUp();
+    }
+}
+
+std::vector<DnsPrefetcher::Prefetch> DnsPrefetcher::takeDuePrefetches(Clock::time_point now) {
+    std::vector<Prefetch> due;
+    std::lock_guard<std::mutex> lock(mLock);
+    for (auto n = mNetworks.begin(); n != mNetworks.end();) {
+        Network& network = n->second;
+        if (network.budgetTime != Clock::time_point()) {
+            const double minutes = std::chrono::duration<double>(now - network.budgetTime).count()
+                    / 60;
+            network.budget = std::min(kPrefetchesPerMinute,
+                    network.budget + minutes * kPrefetchesPerMinute);
+        }
+        network.budgetTime = now;
+
+        for (auto it = network.entries.begin(); it != network.entries.end();) {
+            Entry& entry = it->second;
+            const double score = decayedScore(entry, now);
+            if (score < kForgetScore && !entry.inFlight) {
+                it = network.entries.erase(it);
+                continue;
+            }
+            if (isDue(entry, now) && entry.nextPrefetch <= now) {
+                if (network.budget >= 1) {
+                    network.budget -= 1;
+                    // Seemed too short-lived to prefetch, which may have been a false miss.
+                    if (entry.lifetime != Clock::duration::zero() &&
+                            entry.lifetime <= kMinLifetime) {
+                        forgetLifetime(&entry);
+                    }
+                    entry.inFlight = true;
+                    due.push_back({ n->first, it->first.first, it->first.second, entry.flags,
+                            entry.netcontext });
+                } else {
+                    network.stats.overBudget++;
+                    entry.nextPrefetch = now + kRetryDelay;
+                }
+            }
+            ++it;
+        }
+
+        if (network.entries.empty()) {
+            n = mNetworks.erase(n);
+        } else {
+            ++n;
+        }
+    }
+    return due;
+}
+
+DnsPrefetcher::Clock::time_point DnsPrefetcher::nextPrefetchTime(Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Clock::time_point next = Clock::time_point::max();
+    for (const auto& n : mNetworks) {
+        for (const auto& it : n.second.entries) {
+            if (isDue(it.second, now)) {
+                next = std::min(next, it.second.nextPrefetch);
+            }
+        }
+    }
+    mWakeupTime = next;
+    return next;
+}
+
+void DnsPrefetcher::recordPrefetchResult(const Prefetch& prefetch, bool success, bool cacheHit,
+        Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto n = mNetworks.find(prefetch.netId);
+    if (n == mNetworks.end()) {
+        return;
+    }
+    Network& network = n->second;
+    network.stats.prefetches++;
+    auto it = network.entries.find(std::make_pair(prefetch.name, prefetch.family));
+    if (it == network.entries.end()) {
+        return;
+    }
+
+    Entry& entry = it->second;
+    entry.inFlight = false;
+    if (!success) {
+        entry.nextPrefetch = now + kFailureDelay;
+        return;
+    }
+
+    if (!cacheHit) {
+        network.stats.refills++;
+    }
+    recordCacheResult(&entry, cacheHit, now);
+    if (entry.lifetime != Clock::duration::zero() && entry.lifetime <= kMinLifetime) {
+        entry.nextPrefetch = now + kRelearnDelay;
+    } else {
+        scheduleNext(&entry, now);
+    }
+}
+
+DnsPrefetcher::Stats DnsPrefetcher::getStats(unsigned netId) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto n = mNetworks.find(netId);
+    return (n != mNetworks.end()) ? n->second.stats : Stats();
+}
+
+size_t DnsPrefetcher::getNumNames(unsigned netId) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto n = mNetworks.find(netId);
+    return (n != mNetworks.end()) ? n->second.entries.size() : 0;
+}
+
+void DnsPrefetcher::dump(DumpWriter& dw) {
+    bool idle;
+    {
+        std::lock_guard<std::mutex> lock(mThreadLock);
+        idle = mIdle;
+    }
+    std::lock_guard<std::mutex> lock(mLock);
+    dw.println("DNS prefetcher:%s", idle ? " (device idle)" : "");
+    dw.incIndent();
+    for (const auto& n : mNetworks) {
+        const Stats& s = n.second.stats;
+        const double hitRate = s.lookups ? 100.0 * s.cacheHits / s.lookups : 0;
+        dw.println("netId=%u: names=%zu lookups=%" PRIu64 " cache hit rate=%.1f%% prefetches=%"
+                   PRIu64 " refills=%" PRIu64 " over budget=%" PRIu64, n.first,
+                   n.second.entries.size(), s.lookups, hitRate, s.prefetches, s.refills,
+                   s.overBudget);
+    }
+    dw.decIndent();
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_DNS_PREFETCHER_H
+#define NETD_SERVER_DNS_PREFETCHER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <resolv_netid.h>  // struct android_net_context
+
+class DumpWriter;
+
+/*
+ * Keeps popular names in the resolver cache, so that apps do not pay an upstream round trip when
+ * an entry they use often has just expired.
+ *
+ * DnsProxyListener reports every getaddrinfo lookup, which updates a popularity score for its
+ * (netId, name, family) that decays over time. Bionic does not expose TTLs or cache hits, so the
+ * prefetcher learns how long each popular name lasts in the cache from whether lookups of it sent
+ * a query upstream (see getQueryMarker()): a lookup that did refilled an expired entry, and one
+ * that did not found it still cached. The prefetcher thread probes at doubling ages until an entry
+ * expires, and then narrows down the age at which it expires from both sides. Bionic only goes
+ * upstream once an entry has expired, so once that age is known the prefetcher repeats the lookup
+ * just before it, and every kSlack after that until the entry is refilled, so that it is refilled
+ * within kSlack of expiring, before the next app asks for it.
+ *
+ * App lookups may refill entries too. Finding out whether they did is too expensive to do for
+ * every lookup, so DnsProxyListener only does it for names that wantsCacheResult(), i.e., popular
+ * names whose lifetime is still being learned. Once it is known, app lookups only cost a map
+ * lookup here.
+ *
+ * Concurrent lookups of other names can make a hit look like a miss, and so make an entry look
+ * too short-lived to prefetch. Such entries are learned again after kRelearnDelay.
+ *
+ * Prefetches are limited by a per-network budget, and the number of names tracked per network is
+ * bounded. Lookup, cache hit and prefetch counts are kept per network and shown in dumpsys.
+ *
+ * The prefetcher thread sleeps until the next prefetch is due, and an app lookup only wakes it if
+ * it makes a prefetch due sooner than that. While no popular name is tracked, or while the device
+ * is idle, it does not wake up at all.
+ */
+class DnsPrefetcher {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Lookups of a name count for half as much after this long.
+    static constexpr std::chrono::minutes kHalfLife{10};
+    // Names are prefetched once their score reaches kMinScore, and forgotten below kForgetScore.
+    static constexpr double kMinScore = 3.0;
+    static constexpr double kForgetScore = 0.25;
+    static constexpr size_t kMaxNamesPerNetwork = 128;
+    // Prefetches per network per minute. Unused budget accumulates up to one minute's worth.
+    static constexpr double kPrefetchesPerMinute = 30;
+    // Cache lifetimes shorter than this are not worth prefetching for. Also the first age at which
+    // an entry is probed.
+    static constexpr std::chrono::seconds kMinLifetime{10};
+    // How precisely the age at which an entry expires is learned, and how long a prefetch that
+    // found the entry still cached after that age is postponed. Matches the resolver cache's
+    // one-second granularity.
+    static constexpr std::chrono::seconds kSlack{1};
+    // How long a prefetch over budget is postponed.
+    static constexpr std::chrono::seconds kRetryDelay{5};
+    // How long a name whose lookup failed is not prefetched. Failures are not cached.
+    static constexpr std::chrono::minutes kFailureDelay{10};
+    // How long a name that seemed too short-lived to prefetch is left alone before its lifetime
+    // is learned again.
+    static constexpr std::chrono::minutes kRelearnDelay{10};
+
+    // Whether an app lookup was answered from the cache, if DnsProxyListener found out.
+    enum CacheResult { CACHE_RESULT_UNKNOWN, CACHE_HIT, CACHE_MISS };
+
+    struct Prefetch {
+        unsigned netId;
+        std::string name;
+        int family;
+        int flags;
+        android_net_context netcontext;
+    };
+
+    struct Stats {
+        // App lookups of tracked names, and how many of them are known to have been answered
+        // from the cache: either DnsProxyListener found out, or the entry was refilled recently
+        // enough that it cannot have expired yet.
+        uint64_t lookups = 0;
+        uint64_t cacheHits = 0;
+        // Prefetches sent, and how many of them refilled an expired entry.
+        uint64_t prefetches = 0;
+        uint64_t refills = 0;
+        // Prefetches that were postponed because the network's budget was used up.
+        uint64_t overBudget = 0;
+    };
+
+    DnsPrefetcher();
+    ~DnsPrefetcher();
+
+    int start();
+    void stop();
+
+    // Whether the next app lookup of |name| should find out if it is answered from the cache.
+    // Threadsafe.
+    bool wantsCacheResult(const char* name, int family, unsigned netId);
+
+    // Records a successful getaddrinfo lookup made on behalf of an app. Threadsafe.
+    void recordLookup(const char* name, int family, int flags,
+            const android_net_context& netcontext, CacheResult cacheResult);
+
+    // Returns a value that changes whenever the resolver sends a query upstream on |netId|. A
+    // lookup whose marker is the same before and after it was answered from the cache. Queries for
+    // other names made at the same time also change the marker, so concurrent lookups may be
+    // taken for cache misses. Copies all of the network's resolver stats.
+    static uint64_t getQueryMarker(unsigned netId);
+
+    // Forgets everything about a network that was destroyed. Threadsafe.
+    void removeNetwork(unsigned netId);
+
+    // Stops prefetching while the device is idle, when apps cannot use the network anyway.
+    // Prefetches that became due in the meantime are made when it is no longer idle. Threadsafe.
+    void setDeviceIdle(bool idle);
+
+    void dump(DumpWriter& dw);
+
+    // The prefetcher's logic, with time passed in explicitly. Public for testing.
+    void recordLookupAt(const char* name, int family, int flags,
+            const android_net_context& netcontext, CacheResult cacheResult,
+            Clock::time_point now);
+    std::vector<Prefetch> takeDuePrefetches(Clock::time_point now);
+    // When the next prefetch is due, or Clock::time_point::max() if none is scheduled.
+    Clock::time_point nextPrefetchTime(Clock::time_point now);
+    void recordPrefetchResult(const Prefetch& prefetch, bool success, bool cacheHit,
+            Clock::time_point now);
+    Stats getStats(unsigned netId);
+    size_t getNumNames(unsigned netId);
+
+private:
+    struct Entry {
+        double score = 0;
+        Clock::time_point scoreTime;
+        int flags = 0;
+        android_net_context netcontext;
+        // The last app lookup whose cache result is unknown.
+        Clock::time_point lastBlindLookup;
+        // When the entry was last refilled. Zero if it is not known, or if an app lookup may have
+        // refilled it since.
+        Clock::time_point lastRefill;
+        // The longest age at which the entry was seen still cached, and the shortest age at which
+        // it was seen expired. The latter is zero if it has not been seen to expire yet.
+        Clock::duration minLifetime = Clock::duration::zero();
+        Clock::duration lifetime = Clock::duration::zero();
+        // Until a prefetch refills the entry, how long to wait between prefetches.
+        Clock::duration probeInterval = Clock::duration::zero();
+        // When to prefetch next. Zero if no prefetch is scheduled.
+        Clock::time_point nextPrefetch;
+        bool inFlight = false;
+    };
+
+    struct Network {
+        std::map<std::pair<std::string, int>, Entry> entries;
+        Stats stats;
+        double budget = kPrefetchesPerMinute;
+        Clock::time_point budgetTime;
+    };
+
+    static double decayedScore(const Entry& entry, Clock::time_point now);
+    static bool isLearning(const Entry& entry, Clock::time_point now);
+    static void recordCacheResult(Entry* entry, bool cacheHit, Clock::time_point now);
+    static void scheduleNext(Entry* entry, Clock::time_point now);
+    static void forgetLifetime(Entry* entry);
+    static void evictLeastPopular(Network* network, Clock::time_point now);
+
+    static bool isDue(const Entry& entry, Clock::time_point now);
+
+    static void* threadStart(void* obj);
+    void run();
+    void prefetch(const Prefetch& prefetch);
+    void wakeUp();
+
+    std::mutex mLock;
+    std::map<unsigned, Network> mNetworks;
+    // When the prefetcher thread last planned to wake up.
+    Clock::time_point mWakeupTime;
+
+    // Protects the thread state below. Also used to wake up the prefetcher thread.
+    std::mutex mThreadLock;
+    std::condition_variable mCv;
+    bool mRunning;
+    bool mStopping;
+    bool mWoken;
+    bool mIdle;
+    pthread_t mThread;
+};
+
+#endif  // NETD_SERVER_DNS_PREFETCHER_H
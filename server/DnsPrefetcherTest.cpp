@@ -0,0 +1,317 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * DnsPrefetcherTest.cpp - unit tests for DnsPrefetcher.cpp
+ */
+
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "DnsPrefetcher.h"
+
+using std::chrono::minutes;
+using std::chrono::seconds;
+
+namespace {
+
+const unsigned kNetId = 100;
+
+}  // namespace
+
+class DnsPrefetcherTest : public ::testing::Test {
+protected:
+    typedef DnsPrefetcher::Clock Clock;
+
+    DnsPrefetcherTest() : mNow(Clock::now()) {
+        mNetContext = { kNetId, kNetId, kNetId, kNetId, 0 };
+    }
+
+    // An app looks the name up, which fills the cache if the entry expired. Like
+    // DnsProxyListener, only finds out whether it did if the prefetcher wants to know.
+    void lookup(const char* name, unsigned netId = kNetId) {
+        android_net_context netcontext = mNetContext;
+        netcontext.dns_netid = netId;
+        DnsPrefetcher::CacheResult cacheResult = DnsPrefetcher::CACHE_RESULT_UNKNOWN;
+        if (mPrefetcher.wantsCacheResult(name, AF_UNSPEC, netId)) {
+            mCacheResults++;
+            cacheResult = isCached(name) ? DnsPrefetcher::CACHE_HIT : DnsPrefetcher::CACHE_MISS;
+        }
+        if (name != nullptr) {
+            if (isCached(name)) {
+                mAppHits++;
+            } else {
+                mFilled[name] = mNow;
+            }
+        }
+        mPrefetcher.recordLookupAt(name, AF_UNSPEC, AI_ADDRCONFIG, netcontext, cacheResult, mNow);
+    }
+
+    // Makes the name popular enough to be prefetched.
+    void makePopular(const char* name, unsigned netId = kNetId) {
+        for (int i = 0; i <= DnsPrefetcher::kMinScore; i++) {
+            lookup(name, netId);
+        }
+        mPopular.push_back(name);
+    }
+
+    std::vector<DnsPrefetcher::Prefetch> takeDue() {
+        return mPrefetcher.takeDuePrefetches(mNow);
+    }
+
+    bool isCached(const std::string& name) {
+        auto it = mFilled.find(name);
+        return it != mFilled.end() && mNow - it->second < mLifetime;
+    }
+
+    // Runs the prefetcher for |duration|, answering its lookups from a cache whose entries last
+    // mLifetime, while an app keeps looking up the popular names every 45 seconds. Records how long
+    // after its entry expired each prefetch refilled it.
+    void run(Clock::duration duration) {
+        const Clock::time_point end = mNow + duration;
+        while (mNow < end) {
+            mNow += seconds(1);
+            if (++mTicks % 45 == 0) {
+                for (const std::string& name : mPopular) {
+                    lookup(name.c_str());
+                }
+            }
+            for (const DnsPrefetcher::Prefetch& p : takeDue()) {
+                mPrefetches++;
+                const bool hit = isCached(p.name);
+                if (!hit) {
+                    mLateness.push_back(mNow - (mFilled[p.name] + mLifetime));
+                    mFilled[p.name] = mNow;
+                }
+                mPrefetcher.recordPrefetchResult(p, true, hit, mNow);
+            }
+        }
+    }
+
+    DnsPrefetcher mPrefetcher;
+    Clock::time_point mNow;
+    android_net_context mNetContext;
+    Clock::duration mLifetime = seconds(60);
+    std::vector<std::string> mPopular;
+    std::map<std::string, Clock::time_point> mFilled;
+    size_t mTicks = 0;
+    size_t mPrefetches = 0;
+    size_t mCacheResults = 0;
+    size_t mAppHits = 0;
+    std::vector<Clock::duration> mLateness;
+};
+
+TEST_F(DnsPrefetcherTest, TestRefillsPopularNameAsSoonAsItExpires) {
+    makePopular("www.example.com");
+    std::vector<DnsPrefetcher::Prefetch> due = takeDue();
+    ASSERT_EQ(1U, due.size());
+    EXPECT_EQ(kNetId, due[0].netId);
+    EXPECT_EQ("www.example.com", due[0].name);
+    EXPECT_EQ(AF_UNSPEC, due[0].family);
+    EXPECT_EQ(AI_ADDRCONFIG, due[0].flags);
+    EXPECT_EQ(kNetId, due[0].netcontext.dns_netid);
+
+    // Nothing else is sent while the prefetch is in flight.
+    EXPECT_TRUE(takeDue().empty());
+    mPrefetcher.recordPrefetchResult(due[0], true, true, mNow);
+
+    // Once the lifetime is learned, every refill happens within kSlack of the entry expiring, and
+    // costs at most two prefetches.
+    run(minutes(30));
+    ASSERT_GE(mLateness.size(), 10U);
+    const size_t learned = mLateness.size();
+    const size_t learnedPrefetches = mPrefetches;
+    for (size_t i = learned - 5; i < learned; i++) {
+        EXPECT_LE(mLateness[i], DnsPrefetcher::kSlack);
+    }
+    run(minutes(10));
+    EXPECT_EQ(10U, mLateness.size() - learned);
+    EXPECT_LE(mPrefetches - learnedPrefetches, 20U);
+    for (size_t i = learned; i < mLateness.size(); i++) {
+        EXPECT_LE(mLateness[i], DnsPrefetcher::kSlack);
+    }
+
+    DnsPrefetcher::Stats stats = mPrefetcher.getStats(kNetId);
+    EXPECT_EQ(4U + 40 * 60 / 45, stats.lookups);
+    EXPECT_EQ(mPrefetches + 1, stats.prefetches);
+    EXPECT_EQ(mLateness.size(), stats.refills);
+    // Hits are never overcounted, and once the lifetime is learned almost every app lookup is
+    // counted as one.
+    EXPECT_LE(stats.cacheHits, mAppHits);
+    EXPECT_GE(stats.cacheHits, stats.lookups * 3 / 4);
+}
+
+TEST_F(DnsPrefetcherTest, TestOnlyAsksForCacheResultsWhileLearning) {
+    // Unknown names and names that are not popular yet are not worth finding out about.
+    EXPECT_FALSE(mPrefetcher.wantsCacheResult("www.example.com", AF_UNSPEC, kNetId));
+    lookup("www.example.com");
+    EXPECT_FALSE(mPrefetcher.wantsCacheResult("www.example.com", AF_UNSPEC, kNetId));
+    makePopular("www.example.com");
+    EXPECT_TRUE(mPrefetcher.wantsCacheResult("www.example.com", AF_UNSPEC, kNetId));
+    EXPECT_FALSE(mPrefetcher.wantsCacheResult("www.example.com", AF_INET, kNetId));
+    EXPECT_FALSE(mPrefetcher.wantsCacheResult("www.example.com", AF_UNSPEC, kNetId + 1));
+
+    // Once the lifetime is known, app lookups no longer need to find out.
+    run(minutes(30));
+    EXPECT_FALSE(mPrefetcher.wantsCacheResult("www.example.com", AF_UNSPEC, kNetId));
+    const size_t cacheResults = mCacheResults;
+    run(minutes(10));
+    EXPECT_EQ(cacheResults, mCacheResults);
+}
+
+TEST_F(DnsPrefetcherTest, TestRelearnsWhenLifetimeChanges) {
+    makePopular("www.example.com");
+    run(minutes(30));
+    mLifetime = seconds(300);
+    const size_t before = mLateness.size();
+    run(minutes(120));
+    // Most refills are the prefetcher's own again, not the app's.
+    const size_t n = mLateness.size();
+    ASSERT_GE(n - before, 20U);
+    for (size_t i = n - 5; i < n; i++) {
+        EXPECT_LE(mLateness[i], DnsPrefetcher::kSlack);
+    }
+}
+
+TEST_F(DnsPrefetcherTest, TestStopsForShortLifetimes) {
+    mLifetime = seconds(5);
+    makePopular("www.example.com");
+    run(minutes(5));
+    const size_t prefetches = mPrefetches;
+    EXPECT_LE(prefetches, 5U);
+
+    // App lookups do not start it again.
+    lookup("www.example.com");
+    run(minutes(5));
+    EXPECT_EQ(prefetches, mPrefetches);
+}
+
+TEST_F(DnsPrefetcherTest, TestRelearnsAfterFalseMiss) {
+    makePopular("www.example.com");
+    std::vector<DnsPrefetcher::Prefetch> due = takeDue();
+    ASSERT_EQ(1U, due.size());
+    mFilled["www.example.com"] = mNow;
+    mPrefetcher.recordPrefetchResult(due[0], true, false, mNow);
+
+    // A lookup of another name happens at the same time as the first probe, so the probe looks
+    // like a miss and the entry seems too short-lived to prefetch.
+    mNow += DnsPrefetcher::kMinLifetime;
+    due = takeDue();
+    ASSERT_EQ(1U, due.size());
+    mPrefetcher.recordPrefetchResult(due[0], true, false, mNow);
+    EXPECT_FALSE(mPrefetcher.wantsCacheResult("www.example.com", AF_UNSPEC, kNetId));
+
+    // It is left alone for a while, but then learned again.
+    run(DnsPrefetcher::kRelearnDelay - seconds(1));
+    EXPECT_EQ(0U, mPrefetches);
+    run(minutes(30));
+    const size_t n = mLateness.size();
+    ASSERT_GE(n, 10U);
+    for (size_t i = n - 5; i < n; i++) {
+        EXPECT_LE(mLateness[i], DnsPrefetcher::kSlack);
+    }
+}
+
+TEST_F(DnsPrefetcherTest, TestFailedPrefetchesArePostponed) {
+    makePopular("www.example.com");
+    std::vector<DnsPrefetcher::Prefetch> due = takeDue();
+    ASSERT_EQ(1U, due.size());
+    mPrefetcher.recordPrefetchResult(due[0], false, false, mNow);
+    mNow += DnsPrefetcher::kFailureDelay - seconds(1);
+    makePopular("www.example.com");
+    EXPECT_TRUE(takeDue().empty());
+    mNow += seconds(1);
+    EXPECT_EQ(1U, takeDue().size());
+}
+
+TEST_F(DnsPrefetcherTest, TestIgnoresUnpopularAndLiteralNames) {
+    // Two lookups are not enough to be worth prefetching.
+    lookup("rare.example.com");
+    mNow += seconds(60);
+    lookup("rare.example.com");
+    EXPECT_TRUE(takeDue().empty());
+
+    lookup("192.0.2.1");
+    lookup("2001:db8::1");
+    lookup("");
+    lookup(nullptr);
+    EXPECT_EQ(1U, mPrefetcher.getNumNames(kNetId));
+
+    // Names that are no longer looked up are eventually forgotten.
+    mNow += minutes(60);
+    EXPECT_TRUE(takeDue().empty());
+    EXPECT_EQ(0U, mPrefetcher.getNumNames(kNetId));
+}
+
+TEST_F(DnsPrefetcherTest, TestBudget) {
+    const size_t kBudget = DnsPrefetcher::kPrefetchesPerMinute;
+    for (size_t i = 0; i < kBudget + 5; i++) {
+        makePopular(("host" + std::to_string(i) + ".example.com").c_str());
+    }
+    // Another network has a budget of its own.
+    makePopular("www.example.com", kNetId + 1);
+
+    std::vector<DnsPrefetcher::Prefetch> due = takeDue();
+    EXPECT_EQ(kBudget + 1, due.size());
+    EXPECT_EQ(5U, mPrefetcher.getStats(kNetId).overBudget);
+
+    // The postponed names are retried once the budget has refilled.
+    mNow += DnsPrefetcher::kRetryDelay;
+    EXPECT_EQ(2U, takeDue().size());
+}
+
+TEST_F(DnsPrefetcherTest, TestNamesPerNetworkAreBounded) {
+    for (size_t i = 0; i < DnsPrefetcher::kMaxNamesPerNetwork + 10; i++) {
+        lookup(("host" + std::to_string(i) + ".example.com").c_str());
+    }
+    EXPECT_EQ(DnsPrefetcher::kMaxNamesPerNetwork, mPrefetcher.getNumNames(kNetId));
+    lookup("www.example.com", kNetId + 1);
+    EXPECT_EQ(1U, mPrefetcher.getNumNames(kNetId + 1));
+}
+
+TEST_F(DnsPrefetcherTest, TestNextPrefetchTime) {
+    // Nothing to wake up for.
+    EXPECT_EQ(Clock::time_point::max(), mPrefetcher.nextPrefetchTime(mNow));
+    lookup("www.example.com");
+    EXPECT_EQ(Clock::time_point::max(), mPrefetcher.nextPrefetchTime(mNow));
+
+    // Due as soon as the name is popular.
+    makePopular("www.example.com");
+    EXPECT_EQ(mNow, mPrefetcher.nextPrefetchTime(mNow));
+
+    // Not while the prefetch is in flight, and then at the first probe.
+    std::vector<DnsPrefetcher::Prefetch> due = takeDue();
+    ASSERT_EQ(1U, due.size());
+    EXPECT_EQ(Clock::time_point::max(), mPrefetcher.nextPrefetchTime(mNow));
+    mPrefetcher.recordPrefetchResult(due[0], true, true, mNow);
+    EXPECT_EQ(mNow + DnsPrefetcher::kMinLifetime, mPrefetcher.nextPrefetchTime(mNow));
+}
+
+TEST_F(DnsPrefetcherTest, TestRemoveNetwork) {
+    makePopular("www.example.com");
+    makePopular("www.example.com", kNetId + 1);
+    mPrefetcher.removeNetwork(kNetId);
+    EXPECT_EQ(0U, mPrefetcher.getNumNames(kNetId));
+    EXPECT_EQ(0U, mPrefetcher.getStats(kNetId).lookups);
+
+    std::vector<DnsPrefetcher::Prefetch> due = takeDue();
+    ASSERT_EQ(1U, due.size());
+    EXPECT_EQ(kNetId + 1, due[0].netId);
+}
@@ -37,11 +37,14 @@
 #include <vector>
 
 #include <cutils/log.h>
-#include <utils/String16.h>
 #include <sysutils/SocketClient.h>
 
 #include "Fwmark.h"
+#include "DnsAddressSorter.h"
+#include "DnsEventReporter.h"
+#include "DnsPrefetcher.h"
 #include "DnsProxyListener.h"
+#include "DnsResponseEncoder.h"
 #include "NetdConstants.h"
 #include "NetworkController.h"
 #include "ResponseCode.h"
@@ -49,12 +52,17 @@
 #include "android/net/metrics/INetdEventListener.h"
 #include "QtiDataController.h"
 
-using android::String16;
 using android::net::metrics::INetdEventListener;
 
-DnsProxyListener::DnsProxyListener(const NetworkController* netCtrl, EventReporter* eventReporter) :
-        FrameworkListener("dnsproxyd"), mNetCtrl(netCtrl), mEventReporter(eventReporter) {
+DnsProxyListener::DnsProxyListener(const NetworkController* netCtrl, EventReporter* eventReporter,
+                                   DnsEventReporter* dnsEventReporter,
+                                   DnsPrefetcher* dnsPrefetcher,
+                                   DnsAddressSorter* dnsAddressSorter) :
+        FrameworkListener("dnsproxyd"), mNetCtrl(netCtrl), mEventReporter(eventReporter),
+        mDnsEventReporter(dnsEventReporter), mDnsPrefetcher(dnsPrefetcher),
+        mDnsAddressSorter(dnsAddressSorter) {
     registerCmd(new GetAddrInfoCmd(this));
+    registerCmd(new GetAddrInfoCmd(this, true));
     registerCmd(new GetHostByAddrCmd(this));
     registerCmd(new GetHostByNameCmd(this));
 }
@@ -62,14 +70,15 @@ DnsProxyListener::DnsProxyListener(const NetworkController* netCtrl, EventReport
 DnsProxyListener::GetAddrInfoHandler::GetAddrInfoHandler(
         SocketClient *c, char* host, char* service, struct addrinfo* hints,
         const struct android_net_context& netcontext, const int reportingLevel,
-        const android::sp<android::net::metrics::INetdEventListener>& netdEventListener)
+        DnsEventReporter* dnsEventReporter, DnsPrefetcher* dnsPrefetcher)
         : mClient(c),
           mHost(host),
           mService(service),
           mHints(hints),
           mNetContext(netcontext),
           mReportingLevel(reportingLevel),
-          mNetdEventListener(netdEventListener) {
+          mDnsEventReporter(dnsEventReporter),
+          mDnsPrefetcher(dnsPrefetcher) {
 }
 
 DnsProxyListener::GetAddrInfoHandler::~GetAddrInfoHandler() {
@@ -93,81 +102,6 @@ void* DnsProxyListener::GetAddrInfoHandler::threadStart(void* obj) {
     return NULL;
 }
 
-static bool sendBE32(SocketClient* c, uint32_t data) {
-    uint32_t be_data = htonl(data);
-    return c->sendData(&be_data, sizeof(be_data)) == 0;
-}
-
-// Sends 4 bytes of big-endian length, followed by the data.
-// Returns true on success.
-static bool sendLenAndData(SocketClient* c, const int len, const void* data) {
-    return sendBE32(c, len) && (len == 0 || c->sendData(data, len) == 0);
-}
-
-// Returns true on success
-static bool sendhostent(SocketClient *c, struct hostent *hp) {
-    bool success = true;
-    int i;
-    if (hp->h_name != NULL) {
-        success &= sendLenAndData(c, strlen(hp->h_name)+1, hp->h_name);
-    } else {
-        success &= sendLenAndData(c, 0, "") == 0;
-    }
-
-    for (i=0; hp->h_aliases[i] != NULL; i++) {
-        success &= sendLenAndData(c, strlen(hp->h_aliases[i])+1, hp->h_aliases[i]);
-    }
-    success &= sendLenAndData(c, 0, ""); // null to indicate we're done
-
-    uint32_t buf = htonl(hp->h_addrtype);
-    success &= c->sendData(&buf, sizeof(buf)) == 0;
-
-    buf = htonl(hp->h_length);
-    success &= c->sendData(&buf, sizeof(buf)) == 0;
-
-    for (i=0; hp->h_addr_list[i] != NULL; i++) {
-        success &= sendLenAndData(c, 16, hp->h_addr_list[i]);
-    }
-    success &= sendLenAndData(c, 0, ""); // null to indicate we're done
-    return success;
-}
-
-static bool sendaddrinfo(SocketClient* c, struct addrinfo* ai) {
-    // struct addrinfo {
-    //      int     ai_flags;       /* AI_PASSIVE, AI_CANONNAME, AI_NUMERICHOST */
-    //      int     ai_family;      /* PF_xxx */
-    //      int     ai_socktype;    /* SOCK_xxx */
-    //      int     ai_protocol;    /* 0 or IPPROTO_xxx for IPv4 and IPv6 */
-    //      socklen_t ai_addrlen;   /* length of ai_addr */
-    //      char    *ai_canonname;  /* canonical name for hostname */
-    //      struct  sockaddr *ai_addr;      /* binary address */
-    //      struct  addrinfo *ai_next;      /* next structure in linked list */
-    // };
-
-    // Write the struct piece by piece because we might be a 64-bit netd
-    // talking to a 32-bit process.
-    bool success =
-            sendBE32(c, ai->ai_flags) &&
-            sendBE32(c, ai->ai_family) &&
-            sendBE32(c, ai->ai_socktype) &&
-            sendBE32(c, ai->ai_protocol);
-    if (!success) {
-        return false;
-    }
-
-    // ai_addrlen and ai_addr.
-    if (!sendLenAndData(c, ai->ai_addrlen, ai->ai_addr)) {
-        return false;
-    }
-
-    // strlen(ai_canonname) and ai_canonname.
-    if (!sendLenAndData(c, ai->ai_canonname ? strlen(ai->ai_canonname) + 1 : 0, ai->ai_canonname)) {
-        return false;
-    }
-
-    return true;
-}
-
 void DnsProxyListener::GetAddrInfoHandler::run() {
     if (DBG) {
         ALOGD("GetAddrInfoHandler, now for %s / %s / {%u,%u,%u,%u,%u}", mHost, mService,
@@ -177,81 +111,215 @@ void DnsProxyListener::GetAddrInfoHandler::run() {
     }
 
     struct addrinfo* result = NULL;
+    const int family = mHints ? mHints->ai_family : AF_UNSPEC;
+    const bool wantsCacheResult = mDnsPrefetcher->wantsCacheResult(mHost, family,
+                                                                   mNetContext.dns_netid);
+    const uint64_t queryMarker = wantsCacheResult ?
+            DnsPrefetcher::getQueryMarker(mNetContext.dns_netid) : 0;
     Stopwatch s;
     uint32_t rv = android_getaddrinfofornetcontext(mHost, mService, mHints, &mNetContext, &result);
     const int latencyMs = lround(s.timeTaken());
 
+    if (rv == 0) {
+        DnsPrefetcher::CacheResult cacheResult = DnsPrefetcher::CACHE_RESULT_UNKNOWN;
+        if (wantsCacheResult) {
+            cacheResult = (DnsPrefetcher::getQueryMarker(mNetContext.dns_netid) == queryMarker) ?
+                    DnsPrefetcher::CACHE_HIT : DnsPrefetcher::CACHE_MISS;
+        }
+        mDnsPrefetcher->recordLookup(mHost, family, mHints ? mHints->ai_flags : 0, mNetContext,
+                                     cacheResult);
+    }
+
     if (rv) {
         // getaddrinfo failed
         mClient->sendBinaryMsg(ResponseCode::DnsProxyOperationFailed, &rv, sizeof(rv));
     } else {
-        bool success = !mClient->sendCode(ResponseCode::DnsProxyQueryResult);
-        struct addrinfo* ai = result;
-        while (ai && success) {
-            success = sendBE32(mClient, 1) && sendaddrinfo(mClient, ai);
-            ai = ai->ai_next;
-        }
-        success = success && sendBE32(mClient, 0);
-        if (!success) {
+        DnsResponseEncoder response;
+        response.appendCode(ResponseCode::DnsProxyQueryResult);
+        response.appendAddrinfoList(result);
+        if (response.send(mClient)) {
             ALOGW("Error writing DNS result to client");
         }
     }
-    std::vector<String16> ip_addrs;
-    int total_ip_addr_count = 0;
-    if (result) {
-        if (mNetdEventListener != nullptr
-                && mReportingLevel == INetdEventListener::REPORTING_LEVEL_FULL) {
+    if (mReportingLevel != INetdEventListener::REPORTING_LEVEL_NONE) {
+        DnsEvent event;
+        event.init(mNetContext.dns_netid, INetdEventListener::EVENT_GETADDRINFO, (int32_t) rv,
+                   latencyMs);
+        if (mReportingLevel == INetdEventListener::REPORTING_LEVEL_FULL) {
+            event.setDetails(mHost, mNetContext.uid);
             for (addrinfo* ai = result; ai; ai = ai->ai_next) {
-                sockaddr* ai_addr = ai->ai_addr;
-                if (ai_addr) {
-                    addIpAddrWithinLimit(ip_addrs, ai_addr, ai->ai_addrlen);
-                    total_ip_addr_count++;
+                if (ai->ai_addr) {
+                    event.addIpAddress(ai->ai_addr);
                 }
             }
         }
+        mDnsEventReporter->report(event);
+    }
+    if (result) {
         freeaddrinfo(result);
     }
     mClient->decRef();
-    if (mNetdEventListener != nullptr) {
-        switch (mReportingLevel) {
-            case INetdEventListener::REPORTING_LEVEL_NONE:
-                // Skip reporting.
-                break;
-            case INetdEventListener::REPORTING_LEVEL_METRICS:
-                // Metrics reporting is on. Send metrics.
-                mNetdEventListener->onDnsEvent(mNetContext.dns_netid,
-                                               INetdEventListener::EVENT_GETADDRINFO, (int32_t) rv,
-                                               latencyMs, String16(""), {}, -1, -1);
-                break;
-            case INetdEventListener::REPORTING_LEVEL_FULL:
-                // Full event info reporting is on. Send full info.
-                mNetdEventListener->onDnsEvent(mNetContext.dns_netid,
-                                               INetdEventListener::EVENT_GETADDRINFO, (int32_t) rv,
-                                               latencyMs, String16(mHost), ip_addrs,
-                                               total_ip_addr_count, mNetContext.uid);
-                break;
+}
+
+DnsProxyListener::GetAddrInfoStreamHandler::GetAddrInfoStreamHandler(
+        SocketClient *c, char* host, char* service, struct addrinfo* hints,
+        const struct android_net_context& netcontext, const int reportingLevel,
+        DnsEventReporter* dnsEventReporter, DnsPrefetcher* dnsPrefetcher,
+        DnsAddressSorter* dnsAddressSorter)
+        : mClient(c),
+          mHost(host),
+          mService(service),
+          mHints(hints),
+          mNetContext(netcontext),
+          mReportingLevel(reportingLevel),
+          mDnsEventReporter(dnsEventReporter),
+          mDnsPrefetcher(dnsPrefetcher),
+          mDnsAddressSorter(dnsAddressSorter),
+          mPending(0),
+          mSucceeded(false),
+          mError(0) {
+    mEvent.init(mNetContext.dns_netid, INetdEventListener::EVENT_GETADDRINFO, 0, 0);
+    if (mReportingLevel == INetdEventListener::REPORTING_LEVEL_FULL) {
+        mEvent.setDetails(mHost, mNetContext.uid);
+    }
+}
+
+DnsProxyListener::GetAddrInfoStreamHandler::~GetAddrInfoStreamHandler() {
+    free(mHost);
+    free(mService);
+    free(mHints);
+}
+
+void DnsProxyListener::GetAddrInfoStreamHandler::start() {
+    const int requested = mHints ? mHints->ai_family : AF_UNSPEC;
+    std::vector<int> families = (requested == AF_UNSPEC) ?
+            std::vector<int>({ AF_INET6, AF_INET }) : std::vector<int>({ requested });
+    // Each family is resolved on its own, and bionic only honors AI_ADDRCONFIG for AF_UNSPEC, so
+    // leave out the families that the app has no route for here. If it has none at all, resolve
+    // both anyway, so that names in the hosts file still resolve.
+    if (mHints && requested == AF_UNSPEC && (mHints->ai_flags & AI_ADDRCONFIG)) {
+        std::vector<int> routable;
+        for (int family : families) {
+            if (DnsAddressSorter::hasRoute(family, mNetContext)) {
+                routable.push_back(family);
+            }
         }
+        if (!routable.empty()) {
+            families = routable;
+        }
+    }
+    mPending = families.size();
+    for (int family : families) {
+        Query* query = new Query{ this, family };
+        pthread_t thread;
+        if (int ret = pthread_create(&thread, NULL,
+                DnsProxyListener::GetAddrInfoStreamHandler::threadStart, query)) {
+            // Don't block the listener thread with the lookup. Fail this family instead. If it was
+            // the last one, the handler is gone when this returns, but then the loop is done too.
+            ALOGE("pthread_create failed: %s", strerror(ret));
+            delete query;
+            if (finish(family, EAI_AGAIN, NULL)) {
+                delete this;
+            }
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+void* DnsProxyListener::GetAddrInfoStreamHandler::threadStart(void* obj) {
+    Query* query = reinterpret_cast<Query*>(obj);
+    if (query->handler->run(query->family)) {
+        delete query->handler;
+    }
+    delete query;
+    return NULL;
+}
+
+bool DnsProxyListener::GetAddrInfoStreamHandler::run(int family) {
+    struct addrinfo hints;
+    if (mHints) {
+        hints = *mHints;
     } else {
-        ALOGW("Netd event listener is not available; skipping.");
+        memset(&hints, 0, sizeof(hints));
+    }
+    hints.ai_family = family;
+
+    struct addrinfo* result = NULL;
+    const bool wantsCacheResult = mDnsPrefetcher->wantsCacheResult(mHost, family,
+                                                                   mNetContext.dns_netid);
+    const uint64_t queryMarker = wantsCacheResult ?
+            DnsPrefetcher::getQueryMarker(mNetContext.dns_netid) : 0;
+    uint32_t rv = android_getaddrinfofornetcontext(mHost, mService, &hints, &mNetContext, &result);
+    if (rv == 0) {
+        DnsPrefetcher::CacheResult cacheResult = DnsPrefetcher::CACHE_RESULT_UNKNOWN;
+        if (wantsCacheResult) {
+            cacheResult = (DnsPrefetcher::getQueryMarker(mNetContext.dns_netid) == queryMarker) ?
+                    DnsPrefetcher::CACHE_HIT : DnsPrefetcher::CACHE_MISS;
+        }
+        mDnsPrefetcher->recordLookup(mHost, family, hints.ai_flags, mNetContext, cacheResult);
+        mDnsAddressSorter->sort(mNetContext, &result);
     }
+
+    const bool last = finish(family, rv, result);
+    if (result) {
+        freeaddrinfo(result);
+    }
+    return last;
 }
 
-void DnsProxyListener::addIpAddrWithinLimit(std::vector<android::String16>& ip_addrs,
-        const sockaddr* addr, socklen_t addrlen) {
-    // ipAddresses array is limited to first INetdEventListener::DNS_REPORTED_IP_ADDRESSES_LIMIT
-    // addresses for A and AAAA. Total count of addresses is provided, to be able to tell whether
-    // some addresses didn't get logged.
-    if (ip_addrs.size() < INetdEventListener::DNS_REPORTED_IP_ADDRESSES_LIMIT) {
-        char ip_addr[INET6_ADDRSTRLEN];
-        if (getnameinfo(addr, addrlen, ip_addr, sizeof(ip_addr), nullptr, 0, NI_NUMERICHOST) == 0) {
-            ip_addrs.push_back(String16(ip_addr));
+bool DnsProxyListener::GetAddrInfoStreamHandler::finish(int family, uint32_t rv,
+                                                        addrinfo* result) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (rv == 0) {
+        DnsResponseEncoder response;
+        response.appendCode(ResponseCode::DnsProxyPartialResult);
+        response.appendBE32(family);
+        response.appendAddrinfoList(result);
+        if (response.send(mClient)) {
+            ALOGW("Error writing DNS result to client");
         }
+        mSucceeded = true;
+        if (mReportingLevel == INetdEventListener::REPORTING_LEVEL_FULL) {
+            for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+                if (ai->ai_addr) {
+                    mEvent.addIpAddress(ai->ai_addr);
+                }
+            }
+        }
+    } else if (mError == 0 || mError == (uint32_t) EAI_NODATA) {
+        // A family with no addresses is the least interesting error to report.
+        mError = rv;
+    }
+
+    const bool last = (--mPending == 0);
+    if (last) {
+        if (mSucceeded) {
+            DnsResponseEncoder response;
+            response.appendCode(ResponseCode::DnsProxyQueryResult);
+            response.appendAddrinfoList(NULL);
+            if (response.send(mClient)) {
+                ALOGW("Error writing DNS result to client");
+            }
+        } else {
+            mClient->sendBinaryMsg(ResponseCode::DnsProxyOperationFailed, &mError,
+                                   sizeof(mError));
+        }
+        if (mReportingLevel != INetdEventListener::REPORTING_LEVEL_NONE) {
+            mEvent.returnCode = mSucceeded ? 0 : (int32_t) mError;
+            mEvent.latencyMs = lround(mStopwatch.timeTaken());
+            mDnsEventReporter->report(mEvent);
+        }
+        mClient->decRef();
     }
+    return last;
 }
 
-DnsProxyListener::GetAddrInfoCmd::GetAddrInfoCmd(DnsProxyListener* dnsProxyListener) :
-    NetdCommand("getaddrinfo"),
-    mDnsProxyListener(dnsProxyListener) {
+DnsProxyListener::GetAddrInfoCmd::GetAddrInfoCmd(DnsProxyListener* dnsProxyListener,
+                                                 bool streaming) :
+    NetdCommand(streaming ? "getaddrinfostream" : "getaddrinfo"),
+    mDnsProxyListener(dnsProxyListener),
+    mStreaming(streaming) {
 }
 
 int DnsProxyListener::GetAddrInfoCmd::runCommand(SocketClient *cli,
@@ -325,9 +393,18 @@ int DnsProxyListener::GetAddrInfoCmd::runCommand(SocketClient *cli,
     const int metricsLevel = mDnsProxyListener->mEventReporter->getMetricsReportingLevel();
 
     cli->incRef();
+    if (mStreaming) {
+        DnsProxyListener::GetAddrInfoStreamHandler* handler =
+                new DnsProxyListener::GetAddrInfoStreamHandler(cli, name, service, hints,
+                        netcontext, metricsLevel, mDnsProxyListener->mDnsEventReporter,
+                        mDnsProxyListener->mDnsPrefetcher, mDnsProxyListener->mDnsAddressSorter);
+        handler->start();
+        return 0;
+    }
     DnsProxyListener::GetAddrInfoHandler* handler =
             new DnsProxyListener::GetAddrInfoHandler(cli, name, service, hints, netcontext,
-                    metricsLevel, mDnsProxyListener->mEventReporter->getNetdEventListener());
+                    metricsLevel, mDnsProxyListener->mDnsEventReporter,
+                    mDnsProxyListener->mDnsPrefetcher);
     handler->start();
 
     return 0;
@@ -384,7 +461,7 @@ int DnsProxyListener::GetHostByNameCmd::runCommand(SocketClient *cli,
     cli->incRef();
     DnsProxyListener::GetHostByNameHandler* handler =
             new DnsProxyListener::GetHostByNameHandler(cli, name, af, netId, mark, metricsLevel,
-                    mDnsProxyListener->mEventReporter->getNetdEventListener());
+                    mDnsProxyListener->mDnsEventReporter);
     handler->start();
 
     return 0;
@@ -392,14 +469,14 @@ int DnsProxyListener::GetHostByNameCmd::runCommand(SocketClient *cli,
 
 DnsProxyListener::GetHostByNameHandler::GetHostByNameHandler(
         SocketClient* c, char* name, int af, unsigned netId, uint32_t mark, const int metricsLevel,
-        const android::sp<android::net::metrics::INetdEventListener>& netdEventListener)
+        DnsEventReporter* dnsEventReporter)
         : mClient(c),
           mName(name),
           mAf(af),
           mNetId(netId),
           mMark(mark),
           mReportingLevel(metricsLevel),
-          mNetdEventListener(netdEventListener) {
+          mDnsEventReporter(dnsEventReporter) {
 }
 
 DnsProxyListener::GetHostByNameHandler::~GetHostByNameHandler() {
@@ -439,8 +516,10 @@ void DnsProxyListener::GetHostByNameHandler::run() {
 
     bool success = true;
     if (hp) {
-        success = mClient->sendCode(ResponseCode::DnsProxyQueryResult) == 0;
-        success &= sendhostent(mClient, hp);
+        DnsResponseEncoder response;
+        response.appendCode(ResponseCode::DnsProxyQueryResult);
+        response.appendHostent(hp);
+        success = response.send(mClient) == 0;
     } else {
         success = mClient->sendBinaryMsg(ResponseCode::DnsProxyOperationFailed, NULL, 0) == 0;
     }
@@ -449,42 +528,26 @@ void DnsProxyListener::GetHostByNameHandler::run() {
         ALOGW("GetHostByNameHandler: Error writing DNS result to client\n");
     }
 
-    if (mNetdEventListener != nullptr) {
-        std::vector<String16> ip_addrs;
-        int total_ip_addr_count = 0;
+    if (mReportingLevel != INetdEventListener::REPORTING_LEVEL_NONE) {
+        DnsEvent event;
+        event.init(mNetId, INetdEventListener::EVENT_GETHOSTBYNAME, h_errno, latencyMs);
         if (mReportingLevel == INetdEventListener::REPORTING_LEVEL_FULL) {
+            event.setDetails(mName, mClient->getUid());
             if (hp != nullptr && hp->h_addrtype == AF_INET) {
                 in_addr** list = (in_addr**) hp->h_addr_list;
                 for (int i = 0; list[i] != NULL; i++) {
                     sockaddr_in sin = { .sin_family = AF_INET, .sin_addr = *list[i] };
-                    addIpAddrWithinLimit(ip_addrs, (sockaddr*) &sin, sizeof(sin));
-                    total_ip_addr_count++;
+                    event.addIpAddress((sockaddr*) &sin);
                 }
             } else if (hp != nullptr && hp->h_addrtype == AF_INET6) {
                 in6_addr** list = (in6_addr**) hp->h_addr_list;
                 for (int i = 0; list[i] != NULL; i++) {
                     sockaddr_in6 sin6 = { .sin6_family = AF_INET6, .sin6_addr = *list[i] };
-                    addIpAddrWithinLimit(ip_addrs, (sockaddr*) &sin6, sizeof(sin6));
-                    total_ip_addr_count++;
+                    event.addIpAddress((sockaddr*) &sin6);
                 }
             }
         }
-        switch (mReportingLevel) {
-            case INetdEventListener::REPORTING_LEVEL_NONE:
-                // Reporting is off.
-                break;
-            case INetdEventListener::REPORTING_LEVEL_METRICS:
-                // Metrics reporting is on. Send metrics.
-                mNetdEventListener->onDnsEvent(mNetId, INetdEventListener::EVENT_GETHOSTBYNAME,
-                                               h_errno, latencyMs, String16(""), {}, -1, -1);
-                break;
-            case INetdEventListener::REPORTING_LEVEL_FULL:
-                // Full event info reporting is on. Send full info.
-                mNetdEventListener->onDnsEvent(mNetId, INetdEventListener::EVENT_GETHOSTBYNAME,
-                                               h_errno, latencyMs, String16(mName), ip_addrs,
-                                               total_ip_addr_count, mClient->getUid());
-                break;
-        }
+        mDnsEventReporter->report(event);
     }
 
     mClient->decRef();
@@ -604,8 +667,10 @@ void DnsProxyListener::GetHostByAddrHandler::run() {
 
     bool success = true;
     if (hp) {
-        success = mClient->sendCode(ResponseCode::DnsProxyQueryResult) == 0;
-        success &= sendhostent(mClient, hp);
+        DnsResponseEncoder response;
+        response.appendCode(ResponseCode::DnsProxyQueryResult);
+        response.appendHostent(hp);
+        success = response.send(mClient) == 0;
     } else {
         success = mClient->sendBinaryMsg(ResponseCode::DnsProxyOperationFailed, NULL, 0) == 0;
     }
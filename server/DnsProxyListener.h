@@ -21,30 +21,41 @@
 #include <binder/IServiceManager.h>
 #include <sysutils/FrameworkListener.h>
 
+#include <mutex>
+
 #include "android/net/metrics/INetdEventListener.h"
+#include "DnsEventReporter.h"
 #include "EventReporter.h"
 #include "NetdCommand.h"
+#include "Stopwatch.h"
 
+class DnsAddressSorter;
+class DnsPrefetcher;
 class NetworkController;
 
 class DnsProxyListener : public FrameworkListener {
 public:
-    explicit DnsProxyListener(const NetworkController* netCtrl, EventReporter* eventReporter);
+    DnsProxyListener(const NetworkController* netCtrl, EventReporter* eventReporter,
+                     DnsEventReporter* dnsEventReporter, DnsPrefetcher* dnsPrefetcher,
+                     DnsAddressSorter* dnsAddressSorter);
     virtual ~DnsProxyListener() {}
 
 private:
     const NetworkController *mNetCtrl;
     EventReporter *mEventReporter;
-    static void addIpAddrWithinLimit(std::vector<android::String16>& ip_addrs, const sockaddr* addr,
-            socklen_t addrlen);
+    DnsEventReporter *mDnsEventReporter;
+    DnsPrefetcher *mDnsPrefetcher;
+    DnsAddressSorter *mDnsAddressSorter;
 
+    // Handles both "getaddrinfo" and "getaddrinfostream", which take the same arguments.
     class GetAddrInfoCmd : public NetdCommand {
     public:
-        GetAddrInfoCmd(DnsProxyListener* dnsProxyListener);
+        GetAddrInfoCmd(DnsProxyListener* dnsProxyListener, bool streaming = false);
         virtual ~GetAddrInfoCmd() {}
         int runCommand(SocketClient *c, int argc, char** argv);
     private:
         DnsProxyListener* mDnsProxyListener;
+        const bool mStreaming;
     };
 
     class GetAddrInfoHandler {
@@ -56,7 +67,8 @@ private:
                            struct addrinfo* hints,
                            const struct android_net_context& netcontext,
                            const int reportingLevel,
-                           const android::sp<android::net::metrics::INetdEventListener>& listener);
+                           DnsEventReporter* dnsEventReporter,
+                           DnsPrefetcher* dnsPrefetcher);
         ~GetAddrInfoHandler();
 
         static void* threadStart(void* handler);
@@ -70,7 +82,67 @@ private:
         struct addrinfo* mHints;  // owned
         struct android_net_context mNetContext;
         const int mReportingLevel;
-        android::sp<android::net::metrics::INetdEventListener> mNetdEventListener;
+        DnsEventReporter* mDnsEventReporter;
+        DnsPrefetcher* mDnsPrefetcher;
+    };
+
+    /*
+     * Resolves a getaddrinfostream request. Unless the request asks for one family, the IPv6 and
+     * IPv4 lookups run in parallel, and the results of each are sent as soon as they arrive, so
+     * that apps doing happy eyeballs can start connecting before the slower family answers.
+     *
+     * For each family that resolves, the client receives DnsProxyPartialResult, the family as a
+     * big-endian 32-bit value, and the addrinfo list in the same format as getaddrinfo, sorted by
+     * DnsAddressSorter. Once all lookups are done, the client receives either DnsProxyQueryResult
+     * followed by an empty addrinfo list, or, if no family resolved, DnsProxyOperationFailed and
+     * the error, exactly as for getaddrinfo.
+     */
+    class GetAddrInfoStreamHandler {
+    public:
+        // Note: All of host, service, and hints may be NULL
+        GetAddrInfoStreamHandler(SocketClient *c,
+                                 char* host,
+                                 char* service,
+                                 struct addrinfo* hints,
+                                 const struct android_net_context& netcontext,
+                                 const int reportingLevel,
+                                 DnsEventReporter* dnsEventReporter,
+                                 DnsPrefetcher* dnsPrefetcher,
+                                 DnsAddressSorter* dnsAddressSorter);
+        ~GetAddrInfoStreamHandler();
+
+        void start();
+
+    private:
+        struct Query {
+            GetAddrInfoStreamHandler* handler;
+            int family;
+        };
+
+        static void* threadStart(void* query);
+        // Returns true if this was the last lookup, in which case the caller deletes the handler.
+        bool run(int family);
+        // Sends the outcome of the lookup for |family|, and the final frame if it was the last
+        // one. Returns true if it was, in which case the caller deletes the handler.
+        bool finish(int family, uint32_t rv, addrinfo* result);
+
+        SocketClient* mClient;  // ref counted
+        char* mHost;    // owned
+        char* mService; // owned
+        struct addrinfo* mHints;  // owned
+        struct android_net_context mNetContext;
+        const int mReportingLevel;
+        DnsEventReporter* mDnsEventReporter;
+        DnsPrefetcher* mDnsPrefetcher;
+        DnsAddressSorter* mDnsAddressSorter;
+        Stopwatch mStopwatch;
+
+        // Protects the state below, and serializes the frames sent to the client.
+        std::mutex mLock;
+        int mPending;
+        bool mSucceeded;
+        uint32_t mError;
+        DnsEvent mEvent;
     };
 
     /* ------ gethostbyname ------*/
@@ -91,7 +163,7 @@ private:
                             unsigned netId,
                             uint32_t mark,
                             int reportingLevel,
-                            const android::sp<android::net::metrics::INetdEventListener>& listener);
+                            DnsEventReporter* dnsEventReporter);
         ~GetHostByNameHandler();
         static void* threadStart(void* handler);
         void start();
@@ -103,7 +175,7 @@ private:
         unsigned mNetId;
         uint32_t mMark;
         const int mReportingLevel;
-        android::sp<android::net::metrics::INetdEventListener> mNetdEventListener;
+        DnsEventReporter* mDnsEventReporter;
     };
 
     /* ------ gethostbyaddr ------*/
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sysutils/SocketClient.h>
+
+#include "DnsResponseEncoder.h"
+
+namespace {
+
+// Enough for a typical dual-stack answer without reallocating.
+constexpr size_t kInitialCapacity = 512;
+
+}  // namespace
+
+void DnsResponseEncoder::append(const void* data, size_t len) {
+    if (mBuf.capacity() == 0) {
+        mBuf.reserve(kInitialCapacity);
+    }
+    const char* p = reinterpret_cast<const char*>(data);
+    mBuf.insert(mBuf.end(), p, p + len);
+}
+
+void DnsResponseEncoder::appendCode(int code) {
+    // Three digits and a null, which clients parse with strtol().
+    char buf[4];
+    snprintf(buf, sizeof(buf), "%.3d", code);
+    append(buf, sizeof(buf));
+}
+
+void DnsResponseEncoder::appendBE32(uint32_t data) {
+    uint32_t be_data = htonl(data);
+    append(&be_data, sizeof(be_data));
+}
+
+void DnsResponseEncoder::appendLenAndData(uint32_t len, const void* data) {
+    appendBE32(len);
+    if (len != 0) {
+        append(data, len);
+    }
+}
+
+void DnsResponseEncoder::appendHostent(const hostent* hp) {
+    if (hp->h_name != NULL) {
+        appendLenAndData(strlen(hp->h_name) + 1, hp->h_name);
+    } else {
+        appendLenAndData(0, "");
+    }
+
+    for (int i = 0; hp->h_aliases[i] != NULL; i++) {
+        appendLenAndData(strlen(hp->h_aliases[i]) + 1, hp->h_aliases[i]);
+    }
+    appendLenAndData(0, ""); // null to indicate we're done
+
+    appendBE32(hp->h_addrtype);
+    appendBE32(hp->h_length);
+
+    // Addresses are always sent as 16 bytes, regardless of h_length.
+    for (int i = 0; hp->h_addr_list[i] != NULL; i++) {
+        appendLenAndData(16, hp->h_addr_list[i]);
+    }
+    appendLenAndData(0, ""); // null to indicate we're done
+}
+
+void DnsResponseEncoder::appendAddrinfo(const addrinfo* ai) {
+    // struct addrinfo {
+    //      int     ai_flags;       /* AI_PASSIVE, AI_CANONNAME, AI_NUMERICHOST */
+    //      int     ai_family;      /* PF_xxx */
+    //      int     ai_socktype;    /* SOCK_xxx */
+    //      int     ai_protocol;    /* 0 or IPPROTO_xxx for IPv4 and IPv6 */
+    //      socklen_t ai_addrlen;   /* length of ai_addr */
+    //      char    *ai_canonname;  /* canonical name for hostname */
+    //      struct  sockaddr *ai_addr;      /* binary address */
+    //      struct  addrinfo *ai_next;      /* next structure in linked list */
+    // };
+
+    // Write the struct piece by piece because we might be a 64-bit netd
+    // talking to a 32-bit process.
+    appendBE32(ai->ai_flags);
+    appendBE32(ai->ai_family);
+    appendBE32(ai->ai_socktype);
+    appendBE32(ai->ai_protocol);
+
+    // ai_addrlen and ai_addr.
+    appendLenAndData(ai->ai_addrlen, ai->ai_addr);
+
+    // strlen(ai_canonname) and ai_canonname.
+    appendLenAndData(ai->ai_canonname ? strlen(ai->ai_canonname) + 1 : 0, ai->ai_canonname);
+}
+
+void DnsResponseEncoder::appendAddrinfoList(const addrinfo* result) {
+    for (const addrinfo* ai = result; ai; ai = ai->ai_next) {
+        appendBE32(1);
+        appendAddrinfo(ai);
+    }
+    appendBE32(0);
+}
+
+int DnsResponseEncoder::send(SocketClient* c) const {
+    // SocketClient::sendData() writes the whole buffer with a single writev, retrying on short
+    // writes, and holds the client's write lock while doing so.
+    return c->sendData(mBuf.data(), mBuf.size());
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_DNS_RESPONSE_ENCODER_H
+#define NETD_SERVER_DNS_RESPONSE_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+struct addrinfo;
+struct hostent;
+class SocketClient;
+
+/*
+ * Serializes a dnsproxyd query result into a single buffer, so that it can be written to the
+ * client with one system call instead of one per field.
+ *
+ * The wire format is exactly what the DnsProxyListener handlers used to write field by field:
+ * the response code in host byte order, followed by big-endian lengths and values.
+ */
+class DnsResponseEncoder {
+public:
+    DnsResponseEncoder() = default;
+
+    // The response code, as written by SocketClient::sendCode(): three digits and a null.
+    void appendCode(int code);
+
+    // A 32-bit value in network byte order.
+    void appendBE32(uint32_t data);
+
+    // 4 bytes of big-endian length, followed by the data.
+    void appendLenAndData(uint32_t len, const void* data);
+
+    // A complete hostent: name, aliases, address type and length, and addresses.
+    void appendHostent(const hostent* hp);
+
+    // Every entry of an addrinfo list, each preceded by a 1, followed by a terminating 0.
+    void appendAddrinfoList(const addrinfo* result);
+
+    const std::vector<char>& data() const { return mBuf; }
+
+    // Writes everything appended so far to the client in a single write. Returns 0 on success.
+    int send(SocketClient* c) const;
+
+private:
+    void append(const void* data, size_t len);
+    void appendAddrinfo(const addrinfo* ai);
+
+    std::vector<char> mBuf;
+};
+
+#endif  // NETD_SERVER_DNS_RESPONSE_ENCODER_H
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * DnsResponseEncoderTest.cpp - unit tests for DnsResponseEncoder.cpp
+ */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <sysutils/SocketClient.h>
+
+#include "DnsResponseEncoder.h"
+
+namespace {
+
+// Builds the expected output the way the old field-by-field code wrote it.
+class Expected {
+public:
+    Expected& raw(const void *data, size_t len) {
+        const char *p = reinterpret_cast<const char *>(data);
+        mBuf.insert(mBuf.end(), p, p + len);
+        return *this;
+    }
+    Expected& be32(uint32_t v) {
+        v = htonl(v);
+        return raw(&v, sizeof(v));
+    }
+    Expected& lenAndData(uint32_t len, const void *data) {
+        return be32(len).raw(data, len);
+    }
+    const std::vector<char>& data() const { return mBuf; }
+
+private:
+    std::vector<char> mBuf;
+};
+
+}  // namespace
+
+TEST(DnsResponseEncoderTest, TestHostent) {
+    uint8_t addr1[16] = { 192, 0, 2, 1 };
+    uint8_t addr2[16] = { 192, 0, 2, 2 };
+    char name[] = "example.com";
+    char alias[] = "www.example.com";
+    char *aliases[] = { alias, nullptr };
+    char *addrs[] = { reinterpret_cast<char *>(addr1), reinterpret_cast<char *>(addr2), nullptr };
+    hostent hp = {};
+    hp.h_name = name;
+    hp.h_aliases = aliases;
+    hp.h_addrtype = AF_INET;
+    hp.h_length = 4;
+    hp.h_addr_list = addrs;
+
+    DnsResponseEncoder encoder;
+    encoder.appendCode(222);
+    encoder.appendHostent(&hp);
+
+    Expected expected;
+    expected.raw("222", 4)
+            .lenAndData(sizeof(name), name)
+            .lenAndData(sizeof(alias), alias)
+            .be32(0)
+            .be32(AF_INET)
+            .be32(4)
+            .lenAndData(16, addr1)
+            .lenAndData(16, addr2)
+            .be32(0);
+    EXPECT_EQ(expected.data(), encoder.data());
+}
+
+TEST(DnsResponseEncoderTest, TestAddrinfoList) {
+    sockaddr_in sin = {};
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(53);
+    inet_pton(AF_INET, "192.0.2.1", &sin.sin_addr);
+    sockaddr_in6 sin6 = {};
+    sin6.sin6_family = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8::1", &sin6.sin6_addr);
+    char canonname[] = "example.com";
+
+    addrinfo ai2 = {};
+    ai2.ai_family = AF_INET;
+    ai2.ai_socktype = SOCK_DGRAM;
+    ai2.ai_protocol = IPPROTO_UDP;
+    ai2.ai_addrlen = sizeof(sin);
+    ai2.ai_addr = reinterpret_cast<sockaddr *>(&sin);
+    addrinfo ai1 = {};
+    ai1.ai_flags = AI_CANONNAME;
+    ai1.ai_family = AF_INET6;
+    ai1.ai_socktype = SOCK_STREAM;
+    ai1.ai_protocol = IPPROTO_TCP;
+    ai1.ai_addrlen = sizeof(sin6);
+    ai1.ai_addr = reinterpret_cast<sockaddr *>(&sin6);
+    ai1.ai_canonname = canonname;
+    ai1.ai_next = &ai2;
+
+    DnsResponseEncoder encoder;
+    encoder.appendAddrinfoList(&ai1);
+
+    Expected expected;
+    expected.be32(1)
+            .be32(AI_CANONNAME).be32(AF_INET6).be32(SOCK_STREAM).be32(IPPROTO_TCP)
+            .lenAndData(sizeof(sin6), &sin6)
+            .lenAndData(sizeof(canonname), canonname)
+            .be32(1)
+            .be32(0).be32(AF_INET).be32(SOCK_DGRAM).be32(IPPROTO_UDP)
+            .lenAndData(sizeof(sin), &sin)
+            .be32(0)
+            .be32(0);
+    EXPECT_EQ(expected.data(), encoder.data());
+
+    // An empty result is just the terminator.
+    DnsResponseEncoder empty;
+    empty.appendAddrinfoList(nullptr);
+    EXPECT_EQ(Expected().be32(0).data(), empty.data());
+}
+
+TEST(DnsResponseEncoderTest, TestSendWritesEverything) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+    SocketClient *client = new SocketClient(fds[0], false, false);
+
+    DnsResponseEncoder encoder;
+    encoder.appendCode(222);
+    encoder.appendLenAndData(6, "hello");
+    encoder.appendBE32(0);
+    ASSERT_EQ(0, encoder.send(client));
+
+    std::vector<char> received(encoder.data().size());
+    EXPECT_EQ(static_cast<ssize_t>(received.size()),
+              read(fds[1], received.data(), received.size()));
+    EXPECT_EQ(encoder.data(), received);
+
+    client->decRef();
+    close(fds[0]);
+    close(fds[1]);
+}
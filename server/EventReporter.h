@@ -22,6 +22,7 @@
 #include <mutex>
 
 #include "android/net/metrics/INetdEventListener.h"
+#include "MetricsAggregator.h"
 
 /*
  * This class stores the reporting level and can be used to get the event listener service.
@@ -35,9 +36,20 @@ public:
     // we do not have it already. This method is threadsafe.
     android::sp<android::net::metrics::INetdEventListener> getNetdEventListener();
 
+    // Records which optional INetdEventListener methods the listener implements, as a bitmask of
+    // INetd::EVENT_LISTENER_CAPABILITY_* values. These methods are threadsafe.
+    void setListenerCapabilities(int capabilities) { mListenerCapabilities = capabilities; }
+    bool hasListenerCapability(int capability) const {
+        return (mListenerCapabilities & capability) != 0;
+    }
+
+    // Returns the in-process aggregate of DNS and connect events. This method is threadsafe.
+    MetricsAggregator* getMetrics() { return &mMetrics; }
+
 private:
     std::atomic_int mReportingLevel{
             android::net::metrics::INetdEventListener::REPORTING_LEVEL_FULL};
+    std::atomic_int mListenerCapabilities{0};
     // TODO: consider changing this into an atomic type such as
     // std::atomic<android::net::metrics::INetdEventListener> and deleting the mutex.
     //
@@ -46,6 +58,7 @@ private:
     // and remove mNetdEventListener entirely.
     android::sp<android::net::metrics::INetdEventListener> mNetdEventListener;
     std::mutex mutex;
+    MetricsAggregator mMetrics;
 
 };
 
@@ -16,6 +16,7 @@
 
 #include "FwmarkServer.h"
 
+#include "DnsAddressSorter.h"
 #include "Fwmark.h"
 #include "FwmarkCommand.h"
 #include "NetdConstants.h"
@@ -30,9 +31,10 @@
 using android::String16;
 using android::net::metrics::INetdEventListener;
 
-FwmarkServer::FwmarkServer(NetworkController* networkController, EventReporter* eventReporter) :
+FwmarkServer::FwmarkServer(NetworkController* networkController, EventReporter* eventReporter,
+                           DnsAddressSorter* dnsAddressSorter) :
         SocketListener("fwmarkd", true), mNetworkController(networkController),
-        mEventReporter(eventReporter) {
+        mEventReporter(eventReporter), mDnsAddressSorter(dnsAddressSorter) {
 }
 
 bool FwmarkServer::onDataAvailable(SocketClient* client) {
@@ -175,6 +177,22 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
                 break;
             }
 
+            // Lets getaddrinfostream put destinations that this app cannot reach last. The address
+            // and error come from the app, so they must not affect other apps' lookups.
+            mDnsAddressSorter->recordConnect(fwmark.netId, client->getUid(), &connectInfo.addr.s,
+                                             connectInfo.error);
+
+            // Like DNS events, connects are only aggregated if metrics are enabled, and only
+            // kept per UID at REPORTING_LEVEL_FULL.
+            const int metricsLevel = mEventReporter->getMetricsReportingLevel();
+            if (metricsLevel != INetdEventListener::REPORTING_LEVEL_NONE) {
+                const int32_t uid = (metricsLevel == INetdEventListener::REPORTING_LEVEL_FULL) ?
+                        (int32_t) client->getUid() : -1;
+                mEventReporter->getMetrics()->recordEvent(fwmark.netId,
+                        MetricsAggregator::CONNECT, connectInfo.error, connectInfo.latencyMs,
+                        uid);
+            }
+
             android::sp<android::net::metrics::INetdEventListener> netdEventListener =
                     mEventReporter->getNetdEventListener();
 
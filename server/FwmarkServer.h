@@ -21,11 +21,13 @@
 #include "EventReporter.h"
 #include "sysutils/SocketListener.h"
 
+class DnsAddressSorter;
 class NetworkController;
 
 class FwmarkServer : public SocketListener {
 public:
-    explicit FwmarkServer(NetworkController* networkController, EventReporter* eventReporter);
+    FwmarkServer(NetworkController* networkController, EventReporter* eventReporter,
+                 DnsAddressSorter* dnsAddressSorter);
 
 private:
     // Overridden from SocketListener:
@@ -36,6 +38,7 @@ private:
 
     NetworkController* const mNetworkController;
     EventReporter* mEventReporter;
+    DnsAddressSorter* mDnsAddressSorter;
 };
 
 #endif  // NETD_SERVER_FWMARK_SERVER_H
@@ -88,13 +88,14 @@
  * is correct. The benefit of this, is that idletimers can be setup on
  * interfaces than come and go.
  *
- * A remove should be called for each add command issued during cleanup, as duplicate
- * entries of the rule may exist and will all have to removed.
+ * Adding the timer that an interface already has does nothing, and adding a different one
+ * replaces it. Both tables of a family are changed with a single iptables-restore.
  *
  */
 
 #define LOG_NDEBUG 0
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/socket.h>
@@ -106,44 +107,46 @@
 #include <string.h>
 #include <cutils/properties.h>
 
+#include <android-base/stringprintf.h>
+
 #define LOG_TAG "IdletimerController"
 #include <cutils/log.h>
-#include <logwrap/logwrap.h>
 
 #include "IdletimerController.h"
-#include "NetdConstants.h"
+
+using android::base::StringPrintf;
 
 const char* IdletimerController::LOCAL_RAW_PREROUTING = "idletimer_raw_PREROUTING";
 const char* IdletimerController::LOCAL_MANGLE_POSTROUTING = "idletimer_mangle_POSTROUTING";
 
-IdletimerController::IdletimerController() {
-}
+int (*IdletimerController::execIptablesRestore)(IptablesTarget, const std::string&) =
+        ::execIptablesRestore;
 
-IdletimerController::~IdletimerController() {
-}
-/* return 0 or non-zero */
-int IdletimerController::runIpxtablesCmd(int argc, const char **argv) {
-    int resIpv4, resIpv6;
-
-    // Running for IPv4
-    argv[0] = IPTABLES_PATH;
-    resIpv4 = android_fork_execvp(argc, (char **)argv, NULL, false, false);
+namespace {
 
-    // Running for IPv6
-    argv[0] = IP6TABLES_PATH;
-    resIpv6 = android_fork_execvp(argc, (char **)argv, NULL, false, false);
+// Same as MAX_IDLETIMER_LABEL_SIZE in the kernel, including the terminating NUL.
+const size_t MAX_LABEL_SIZE = 28;
 
-#if !LOG_NDEBUG
-    std::string full_cmd = argv[0];
-    argc--; argv++;
-    for (; argc; argc--, argv++) {
-        full_cmd += " ";
-        full_cmd += argv[0];
+// The label ends up in iptables-restore input, so it must be a single word.
+bool isValidLabel(const char *label) {
+    size_t len = strlen(label);
+    if (len == 0 || len >= MAX_LABEL_SIZE) {
+        return false;
     }
-    ALOGV("runCmd(%s) res_ipv4=%d, res_ipv6=%d", full_cmd.c_str(), resIpv4, resIpv6);
-#endif
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum(label[i]) && !strchr("_-.:", label[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
 
-    return (resIpv4 == 0 && resIpv6 == 0) ? 0 : -1;
+IdletimerController::IdletimerController() {
+}
+
+IdletimerController::~IdletimerController() {
 }
 
 bool IdletimerController::setupIptablesHooks() {
@@ -151,31 +154,15 @@ bool IdletimerController::setupIptablesHooks() {
 }
 
 int IdletimerController::setDefaults() {
-  int res;
-  const char *cmd1[] = {
-      NULL, // To be filled inside runIpxtablesCmd
-      "-w",
-      "-t",
-      "raw",
-      "-F",
-      LOCAL_RAW_PREROUTING
-  };
-  res = runIpxtablesCmd(ARRAY_SIZE(cmd1), cmd1);
-
-  if (res)
-    return res;
-
-  const char *cmd2[] = {
-      NULL, // To be filled inside runIpxtablesCmd
-      "-w",
-      "-t",
-      "mangle",
-      "-F",
-      LOCAL_MANGLE_POSTROUTING
-  };
-  res = runIpxtablesCmd(ARRAY_SIZE(cmd2), cmd2);
-
-  return res;
+    mTimers.clear();
+    std::string commands = StringPrintf(
+            "*raw\n"
+            "-F %s\n"
+            "COMMIT\n"
+            "*mangle\n"
+            "-F %s\n"
+            "COMMIT\n", LOCAL_RAW_PREROUTING, LOCAL_MANGLE_POSTROUTING);
+    return execIptablesRestore(V4V6, commands) ? -1 : 0;
 }
 
 int IdletimerController::enableIdletimerControl() {
@@ -188,63 +175,86 @@ int IdletimerController::disableIdletimerControl() {
     return res;
 }
 
+std::string IdletimerController::makeRestoreCommands(const std::string& iface,
+                                                     const Changes& changes) {
+    std::string commands;
+    for (bool raw : { true, false }) {
+        commands += raw ? "*raw\n" : "*mangle\n";
+        for (const auto& change : changes) {
+            commands += StringPrintf(
+                    "%s %s %s %s -j IDLETIMER --timeout %u --label %s --send_nl_msg 1\n",
+                    (change.first == IptOpAdd) ? "-A" : "-D",
+                    raw ? LOCAL_RAW_PREROUTING : LOCAL_MANGLE_POSTROUTING,
+                    raw ? "-i" : "-o", iface.c_str(), change.second.timeout,
+                    change.second.label.c_str());
+        }
+        commands += "COMMIT\n";
+    }
+    return commands;
+}
+
+int IdletimerController::applyChanges(const std::string& iface, const Changes& changes) {
+    if (execIptablesRestore(V4, makeRestoreCommands(iface, changes))) {
+        return -1;
+    }
+    if (execIptablesRestore(V6, makeRestoreCommands(iface, changes))) {
+        Changes undo;
+        for (auto it = changes.rbegin(); it != changes.rend(); ++it) {
+            undo.push_back({ (it->first == IptOpAdd) ? IptOpDelete : IptOpAdd, it->second });
+        }
+        execIptablesRestore(V4, makeRestoreCommands(iface, undo));
+        return -1;
+    }
+    return 0;
+}
+
 int IdletimerController::modifyInterfaceIdletimer(IptOp op, const char *iface,
                                                   uint32_t timeout,
                                                   const char *classLabel) {
-  int res;
-  char timeout_str[11]; //enough to store any 32-bit unsigned decimal
-
-  if (!isIfaceName(iface)) {
-    errno = ENOENT;
-    return -1;
-  }
-
-  snprintf(timeout_str, sizeof(timeout_str), "%u", timeout);
-
-  const char *cmd1[] = {
-      NULL, // To be filled inside runIpxtablesCmd
-      "-w",
-      "-t",
-      "raw",
-      (op == IptOpAdd) ? "-A" : "-D",
-      LOCAL_RAW_PREROUTING,
-      "-i",
-      iface,
-      "-j",
-      "IDLETIMER",
-      "--timeout",
-      timeout_str,
-      "--label",
-      classLabel,
-      "--send_nl_msg",
-      "1"
-  };
-  res = runIpxtablesCmd(ARRAY_SIZE(cmd1), cmd1);
+    if (!isIfaceName(iface)) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (!isValidLabel(classLabel)) {
+        errno = EINVAL;
+        return -1;
+    }
 
-  if (res)
-    return res;
+    Timer timer = { timeout, classLabel };
+    auto existing = mTimers.find(iface);
+    Changes changes;
+    if (op == IptOpAdd) {
+        if (existing != mTimers.end() && existing->second == timer) {
+            ALOGV("idletimer %s already on %s", classLabel, iface);
+            return 0;
+        }
+        if (existing != mTimers.end()) {
+            changes.push_back({ IptOpDelete, existing->second });
+        }
+        changes.push_back({ IptOpAdd, timer });
+    } else {
+        if (existing != mTimers.end() && !(existing->second == timer)) {
+            // That timer was replaced, and its rules are gone already.
+            return 0;
+        }
+        // Without an entry, the rules may still be left from a previous netd.
+        changes.push_back({ IptOpDelete, timer });
+    }
 
-  const char *cmd2[] = {
-      NULL, // To be filled inside runIpxtablesCmd
-      "-w",
-      "-t",
-      "mangle",
-      (op == IptOpAdd) ? "-A" : "-D",
-      LOCAL_MANGLE_POSTROUTING,
-      "-o",
-      iface,
-      "-j",
-      "IDLETIMER",
-      "--timeout",
-      timeout_str,
-      "--label",
-      classLabel,
-      "--send_nl_msg",
-      "1"
-  };
-  res = runIpxtablesCmd(ARRAY_SIZE(cmd2), cmd2);
+    if (op == IptOpDelete) {
+        // Remove as much as possible, whatever is left over is of no use.
+        std::string commands = makeRestoreCommands(iface, changes);
+        int resIpv4 = execIptablesRestore(V4, commands);
+        int resIpv6 = execIptablesRestore(V6, commands);
+        mTimers.erase(iface);
+        return (resIpv4 == 0 && resIpv6 == 0) ? 0 : -1;
+    }
 
-  return res;
+    if (applyChanges(iface, changes)) {
+        return -1;
+    }
+    mTimers[iface] = timer;
+    return 0;
 }
 
 int IdletimerController::addInterfaceIdletimer(const char *iface,
@@ -16,6 +16,15 @@
 #ifndef _IDLETIMER_CONTROLLER_H
 #define _IDLETIMER_CONTROLLER_H
 
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "NetdConstants.h"
+
 class IdletimerController {
 public:
 
@@ -33,12 +42,31 @@ public:
     static const char* LOCAL_RAW_PREROUTING;
     static const char* LOCAL_MANGLE_POSTROUTING;
 
+ protected:
+    friend class IdletimerControllerTest;
+    static int (*execIptablesRestore)(IptablesTarget target, const std::string& commands);
+
  private:
     enum IptOp { IptOpAdd, IptOpDelete };
+
+    struct Timer {
+        uint32_t timeout;
+        std::string label;
+        bool operator==(const Timer& other) const {
+            return timeout == other.timeout && label == other.label;
+        }
+    };
+    typedef std::vector<std::pair<IptOp, Timer>> Changes;
+
     int setDefaults();
-    int runIpxtablesCmd(int argc, const char **cmd);
+    static std::string makeRestoreCommands(const std::string& iface, const Changes& changes);
+    // Applies |changes| to both families, undoing them on IPv4 if IPv6 fails.
+    int applyChanges(const std::string& iface, const Changes& changes);
     int modifyInterfaceIdletimer(IptOp op, const char *iface, uint32_t timeout,
                                  const char *classLabel);
+
+    // The timer installed on each interface, so that adding it again does not touch iptables.
+    std::map<std::string, Timer> mTimers;
 };
 
 #endif
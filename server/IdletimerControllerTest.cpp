@@ -0,0 +1,144 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IdletimerControllerTest.cpp - unit tests for IdletimerController.cpp
+ */
+
+#include <errno.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <android-base/stringprintf.h>
+
+#include "IdletimerController.h"
+#include "IptablesBaseTest.h"
+
+using android::base::StringPrintf;
+
+class IdletimerControllerTest : public IptablesBaseTest {
+public:
+    IdletimerControllerTest() {
+        IdletimerController::execIptablesRestore = fakeFailingIptablesRestore;
+    }
+
+protected:
+    IdletimerController mIdletimerCtrl;
+
+    static std::string rules(const char* op, const char* iface, uint32_t timeout,
+                             const char* label) {
+        return StringPrintf(
+                "%s idletimer_raw_PREROUTING -i %s -j IDLETIMER --timeout %u --label %s "
+                "--send_nl_msg 1\n", op, iface, timeout, label);
+    }
+
+    static std::string mangleRules(const char* op, const char* iface, uint32_t timeout,
+                                   const char* label) {
+        return StringPrintf(
+                "%s idletimer_mangle_POSTROUTING -o %s -j IDLETIMER --timeout %u --label %s "
+                "--send_nl_msg 1\n", op, iface, timeout, label);
+    }
+
+    static std::string timerCommands(const char* op, const char* iface, uint32_t timeout,
+                                     const char* label) {
+        return "*raw\n" + rules(op, iface, timeout, label) + "COMMIT\n" +
+               "*mangle\n" + mangleRules(op, iface, timeout, label) + "COMMIT\n";
+    }
+
+    void expectTimerCommands(const char* op, const char* iface, uint32_t timeout,
+                             const char* label) {
+        std::string commands = timerCommands(op, iface, timeout, label);
+        expectIptablesRestoreCommands(ExpectedIptablesCommands{
+            { V4, commands },
+            { V6, commands },
+        });
+    }
+};
+
+const std::string FLUSH_COMMANDS =
+        "*raw\n"
+        "-F idletimer_raw_PREROUTING\n"
+        "COMMIT\n"
+        "*mangle\n"
+        "-F idletimer_mangle_POSTROUTING\n"
+        "COMMIT\n";
+
+TEST_F(IdletimerControllerTest, TestEnableDisable) {
+    EXPECT_EQ(0, mIdletimerCtrl.enableIdletimerControl());
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{ { V4V6, FLUSH_COMMANDS } });
+    EXPECT_EQ(0, mIdletimerCtrl.disableIdletimerControl());
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{ { V4V6, FLUSH_COMMANDS } });
+    expectIptablesCommands(std::vector<std::string>{});
+}
+
+TEST_F(IdletimerControllerTest, TestAddIsCached) {
+    EXPECT_EQ(0, mIdletimerCtrl.addInterfaceIdletimer("rmnet0", 5, "0"));
+    expectTimerCommands("-A", "rmnet0", 5, "0");
+
+    // The same timer again does not change anything.
+    EXPECT_EQ(0, mIdletimerCtrl.addInterfaceIdletimer("rmnet0", 5, "0"));
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+
+    // A different timer replaces it in one go.
+    EXPECT_EQ(0, mIdletimerCtrl.addInterfaceIdletimer("rmnet0", 10, "0"));
+    std::string commands =
+            "*raw\n" + rules("-D", "rmnet0", 5, "0") + rules("-A", "rmnet0", 10, "0") +
+            "COMMIT\n"
+            "*mangle\n" + mangleRules("-D", "rmnet0", 5, "0") +
+            mangleRules("-A", "rmnet0", 10, "0") + "COMMIT\n";
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{ { V4, commands }, { V6, commands } });
+
+    // Removing the replaced timer has nothing left to do.
+    EXPECT_EQ(0, mIdletimerCtrl.removeInterfaceIdletimer("rmnet0", 5, "0"));
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+
+    EXPECT_EQ(0, mIdletimerCtrl.removeInterfaceIdletimer("rmnet0", 10, "0"));
+    expectTimerCommands("-D", "rmnet0", 10, "0");
+    EXPECT_EQ(0, mIdletimerCtrl.addInterfaceIdletimer("rmnet0", 10, "0"));
+    expectTimerCommands("-A", "rmnet0", 10, "0");
+
+    // Flushing the chains forgets about all timers.
+    EXPECT_EQ(0, mIdletimerCtrl.disableIdletimerControl());
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{ { V4V6, FLUSH_COMMANDS } });
+    EXPECT_EQ(0, mIdletimerCtrl.addInterfaceIdletimer("rmnet0", 10, "0"));
+    expectTimerCommands("-A", "rmnet0", 10, "0");
+}
+
+TEST_F(IdletimerControllerTest, TestFailedAddIsUndone) {
+    sRestoreFailAt = 1;
+    EXPECT_EQ(-1, mIdletimerCtrl.addInterfaceIdletimer("wlan0", 15, "1"));
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{
+        { V4, timerCommands("-A", "wlan0", 15, "1") },
+        { V6, timerCommands("-A", "wlan0", 15, "1") },
+        { V4, timerCommands("-D", "wlan0", 15, "1") },
+    });
+
+    // Nothing was remembered, so trying again applies the rules.
+    sRestoreFailAt = -1;
+    EXPECT_EQ(0, mIdletimerCtrl.addInterfaceIdletimer("wlan0", 15, "1"));
+    expectTimerCommands("-A", "wlan0", 15, "1");
+}
+
+TEST_F(IdletimerControllerTest, TestInvalidArguments) {
+    EXPECT_EQ(-1, mIdletimerCtrl.addInterfaceIdletimer("rmnet0!", 5, "0"));
+    EXPECT_EQ(ENOENT, errno);
+    EXPECT_EQ(-1, mIdletimerCtrl.addInterfaceIdletimer("rmnet0", 5, "0\n-F"));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mIdletimerCtrl.addInterfaceIdletimer("rmnet0", 5, ""));
+    EXPECT_EQ(EINVAL, errno);
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+}
@@ -14,24 +14,35 @@
  * limitations under the License.
  */
 
-#include <dirent.h>
+#include <arpa/inet.h>
 #include <errno.h>
 #include <malloc.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/if_addr.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <functional>
+#include <mutex>
 
 #define LOG_TAG "InterfaceController"
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <cutils/log.h>
 #include <logwrap/logwrap.h>
-#include <netutils/ifc.h>
 
 #include "InterfaceController.h"
 #include "RouteController.h"
+#include "SysctlWriter.h"
 
 using android::base::StringPrintf;
 using android::base::ReadFileToString;
-using android::base::WriteStringToFile;
 
 namespace {
 
@@ -42,7 +53,6 @@ const char ipv4_neigh_conf_dir[] = "/proc/sys/net/ipv4/neigh";
 const char ipv6_neigh_conf_dir[] = "/proc/sys/net/ipv6/neigh";
 
 const char proc_net_path[] = "/proc/sys/net";
-const char sys_net_path[] = "/sys/class/net";
 
 const char wl_util_path[] = "/vendor/xbin/wlutil";
 
@@ -62,35 +72,21 @@ inline bool isInterfaceName(const char *name) {
            (strcmp(name, "all") != 0);
 }
 
+SysctlWriter& sysctlWriter() {
+    static SysctlWriter writer;
+    return writer;
+}
+
+// Returns 0, or -1 with errno set.
 int writeValueToPath(
         const char* dirname, const char* subdirname, const char* basename,
         const char* value) {
-    std::string path(StringPrintf("%s/%s/%s", dirname, subdirname, basename));
-    return WriteStringToFile(value, path) ? 0 : -1;
-}
-
-void setOnAllInterfaces(const char* dirname, const char* basename, const char* value) {
-    // Set the default value, which is used by any interfaces that are created in the future.
-    writeValueToPath(dirname, "default", basename, value);
-
-    // Set the value on all the interfaces that currently exist.
-    DIR* dir = opendir(dirname);
-    if (!dir) {
-        ALOGE("Can't list %s: %s", dirname, strerror(errno));
-        return;
-    }
-    dirent* d;
-    while ((d = readdir(dir))) {
-        if ((d->d_type != DT_DIR) || !isInterfaceName(d->d_name)) {
-            continue;
-        }
-        writeValueToPath(dirname, d->d_name, basename, value);
+    int ret = sysctlWriter().set(subdirname, {{ dirname, basename, value }});
+    if (ret) {
+        errno = -ret;
+        return -1;
     }
-    closedir(dir);
-}
-
-void setIPv6UseOutgoingInterfaceAddrsOnly(const char *value) {
-    setOnAllInterfaces(ipv6_proc_path, "use_oif_addrs_only", value);
+    return 0;
 }
 
 std::string getParameterPathname(
@@ -108,27 +104,290 @@ std::string getParameterPathname(
     return StringPrintf("%s/%s/%s/%s/%s", proc_net_path, family, which, interface, parameter);
 }
 
-}  // namespace
+// Link dumps can put messages of several kilobytes each into a single datagram.
+const size_t RTNETLINK_BUFFER_SIZE = 32768;
 
-void InterfaceController::initializeAll() {
-    // Initial IPv6 settings.
-    // By default, accept_ra is set to 1 (accept RAs unless forwarding is on) on all interfaces.
-    // This causes RAs to work or not work based on whether forwarding is on, and causes routes
-    // learned from RAs to go away when forwarding is turned on. Make this behaviour predictable
-    // by always setting accept_ra to 2.
-    setAcceptRA("2");
+// The largest batch of requests sent in a single datagram.
+const size_t RTNETLINK_MAX_BATCH_SIZE = 8192;
 
-    setAcceptRARouteTable(-RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX);
+// All rtnetlink requests share one socket, and are sent one batch at a time. Replies are matched
+// to requests by sequence number, so a late reply to an earlier batch is never mistaken for one.
+std::mutex sRtnetlinkLock;
+int sRtnetlinkSocket = -1;
+uint32_t sRtnetlinkSeq = 0;
 
-    // Enable optimistic DAD for IPv6 addresses on all interfaces.
-    setIPv6OptimisticMode("1");
+void closeRtnetlinkSocketLocked() {
+    if (sRtnetlinkSocket != -1) {
+        close(sRtnetlinkSocket);
+        sRtnetlinkSocket = -1;
+    }
+}
 
-    // Reduce the ARP/ND base reachable time from the default (30sec) to 15sec.
-    setBaseReachableTimeMs(15 * 1000);
+// Sends |count| requests, which are laid out back to back in |batch|, in one datagram, and waits
+// until the kernel has finished answering all of them. Every request must be a dump or ask for an
+// ack. Replies other than acks are passed to |handler|, and results[i] is set to the result of
+// the i-th request. Returns 0, or a negative errno if the requests could not be sent or answered.
+int sendRtnetlinkBatchLocked(std::string *batch, size_t count, int *results,
+                             const std::function<void(const nlmsghdr *)>& handler) {
+    if (sRtnetlinkSocket == -1) {
+        sRtnetlinkSocket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+        if (sRtnetlinkSocket == -1) {
+            return -errno;
+        }
+    }
+
+    const uint32_t firstSeq = ++sRtnetlinkSeq;
+    sRtnetlinkSeq += count - 1;
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        nlmsghdr *nlh = reinterpret_cast<nlmsghdr *>(&(*batch)[offset]);
+        nlh->nlmsg_seq = firstSeq + i;
+        offset += NLMSG_ALIGN(nlh->nlmsg_len);
+    }
+    if (send(sRtnetlinkSocket, batch->data(), batch->size(), 0) != (ssize_t) batch->size()) {
+        int ret = -errno;
+        closeRtnetlinkSocketLocked();
+        return ret;
+    }
+
+    std::vector<bool> answered(count, false);
+    size_t pending = count;
+    std::vector<char> buf(RTNETLINK_BUFFER_SIZE);
+    while (pending) {
+        ssize_t bytesread = TEMP_FAILURE_RETRY(recv(sRtnetlinkSocket, buf.data(), buf.size(), 0));
+        if (bytesread <= 0) {
+            // Replies may have been lost, e.g. with ENOBUFS. Start over with a new socket.
+            int ret = bytesread ? -errno : -EIO;
+            closeRtnetlinkSocketLocked();
+            return ret;
+        }
+        uint32_t remaining = bytesread;
+        for (const nlmsghdr *nlh = reinterpret_cast<const nlmsghdr *>(buf.data());
+             NLMSG_OK(nlh, remaining); nlh = NLMSG_NEXT(nlh, remaining)) {
+            const uint32_t index = nlh->nlmsg_seq - firstSeq;
+            if (index >= count || answered[index]) {
+                continue;
+            }
+            if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) {
+                // Both carry an error code, which is 0 on success.
+                int error = 0;
+                if (nlh->nlmsg_len >= NLMSG_LENGTH(sizeof(int))) {
+                    memcpy(&error, NLMSG_DATA(nlh), sizeof(error));
+                }
+                results[index] = error;
+                answered[index] = true;
+                pending--;
+            } else {
+                handler(nlh);
+            }
+        }
+    }
+    return 0;
+}
+
+// Sends a single rtnetlink request, which must be a dump or ask for an ack, and passes every reply
+// other than the ack to |handler|. Returns 0 or a negative errno.
+int sendRtnetlinkRequest(const nlmsghdr *request,
+                         const std::function<void(const nlmsghdr *)>& handler) {
+    std::string batch(reinterpret_cast<const char *>(request), request->nlmsg_len);
+    int result;
+    std::lock_guard<std::mutex> guard(sRtnetlinkLock);
+    int ret = sendRtnetlinkBatchLocked(&batch, 1, &result, handler);
+    return ret ? ret : result;
+}
+
+// Sends |requests|, which must all ask for acks, in as few datagrams as possible. Sets |results|
+// to the result of each request. Returns 0, or a negative errno if not all requests were answered.
+int sendRtnetlinkRequests(const std::vector<std::string>& requests, std::vector<int> *results) {
+    results->assign(requests.size(), 0);
+    std::lock_guard<std::mutex> guard(sRtnetlinkLock);
+    size_t first = 0;
+    while (first < requests.size()) {
+        std::string batch;
+        size_t count = 0;
+        do {
+            batch += requests[first + count];
+            count++;
+        } while (first + count < requests.size() &&
+                 batch.size() + requests[first + count].size() <= RTNETLINK_MAX_BATCH_SIZE);
+        int ret = sendRtnetlinkBatchLocked(&batch, count, &(*results)[first],
+                                           [] (const nlmsghdr *) {});
+        if (ret) {
+            return ret;
+        }
+        first += count;
+    }
+    return 0;
+}
+
+// Starts an rtnetlink request with a fixed header of type T.
+template <typename T>
+std::string newRtnetlinkRequest(uint16_t type, uint16_t flags, const T& header) {
+    nlmsghdr nlh;
+    memset(&nlh, 0, sizeof(nlh));
+    nlh.nlmsg_len = NLMSG_LENGTH(sizeof(T));
+    nlh.nlmsg_type = type;
+    nlh.nlmsg_flags = flags;
+    std::string request(reinterpret_cast<const char *>(&nlh), sizeof(nlh));
+    request.append(reinterpret_cast<const char *>(&header), sizeof(T));
+    request.resize(NLMSG_ALIGN(request.size()), '\0');
+    return request;
+}
+
+// Appends an attribute to a request started by newRtnetlinkRequest().
+void addAttribute(std::string *request, uint16_t type, const void *data, size_t len) {
+    rtattr rta;
+    rta.rta_len = RTA_LENGTH(len);
+    rta.rta_type = type;
+    request->append(reinterpret_cast<const char *>(&rta), sizeof(rta));
+    request->append(reinterpret_cast<const char *>(data), len);
+    request->resize(NLMSG_ALIGN(request->size()), '\0');
+    reinterpret_cast<nlmsghdr *>(&(*request)[0])->nlmsg_len = request->size();
+}
+
+// Builds an RTM_NEWADDR or RTM_DELADDR request, the same way as libnetutils does. Returns 0 or a
+// negative errno.
+int makeAddressRequest(uint16_t type, unsigned ifindex, const char *addrString, int prefixLength,
+                       std::string *request) {
+    uint8_t addr[sizeof(in6_addr)];
+    ifaddrmsg ifa;
+    memset(&ifa, 0, sizeof(ifa));
+    size_t addrlen;
+    if (inet_pton(AF_INET, addrString, addr) == 1) {
+        ifa.ifa_family = AF_INET;
+        addrlen = sizeof(in_addr);
+    } else if (inet_pton(AF_INET6, addrString, addr) == 1) {
+        ifa.ifa_family = AF_INET6;
+        addrlen = sizeof(in6_addr);
+    } else {
+        return -EINVAL;
+    }
+    if (prefixLength < 0 || prefixLength > (int) addrlen * 8) {
+        return -EINVAL;
+    }
+    ifa.ifa_prefixlen = prefixLength;
+    ifa.ifa_index = ifindex;
+
+    uint16_t flags = NLM_F_REQUEST | NLM_F_ACK;
+    if (type == RTM_NEWADDR) {
+        flags |= NLM_F_CREATE | NLM_F_REPLACE;
+    }
+    *request = newRtnetlinkRequest(type, flags, ifa);
+    addAttribute(request, IFA_LOCAL, addr, addrlen);
+    if (ifa.ifa_family == AF_INET) {
+        in_addr broadcast;
+        memcpy(&broadcast, addr, sizeof(broadcast));
+        if (prefixLength < 32) {
+            broadcast.s_addr |= htonl(0xffffffffU >> prefixLength);
+        }
+        addAttribute(request, IFA_BROADCAST, &broadcast, sizeof(broadcast));
+    }
+    return 0;
+}
+
+// Builds an RTM_NEWLINK request that sets the MTU, unless |mtu| is 0, and changes the flags.
+std::string makeLinkRequest(unsigned ifindex, int mtu, unsigned flagsToSet,
+                            unsigned flagsToClear) {
+    ifinfomsg ifi;
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = ifindex;
+    ifi.ifi_flags = flagsToSet;
+    ifi.ifi_change = flagsToSet | flagsToClear;
+    std::string request = newRtnetlinkRequest(RTM_NEWLINK, NLM_F_REQUEST | NLM_F_ACK, ifi);
+    if (mtu > 0) {
+        uint32_t value = mtu;
+        addAttribute(&request, IFLA_MTU, &value, sizeof(value));
+    }
+    return request;
+}
+
+// Adds or removes |addresses| on |interface| in one batch. Returns 0 or a negative errno.
+int modifyAddresses(uint16_t type, const char *interface,
+                    const std::vector<InterfaceController::InterfaceAddress>& addresses,
+                    std::vector<int> *results) {
+    unsigned ifindex = if_nametoindex(interface);
+    if (ifindex == 0) {
+        return -ENODEV;
+    }
+
+    results->assign(addresses.size(), 0);
+    std::vector<std::string> requests;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < addresses.size(); i++) {
+        std::string request;
+        int ret = makeAddressRequest(type, ifindex, addresses[i].address.c_str(),
+                                     addresses[i].prefixLength, &request);
+        if (ret) {
+            (*results)[i] = ret;
+            continue;
+        }
+        requests.push_back(std::move(request));
+        indices.push_back(i);
+    }
+    if (requests.empty()) {
+        return 0;
+    }
+
+    std::vector<int> sent;
+    int ret = sendRtnetlinkRequests(requests, &sent);
+    for (size_t i = 0; i < indices.size(); i++) {
+        (*results)[indices[i]] = sent[i];
+    }
+    return ret;
+}
+
+// Calls |handler| for each attribute of an rtnetlink message whose fixed header is |hdrlen| long.
+void forEachAttribute(const nlmsghdr *nlh, size_t hdrlen,
+                      const std::function<void(const rtattr *)>& handler) {
+    if (nlh->nlmsg_len < NLMSG_LENGTH(hdrlen)) {
+        return;
+    }
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(hdrlen);
+    for (const rtattr *rta = reinterpret_cast<const rtattr *>(
+                 reinterpret_cast<const char *>(NLMSG_DATA(nlh)) + NLMSG_ALIGN(hdrlen));
+         RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        handler(rta);
+    }
+}
+
+std::string getAttributeString(const rtattr *rta) {
+    const char *data = reinterpret_cast<const char *>(RTA_DATA(rta));
+    return std::string(data, strnlen(data, RTA_PAYLOAD(rta)));
+}
+
+}  // namespace
 
-    // When sending traffic via a given interface use only addresses configured
-       // on that interface as possible source addresses.
-    setIPv6UseOutgoingInterfaceAddrsOnly("1");
+void InterfaceController::initializeAll() {
+    // accept_ra_rt_table is interpreted as:
+    //     If == 0: default. Routes go into RT6_TABLE_MAIN.
+    //     If > 0: user set. Routes go into the specified table.
+    //     If < 0: automatic. The absolute value is intepreted as an offset and added to the
+    //             interface ID to get the table. If it's set to -1000, routes from interface ID 5
+    //             will go into table 1005, etc.
+    const std::string routeTable(
+            StringPrintf("%d", -RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX));
+    // Reduce the ARP/ND base reachable time from the default (30sec) to 15sec.
+    const std::string reachableTimeMs(StringPrintf("%u", 15 * 1000));
+
+    // All the settings are applied together, so that each directory is only listed once.
+    sysctlWriter().setOnAllInterfaces({
+        // Initial IPv6 settings.
+        // By default, accept_ra is set to 1 (accept RAs unless forwarding is on) on all
+        // interfaces. This causes RAs to work or not work based on whether forwarding is on, and
+        // causes routes learned from RAs to go away when forwarding is turned on. Make this
+        // behaviour predictable by always setting accept_ra to 2.
+        { ipv6_proc_path, "accept_ra", "2" },
+        { ipv6_proc_path, "accept_ra_rt_table", routeTable },
+        // Enable optimistic DAD for IPv6 addresses on all interfaces.
+        { ipv6_proc_path, "optimistic_dad", "1" },
+        { ipv6_proc_path, "use_optimistic", "1" },
+        // When sending traffic via a given interface use only addresses configured
+        // on that interface as possible source addresses.
+        { ipv6_proc_path, "use_oif_addrs_only", "1" },
+        { ipv4_neigh_conf_dir, "base_reachable_time_ms", reachableTimeMs },
+        { ipv6_neigh_conf_dir, "base_reachable_time_ms", reachableTimeMs },
+    });
 }
 
 int InterfaceController::setEnableIPv6(const char *interface, const int on) {
@@ -204,19 +463,22 @@ int InterfaceController::setIPv6NdOffload(char* interface, const int on) {
     }
 }
 
-void InterfaceController::setAcceptRA(const char *value) {
-    setOnAllInterfaces(ipv6_proc_path, "accept_ra", value);
-}
-
-// |tableOrOffset| is interpreted as:
-//     If == 0: default. Routes go into RT6_TABLE_MAIN.
-//     If > 0: user set. Routes go into the specified table.
-//     If < 0: automatic. The absolute value is intepreted as an offset and added to the interface
-//             ID to get the table. If it's set to -1000, routes from interface ID 5 will go into
-//             table 1005, etc.
-void InterfaceController::setAcceptRARouteTable(int tableOrOffset) {
-    std::string value(StringPrintf("%d", tableOrOffset));
-    setOnAllInterfaces(ipv6_proc_path, "accept_ra_rt_table", value.c_str());
+int InterfaceController::setIPv6Parameters(
+        const char *interface, const std::vector<std::pair<std::string, std::string>>& values) {
+    if (!isIfaceName(interface)) {
+        errno = ENOENT;
+        return -1;
+    }
+    std::vector<SysctlWriter::Setting> settings;
+    for (const auto& value : values) {
+        settings.push_back({ ipv6_proc_path, value.first, value.second });
+    }
+    int ret = sysctlWriter().set(interface, settings);
+    if (ret) {
+        errno = -ret;
+        return -1;
+    }
+    return 0;
 }
 
 int InterfaceController::setMtu(const char *interface, const char *mtu)
@@ -225,17 +487,254 @@ int InterfaceController::setMtu(const char *interface, const char *mtu)
         errno = ENOENT;
         return -1;
     }
-    return writeValueToPath(sys_net_path, interface, "mtu", mtu);
+    char *end;
+    errno = 0;
+    long value = strtol(mtu, &end, 10);
+    if (errno || end == mtu || *end != '\0' || value <= 0 || value > INT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    LinkConfig config;
+    config.mtu = value;
+    LinkConfigResults results;
+    int ret = setLinkConfig(interface, config, &results);
+    if (ret || results.mtu) {
+        errno = ret ? -ret : -results.mtu;
+        return -1;
+    }
+    return 0;
+}
+
+int InterfaceController::setLinkConfig(const char *interface, const LinkConfig& config,
+                                       LinkConfigResults *results) {
+    results->mtu = 0;
+    results->flags = 0;
+    if (config.flagsToSet & config.flagsToClear) {
+        return -EINVAL;
+    }
+    const bool changeMtu = config.mtu > 0;
+    const bool changeFlags = (config.flagsToSet | config.flagsToClear) != 0;
+    if (!changeMtu && !changeFlags) {
+        return 0;
+    }
+    unsigned ifindex = if_nametoindex(interface);
+    if (ifindex == 0) {
+        return -ENODEV;
+    }
+
+    // The kernel applies the MTU before the flags, so a link comes up with its new MTU.
+    std::vector<int> sent;
+    int ret = sendRtnetlinkRequests({
+        makeLinkRequest(ifindex, config.mtu, config.flagsToSet, config.flagsToClear),
+    }, &sent);
+    if (ret || sent[0] == 0) {
+        return ret;
+    }
+    if (!changeMtu || !changeFlags) {
+        (changeMtu ? results->mtu : results->flags) = sent[0];
+        return 0;
+    }
+
+    // The kernel stops at the first attribute that fails, and only says how. Apply each attribute
+    // on its own, in one batch, to find out which ones failed.
+    ret = sendRtnetlinkRequests({
+        makeLinkRequest(ifindex, config.mtu, 0, 0),
+        makeLinkRequest(ifindex, 0, config.flagsToSet, config.flagsToClear),
+    }, &sent);
+    if (ret) {
+        return ret;
+    }
+    results->mtu = sent[0];
+    results->flags = sent[1];
+    return 0;
 }
 
 int InterfaceController::addAddress(const char *interface,
         const char *addrString, int prefixLength) {
-    return ifc_add_address(interface, addrString, prefixLength);
+    std::vector<int> results;
+    int ret = addAddresses(interface, {{ addrString, prefixLength }}, &results);
+    return ret ? ret : results[0];
 }
 
 int InterfaceController::delAddress(const char *interface,
         const char *addrString, int prefixLength) {
-    return ifc_del_address(interface, addrString, prefixLength);
+    std::vector<int> results;
+    int ret = delAddresses(interface, {{ addrString, prefixLength }}, &results);
+    return ret ? ret : results[0];
+}
+
+int InterfaceController::addAddresses(const char *interface,
+        const std::vector<InterfaceAddress>& addresses, std::vector<int> *results) {
+    return modifyAddresses(RTM_NEWADDR, interface, addresses, results);
+}
+
+int InterfaceController::delAddresses(const char *interface,
+        const std::vector<InterfaceAddress>& addresses, std::vector<int> *results) {
+    return modifyAddresses(RTM_DELADDR, interface, addresses, results);
+}
+
+int InterfaceController::clearAddresses(const char *interface, int family, const char *label) {
+    unsigned ifindex = if_nametoindex(interface);
+    if (ifindex == 0) {
+        return -ENODEV;
+    }
+
+    ifaddrmsg ifa;
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = family;
+    std::string dump = newRtnetlinkRequest(RTM_GETADDR, NLM_F_REQUEST | NLM_F_DUMP, ifa);
+
+    // Turn every address of the interface into a request to delete it. With a label, like
+    // SIOCSIFADDR with 0.0.0.0, only the first address with that label is deleted.
+    std::vector<std::string> requests;
+    int ret = sendRtnetlinkRequest(reinterpret_cast<const nlmsghdr *>(dump.data()),
+                                   [ifindex, label, &requests] (const nlmsghdr *nlh) {
+        if (nlh->nlmsg_type != RTM_NEWADDR || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(ifaddrmsg))) {
+            return;
+        }
+        ifaddrmsg ifa = *reinterpret_cast<const ifaddrmsg *>(NLMSG_DATA(nlh));
+        if (ifa.ifa_index != ifindex || (label && !requests.empty())) {
+            return;
+        }
+        std::string request = newRtnetlinkRequest(RTM_DELADDR, NLM_F_REQUEST | NLM_F_ACK, ifa);
+        bool labelMatches = false;
+        forEachAttribute(nlh, sizeof(ifaddrmsg),
+                         [label, &request, &labelMatches] (const rtattr *rta) {
+            if (rta->rta_type == IFA_LOCAL || rta->rta_type == IFA_ADDRESS) {
+                addAttribute(&request, rta->rta_type, RTA_DATA(rta), RTA_PAYLOAD(rta));
+            } else if (rta->rta_type == IFA_LABEL && label) {
+                labelMatches = getAttributeString(rta) == label;
+            }
+        });
+        if (label && !labelMatches) {
+            return;
+        }
+        requests.push_back(std::move(request));
+    });
+    if (ret || requests.empty()) {
+        return ret;
+    }
+
+    std::vector<int> results;
+    ret = sendRtnetlinkRequests(requests, &results);
+    if (ret) {
+        return ret;
+    }
+    for (int result : results) {
+        // Deleting a primary IPv4 address can delete its secondaries along with it.
+        if (result && result != -EADDRNOTAVAIL) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+int InterfaceController::getInterfaceList(std::vector<std::string> *names) {
+    struct {
+        nlmsghdr nlh;
+        ifinfomsg ifi;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = sizeof(request);
+    request.nlh.nlmsg_type = RTM_GETLINK;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.ifi.ifi_family = AF_UNSPEC;
+    return sendRtnetlinkRequest(&request.nlh, [names] (const nlmsghdr *nlh) {
+        if (nlh->nlmsg_type != RTM_NEWLINK) {
+            return;
+        }
+        forEachAttribute(nlh, sizeof(ifinfomsg), [names] (const rtattr *rta) {
+            if (rta->rta_type == IFLA_IFNAME) {
+                names->push_back(getAttributeString(rta));
+            }
+        });
+    });
+}
+
+int InterfaceController::getInterfaceConfig(const char *interface, InterfaceConfig *config) {
+    size_t nameLen = strlen(interface);
+    if (nameLen == 0 || nameLen >= IFNAMSIZ) {
+        return -ENODEV;
+    }
+    memset(config, 0, sizeof(*config));
+
+    // Looking the link up by name gives its index, flags and hardware address.
+    struct {
+        nlmsghdr nlh;
+        ifinfomsg ifi;
+        rtattr nameAttr;
+        char name[IFNAMSIZ];
+    } linkRequest;
+    memset(&linkRequest, 0, sizeof(linkRequest));
+    linkRequest.nameAttr.rta_type = IFLA_IFNAME;
+    linkRequest.nameAttr.rta_len = RTA_LENGTH(nameLen + 1);
+    memcpy(linkRequest.name, interface, nameLen);
+    linkRequest.nlh.nlmsg_len =
+            NLMSG_LENGTH(sizeof(ifinfomsg)) + RTA_ALIGN(RTA_LENGTH(nameLen + 1));
+    linkRequest.nlh.nlmsg_type = RTM_GETLINK;
+    linkRequest.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    linkRequest.ifi.ifi_family = AF_UNSPEC;
+
+    int ifindex = 0;
+    int ret = sendRtnetlinkRequest(&linkRequest.nlh, [config, &ifindex] (const nlmsghdr *nlh) {
+        if (nlh->nlmsg_type != RTM_NEWLINK || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(ifinfomsg))) {
+            return;
+        }
+        const ifinfomsg *ifi = reinterpret_cast<const ifinfomsg *>(NLMSG_DATA(nlh));
+        ifindex = ifi->ifi_index;
+        config->flags = ifi->ifi_flags;
+        forEachAttribute(nlh, sizeof(ifinfomsg), [config] (const rtattr *rta) {
+            if (rta->rta_type == IFLA_ADDRESS && RTA_PAYLOAD(rta) == sizeof(config->hwaddr)) {
+                memcpy(config->hwaddr, RTA_DATA(rta), sizeof(config->hwaddr));
+            }
+        });
+    });
+    if (ret) {
+        return ret;
+    }
+    if (ifindex == 0) {
+        return -ENODEV;
+    }
+
+    // Like SIOCGIFADDR, report the first address labelled with the interface's name. Primary
+    // addresses come before secondary ones in the dump.
+    struct {
+        nlmsghdr nlh;
+        ifaddrmsg ifa;
+    } addrRequest;
+    memset(&addrRequest, 0, sizeof(addrRequest));
+    addrRequest.nlh.nlmsg_len = sizeof(addrRequest);
+    addrRequest.nlh.nlmsg_type = RTM_GETADDR;
+    addrRequest.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    addrRequest.ifa.ifa_family = AF_INET;
+    bool found = false;
+    return sendRtnetlinkRequest(&addrRequest.nlh,
+                                [config, ifindex, interface, &found] (const nlmsghdr *nlh) {
+        if (found || nlh->nlmsg_type != RTM_NEWADDR ||
+            nlh->nlmsg_len < NLMSG_LENGTH(sizeof(ifaddrmsg))) {
+            return;
+        }
+        const ifaddrmsg *ifa = reinterpret_cast<const ifaddrmsg *>(NLMSG_DATA(nlh));
+        if ((int) ifa->ifa_index != ifindex || ifa->ifa_family != AF_INET) {
+            return;
+        }
+        bool labelMatches = true;
+        in_addr local = {};
+        bool haveLocal = false;
+        forEachAttribute(nlh, sizeof(ifaddrmsg), [&] (const rtattr *rta) {
+            if (rta->rta_type == IFA_LABEL) {
+                labelMatches = getAttributeString(rta) == interface;
+            } else if (rta->rta_type == IFA_LOCAL && RTA_PAYLOAD(rta) == sizeof(local)) {
+                memcpy(&local, RTA_DATA(rta), sizeof(local));
+                haveLocal = true;
+            }
+        });
+        if (labelMatches && haveLocal) {
+            config->addr = local;
+            config->prefixLength = ifa->ifa_prefixlen;
+            found = true;
+        }
+    });
 }
 
 int InterfaceController::getParameter(
@@ -255,16 +754,8 @@ int InterfaceController::setParameter(
     if (path.empty()) {
         return -errno;
     }
-    return WriteStringToFile(value, path) ? 0 : -errno;
-}
-
-void InterfaceController::setBaseReachableTimeMs(unsigned int millis) {
-    std::string value(StringPrintf("%u", millis));
-    setOnAllInterfaces(ipv4_neigh_conf_dir, "base_reachable_time_ms", value.c_str());
-    setOnAllInterfaces(ipv6_neigh_conf_dir, "base_reachable_time_ms", value.c_str());
-}
-
-void InterfaceController::setIPv6OptimisticMode(const char *value) {
-    setOnAllInterfaces(ipv6_proc_path, "optimistic_dad", value);
-    setOnAllInterfaces(ipv6_proc_path, "use_optimistic", value);
+    // Always written, since the caller may be correcting a value that changed behind netd's back,
+    // but through the same writer as the other settings so that it does not skip the next write.
+    const std::string directory(StringPrintf("%s/%s/%s", proc_net_path, family, which));
+    return sysctlWriter().setUncached(interface, { directory, parameter, value });
 }
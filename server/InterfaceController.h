@@ -17,10 +17,44 @@
 #ifndef _INTERFACE_CONTROLLER_H
 #define _INTERFACE_CONTROLLER_H
 
+#include <netinet/in.h>
+#include <stdint.h>
+
 #include <string>
+#include <utility>
+#include <vector>
 
 class InterfaceController {
 public:
+    struct InterfaceConfig {
+        uint8_t hwaddr[6];
+        // The primary IPv4 address of the interface, or 0.0.0.0 if it has none.
+        in_addr addr;
+        int prefixLength;
+        // The same flags as SIOCGIFFLAGS returns.
+        unsigned flags;
+    };
+
+    struct InterfaceAddress {
+        std::string address;
+        int prefixLength;
+    };
+
+    // Link settings applied by setLinkConfig().
+    struct LinkConfig {
+        // 0 leaves the MTU unchanged.
+        int mtu = 0;
+        // IFF_* flags, e.g. IFF_UP to bring the link up.
+        unsigned flagsToSet = 0;
+        unsigned flagsToClear = 0;
+    };
+
+    // 0, or a negative errno, for each part of a LinkConfig. 0 for the parts that were not set.
+    struct LinkConfigResults {
+        int mtu;
+        int flags;
+    };
+
     static void initializeAll();
 
     static int setEnableIPv6(const char *interface, const int on);
@@ -29,9 +63,34 @@ public:
     static int setIPv6DadTransmits(const char *interface, const char *value);
     static int setIPv6PrivacyExtensions(const char *interface, const int on);
     static int setIPv6NdOffload(char* interface, const int on);
+    // Writes several /proc/sys/net/ipv6/conf/<interface>/ values in the order given, skipping the
+    // ones that netd already set to the same value. Stops at the first failure.
+    static int setIPv6Parameters(
+            const char *interface, const std::vector<std::pair<std::string, std::string>>& values);
     static int setMtu(const char *interface, const char *mtu);
+    // Applies |config| with a single RTM_NEWLINK request, and sets |results| to the result of each
+    // part of it. Returns a negative errno if |config| could not be applied at all, e.g. because
+    // the interface does not exist.
+    static int setLinkConfig(const char *interface, const LinkConfig& config,
+                             LinkConfigResults *results);
     static int addAddress(const char *interface, const char *addrString, int prefixLength);
     static int delAddress(const char *interface, const char *addrString, int prefixLength);
+    // Add or remove several addresses with one batch of rtnetlink requests. Each element of
+    // |results| is set to 0 or a negative errno for the corresponding address. Returns a negative
+    // errno if the batch could not be applied at all.
+    static int addAddresses(const char *interface, const std::vector<InterfaceAddress>& addresses,
+                            std::vector<int> *results);
+    static int delAddresses(const char *interface, const std::vector<InterfaceAddress>& addresses,
+                            std::vector<int> *results);
+    // Removes all addresses of |family|, or of all families if it is AF_UNSPEC. If |label| is set,
+    // only removes the first IPv4 address with that label, as SIOCSIFADDR with 0.0.0.0 does.
+    static int clearAddresses(const char *interface, int family, const char *label = nullptr);
+
+    // Lists all interfaces with a single rtnetlink dump.
+    static int getInterfaceList(std::vector<std::string> *names);
+    // Reads the hardware address, primary IPv4 address and flags of an interface over rtnetlink.
+    // Returns -ENODEV if it does not exist.
+    static int getInterfaceConfig(const char *interface, InterfaceConfig *config);
 
     // Read and write values in files of the form:
     //     /proc/sys/net/<family>/<which>/<interface>/<parameter>
@@ -43,11 +102,6 @@ public:
             const char *value);
 
 private:
-    static void setAcceptRA(const char* value);
-    static void setAcceptRARouteTable(int tableOrOffset);
-    static void setBaseReachableTimeMs(unsigned int millis);
-    static void setIPv6OptimisticMode(const char *value);
-
     InterfaceController() = delete;
     ~InterfaceController() = delete;
 };
@@ -33,6 +33,7 @@
 IptablesBaseTest::IptablesBaseTest() {
     sCmds.clear();
     sRestoreCmds.clear();
+    sRestoreFailAt = -1;
 }
 
 int IptablesBaseTest::fake_android_fork_exec(int argc, char* argv[], int *status, bool, bool) {
@@ -87,6 +88,12 @@ int IptablesBaseTest::fakeExecIptablesRestore(IptablesTarget target, const std::
     return 0;
 }
 
+int IptablesBaseTest::fakeFailingIptablesRestore(IptablesTarget target,
+                                                 const std::string& commands) {
+    fakeExecIptablesRestore(target, commands);
+    return ((int) sRestoreCmds.size() - 1 == sRestoreFailAt) ? -1 : 0;
+}
+
 int IptablesBaseTest::expectIptablesCommand(IptablesTarget target, int pos,
                                             const std::string& cmd) {
 
@@ -159,4 +166,5 @@ void IptablesBaseTest::expectIptablesRestoreCommands(const ExpectedIptablesComma
 
 std::vector<std::string> IptablesBaseTest::sCmds = {};
 IptablesBaseTest::ExpectedIptablesCommands IptablesBaseTest::sRestoreCmds = {};
+int IptablesBaseTest::sRestoreFailAt = -1;
 std::deque<std::string> IptablesBaseTest::sPopenContents = {};
@@ -30,6 +30,8 @@ public:
     static int fake_android_fork_execvp(int argc, char* argv[], int *status, bool, bool);
     static int fakeExecIptables(IptablesTarget target, ...);
     static int fakeExecIptablesRestore(IptablesTarget target, const std::string& commands);
+    // Like fakeExecIptablesRestore, but the call at index sRestoreFailAt fails.
+    static int fakeFailingIptablesRestore(IptablesTarget target, const std::string& commands);
     static FILE *fake_popen(const char *cmd, const char *type);
     void expectIptablesCommands(const std::vector<std::string>& expectedCmds);
     void expectIptablesCommands(const ExpectedIptablesCommands& expectedCmds);
@@ -40,6 +42,8 @@ public:
 protected:
     static std::vector<std::string> sCmds;
     static ExpectedIptablesCommands sRestoreCmds;
+    // Index of the iptables-restore call that fakeFailingIptablesRestore fails, or -1.
+    static int sRestoreFailAt;
     static std::deque<std::string> sPopenContents;
     int expectIptablesCommand(IptablesTarget target, int pos, const std::string& cmd);
 };
@@ -22,7 +22,7 @@
 #include <netinet/in.h>
 #include <pthread.h>
 #include <stdlib.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <string.h>
@@ -46,8 +46,18 @@
 
 MDnsSdListener::MDnsSdListener() :
                  FrameworkListener("mdns", true) {
-    Monitor *m = new Monitor();
-    registerCmd(new Handler(m, this));
+    mMonitor = new Monitor();
+    registerCmd(new Handler(mMonitor, this));
+}
+
+bool MDnsSdListener::onDataAvailable(SocketClient *c) {
+    bool connected = FrameworkListener::onDataAvailable(c);
+    if (!connected) {
+        // The client is about to be released. Stop any requests it left running, or they would
+        // keep their mdnsd connections open until netd restarts.
+        mMonitor->freeServiceRefsOwnedBy(c);
+    }
+    return connected;
 }
 
 MDnsSdListener::Handler::Handler(Monitor *m, MDnsSdListener *listener) :
@@ -70,7 +80,7 @@ void MDnsSdListener::Handler::discover(SocketClient *cli,
                 requestFlags);
     }
     Context *context = new Context(requestId, mListener);
-    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context);
+    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context, cli);
     if (ref == NULL) {
         ALOGE("requestId %d already in use during discover call", requestId);
         cli->sendMsg(ResponseCode::CommandParameterError,
@@ -146,7 +156,7 @@ void MDnsSdListener::Handler::stop(SocketClient *cli, int argc, char **argv, con
         return;
     }
     if (VDBG) ALOGD("Stopping %s with ref %p", str, ref);
-    mMonitor->deallocateServiceRef(ref);
+    mMonitor->deallocateServiceRef(requestId);
     mMonitor->freeServiceRef(requestId);
     char *msg;
     asprintf(&msg, "%s stopped", str);
@@ -162,7 +172,7 @@ void MDnsSdListener::Handler::serviceRegister(SocketClient *cli, int requestId,
                 interfaceName, serviceName, serviceType, domain, host, port, txtLen);
     }
     Context *context = new Context(requestId, mListener);
-    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context);
+    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context, cli);
     port = htons(port);
     if (ref == NULL) {
         ALOGE("requestId %d already in use during register call", requestId);
@@ -218,7 +228,7 @@ void MDnsSdListener::Handler::resolveService(SocketClient *cli, int requestId,
                 serviceName, regType, domain);
     }
     Context *context = new Context(requestId, mListener);
-    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context);
+    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context, cli);
     if (ref == NULL) {
         ALOGE("request Id %d already in use during resolve call", requestId);
         cli->sendMsg(ResponseCode::CommandParameterError,
@@ -284,7 +294,7 @@ void MDnsSdListener::Handler::getAddrInfo(SocketClient *cli, int requestId,
         const char *interfaceName, uint32_t protocol, const char *hostname) {
     if (VDBG) ALOGD("getAddrInfo(%d, %s %d, %s)", requestId, interfaceName, protocol, hostname);
     Context *context = new Context(requestId, mListener);
-    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context);
+    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context, cli);
     if (ref == NULL) {
         ALOGE("request ID %d already in use during getAddrInfo call", requestId);
         cli->sendMsg(ResponseCode::CommandParameterError,
@@ -344,7 +354,7 @@ void MDnsSdListener::Handler::setHostname(SocketClient *cli, int requestId,
         const char *hostname) {
     if (VDBG) ALOGD("setHostname(%d, %s)", requestId, hostname);
     Context *context = new Context(requestId, mListener);
-    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context);
+    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context, cli);
     if (ref == NULL) {
         ALOGE("request Id %d already in use during setHostname call", requestId);
         cli->sendMsg(ResponseCode::CommandParameterError,
@@ -516,13 +526,8 @@ int MDnsSdListener::Handler::runCommand(SocketClient *cli,
 }
 
 MDnsSdListener::Monitor::Monitor() {
-    mHead = NULL;
-    mLiveCount = 0;
-    mPollFds = NULL;
-    mPollRefs = NULL;
-    mPollSize = 10;
-    socketpair(AF_LOCAL, SOCK_STREAM, 0, mCtrlSocketPair);
-    pthread_mutex_init(&mHeadMutex, NULL);
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    LOG_ALWAYS_FATAL_IF((mEpollFd == -1), "epoll_create1 failed: %s", strerror(errno));
 
     pthread_create(&mThread, NULL, MDnsSdListener::Monitor::threadStart, this);
     pthread_detach(mThread);
@@ -561,7 +566,7 @@ static int wait_for_property(const char *name, const char *desired_value, int ma
 int MDnsSdListener::Monitor::startService() {
     int result = 0;
     char property_value[PROPERTY_VALUE_MAX];
-    pthread_mutex_lock(&mHeadMutex);
+    std::lock_guard<std::mutex> lock(mHeadMutex);
     property_get(MDNS_SERVICE_STATUS, property_value, "");
     if (strcmp("running", property_value) != 0) {
         ALOGD("Starting MDNSD");
@@ -571,14 +576,13 @@ int MDnsSdListener::Monitor::startService() {
     } else {
         result = 0;
     }
-    pthread_mutex_unlock(&mHeadMutex);
     return result;
 }
 
 int MDnsSdListener::Monitor::stopService() {
     int result = 0;
-    pthread_mutex_lock(&mHeadMutex);
-    if (mHead == NULL) {
+    std::lock_guard<std::mutex> lock(mHeadMutex);
+    if (mElements.empty()) {
         ALOGD("Stopping MDNSD");
         property_set("ctl.stop", MDNS_SERVICE_NAME);
         wait_for_property(MDNS_SERVICE_STATUS, "stopped", 5);
@@ -586,195 +590,153 @@ int MDnsSdListener::Monitor::stopService() {
     } else {
         result = 0;
     }
-    pthread_mutex_unlock(&mHeadMutex);
     return result;
 }
 
 void MDnsSdListener::Monitor::run() {
-    int pollCount = 1;
-
-    mPollFds = (struct pollfd *)calloc(sizeof(struct pollfd), mPollSize);
-    mPollRefs = (DNSServiceRef **)calloc(sizeof(DNSServiceRef *), mPollSize);
-    LOG_ALWAYS_FATAL_IF((mPollFds == NULL), "initial calloc failed on mPollFds with a size of %d",
-            ((int)sizeof(struct pollfd)) * mPollSize);
-    LOG_ALWAYS_FATAL_IF((mPollRefs == NULL), "initial calloc failed on mPollRefs with a size of %d",
-            ((int)sizeof(DNSServiceRef *)) * mPollSize);
-
-    mPollFds[0].fd = mCtrlSocketPair[0];
-    mPollFds[0].events = POLLIN;
+    static const int kMaxEvents = 16;
+    struct epoll_event events[kMaxEvents];
 
     if (VDBG) ALOGD("MDnsSdListener starting to monitor");
     while (1) {
-        if (VDBG) ALOGD("Going to poll with pollCount %d", pollCount);
-        int pollResults = poll(mPollFds, pollCount, 10000000);
-        if (pollResults < 0) {
-            ALOGE("Error in poll - got %d", errno);
-        } else if (pollResults > 0) {
-            if (VDBG) ALOGD("Monitor poll got data pollCount = %d, %d", pollCount, pollResults);
-            for(int i = 1; i < pollCount; i++) {
-                if (mPollFds[i].revents != 0) {
-                    if (VDBG) {
-                        ALOGD("Monitor found [%d].revents = %d - calling ProcessResults",
-                                i, mPollFds[i].revents);
-                    }
-                    pthread_mutex_lock(&mHeadMutex);
-                    DNSServiceProcessResult(*(mPollRefs[i]));
-                    pthread_mutex_unlock(&mHeadMutex);
-                    mPollFds[i].revents = 0;
-                }
-            }
-            if (VDBG) ALOGD("controlSocket shows revent= %d", mPollFds[0].revents);
-            switch (mPollFds[0].revents) {
-                case POLLIN: {
-                    char readBuf[2];
-                    read(mCtrlSocketPair[0], &readBuf, 1);
-                    if (DBG) ALOGD("MDnsSdListener::Monitor got %c", readBuf[0]);
-                    if (memcmp(RESCAN, readBuf, 1) == 0) {
-                        pollCount = rescan();
-                    }
-                }
-            }
-            mPollFds[0].revents = 0;
-        } else {
-            if (VDBG) ALOGD("MDnsSdListener::Monitor poll timed out");
+        int eventCount = epoll_wait(mEpollFd, events, kMaxEvents, -1);
+        if (eventCount < 0) {
+            if (errno != EINTR) ALOGE("Error in epoll_wait - got %d", errno);
+            continue;
+        }
+        if (VDBG) ALOGD("Monitor epoll got %d events", eventCount);
+        for (int i = 0; i < eventCount; i++) {
+            processResult(events[i].data.u64);
         }
     }
-    free(mPollFds);
-    free(mPollRefs);
 }
 
-#define DBG_RESCAN 0
-
-int MDnsSdListener::Monitor::rescan() {
-// rescan the list from mHead and make new pollfds and serviceRefs
-    if (VDBG) {
-        ALOGD("MDnsSdListener::Monitor poll rescanning - size=%d, live=%d", mPollSize, mLiveCount);
-    }
-    pthread_mutex_lock(&mHeadMutex);
-    Element **prevPtr = &mHead;
-    int i = 1;
-    if (mPollSize <= mLiveCount) {
-        mPollSize = mLiveCount + 5;
-        free(mPollFds);
-        free(mPollRefs);
-        mPollFds = (struct pollfd *)calloc(sizeof(struct pollfd), mPollSize);
-        mPollRefs = (DNSServiceRef **)calloc(sizeof(DNSServiceRef *), mPollSize);
-        LOG_ALWAYS_FATAL_IF((mPollFds == NULL), "calloc failed on mPollFds with a size of %d",
-                ((int)sizeof(struct pollfd)) * mPollSize);
-        LOG_ALWAYS_FATAL_IF((mPollRefs == NULL), "calloc failed on mPollRefs with a size of %d",
-                ((int)sizeof(DNSServiceRef *)) * mPollSize);
-    } else {
-        memset(mPollFds, 0, sizeof(struct pollfd) * mPollSize);
-        memset(mPollRefs, 0, sizeof(DNSServiceRef *) * mPollSize);
-    }
-    mPollFds[0].fd = mCtrlSocketPair[0];
-    mPollFds[0].events = POLLIN;
-    if (DBG_RESCAN) ALOGD("mHead = %p", mHead);
-    while (*prevPtr != NULL) {
-        if (DBG_RESCAN) ALOGD("checking %p, mReady = %d", *prevPtr, (*prevPtr)->mReady);
-        if ((*prevPtr)->mReady == 1) {
-            int fd = DNSServiceRefSockFD((*prevPtr)->mRef);
-            if (fd != -1) {
-                if (DBG_RESCAN) ALOGD("  adding FD %d", fd);
-                mPollFds[i].fd = fd;
-                mPollFds[i].events = POLLIN;
-                mPollRefs[i] = &((*prevPtr)->mRef);
-                i++;
-            } else {
-                ALOGE("Error retreving socket FD for live ServiceRef");
-            }
-            prevPtr = &((*prevPtr)->mNext); // advance to the next element
-        } else if ((*prevPtr)->mReady == -1) {
-            if (DBG_RESCAN) ALOGD("  removing %p from  play", *prevPtr);
-            Element *cur = *prevPtr;
-            *prevPtr = (cur)->mNext; // change our notion of this element and don't advance
-            delete cur;
-        } else if ((*prevPtr)->mReady == 0) {
-            // Not ready so just skip this node and continue on
-            if (DBG_RESCAN) ALOGD("%p not ready.  Continuing.", *prevPtr);
-            prevPtr = &((*prevPtr)->mNext);
+void MDnsSdListener::Monitor::processResult(uint64_t key) {
+    std::shared_ptr<Element> e;
+    {
+        std::lock_guard<std::mutex> lock(mHeadMutex);
+        std::shared_ptr<Element> *found = mElements.get(ElementTable::Handle::fromKey(key));
+        if (found == nullptr) {
+            // Freed (and possibly the slot reused) since the event was reported.
+            return;
         }
+        e = *found;
+    }
+
+    std::lock_guard<std::mutex> lock(e->mLock);
+    if (!e->mMonitored || e->mRef == nullptr) {
+        return;
+    }
+    if (VDBG) ALOGD("Monitor calling ProcessResults for %d", e->mId);
+    DNSServiceErrorType result = DNSServiceProcessResult(e->mRef);
+    if (result != kDNSServiceErr_NoError) {
+        // Most likely mdnsd closed the connection. Stop watching the socket, otherwise it will
+        // stay readable and we will spin.
+        ALOGE("DNSServiceProcessResult for %d failed: %d", e->mId, result);
+        stopMonitoringLocked(e.get());
     }
-    pthread_mutex_unlock(&mHeadMutex);
-    return i;
 }
 
-DNSServiceRef *MDnsSdListener::Monitor::allocateServiceRef(int id, Context *context) {
-    if (lookupServiceRef(id) != NULL) {
-        delete(context);
+std::shared_ptr<MDnsSdListener::Monitor::Element> MDnsSdListener::Monitor::findElement(int id) {
+    std::lock_guard<std::mutex> lock(mHeadMutex);
+    std::shared_ptr<Element> *e = mElements.find(id);
+    return (e != nullptr) ? *e : nullptr;
+}
+
+DNSServiceRef *MDnsSdListener::Monitor::allocateServiceRef(int id, Context *context,
+        SocketClient *owner) {
+    std::shared_ptr<Element> e = std::make_shared<Element>(id, context);
+    ElementTable::Handle handle;
+    std::lock_guard<std::mutex> lock(mHeadMutex);
+    if (!mElements.insert(id, owner, e, &handle)) {
         return NULL;
     }
-    Element *e = new Element(id, context);
-    pthread_mutex_lock(&mHeadMutex);
-    e->mNext = mHead;
-    mHead = e;
-    pthread_mutex_unlock(&mHeadMutex);
+    e->mKey = handle.toKey();
     return &(e->mRef);
 }
 
 DNSServiceRef *MDnsSdListener::Monitor::lookupServiceRef(int id) {
-    pthread_mutex_lock(&mHeadMutex);
-    Element *cur = mHead;
-    while (cur != NULL) {
-        if (cur->mId == id) {
-            DNSServiceRef *result = &(cur->mRef);
-            pthread_mutex_unlock(&mHeadMutex);
-            return result;
-        }
-        cur = cur->mNext;
-    }
-    pthread_mutex_unlock(&mHeadMutex);
-    return NULL;
+    std::shared_ptr<Element> e = findElement(id);
+    return (e != nullptr) ? &(e->mRef) : NULL;
 }
 
 void MDnsSdListener::Monitor::startMonitoring(int id) {
     if (VDBG) ALOGD("startMonitoring %d", id);
-    pthread_mutex_lock(&mHeadMutex);
-    Element *cur = mHead;
-    while (cur != NULL) {
-        if (cur->mId == id) {
-            if (DBG_RESCAN) ALOGD("marking %p as ready to be added", cur);
-            mLiveCount++;
-            cur->mReady = 1;
-            pthread_mutex_unlock(&mHeadMutex);
-            write(mCtrlSocketPair[1], RESCAN, 1);  // trigger a rescan for a fresh poll
-            if (VDBG) ALOGD("triggering rescan");
-            return;
-        }
-        cur = cur->mNext;
+    std::shared_ptr<Element> e = findElement(id);
+    if (e == nullptr) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(e->mLock);
+    int fd = DNSServiceRefSockFD(e->mRef);
+    if (fd == -1) {
+        ALOGE("Error retreving socket FD for live ServiceRef");
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = e->mKey;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        ALOGE("Failed to monitor ServiceRef %d: %s", id, strerror(errno));
+        return;
+    }
+    e->mMonitored = true;
+}
+
+void MDnsSdListener::Monitor::stopMonitoringLocked(Element *e) {
+    if (!e->mMonitored) {
+        return;
+    }
+    int fd = DNSServiceRefSockFD(e->mRef);
+    if (fd != -1 && epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+        ALOGE("Failed to stop monitoring ServiceRef %d: %s", e->mId, strerror(errno));
+    }
+    e->mMonitored = false;
+}
+
+void MDnsSdListener::Monitor::deallocateLocked(Element *e) {
+    stopMonitoringLocked(e);
+    if (e->mRef != nullptr) {
+        DNSServiceRefDeallocate(e->mRef);
+        e->mRef = nullptr;
     }
-    pthread_mutex_unlock(&mHeadMutex);
 }
 
 void MDnsSdListener::Monitor::freeServiceRef(int id) {
     if (VDBG) ALOGD("freeServiceRef %d", id);
-    pthread_mutex_lock(&mHeadMutex);
-    Element **prevPtr = &mHead;
-    Element *cur;
-    while (*prevPtr != NULL) {
-        cur = *prevPtr;
-        if (cur->mId == id) {
-            if (DBG_RESCAN) ALOGD("marking %p as ready to be removed", cur);
-            mLiveCount--;
-            if (cur->mReady == 1) {
-                cur->mReady = -1; // tell poll thread to delete
-                write(mCtrlSocketPair[1], RESCAN, 1); // trigger a rescan for a fresh poll
-                if (VDBG) ALOGD("triggering rescan");
-            } else {
-                *prevPtr = cur->mNext;
-                delete cur;
-            }
-            pthread_mutex_unlock(&mHeadMutex);
+    std::shared_ptr<Element> e;
+    {
+        std::lock_guard<std::mutex> lock(mHeadMutex);
+        if (!mElements.erase(id, &e)) {
             return;
         }
-        prevPtr = &(cur->mNext);
     }
-    pthread_mutex_unlock(&mHeadMutex);
+    // If the monitor thread is processing this element, it holds its own reference and the
+    // element is deleted when it is done.
+    std::lock_guard<std::mutex> lock(e->mLock);
+    stopMonitoringLocked(e.get());
+}
+
+void MDnsSdListener::Monitor::deallocateServiceRef(int id) {
+    std::shared_ptr<Element> e = findElement(id);
+    if (e == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(e->mLock);
+    deallocateLocked(e.get());
 }
 
-void MDnsSdListener::Monitor::deallocateServiceRef(DNSServiceRef* ref) {
-    pthread_mutex_lock(&mHeadMutex);
-    DNSServiceRefDeallocate(*ref);
-    *ref = nullptr;
-    pthread_mutex_unlock(&mHeadMutex);
-}
\ No newline at end of file
+void MDnsSdListener::Monitor::freeServiceRefsOwnedBy(SocketClient *owner) {
+    std::vector<std::shared_ptr<Element>> elements;
+    {
+        std::lock_guard<std::mutex> lock(mHeadMutex);
+        elements = mElements.eraseOwnedBy(owner);
+    }
+    if (!elements.empty()) {
+        ALOGD("Client disconnected, stopping %zu mdnssd requests", elements.size());
+    }
+    for (const auto& e : elements) {
+        std::lock_guard<std::mutex> lock(e->mLock);
+        deallocateLocked(e.get());
+    }
+}
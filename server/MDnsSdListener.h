@@ -18,10 +18,15 @@
 #define _MDNSSDLISTENER_H__
 
 #include <pthread.h>
+#include <stdint.h>
 #include <sysutils/FrameworkListener.h>
 #include <dns_sd.h>
 
+#include <memory>
+#include <mutex>
+
 #include "NetdCommand.h"
+#include "RequestTable.h"
 
 // callbacks
 void MDnsSdListenerDiscoverCallback(DNSServiceRef sdRef, DNSServiceFlags flags,
@@ -44,13 +49,16 @@ void MDnsSdListenerGetAddrInfoCallback(DNSServiceRef sdRef, DNSServiceFlags flag
         uint32_t interface, DNSServiceErrorType errorCode, const char *hostname,
         const struct sockaddr *const sa, uint32_t ttl, void *inContext);
 
-#define RESCAN "1"
-
 class MDnsSdListener : public FrameworkListener {
 public:
     MDnsSdListener();
     virtual ~MDnsSdListener() {}
 
+protected:
+    virtual bool onDataAvailable(SocketClient *c);
+
+public:
+
     class Context {
     public:
         MDnsSdListener *mListener;
@@ -69,36 +77,52 @@ public:
     public:
         Monitor();
         virtual ~Monitor() {}
-        DNSServiceRef *allocateServiceRef(int id, Context *c);
+        // Returns NULL if the id is already in use. The request belongs to owner, and is freed by
+        // freeServiceRefsOwnedBy() if it is still running when the owner disconnects.
+        DNSServiceRef *allocateServiceRef(int id, Context *c, SocketClient *owner);
         void startMonitoring(int id);
         DNSServiceRef *lookupServiceRef(int id);
         void freeServiceRef(int id);
         static void *threadStart(void *handler);
         int startService();
         int stopService();
-        void deallocateServiceRef(DNSServiceRef* ref);
+        void deallocateServiceRef(int id);
+        void freeServiceRefsOwnedBy(SocketClient *owner);
     private:
-        void run();
-        int rescan(); // returns the number of elements in the poll
         class Element {
         public:
-            int mId;
-            Element *mNext;
-            DNSServiceRef mRef;
-            Context *mContext;
-            int mReady;
             Element(int id, Context *context)
-                    : mId(id), mNext(NULL), mContext(context), mReady(0) {}
-            virtual ~Element() { delete(mContext); }
+                    : mId(id), mKey(0), mContext(context), mRef(nullptr), mMonitored(false) {}
+            ~Element() { delete(mContext); }
+
+            const int mId;
+            // The element's handle in mElements, used as its epoll key. Stale epoll events for
+            // an element that has been freed do not find any later element in the same slot.
+            uint64_t mKey;
+            Context *mContext;
+            // Serializes DNSServiceProcessResult() on the monitor thread with
+            // DNSServiceRefDeallocate() on the command thread, without blocking other refs.
+            std::mutex mLock;
+            DNSServiceRef mRef;
+            bool mMonitored;
         };
-        Element *mHead;
-        int mLiveCount;
-        struct pollfd *mPollFds;
-        DNSServiceRef **mPollRefs;
-        int mPollSize;
+
+        void run();
+        std::shared_ptr<Element> findElement(int id);
+        void processResult(uint64_t key);
+        void stopMonitoringLocked(Element *e);
+        void deallocateLocked(Element *e);
+
+        typedef RequestTable<std::shared_ptr<Element>, SocketClient *> ElementTable;
+
+        // Owns all elements, indexed by request id and by owning client. The monitor thread takes
+        // a reference to an element while it is processing it, so freeServiceRef() never deletes
+        // an element out from under it.
+        ElementTable mElements;
+        int mEpollFd;
         pthread_t mThread;
-        int mCtrlSocketPair[2];
-        pthread_mutex_t mHeadMutex;
+        // Protects mElements. Never held while processing results.
+        std::mutex mHeadMutex;
     };
 
     class Handler : public NetdCommand {
@@ -134,6 +158,9 @@ public:
         int flagsToI(DNSServiceFlags flags);
         Monitor *mMonitor;
     };
+
+private:
+    Monitor *mMonitor;
 };
 
 #endif
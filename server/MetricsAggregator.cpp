@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <string>
+
+#include <android-base/stringprintf.h>
+
+#include "DumpWriter.h"
+#include "MetricsAggregator.h"
+
+using android::base::StringAppendF;
+
+namespace {
+
+const char* eventTypeName(int32_t type) {
+    switch (type) {
+        case MetricsAggregator::GETADDRINFO:   return "getaddrinfo";
+        case MetricsAggregator::GETHOSTBYNAME: return "gethostbyname";
+        case MetricsAggregator::CONNECT:       return "connect";
+        default:                               return "unknown";
+    }
+}
+
+}  // namespace
+
+constexpr uint32_t MetricsAggregator::kMaxLatencyMs;
+constexpr size_t MetricsAggregator::kTopUids;
+constexpr size_t MetricsAggregator::kMaxKeys;
+constexpr size_t MetricsAggregator::kMaxErrorCodes;
+constexpr size_t MetricsAggregator::kMaxUids;
+
+int MetricsAggregator::latencyToBucket(uint32_t latencyMs) {
+    latencyMs = std::min(latencyMs, kMaxLatencyMs);
+    if (latencyMs < kSubBuckets) {
+        return latencyMs;
+    }
+    // The highest set bit selects the power of two, the next two bits select the sub-bucket.
+    const int log2 = 31 - __builtin_clz(latencyMs);
+    const int sub = (latencyMs >> (log2 - 2)) & (kSubBuckets - 1);
+    return kSubBuckets + (log2 - 2) * kSubBuckets + sub;
+}
+
+uint32_t MetricsAggregator::bucketLowerBound(int bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    const int log2 = (bucket - kSubBuckets) / kSubBuckets + 2;
+    const int sub = (bucket - kSubBuckets) % kSubBuckets;
+    return static_cast<uint32_t>(kSubBuckets + sub) << (log2 - 2);
+}
+
+void MetricsAggregator::recordEvent(int32_t netId, EventType type, int32_t error,
+                                    uint32_t latencyMs, int32_t uid) {
+    std::lock_guard<std::mutex> lock(mLock);
+    const auto key = std::make_pair(netId, static_cast<int32_t>(type));
+    auto it = mStats.find(key);
+    if (it == mStats.end()) {
+        if (mStats.size() >= kMaxKeys) {
+            mDroppedEvents++;
+            return;
+        }
+        it = mStats.insert(std::make_pair(key, Stats())).first;
+    }
+    Stats& stats = it->second;
+    stats.count++;
+    stats.histogram[latencyToBucket(latencyMs)]++;
+    stats.maxMs = std::max(stats.maxMs, std::min(latencyMs, kMaxLatencyMs));
+    if (error != 0) {
+        stats.errors++;
+        auto code = stats.errorCodes.find(error);
+        if (code != stats.errorCodes.end()) {
+            code->second++;
+        } else if (stats.errorCodes.size() < kMaxErrorCodes) {
+            stats.errorCodes[error] = 1;
+        }
+    }
+    // The UID is not known if the event was recorded at REPORTING_LEVEL_METRICS.
+    if (uid >= 0) {
+        countUid(stats.uids, uid);
+    }
+}
+
+void MetricsAggregator::countUid(std::unordered_map<int32_t, uint64_t>& uids, int32_t uid) {
+    auto it = uids.find(uid);
+    if (it != uids.end()) {
+        it->second++;
+        return;
+    }
+    uint64_t count = 1;
+    if (uids.size() >= kMaxUids) {
+        auto least = std::min_element(uids.begin(), uids.end(),
+                [](const std::pair<const int32_t, uint64_t>& a,
+                   const std::pair<const int32_t, uint64_t>& b) {
+                    return a.second < b.second;
+                });
+        count += least->second;
+        uids.erase(least);
+    }
+    uids[uid] = count;
+}
+
+void MetricsAggregator::removeNetwork(int32_t netId) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto begin = mStats.lower_bound(std::make_pair(netId, INT32_MIN));
+    auto end = begin;
+    while (end != mStats.end() && end->first.first == netId) {
+        ++end;
+    }
+    mStats.erase(begin, end);
+}
+
+uint32_t MetricsAggregator::percentile(const Stats& stats, int percent) {
+    // Smallest bucket such that at least |percent|% of events are in it or below it.
+    const uint64_t target = (stats.count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumBuckets; i++) {
+        seen += stats.histogram[i];
+        if (seen >= target && seen > 0) {
+            return bucketLowerBound(i);
+        }
+    }
+    return 0;
+}
+
+MetricsAggregator::Summary MetricsAggregator::summarize(int32_t netId, int32_t type,
+                                                        const Stats& stats) {
+    Summary s;
+    s.netId = netId;
+    s.eventType = type;
+    s.count = stats.count;
+    s.errors = stats.errors;
+    s.p50Ms = percentile(stats, 50);
+    s.p90Ms = percentile(stats, 90);
+    s.p99Ms = percentile(stats, 99);
+    s.maxMs = stats.maxMs;
+    s.histogram.assign(stats.histogram, stats.histogram + kNumBuckets);
+    s.errorCodes.assign(stats.errorCodes.begin(), stats.errorCodes.end());
+
+    s.topUids.assign(stats.uids.begin(), stats.uids.end());
+    const size_t n = std::min(kTopUids, s.topUids.size());
+    std::partial_sort(s.topUids.begin(), s.topUids.begin() + n, s.topUids.end(),
+            [](const std::pair<int32_t, uint64_t>& a, const std::pair<int32_t, uint64_t>& b) {
+                return (a.second != b.second) ? a.second > b.second : a.first < b.first;
+            });
+    s.topUids.resize(n);
+    return s;
+}
+
+std::vector<MetricsAggregator::Summary> MetricsAggregator::getSummaries(bool reset) {
+    std::map<std::pair<int32_t, int32_t>, Stats> stats;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (reset) {
+            stats.swap(mStats);
+        } else {
+            stats = mStats;
+        }
+    }
+
+    // Build the summaries without holding the lock, so that producers are not held up.
+    std::vector<Summary> summaries;
+    summaries.reserve(stats.size());
+    for (const auto& entry : stats) {
+        summaries.push_back(summarize(entry.first.first, entry.first.second, entry.second));
+    }
+    return summaries;
+}
+
+void MetricsAggregator::dump(DumpWriter& dw) {
+    uint64_t droppedEvents;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        droppedEvents = mDroppedEvents;
+    }
+    dw.println("Event metrics: %" PRIu64 " events dropped (more than %zu networks and types)",
+               droppedEvents, kMaxKeys);
+    dw.incIndent();
+    for (const Summary& s : getSummaries(false)) {
+        dw.println("netId=%d %s: count=%" PRIu64 " errors=%" PRIu64 " p50=%ums p90=%ums p99=%ums"
+                   " max=%ums", s.netId, eventTypeName(s.eventType), s.count, s.errors,
+                   s.p50Ms, s.p90Ms, s.p99Ms, s.maxMs);
+        dw.incIndent();
+        if (!s.errorCodes.empty()) {
+            std::string errors;
+            for (const auto& e : s.errorCodes) {
+                StringAppendF(&errors, " %d:%" PRIu64, e.first, e.second);
+            }
+            dw.println("errors:%s", errors.c_str());
+        }
+        if (!s.topUids.empty()) {
+            std::string uids;
+            for (const auto& u : s.topUids) {
+                StringAppendF(&uids, " %d:%" PRIu64, u.first, u.second);
+            }
+            dw.println("top uids:%s", uids.c_str());
+        }
+        dw.decIndent();
+    }
+    dw.decIndent();
+}
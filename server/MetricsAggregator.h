@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_METRICS_AGGREGATOR_H
+#define NETD_SERVER_METRICS_AGGREGATOR_H
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class DumpWriter;
+
+/*
+ * Aggregates DNS and connect events inside netd, so that the framework can fetch summaries instead
+ * of processing every event.
+ *
+ * For each (netId, event type) this keeps a latency histogram, a count of each error code, and a
+ * count of events per UID. Latencies are binned into log-linear buckets, HDR-histogram style: four
+ * buckets per power of two, so each bucket is at most 25% wide relative to its lower bound.
+ *
+ * Memory is bounded even if the summaries are never reset. Events for more than kMaxKeys
+ * (netId, event type) pairs are dropped and counted, and error codes beyond the first
+ * kMaxErrorCodes are only counted in the error total. At most kMaxUids UIDs are tracked per pair;
+ * when another UID shows up, it replaces the least busy one and inherits its count (the
+ * "space-saving" algorithm), so a busy UID is still found but its count may be overestimated.
+ */
+class MetricsAggregator {
+public:
+    // Event types. The DNS types have the same values as INetdEventListener::EVENT_*.
+    enum EventType {
+        GETADDRINFO = 1,
+        GETHOSTBYNAME = 2,
+        CONNECT = 3,
+    };
+
+    // Latencies of 0-3ms have a bucket each. Above that, each power of two is split in four.
+    static constexpr int kSubBuckets = 4;
+    static constexpr uint32_t kMaxLatencyMs = 65535;
+    static constexpr int kNumBuckets = 60;
+    // Number of UIDs reported per (netId, event type).
+    static constexpr size_t kTopUids = 5;
+    static constexpr size_t kMaxKeys = 128;
+    static constexpr size_t kMaxErrorCodes = 32;
+    static constexpr size_t kMaxUids = 64;
+
+    struct Summary {
+        int32_t netId;
+        int32_t eventType;
+        uint64_t count;
+        uint64_t errors;
+        // Lower bounds of the buckets containing these percentiles.
+        uint32_t p50Ms;
+        uint32_t p90Ms;
+        uint32_t p99Ms;
+        uint32_t maxMs;
+        std::vector<uint64_t> histogram;
+        // Error code -> number of events, in ascending order of error code.
+        std::vector<std::pair<int32_t, uint64_t>> errorCodes;
+        // UID -> number of events, busiest UID first.
+        std::vector<std::pair<int32_t, uint64_t>> topUids;
+    };
+
+    MetricsAggregator() = default;
+
+    void recordEvent(int32_t netId, EventType type, int32_t error, uint32_t latencyMs, int32_t uid);
+
+    // Discards everything recorded for a network, e.g., because it was destroyed.
+    void removeNetwork(int32_t netId);
+
+    // Returns one summary per (netId, event type) seen since the last reset, ordered by netId and
+    // then event type. If reset is true, starts a new aggregation period.
+    std::vector<Summary> getSummaries(bool reset);
+
+    void dump(DumpWriter& dw);
+
+    static int latencyToBucket(uint32_t latencyMs);
+    static uint32_t bucketLowerBound(int bucket);
+
+private:
+    struct Stats {
+        uint64_t count = 0;
+        uint64_t errors = 0;
+        uint32_t maxMs = 0;
+        uint64_t histogram[kNumBuckets] = {};
+        std::map<int32_t, uint64_t> errorCodes;
+        std::unordered_map<int32_t, uint64_t> uids;
+    };
+
+    static void countUid(std::unordered_map<int32_t, uint64_t>& uids, int32_t uid);
+    static uint32_t percentile(const Stats& stats, int percent);
+    static Summary summarize(int32_t netId, int32_t type, const Stats& stats);
+
+    std::mutex mLock;
+    std::map<std::pair<int32_t, int32_t>, Stats> mStats;
+    // Events dropped because mStats had kMaxKeys entries.
+    uint64_t mDroppedEvents = 0;
+};
+
+#endif  // NETD_SERVER_METRICS_AGGREGATOR_H
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MetricsAggregatorTest.cpp - unit tests for MetricsAggregator.cpp
+ */
+
+#include <errno.h>
+
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "MetricsAggregator.h"
+
+using Pairs = std::vector<std::pair<int32_t, uint64_t>>;
+
+TEST(MetricsAggregatorTest, TestBuckets) {
+    // Small latencies are exact.
+    for (uint32_t i = 0; i < 4; i++) {
+        EXPECT_EQ(static_cast<int>(i), MetricsAggregator::latencyToBucket(i));
+    }
+    EXPECT_EQ(4, MetricsAggregator::latencyToBucket(4));
+    EXPECT_EQ(7, MetricsAggregator::latencyToBucket(7));
+    EXPECT_EQ(8, MetricsAggregator::latencyToBucket(8));
+    EXPECT_EQ(8, MetricsAggregator::latencyToBucket(9));
+    EXPECT_EQ(9, MetricsAggregator::latencyToBucket(10));
+    EXPECT_EQ(MetricsAggregator::kNumBuckets - 1,
+              MetricsAggregator::latencyToBucket(MetricsAggregator::kMaxLatencyMs));
+    EXPECT_EQ(MetricsAggregator::kNumBuckets - 1,
+              MetricsAggregator::latencyToBucket(10 * MetricsAggregator::kMaxLatencyMs));
+
+    // Every latency falls between its bucket's lower bound and the next bucket's.
+    for (uint32_t ms = 0; ms <= MetricsAggregator::kMaxLatencyMs; ms++) {
+        const int bucket = MetricsAggregator::latencyToBucket(ms);
+        ASSERT_LE(MetricsAggregator::bucketLowerBound(bucket), ms);
+        if (bucket + 1 < MetricsAggregator::kNumBuckets) {
+            ASSERT_GT(MetricsAggregator::bucketLowerBound(bucket + 1), ms);
+        }
+    }
+}
+
+TEST(MetricsAggregatorTest, TestSummaries) {
+    MetricsAggregator metrics;
+    for (int i = 0; i < 100; i++) {
+        metrics.recordEvent(100, MetricsAggregator::GETADDRINFO, 0, (i < 90) ? 10 : 500, 10001);
+    }
+    metrics.recordEvent(100, MetricsAggregator::GETADDRINFO, 7, 2000, 10002);
+    metrics.recordEvent(100, MetricsAggregator::GETADDRINFO, 7, 2000, 10002);
+    metrics.recordEvent(100, MetricsAggregator::GETADDRINFO, 2, 5, -1);
+    metrics.recordEvent(101, MetricsAggregator::CONNECT, ECONNREFUSED, 30, 10003);
+    metrics.recordEvent(100, MetricsAggregator::CONNECT, 0, 30, 10003);
+
+    std::vector<MetricsAggregator::Summary> summaries = metrics.getSummaries(false);
+    ASSERT_EQ(3U, summaries.size());
+
+    const MetricsAggregator::Summary& dns = summaries[0];
+    EXPECT_EQ(100, dns.netId);
+    EXPECT_EQ(MetricsAggregator::GETADDRINFO, dns.eventType);
+    EXPECT_EQ(103U, dns.count);
+    EXPECT_EQ(3U, dns.errors);
+    EXPECT_EQ(10U, dns.p50Ms);
+    EXPECT_EQ(448U, dns.p90Ms);   // 500ms falls in the [448, 512) bucket.
+    EXPECT_EQ(1792U, dns.p99Ms);  // 2000ms falls in the [1792, 2048) bucket.
+    EXPECT_EQ(2000U, dns.maxMs);
+    EXPECT_EQ(static_cast<size_t>(MetricsAggregator::kNumBuckets), dns.histogram.size());
+    EXPECT_EQ(90U, dns.histogram[MetricsAggregator::latencyToBucket(10)]);
+    EXPECT_EQ(Pairs({ {2, 1}, {7, 2} }), dns.errorCodes);
+    // UIDs that were not reported (-1) are not counted.
+    EXPECT_EQ(Pairs({ {10001, 100}, {10002, 2} }), dns.topUids);
+
+    EXPECT_EQ(100, summaries[1].netId);
+    EXPECT_EQ(MetricsAggregator::CONNECT, summaries[1].eventType);
+    EXPECT_EQ(0U, summaries[1].errors);
+
+    EXPECT_EQ(101, summaries[2].netId);
+    EXPECT_EQ(Pairs({ {ECONNREFUSED, 1} }), summaries[2].errorCodes);
+
+    // Reading with reset returns the same data, and then starts again.
+    EXPECT_EQ(3U, metrics.getSummaries(true).size());
+    EXPECT_EQ(0U, metrics.getSummaries(false).size());
+}
+
+TEST(MetricsAggregatorTest, TestTopUidsLimit) {
+    MetricsAggregator metrics;
+    for (int uid = 0; uid < 20; uid++) {
+        for (int i = 0; i <= uid; i++) {
+            metrics.recordEvent(100, MetricsAggregator::GETHOSTBYNAME, 0, 1, 10000 + uid);
+        }
+    }
+    std::vector<MetricsAggregator::Summary> summaries = metrics.getSummaries(false);
+    ASSERT_EQ(1U, summaries.size());
+    EXPECT_EQ(Pairs({ {10019, 20}, {10018, 19}, {10017, 18}, {10016, 17}, {10015, 16} }),
+              summaries[0].topUids);
+}
+
+TEST(MetricsAggregatorTest, TestUidsLimit) {
+    MetricsAggregator metrics;
+    const int32_t busyUid = 20000;
+    for (size_t i = 0; i < MetricsAggregator::kMaxUids; i++) {
+        metrics.recordEvent(100, MetricsAggregator::CONNECT, 0, 1, 10000 + i);
+    }
+    // A UID that only shows up once the table is full is still found.
+    for (int i = 0; i < 10; i++) {
+        metrics.recordEvent(100, MetricsAggregator::CONNECT, 0, 1, busyUid);
+    }
+    std::vector<MetricsAggregator::Summary> summaries = metrics.getSummaries(false);
+    ASSERT_EQ(1U, summaries.size());
+    ASSERT_FALSE(summaries[0].topUids.empty());
+    EXPECT_EQ(busyUid, summaries[0].topUids[0].first);
+    EXPECT_EQ(11U, summaries[0].topUids[0].second);
+    EXPECT_EQ(MetricsAggregator::kMaxUids + 10, summaries[0].count);
+}
+
+TEST(MetricsAggregatorTest, TestKeysLimit) {
+    MetricsAggregator metrics;
+    for (size_t netId = 0; netId < MetricsAggregator::kMaxKeys; netId++) {
+        metrics.recordEvent(netId, MetricsAggregator::GETADDRINFO, 0, 1, 10000);
+    }
+    metrics.recordEvent(1000, MetricsAggregator::GETADDRINFO, 0, 1, 10000);
+    metrics.recordEvent(0, MetricsAggregator::GETADDRINFO, 0, 1, 10000);
+    std::vector<MetricsAggregator::Summary> summaries = metrics.getSummaries(false);
+    ASSERT_EQ(MetricsAggregator::kMaxKeys, summaries.size());
+    EXPECT_EQ(2U, summaries[0].count);
+    EXPECT_NE(1000, summaries.back().netId);
+
+    // Removing a network makes room for another.
+    metrics.removeNetwork(0);
+    metrics.recordEvent(1000, MetricsAggregator::GETADDRINFO, 0, 1, 10000);
+    summaries = metrics.getSummaries(false);
+    ASSERT_EQ(MetricsAggregator::kMaxKeys, summaries.size());
+    EXPECT_EQ(1, summaries[0].netId);
+    EXPECT_EQ(1000, summaries.back().netId);
+}
+
+TEST(MetricsAggregatorTest, TestRemoveNetwork) {
+    MetricsAggregator metrics;
+    metrics.recordEvent(100, MetricsAggregator::GETADDRINFO, 0, 1, 10000);
+    metrics.recordEvent(100, MetricsAggregator::CONNECT, 0, 1, 10000);
+    metrics.recordEvent(101, MetricsAggregator::CONNECT, 0, 1, 10000);
+    metrics.removeNetwork(100);
+    std::vector<MetricsAggregator::Summary> summaries = metrics.getSummaries(false);
+    ASSERT_EQ(1U, summaries.size());
+    EXPECT_EQ(101, summaries[0].netId);
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_MPSC_RING_H
+#define NETD_SERVER_MPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+/*
+ * A bounded, lock-free, multiple-producer single-consumer ring of fixed-size records.
+ *
+ * Any number of threads may call tryPush() concurrently. Only one thread at a time may call
+ * tryPop(). Neither ever blocks: tryPush() fails if the ring is full and tryPop() fails if it is
+ * empty. Each slot carries a sequence number that tells producers and the consumer whether the
+ * slot is free, being written, or ready to be read (D. Vyukov's bounded queue).
+ */
+template <typename T, size_t N>
+class MpscRing {
+public:
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+
+    MpscRing() {
+        for (size_t i = 0; i < N; i++) {
+            mSlots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // Copies |value| into the ring. Returns false if the ring is full.
+    bool tryPush(const T& value) {
+        Slot* slot;
+        size_t pos = mHead.value.load(std::memory_order_relaxed);
+        while (true) {
+            slot = &mSlots[pos & (N - 1)];
+            const size_t seq = slot->seq.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                // The slot is free. Claim it, unless another producer got there first.
+                if (mHead.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The consumer has not yet read the record written one lap ago.
+                return false;
+            } else {
+                pos = mHead.value.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = value;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Moves the oldest record into |value|. Returns false if there is nothing to read.
+    bool tryPop(T* value) {
+        const size_t pos = mTail.value.load(std::memory_order_relaxed);
+        Slot* slot = &mSlots[pos & (N - 1)];
+        const size_t seq = slot->seq.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0) {
+            return false;
+        }
+        *value = slot->value;
+        slot->seq.store(pos + N, std::memory_order_release);
+        mTail.value.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Number of records claimed but not yet read. Only a hint while producers are running.
+    size_t size() const {
+        const size_t head = mHead.value.load(std::memory_order_relaxed);
+        const size_t tail = mTail.value.load(std::memory_order_relaxed);
+        return (head > tail) ? head - tail : 0;
+    }
+
+    static constexpr size_t capacity() { return N; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T value = T();
+    };
+
+    // Producers and the consumer touch different ends of the ring; keep them on separate cache
+    // lines. Padding rather than alignas(), so that rings can be allocated with plain new.
+    static constexpr size_t kCacheLineSize = 64;
+
+    struct Index {
+        std::atomic<size_t> value{0};
+        char padding[kCacheLineSize - sizeof(std::atomic<size_t>)];
+    };
+
+    Index mHead;
+    Index mTail;
+    Slot mSlots[N];
+};
+
+#endif  // NETD_SERVER_MPSC_RING_H
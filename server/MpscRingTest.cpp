@@ -0,0 +1,90 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MpscRingTest.cpp - unit tests for MpscRing.h
+ */
+
+#include <sched.h>
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "MpscRing.h"
+
+TEST(MpscRingTest, TestFifoAndFull) {
+    MpscRing<int, 4> ring;
+    int value;
+    EXPECT_FALSE(ring.tryPop(&value));
+
+    // Go round the ring several times to exercise wraparound.
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 4; i++) {
+            EXPECT_TRUE(ring.tryPush(lap * 10 + i));
+        }
+        EXPECT_FALSE(ring.tryPush(99));
+        EXPECT_EQ(4U, ring.size());
+
+        for (int i = 0; i < 4; i++) {
+            ASSERT_TRUE(ring.tryPop(&value));
+            EXPECT_EQ(lap * 10 + i, value);
+        }
+        EXPECT_FALSE(ring.tryPop(&value));
+        EXPECT_EQ(0U, ring.size());
+    }
+}
+
+TEST(MpscRingTest, TestConcurrentProducers) {
+    struct Record {
+        int producer;
+        int sequence;
+    };
+    constexpr int kProducers = 4;
+    constexpr int kRecordsPerProducer = 20000;
+    MpscRing<Record, 64> ring;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; p++) {
+        producers.emplace_back([&ring, p] {
+            for (int i = 0; i < kRecordsPerProducer; i++) {
+                while (!ring.tryPush({ p, i })) {
+                    sched_yield();
+                }
+            }
+        });
+    }
+
+    // Records from each producer must arrive complete and in order.
+    std::vector<int> next(kProducers, 0);
+    int received = 0;
+    Record record;
+    while (received < kProducers * kRecordsPerProducer) {
+        if (!ring.tryPop(&record)) {
+            sched_yield();
+            continue;
+        }
+        ASSERT_LE(0, record.producer);
+        ASSERT_GT(kProducers, record.producer);
+        ASSERT_EQ(next[record.producer], record.sequence);
+        next[record.producer]++;
+        received++;
+    }
+
+    for (std::thread& t : producers) {
+        t.join();
+    }
+    EXPECT_FALSE(ring.tryPop(&record));
+}
@@ -27,13 +27,17 @@
 #include <string.h>
 #include <cutils/properties.h>
 
+#include <algorithm>
+
 #define LOG_TAG "NatController"
+#include <android-base/stringprintf.h>
 #include <cutils/log.h>
 #include <logwrap/logwrap.h>
 
 #include "NatController.h"
 #include "NetdConstants.h"
 #include "RouteController.h"
+#include "TetherCounters.h"
 
 const char* NatController::LOCAL_FORWARD = "natctrl_FORWARD";
 const char* NatController::LOCAL_MANGLE_FORWARD = "natctrl_mangle_FORWARD";
@@ -41,9 +45,13 @@ const char* NatController::LOCAL_NAT_POSTROUTING = "natctrl_nat_POSTROUTING";
 const char* NatController::LOCAL_RAW_PREROUTING = "natctrl_raw_PREROUTING";
 const char* NatController::LOCAL_TETHER_COUNTERS_CHAIN = "natctrl_tether_counters";
 
+using android::base::StringAppendF;
+using android::base::StringPrintf;
+
 auto NatController::execFunction = android_fork_execvp;
+auto NatController::iptablesRestoreFunction = execIptablesRestore;
 
-NatController::NatController() {
+NatController::NatController(TetherCounters* tetherCounters) : tetherCounters(tetherCounters) {
 }
 
 NatController::~NatController() {
@@ -117,287 +125,160 @@ int NatController::setupIptablesHooks() {
     }
     ifacePairList.clear();
 
+    if (tetherCounters) {
+        tetherCounters->init();
+    }
+
     return 0;
 }
 
 int NatController::setDefaults() {
-    /*
-     * The following only works because:
-     *  - the defaultsCommands[].cmd array is padded with NULL, and
-     *  - the 1st argc of runCmd() will just be the max for the CommandsAndArgs[].cmd, and
-     *  - internally it will be memcopied to an array and terminated with a NULL.
-     */
-    struct CommandsAndArgs defaultCommands[] = {
-        {{IPTABLES_PATH, "-w", "-F", LOCAL_FORWARD,}, 1},
-        {{IP6TABLES_PATH, "-w", "-F", LOCAL_FORWARD,}, 1},
-        {{IPTABLES_PATH, "-w", "-A", LOCAL_FORWARD, "-j", "DROP"}, 1},
-        {{IPTABLES_PATH, "-w", "-t", "nat", "-F", LOCAL_NAT_POSTROUTING}, 1},
-        {{IP6TABLES_PATH, "-w", "-t", "raw", "-F", LOCAL_RAW_PREROUTING}, 1},
-    };
-    for (unsigned int cmdNum = 0; cmdNum < ARRAY_SIZE(defaultCommands); cmdNum++) {
-        if (runCmd(ARRAY_SIZE(defaultCommands[cmdNum].cmd), defaultCommands[cmdNum].cmd) &&
-            defaultCommands[cmdNum].checkRes) {
-                return -1;
-        }
+    std::list<IfacePair> none;
+    int res = 0;
+    res |= iptablesRestoreFunction(V4, makeRestoreCommands(V4, none, {}, true));
+    res |= iptablesRestoreFunction(V6, makeRestoreCommands(V6, none, {}, true));
+    if (res) {
+        return -1;
     }
 
-    natCount = 0;
+    natPairs.clear();
 
     return 0;
 }
 
-int NatController::enableNat(const char* intIface, const char* extIface) {
-    ALOGV("enableNat(intIface=<%s>, extIface=<%s>)",intIface, extIface);
-
-    if (!isIfaceName(intIface) || !isIfaceName(extIface)) {
-        errno = ENODEV;
-        return -1;
-    }
-
-    /* Bug: b/9565268. "enableNat wlan0 wlan0". For now we fail until java-land is fixed */
-    if (!strcmp(intIface, extIface)) {
-        ALOGE("Duplicate interface specified: %s %s", intIface, extIface);
-        errno = EINVAL;
-        return -1;
-    }
-
-    // add this if we are the first added nat
-    if (natCount == 0) {
-        const char *v4Cmd[] = {
-                IPTABLES_PATH,
-                "-w",
-                "-t",
-                "nat",
-                "-A",
-                LOCAL_NAT_POSTROUTING,
-                "-o",
-                extIface,
-                "-j",
-                "MASQUERADE"
-        };
+/*
+ * Within each family, the filter table is committed last, so if iptables-restore fails, the
+ * tether counting rules have not been touched.
+ */
+std::string NatController::makeRestoreCommands(IptablesTarget target,
+                                               const std::list<IfacePair>& pairs,
+                                               const std::vector<IfacePair>& counters,
+                                               bool addCounters) const {
+    std::string commands;
+
+    if (target == V4) {
+        commands += StringPrintf("*nat\n-F %s\n", LOCAL_NAT_POSTROUTING);
+        std::vector<std::string> extIfaces;
+        for (const auto& pair : pairs) {
+            if (std::find(extIfaces.begin(), extIfaces.end(), pair.second) == extIfaces.end()) {
+                extIfaces.push_back(pair.second);
+                StringAppendF(&commands, "-A %s -o %s -j MASQUERADE\n",
+                              LOCAL_NAT_POSTROUTING, pair.second.c_str());
+            }
+        }
+        commands += "COMMIT\n";
+
+        commands += StringPrintf("*filter\n-F %s\n", LOCAL_FORWARD);
+        for (const auto& pair : pairs) {
+            const char *intIface = pair.first.c_str();
+            const char *extIface = pair.second.c_str();
+            StringAppendF(&commands,
+                          "-A %s -i %s -o %s -m state --state ESTABLISHED,RELATED -g %s\n",
+                          LOCAL_FORWARD, extIface, intIface, LOCAL_TETHER_COUNTERS_CHAIN);
+            StringAppendF(&commands, "-A %s -i %s -o %s -m state --state INVALID -j DROP\n",
+                          LOCAL_FORWARD, intIface, extIface);
+            StringAppendF(&commands, "-A %s -i %s -o %s -g %s\n",
+                          LOCAL_FORWARD, intIface, extIface, LOCAL_TETHER_COUNTERS_CHAIN);
+        }
+        StringAppendF(&commands, "-A %s -j DROP\n", LOCAL_FORWARD);
+    } else {
+        commands += StringPrintf("*raw\n-F %s\n", LOCAL_RAW_PREROUTING);
+        for (const auto& pair : pairs) {
+            StringAppendF(&commands, "-A %s -i %s -m rpfilter --invert ! -s fe80::/64 -j DROP\n",
+                          LOCAL_RAW_PREROUTING, pair.first.c_str());
+        }
+        commands += "COMMIT\n";
 
         /*
          * IPv6 tethering doesn't need the state-based conntrack rules, so
          * it unconditionally jumps to the tether counters chain all the time.
          */
-        const char *v6Cmd[] = {IP6TABLES_PATH, "-w", "-A", LOCAL_FORWARD,
-                               "-g", LOCAL_TETHER_COUNTERS_CHAIN};
-
-        if (runCmd(ARRAY_SIZE(v4Cmd), v4Cmd) || runCmd(ARRAY_SIZE(v6Cmd), v6Cmd)) {
-            ALOGE("Error setting postroute rule: iface=%s", extIface);
-            // unwind what's been done, but don't care about success - what more could we do?
-            setDefaults();
-            return -1;
+        commands += StringPrintf("*filter\n-F %s\n", LOCAL_FORWARD);
+        if (!pairs.empty()) {
+            StringAppendF(&commands, "-A %s -g %s\n", LOCAL_FORWARD, LOCAL_TETHER_COUNTERS_CHAIN);
         }
     }
 
-    if (setForwardRules(true, intIface, extIface) != 0) {
-        ALOGE("Error setting forward rules");
-        if (natCount == 0) {
-            setDefaults();
+    for (const auto& counter : counters) {
+        std::string match;
+        if (tetherCounters) {
+            match = tetherCounters->getCountingMatch(counter.first, counter.second);
         }
-        errno = ENODEV;
-        return -1;
+        StringAppendF(&commands, "%s %s -i %s -o %s%s%s -j RETURN\n", addCounters ? "-A" : "-D",
+                      LOCAL_TETHER_COUNTERS_CHAIN, counter.first.c_str(), counter.second.c_str(),
+                      match.empty() ? "" : " ", match.c_str());
     }
+    commands += "COMMIT\n";
 
-    /* Always make sure the drop rule is at the end */
-    const char *cmd1[] = {
-            IPTABLES_PATH,
-            "-w",
-            "-D",
-            LOCAL_FORWARD,
-            "-j",
-            "DROP"
-    };
-    runCmd(ARRAY_SIZE(cmd1), cmd1);
-    const char *cmd2[] = {
-            IPTABLES_PATH,
-            "-w",
-            "-A",
-            LOCAL_FORWARD,
-            "-j",
-            "DROP"
-    };
-    runCmd(ARRAY_SIZE(cmd2), cmd2);
-
-    natCount++;
-    return 0;
+    return commands;
 }
 
-bool NatController::checkTetherCountingRuleExist(const char *pair_name) {
-    std::list<std::string>::iterator it;
-
-    for (it = ifacePairList.begin(); it != ifacePairList.end(); it++) {
-        if (*it == pair_name) {
-            /* We already have this counter */
-            return true;
+int NatController::applyPairs(const std::list<IfacePair>& pairs) {
+    /* We only ever add tethering counting rules so that they stick. */
+    std::vector<IfacePair> counters;
+    for (const auto& pair : pairs) {
+        for (const IfacePair& counter : { pair, IfacePair(pair.second, pair.first) }) {
+            std::string pairName = counter.first + "_" + counter.second;
+            if (!checkTetherCountingRuleExist(pairName.c_str()) &&
+                std::find(counters.begin(), counters.end(), counter) == counters.end()) {
+                counters.push_back(counter);
+            }
         }
     }
-    return false;
-}
-
-int NatController::setTetherCountingRules(bool add, const char *intIface, const char *extIface) {
-
-    /* We only ever add tethering quota rules so that they stick. */
-    if (!add) {
-        return 0;
-    }
-    char *pair_name;
-    asprintf(&pair_name, "%s_%s", intIface, extIface);
 
-    if (checkTetherCountingRuleExist(pair_name)) {
-        free(pair_name);
-        return 0;
-    }
-    const char *cmd2b[] = {
-        IPTABLES_PATH,
-        "-w", "-A", LOCAL_TETHER_COUNTERS_CHAIN, "-i", intIface, "-o", extIface, "-j", "RETURN"
-    };
-
-    const char *cmd2c[] = {
-        IP6TABLES_PATH,
-        "-w", "-A", LOCAL_TETHER_COUNTERS_CHAIN, "-i", intIface, "-o", extIface, "-j", "RETURN"
-    };
-
-    if (runCmd(ARRAY_SIZE(cmd2b), cmd2b) || runCmd(ARRAY_SIZE(cmd2c), cmd2c)) {
-        free(pair_name);
+    if (iptablesRestoreFunction(V4, makeRestoreCommands(V4, pairs, counters, true))) {
+        // unwind what's been done, but don't care about success - what more could we do?
+        iptablesRestoreFunction(V4, makeRestoreCommands(V4, natPairs, {}, true));
         return -1;
     }
-    ifacePairList.push_front(pair_name);
-    free(pair_name);
-
-    asprintf(&pair_name, "%s_%s", extIface, intIface);
-    if (checkTetherCountingRuleExist(pair_name)) {
-        free(pair_name);
-        return 0;
+    if (iptablesRestoreFunction(V6, makeRestoreCommands(V6, pairs, counters, true))) {
+        iptablesRestoreFunction(V4, makeRestoreCommands(V4, natPairs, counters, false));
+        iptablesRestoreFunction(V6, makeRestoreCommands(V6, natPairs, {}, true));
+        return -1;
     }
 
-    const char *cmd3b[] = {
-        IPTABLES_PATH,
-        "-w", "-A", LOCAL_TETHER_COUNTERS_CHAIN, "-i", extIface, "-o", intIface, "-j", "RETURN"
-    };
-
-    const char *cmd3c[] = {
-        IP6TABLES_PATH,
-        "-w", "-A", LOCAL_TETHER_COUNTERS_CHAIN, "-i", extIface, "-o", intIface, "-j", "RETURN"
-    };
-
-    if (runCmd(ARRAY_SIZE(cmd3b), cmd3b) || runCmd(ARRAY_SIZE(cmd3c), cmd3c)) {
-        // unwind what's been done, but don't care about success - what more could we do?
-        free(pair_name);
-        return -1;
+    natPairs = pairs;
+    for (const auto& counter : counters) {
+        ifacePairList.push_front(counter.first + "_" + counter.second);
     }
-    ifacePairList.push_front(pair_name);
-    free(pair_name);
     return 0;
 }
 
-int NatController::setForwardRules(bool add, const char *intIface, const char *extIface) {
-    const char *cmd1[] = {
-            IPTABLES_PATH,
-            "-w",
-            add ? "-A" : "-D",
-            LOCAL_FORWARD,
-            "-i",
-            extIface,
-            "-o",
-            intIface,
-            "-m",
-            "state",
-            "--state",
-            "ESTABLISHED,RELATED",
-            "-g",
-            LOCAL_TETHER_COUNTERS_CHAIN
-    };
-    int rc = 0;
+int NatController::enableNat(const char* intIface, const char* extIface) {
+    ALOGV("enableNat(intIface=<%s>, extIface=<%s>)",intIface, extIface);
 
-    if (runCmd(ARRAY_SIZE(cmd1), cmd1) && add) {
+    if (!isIfaceName(intIface) || !isIfaceName(extIface)) {
+        errno = ENODEV;
         return -1;
     }
 
-    const char *cmd2[] = {
-            IPTABLES_PATH,
-            "-w",
-            add ? "-A" : "-D",
-            LOCAL_FORWARD,
-            "-i",
-            intIface,
-            "-o",
-            extIface,
-            "-m",
-            "state",
-            "--state",
-            "INVALID",
-            "-j",
-            "DROP"
-    };
-
-    const char *cmd3[] = {
-            IPTABLES_PATH,
-            "-w",
-            add ? "-A" : "-D",
-            LOCAL_FORWARD,
-            "-i",
-            intIface,
-            "-o",
-            extIface,
-            "-g",
-            LOCAL_TETHER_COUNTERS_CHAIN
-    };
-
-    const char *cmd4[] = {
-            IP6TABLES_PATH,
-            "-w",
-            "-t",
-            "raw",
-            add ? "-A" : "-D",
-            LOCAL_RAW_PREROUTING,
-            "-i",
-            intIface,
-            "-m",
-            "rpfilter",
-            "--invert",
-            "!",
-            "-s",
-            "fe80::/64",
-            "-j",
-            "DROP"
-    };
-
-    if (runCmd(ARRAY_SIZE(cmd2), cmd2) && add) {
-        // bail on error, but only if adding
-        rc = -1;
-        goto err_invalid_drop;
+    /* Bug: b/9565268. "enableNat wlan0 wlan0". For now we fail until java-land is fixed */
+    if (!strcmp(intIface, extIface)) {
+        ALOGE("Duplicate interface specified: %s %s", intIface, extIface);
+        errno = EINVAL;
+        return -1;
     }
 
-    if (runCmd(ARRAY_SIZE(cmd3), cmd3) && add) {
-        // unwind what's been done, but don't care about success - what more could we do?
-        rc = -1;
-        goto err_return;
+    std::list<IfacePair> pairs = natPairs;
+    pairs.push_back(IfacePair(intIface, extIface));
+    if (applyPairs(pairs)) {
+        ALOGE("Error setting NAT rules: %s -> %s", intIface, extIface);
+        errno = ENODEV;
+        return -1;
     }
+    return 0;
+}
 
-    if (runCmd(ARRAY_SIZE(cmd4), cmd4) && add) {
-        rc = -1;
-        goto err_rpfilter;
-    }
+bool NatController::checkTetherCountingRuleExist(const char *pair_name) {
+    std::list<std::string>::iterator it;
 
-    if (setTetherCountingRules(add, intIface, extIface) && add) {
-        rc = -1;
-        goto err_return;
+    for (it = ifacePairList.begin(); it != ifacePairList.end(); it++) {
+        if (*it == pair_name) {
+            /* We already have this counter */
+            return true;
+        }
     }
-
-    return 0;
-
-err_rpfilter:
-    cmd3[2] = "-D";
-    runCmd(ARRAY_SIZE(cmd3), cmd3);
-err_return:
-    cmd2[2] = "-D";
-    runCmd(ARRAY_SIZE(cmd2), cmd2);
-err_invalid_drop:
-    cmd1[2] = "-D";
-    runCmd(ARRAY_SIZE(cmd1), cmd1);
-    return rc;
+    return false;
 }
 
 int NatController::disableNat(const char* intIface, const char* extIface) {
@@ -406,10 +287,15 @@ int NatController::disableNat(const char* intIface, const char* extIface) {
         return -1;
     }
 
-    setForwardRules(false, intIface, extIface);
-    if (--natCount <= 0) {
-        // handle decrement to 0 case (do reset to defaults) and erroneous dec below 0
-        setDefaults();
+    std::list<IfacePair> pairs = natPairs;
+    auto it = std::find(pairs.begin(), pairs.end(), IfacePair(intIface, extIface));
+    if (it == pairs.end()) {
+        return 0;
+    }
+    pairs.erase(it);
+    if (applyPairs(pairs)) {
+        ALOGE("Error removing NAT rules: %s -> %s", intIface, extIface);
+        return -1;
     }
     return 0;
 }
@@ -20,10 +20,17 @@
 #include <linux/in.h>
 #include <list>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "NetdConstants.h"
+
+class TetherCounters;
 
 class NatController {
 public:
-    NatController();
+    // If tetherCounters is not null, the tether counting rules count into its objects.
+    explicit NatController(TetherCounters* tetherCounters = nullptr);
     virtual ~NatController();
 
     int enableNat(const char* intIface, const char* extIface);
@@ -40,18 +47,33 @@ public:
     std::list<std::string> ifacePairList;
 
 private:
-    int natCount;
+    // An internal and an external interface.
+    typedef std::pair<std::string, std::string> IfacePair;
+
+    // The pairs NAT is enabled on, in the order they were enabled.
+    std::list<IfacePair> natPairs;
+
+    TetherCounters* const tetherCounters;
 
     bool checkTetherCountingRuleExist(const char *pair_name);
 
     int setDefaults();
     int runCmd(int argc, const char **argv);
-    int setForwardRules(bool set, const char *intIface, const char *extIface);
-    int setTetherCountingRules(bool add, const char *intIface, const char *extIface);
+
+    /*
+     * Rewrites the NAT chains of one family so that they forward exactly the given pairs, and
+     * adds or deletes the given tether counting rules, in a single iptables-restore.
+     */
+    std::string makeRestoreCommands(IptablesTarget target, const std::list<IfacePair>& pairs,
+                                    const std::vector<IfacePair>& counters,
+                                    bool addCounters) const;
+    /* Moves both families from natPairs to pairs, or leaves them as they were on failure. */
+    int applyPairs(const std::list<IfacePair>& pairs);
 
     // For testing.
     friend class NatControllerTest;
     static int (*execFunction)(int, char **, int *, bool, bool);
+    static int (*iptablesRestoreFunction)(IptablesTarget, const std::string&);
 };
 
 #endif
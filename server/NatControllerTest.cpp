@@ -38,6 +38,7 @@ class NatControllerTest : public IptablesBaseTest {
 public:
     NatControllerTest() {
         NatController::execFunction = fake_android_fork_exec;
+        NatController::iptablesRestoreFunction = fakeFailingIptablesRestore;
     }
 
 protected:
@@ -48,17 +49,22 @@ protected:
     }
 
     const ExpectedIptablesCommands FLUSH_COMMANDS = {
-        { V4V6, "-F natctrl_FORWARD" },
-        { V4,   "-A natctrl_FORWARD -j DROP" },
-        { V4,   "-t nat -F natctrl_nat_POSTROUTING" },
-        { V6,   "-t raw -F natctrl_raw_PREROUTING" },
+        { V4, "*nat\n"
+              "-F natctrl_nat_POSTROUTING\n"
+              "COMMIT\n"
+              "*filter\n"
+              "-F natctrl_FORWARD\n"
+              "-A natctrl_FORWARD -j DROP\n"
+              "COMMIT\n" },
+        { V6, "*raw\n"
+              "-F natctrl_raw_PREROUTING\n"
+              "COMMIT\n"
+              "*filter\n"
+              "-F natctrl_FORWARD\n"
+              "COMMIT\n" },
     };
 
     const ExpectedIptablesCommands SETUP_COMMANDS = {
-        { V4V6, "-F natctrl_FORWARD" },
-        { V4,   "-A natctrl_FORWARD -j DROP" },
-        { V4,   "-t nat -F natctrl_nat_POSTROUTING" },
-        { V6,   "-t raw -F natctrl_raw_PREROUTING" },
         { V4V6, "-F natctrl_tether_counters" },
         { V4V6, "-X natctrl_tether_counters" },
         { V4V6, "-N natctrl_tether_counters" },
@@ -66,84 +72,151 @@ protected:
                 "-j TCPMSS --clamp-mss-to-pmtu" },
     };
 
-    const ExpectedIptablesCommands TWIDDLE_COMMANDS = {
-        { V4, "-D natctrl_FORWARD -j DROP" },
-        { V4, "-A natctrl_FORWARD -j DROP" },
-    };
-
-    ExpectedIptablesCommands firstNatCommands(const char *extIf) {
-        return {
-            { V4, StringPrintf("-t nat -A natctrl_nat_POSTROUTING -o %s -j MASQUERADE", extIf) },
-            { V6, "-A natctrl_FORWARD -g natctrl_tether_counters" },
-        };
+    static std::string v4ForwardRules(const char *intIf, const char *extIf) {
+        return StringPrintf(
+                "-A natctrl_FORWARD -i %s -o %s -m state --state ESTABLISHED,RELATED"
+                " -g natctrl_tether_counters\n"
+                "-A natctrl_FORWARD -i %s -o %s -m state --state INVALID -j DROP\n"
+                "-A natctrl_FORWARD -i %s -o %s -g natctrl_tether_counters\n",
+                extIf, intIf, intIf, extIf, intIf, extIf);
     }
 
-    ExpectedIptablesCommands startNatCommands(const char *intIf, const char *extIf) {
-        return {
-            { V4,   StringPrintf("-A natctrl_FORWARD -i %s -o %s -m state --state"
-                                 " ESTABLISHED,RELATED -g natctrl_tether_counters", extIf, intIf) },
-            { V4,   StringPrintf("-A natctrl_FORWARD -i %s -o %s -m state --state INVALID -j DROP",
-                                 intIf, extIf) },
-            { V4,   StringPrintf("-A natctrl_FORWARD -i %s -o %s -g natctrl_tether_counters",
-                                 intIf, extIf) },
-            { V6,   StringPrintf("-t raw -A natctrl_raw_PREROUTING -i %s -m rpfilter --invert"
-                                 " ! -s fe80::/64 -j DROP", intIf) },
-            { V4V6, StringPrintf("-A natctrl_tether_counters -i %s -o %s -j RETURN",
-                                 intIf, extIf) },
-            { V4V6, StringPrintf("-A natctrl_tether_counters -i %s -o %s -j RETURN",
-                                 extIf, intIf) },
-        };
+    static std::string rpfilterRule(const char *intIf) {
+        return StringPrintf("-A natctrl_raw_PREROUTING -i %s -m rpfilter --invert"
+                            " ! -s fe80::/64 -j DROP\n", intIf);
     }
 
-    ExpectedIptablesCommands stopNatCommands(const char *intIf, const char *extIf) {
-        return {
-            { V4, StringPrintf("-D natctrl_FORWARD -i %s -o %s -m state --state"
-                               " ESTABLISHED,RELATED -g natctrl_tether_counters", extIf, intIf) },
-            { V4, StringPrintf("-D natctrl_FORWARD -i %s -o %s -m state --state INVALID -j DROP",
-                               intIf, extIf) },
-            { V4, StringPrintf("-D natctrl_FORWARD -i %s -o %s -g natctrl_tether_counters",
-                               intIf, extIf) },
-            { V6, StringPrintf("-t raw -D natctrl_raw_PREROUTING -i %s -m rpfilter --invert"
-                               " ! -s fe80::/64 -j DROP", intIf) },
-        };
+    static std::string counterRules(const char *op, const char *intIf, const char *extIf) {
+        return StringPrintf("%s natctrl_tether_counters -i %s -o %s -j RETURN\n"
+                            "%s natctrl_tether_counters -i %s -o %s -j RETURN\n",
+                            op, intIf, extIf, op, extIf, intIf);
     }
 };
 
 TEST_F(NatControllerTest, TestSetupIptablesHooks) {
     mNatCtrl.setupIptablesHooks();
+    expectIptablesRestoreCommands(FLUSH_COMMANDS);
     expectIptablesCommands(SETUP_COMMANDS);
 }
 
 TEST_F(NatControllerTest, TestSetDefaults) {
     setDefaults();
-    expectIptablesCommands(FLUSH_COMMANDS);
+    expectIptablesRestoreCommands(FLUSH_COMMANDS);
+    expectIptablesCommands(std::vector<std::string>());
 }
 
 TEST_F(NatControllerTest, TestAddAndRemoveNat) {
+    const std::string kV4Nat =
+            "*nat\n"
+            "-F natctrl_nat_POSTROUTING\n"
+            "-A natctrl_nat_POSTROUTING -o rmnet0 -j MASQUERADE\n"
+            "COMMIT\n";
 
-    std::vector<ExpectedIptablesCommands> startFirstNat = {
-        firstNatCommands("rmnet0"),
-        startNatCommands("wlan0", "rmnet0"),
-        TWIDDLE_COMMANDS,
-    };
     mNatCtrl.enableNat("wlan0", "rmnet0");
-    expectIptablesCommands(startFirstNat);
-
-    std::vector<ExpectedIptablesCommands> startOtherNat = {
-         startNatCommands("usb0", "rmnet0"),
-         TWIDDLE_COMMANDS,
-    };
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{
+        { V4, kV4Nat +
+              "*filter\n"
+              "-F natctrl_FORWARD\n" +
+              v4ForwardRules("wlan0", "rmnet0") +
+              "-A natctrl_FORWARD -j DROP\n" +
+              counterRules("-A", "wlan0", "rmnet0") +
+              "COMMIT\n" },
+        { V6, "*raw\n"
+              "-F natctrl_raw_PREROUTING\n" +
+              rpfilterRule("wlan0") +
+              "COMMIT\n"
+              "*filter\n"
+              "-F natctrl_FORWARD\n"
+              "-A natctrl_FORWARD -g natctrl_tether_counters\n" +
+              counterRules("-A", "wlan0", "rmnet0") +
+              "COMMIT\n" },
+    });
+
+    // Only the new pair's counting rules are added.
     mNatCtrl.enableNat("usb0", "rmnet0");
-    expectIptablesCommands(startOtherNat);
-
-    ExpectedIptablesCommands stopOtherNat = stopNatCommands("wlan0", "rmnet0");
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{
+        { V4, kV4Nat +
+              "*filter\n"
+              "-F natctrl_FORWARD\n" +
+              v4ForwardRules("wlan0", "rmnet0") +
+              v4ForwardRules("usb0", "rmnet0") +
+              "-A natctrl_FORWARD -j DROP\n" +
+              counterRules("-A", "usb0", "rmnet0") +
+              "COMMIT\n" },
+        { V6, "*raw\n"
+              "-F natctrl_raw_PREROUTING\n" +
+              rpfilterRule("wlan0") +
+              rpfilterRule("usb0") +
+              "COMMIT\n"
+              "*filter\n"
+              "-F natctrl_FORWARD\n"
+              "-A natctrl_FORWARD -g natctrl_tether_counters\n" +
+              counterRules("-A", "usb0", "rmnet0") +
+              "COMMIT\n" },
+    });
+
+    // Counting rules stick.
     mNatCtrl.disableNat("wlan0", "rmnet0");
-    expectIptablesCommands(stopOtherNat);
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{
+        { V4, kV4Nat +
+              "*filter\n"
+              "-F natctrl_FORWARD\n" +
+              v4ForwardRules("usb0", "rmnet0") +
+              "-A natctrl_FORWARD -j DROP\n"
+              "COMMIT\n" },
+        { V6, "*raw\n"
+              "-F natctrl_raw_PREROUTING\n" +
+              rpfilterRule("usb0") +
+              "COMMIT\n"
+              "*filter\n"
+              "-F natctrl_FORWARD\n"
+              "-A natctrl_FORWARD -g natctrl_tether_counters\n"
+              "COMMIT\n" },
+    });
 
-    std::vector<ExpectedIptablesCommands> stopLastNat = {
-        stopNatCommands("usb0", "rmnet0"),
-        FLUSH_COMMANDS,
-    };
     mNatCtrl.disableNat("usb0", "rmnet0");
-    expectIptablesCommands(stopLastNat);
+    expectIptablesRestoreCommands(FLUSH_COMMANDS);
+
+    // Disabling NAT on a pair it is not enabled on does nothing.
+    mNatCtrl.disableNat("usb0", "rmnet0");
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+    expectIptablesCommands(std::vector<std::string>());
+}
+
+TEST_F(NatControllerTest, TestRollsBackOnFailure) {
+    EXPECT_EQ(0, mNatCtrl.enableNat("wlan0", "rmnet0"));
+    sRestoreCmds.clear();
+
+    // The IPv6 transaction fails, so the IPv4 one is reverted, including its new counting rules.
+    sRestoreFailAt = 1;
+    EXPECT_EQ(-1, mNatCtrl.enableNat("usb0", "rmnet0"));
+    ASSERT_EQ(4U, sRestoreCmds.size());
+    EXPECT_EQ(V4, sRestoreCmds[2].first);
+    EXPECT_EQ("*nat\n"
+              "-F natctrl_nat_POSTROUTING\n"
+              "-A natctrl_nat_POSTROUTING -o rmnet0 -j MASQUERADE\n"
+              "COMMIT\n"
+              "*filter\n"
+              "-F natctrl_FORWARD\n" +
+              v4ForwardRules("wlan0", "rmnet0") +
+              "-A natctrl_FORWARD -j DROP\n" +
+              counterRules("-D", "usb0", "rmnet0") +
+              "COMMIT\n", sRestoreCmds[2].second);
+    EXPECT_EQ(V6, sRestoreCmds[3].first);
+    EXPECT_EQ("*raw\n"
+              "-F natctrl_raw_PREROUTING\n" +
+              rpfilterRule("wlan0") +
+              "COMMIT\n"
+              "*filter\n"
+              "-F natctrl_FORWARD\n"
+              "-A natctrl_FORWARD -g natctrl_tether_counters\n"
+              "COMMIT\n", sRestoreCmds[3].second);
+    sRestoreCmds.clear();
+
+    // Since nothing changed, the counting rules are added again next time.
+    sRestoreFailAt = -1;
+    EXPECT_EQ(0, mNatCtrl.enableNat("usb0", "rmnet0"));
+    ASSERT_EQ(2U, sRestoreCmds.size());
+    EXPECT_NE(std::string::npos, sRestoreCmds[0].second.find(counterRules("-A", "usb0", "rmnet0")));
+    sRestoreCmds.clear();
 }
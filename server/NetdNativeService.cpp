@@ -32,8 +32,10 @@
 #include "DumpWriter.h"
 #include "EventReporter.h"
 #include "InterfaceController.h"
+#include "MetricsAggregator.h"
 #include "NetdConstants.h"
 #include "NetdNativeService.h"
+#include "NetlinkManager.h"
 #include "RouteController.h"
 #include "SockDiag.h"
 #include "UidRanges.h"
@@ -83,6 +85,34 @@ binder::Status checkPermission(const char *permission) {
     android::RWLock::AutoWLock _lock(lock);
 
 #define NETD_BIG_LOCK_RPC(permission) NETD_LOCKING_RPC((permission), gBigNetdLock)
+
+binder::Status modifyAddresses(bool add, const std::string &ifName,
+        const std::vector<std::string> &addrStrings, const std::vector<int32_t> &prefixLengths,
+        std::vector<int32_t> *results) {
+    if (addrStrings.size() != prefixLengths.size()) {
+        return binder::Status::fromServiceSpecificError(EINVAL,
+                String8("Address and prefix length counts differ"));
+    }
+    std::vector<InterfaceController::InterfaceAddress> addresses;
+    for (size_t i = 0; i < addrStrings.size(); i++) {
+        addresses.push_back({ addrStrings[i], prefixLengths[i] });
+    }
+
+    std::vector<int> errors;
+    const int err = add ?
+            InterfaceController::addAddresses(ifName.c_str(), addresses, &errors) :
+            InterfaceController::delAddresses(ifName.c_str(), addresses, &errors);
+    if (err != 0) {
+        return binder::Status::fromServiceSpecificError(-err,
+                String8::format("InterfaceController error: %s", strerror(-err)));
+    }
+    results->clear();
+    for (int error : errors) {
+        results->push_back(-error);
+    }
+    return binder::Status::ok();
+}
+
 }  // namespace
 
 
@@ -112,6 +142,18 @@ status_t NetdNativeService::dump(int fd, const Vector<String16> & /* args */) {
     dw.blankline();
     gCtls->netCtrl.dump(dw);
     dw.blankline();
+    NetlinkManager::Instance()->dump(dw);
+    dw.blankline();
+    gCtls->dnsEventReporter.dump(dw);
+    gCtls->dnsPrefetcher.dump(dw);
+    gCtls->dnsAddressSorter.dump(dw);
+    dw.blankline();
+    gCtls->tetherOffloadCtrl.dump(dw);
+    dw.blankline();
+    gCtls->clatdCtrl.dump(dw);
+    dw.blankline();
+    gCtls->eventReporter.getMetrics()->dump(dw);
+    dw.blankline();
 
     return NO_ERROR;
 }
@@ -216,6 +258,18 @@ binder::Status NetdNativeService::getResolverInfo(int32_t netId,
     return binder::Status::ok();
 }
 
+binder::Status NetdNativeService::getResolverInfoForNetwork(int32_t netId, ResolverInfo* info) {
+    // Like getResolverInfo(), this does not lock within Netd.
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+
+    int err = gCtls->resolverCtrl.getResolverInfo(netId, info);
+    if (err != 0) {
+        return binder::Status::fromServiceSpecificError(-err,
+                String8::format("ResolverController error: %s", strerror(-err)));
+    }
+    return binder::Status::ok();
+}
+
 binder::Status NetdNativeService::tetherApplyDnsInterfaces(bool *ret) {
     NETD_BIG_LOCK_RPC(CONNECTIVITY_INTERNAL);
 
@@ -249,6 +303,45 @@ binder::Status NetdNativeService::interfaceDelAddress(const std::string &ifName,
     return binder::Status::ok();
 }
 
+binder::Status NetdNativeService::interfaceAddAddresses(const std::string &ifName,
+        const std::vector<std::string> &addrStrings, const std::vector<int32_t> &prefixLengths,
+        std::vector<int32_t> *results) {
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+
+    return modifyAddresses(true, ifName, addrStrings, prefixLengths, results);
+}
+
+binder::Status NetdNativeService::interfaceDelAddresses(const std::string &ifName,
+        const std::vector<std::string> &addrStrings, const std::vector<int32_t> &prefixLengths,
+        std::vector<int32_t> *results) {
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+
+    return modifyAddresses(false, ifName, addrStrings, prefixLengths, results);
+}
+
+binder::Status NetdNativeService::interfaceSetLinkConfig(const std::string &ifName, int32_t mtu,
+        int32_t flagsToSet, int32_t flagsToClear, std::vector<int32_t> *results) {
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+
+    if (mtu < 0) {
+        return binder::Status::fromServiceSpecificError(EINVAL, String8("Invalid MTU"));
+    }
+    InterfaceController::LinkConfig config;
+    config.mtu = mtu;
+    config.flagsToSet = flagsToSet;
+    config.flagsToClear = flagsToClear;
+    InterfaceController::LinkConfigResults linkResults;
+    const int err = InterfaceController::setLinkConfig(ifName.c_str(), config, &linkResults);
+    if (err != 0) {
+        return binder::Status::fromServiceSpecificError(-err,
+                String8::format("InterfaceController error: %s", strerror(-err)));
+    }
+    results->assign(INetd::LINK_CONFIG_RESULT_SIZE, 0);
+    (*results)[INetd::LINK_CONFIG_RESULT_MTU] = -linkResults.mtu;
+    (*results)[INetd::LINK_CONFIG_RESULT_FLAGS] = -linkResults.flags;
+    return binder::Status::ok();
+}
+
 binder::Status NetdNativeService::setProcSysNet(
         int32_t family, int32_t which, const std::string &ifname, const std::string &parameter,
         const std::string &value) {
@@ -309,5 +402,57 @@ binder::Status NetdNativeService::setMetricsReportingLevel(const int reportingLe
             : binder::Status::fromExceptionCode(binder::Status::EX_ILLEGAL_ARGUMENT);
 }
 
+binder::Status NetdNativeService::setNetdEventListenerCapabilities(int32_t capabilities) {
+    // This function intentionally does not lock, since the only thing it does is one write to an
+    // atomic_int.
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+
+    gCtls->eventReporter.setListenerCapabilities(capabilities);
+    return binder::Status::ok();
+}
+
+binder::Status NetdNativeService::getNetworkMetrics(bool reset, std::vector<int64_t>* summaries,
+        std::vector<int64_t>* latencyHistograms, std::vector<int64_t>* errorCodes,
+        std::vector<int64_t>* topUids) {
+    // This function intentionally does not take the big lock. The aggregator has its own lock,
+    // which it only holds long enough to copy its counters.
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+
+    static_assert(INetd::METRICS_LATENCY_BUCKETS == MetricsAggregator::kNumBuckets,
+                  "Histogram size mismatch");
+    static_assert(INetd::METRICS_EVENT_CONNECT == MetricsAggregator::CONNECT,
+                  "Event type mismatch");
+
+    const std::vector<MetricsAggregator::Summary> metrics =
+            gCtls->eventReporter.getMetrics()->getSummaries(reset);
+
+    summaries->clear();
+    latencyHistograms->clear();
+    errorCodes->clear();
+    topUids->clear();
+    for (size_t i = 0; i < metrics.size(); i++) {
+        const MetricsAggregator::Summary& m = metrics[i];
+        int64_t summary[INetd::METRICS_SUMMARY_SIZE];
+        summary[INetd::METRICS_SUMMARY_NETID] = m.netId;
+        summary[INetd::METRICS_SUMMARY_EVENT_TYPE] = m.eventType;
+        summary[INetd::METRICS_SUMMARY_COUNT] = m.count;
+        summary[INetd::METRICS_SUMMARY_ERRORS] = m.errors;
+        summary[INetd::METRICS_SUMMARY_LATENCY_P50_MS] = m.p50Ms;
+        summary[INetd::METRICS_SUMMARY_LATENCY_P90_MS] = m.p90Ms;
+        summary[INetd::METRICS_SUMMARY_LATENCY_P99_MS] = m.p99Ms;
+        summary[INetd::METRICS_SUMMARY_LATENCY_MAX_MS] = m.maxMs;
+        summaries->insert(summaries->end(), summary, summary + INetd::METRICS_SUMMARY_SIZE);
+        latencyHistograms->insert(latencyHistograms->end(), m.histogram.begin(),
+                                  m.histogram.end());
+        for (const auto& e : m.errorCodes) {
+            errorCodes->insert(errorCodes->end(), { (int64_t) i, e.first, (int64_t) e.second });
+        }
+        for (const auto& u : m.topUids) {
+            topUids->insert(topUids->end(), { (int64_t) i, u.first, (int64_t) u.second });
+        }
+    }
+    return binder::Status::ok();
+}
+
 }  // namespace net
 }  // namespace android
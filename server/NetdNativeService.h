@@ -22,6 +22,7 @@
 #include <binder/BinderService.h>
 
 #include "android/net/BnNetd.h"
+#include "android/net/ResolverInfo.h"
 #include "android/net/UidRange.h"
 
 namespace android {
@@ -47,6 +48,7 @@ class NetdNativeService : public BinderService<NetdNativeService>, public BnNetd
     binder::Status getResolverInfo(int32_t netId, std::vector<std::string>* servers,
             std::vector<std::string>* domains, std::vector<int32_t>* params,
             std::vector<int32_t>* stats) override;
+    binder::Status getResolverInfoForNetwork(int32_t netId, ResolverInfo* info) override;
 
     // Tethering-related commands.
     binder::Status tetherApplyDnsInterfaces(bool *ret) override;
@@ -55,6 +57,14 @@ class NetdNativeService : public BinderService<NetdNativeService>, public BnNetd
             const std::string &addrString, int prefixLength) override;
     binder::Status interfaceDelAddress(const std::string &ifName,
             const std::string &addrString, int prefixLength) override;
+    binder::Status interfaceAddAddresses(const std::string &ifName,
+            const std::vector<std::string> &addrStrings, const std::vector<int32_t> &prefixLengths,
+            std::vector<int32_t> *results) override;
+    binder::Status interfaceDelAddresses(const std::string &ifName,
+            const std::vector<std::string> &addrStrings, const std::vector<int32_t> &prefixLengths,
+            std::vector<int32_t> *results) override;
+    binder::Status interfaceSetLinkConfig(const std::string &ifName, int32_t mtu,
+            int32_t flagsToSet, int32_t flagsToClear, std::vector<int32_t> *results) override;
 
     binder::Status setProcSysNet(
             int32_t family, int32_t which, const std::string &ifname, const std::string &parameter,
@@ -63,6 +73,12 @@ class NetdNativeService : public BinderService<NetdNativeService>, public BnNetd
     // Metrics reporting level set / get (internal use only).
     binder::Status getMetricsReportingLevel(int *reportingLevel) override;
     binder::Status setMetricsReportingLevel(const int reportingLevel) override;
+    binder::Status setNetdEventListenerCapabilities(int32_t capabilities) override;
+
+    // Aggregated DNS and connect metrics.
+    binder::Status getNetworkMetrics(bool reset, std::vector<int64_t>* summaries,
+            std::vector<int64_t>* latencyHistograms, std::vector<int64_t>* errorCodes,
+            std::vector<int64_t>* topUids) override;
 };
 
 }  // namespace net
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,9 +24,14 @@
 #define LOG_TAG "Netd"
 
 #include <cutils/log.h>
+#include <cutils/uevent.h>
+
+#include <net/if.h>
+#include <linux/netlink.h>
 
 #include <netutils/ifc.h>
 #include <sysutils/NetlinkEvent.h>
+#include "DumpWriter.h"
 #include "NetlinkHandler.h"
 #include "NetlinkManager.h"
 #include "ResponseCode.h"
@@ -34,9 +40,16 @@
 static const char *kUpdated = "updated";
 static const char *kRemoved = "removed";
 
-NetlinkHandler::NetlinkHandler(NetlinkManager *nm, int listenerSocket,
-                               int format) :
-                        NetlinkListener(listenerSocket, format) {
+constexpr std::chrono::seconds NetlinkHandler::kOverflowLogInterval;
+
+NetlinkHandler::NetlinkHandler(NetlinkManager *nm, const char *name, int listenerSocket,
+                               int netlinkFamily, int format) :
+                        NetlinkListener(listenerSocket, format),
+                        mName(name), mNetlinkFamily(netlinkFamily), mFormat(format),
+                        mQueue(kQueueCapacity),
+                        mQueueHead(0), mQueueSize(0), mQueueBytes(0), mStopping(false),
+                        mReceived(0), mQueueDrops(0), mKernelDrops(0), mMaxQueueSize(0),
+                        mLoggedKernelDrops(0) {
     mNm = nm;
 }
 
@@ -44,11 +57,143 @@ NetlinkHandler::~NetlinkHandler() {
 }
 
 int NetlinkHandler::start() {
-    return this->startListener();
+    mStopping = false;
+    if (int ret = pthread_create(&mThread, NULL, NetlinkHandler::threadStart, this)) {
+        errno = ret;
+        return -1;
+    }
+
+    if (this->startListener()) {
+        int err = errno;
+        stopWorker();
+        errno = err;
+        return -1;
+    }
+    return 0;
 }
 
 int NetlinkHandler::stop() {
-    return this->stopListener();
+    int ret = this->stopListener();
+    stopWorker();
+    return ret;
+}
+
+void NetlinkHandler::stopWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        mStopping = true;
+    }
+    mQueueCv.notify_one();
+    pthread_join(mThread, NULL);
+}
+
+void *NetlinkHandler::threadStart(void *obj) {
+    reinterpret_cast<NetlinkHandler *>(obj)->run();
+    return NULL;
+}
+
+bool NetlinkHandler::onDataAvailable(SocketClient *cli) {
+    uid_t uid = -1;
+    bool requireGroup = (mFormat != NETLINK_FORMAT_BINARY_UNICAST);
+
+    ssize_t count = TEMP_FAILURE_RETRY(uevent_kernel_recv(cli->getSocket(),
+            mBuffer, sizeof(mBuffer), requireGroup, &uid));
+    if (count < 0) {
+        if (errno == ENOBUFS) {
+            // The kernel dropped messages because the receive buffer filled up. Keep reading. During
+            // an event storm this happens over and over, so only log it every so often.
+            const uint64_t drops = ++mKernelDrops;
+            const auto now = std::chrono::steady_clock::now();
+            if (mLoggedKernelDrops == 0 || now - mLastOverflowLog >= kOverflowLogInterval) {
+                ALOGW("%s netlink socket overflowed %" PRIu64 " times (%" PRIu64 " in total)",
+                      mName, drops - mLoggedKernelDrops, drops);
+                mLastOverflowLog = now;
+                mLoggedKernelDrops = drops;
+            }
+            return true;
+        }
+        SLOGE("recvmsg failed (%s)", strerror(errno));
+        return false;
+    }
+
+    mReceived++;
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        if (mQueueSize == kQueueCapacity || mQueueBytes + count > kQueueMaxBytes) {
+            mQueueDrops++;
+            return true;
+        }
+        // A new buffer of the right size, rather than assign(), so that a slot never keeps the
+        // capacity of an earlier, larger message.
+        mQueue[(mQueueHead + mQueueSize) % kQueueCapacity] =
+                std::vector<char>(mBuffer, mBuffer + count);
+        mQueueSize++;
+        mQueueBytes += count;
+        if (mQueueSize > mMaxQueueSize) {
+            mMaxQueueSize = mQueueSize;
+        }
+    }
+    mQueueCv.notify_one();
+    return true;
+}
+
+void NetlinkHandler::run() {
+    // Messages are decoded from a private copy so that the listener thread can keep filling the
+    // ring while we process.
+    std::vector<char> msg;
+    std::vector<RtnetlinkEvent> rtEvents;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mQueueLock);
+            mQueueCv.wait(lock, [this] { return mStopping || mQueueSize > 0; });
+            // The listener is stopped first, so nothing is added once we are stopping.
+            if (mQueueSize == 0) {
+                return;
+            }
+            msg = std::move(mQueue[mQueueHead]);
+            mQueue[mQueueHead].clear();
+            mQueueHead = (mQueueHead + 1) % kQueueCapacity;
+            mQueueSize--;
+            mQueueBytes -= msg.size();
+        }
+
+        if (mNetlinkFamily == NETLINK_ROUTE &&
+                RtnetlinkEvent::parse(msg.data(), msg.size(), &rtEvents)) {
+            // Forget the interfaces that this datagram deletes before resolving the names in any
+            // of its other events.
+            for (const RtnetlinkEvent& event : rtEvents) {
+                if (event.type == RtnetlinkEvent::LINK_REMOVED) {
+                    mIfNames.erase(event.ifindex);
+                }
+            }
+            for (const RtnetlinkEvent& event : rtEvents) {
+                onRtnetlinkEvent(event);
+            }
+            continue;
+        }
+
+        NetlinkEvent evt;
+        if (evt.decode(msg.data(), msg.size(), mFormat)) {
+            onEvent(&evt);
+        } else if (mFormat != NETLINK_FORMAT_BINARY) {
+            // Don't complain if the binary decoder returns false. That can just mean that the
+            // buffer contained no messages we're interested in.
+            SLOGE("Error decoding NetlinkEvent");
+        }
+    }
+}
+
+void NetlinkHandler::dump(DumpWriter& dw) {
+    size_t queueSize, queueBytes;
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        queueSize = mQueueSize;
+        queueBytes = mQueueBytes;
+    }
+    dw.println("%s: received=%" PRIu64 " queued=%zu (%zu bytes) maxQueued=%zu/%zu queueDrops=%"
+               PRIu64 " ENOBUFS=%" PRIu64,
+               mName, mReceived.load(), queueSize, queueBytes, mMaxQueueSize.load(),
+               kQueueCapacity, mQueueDrops.load(), mKernelDrops.load());
 }
 
 void NetlinkHandler::onEvent(NetlinkEvent *evt) {
@@ -80,22 +225,13 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
             const char *scope = evt->findParam("SCOPE");
             if (action == NetlinkEvent::Action::kAddressRemoved && iface && address) {
                 // Note: if this interface was deleted, iface is "" and we don't notify.
-                SockDiag sd;
-                if (sd.open()) {
-                    char addrstr[INET6_ADDRSTRLEN];
-                    strncpy(addrstr, address, sizeof(addrstr));
-                    char *slash = strchr(addrstr, '/');
-                    if (slash) {
-                        *slash = '\0';
-                    }
-
-                    int ret = sd.destroySockets(addrstr);
-                    if (ret < 0) {
-                        ALOGE("Error destroying sockets: %s", strerror(ret));
-                    }
-                } else {
-                    ALOGE("Error opening NETLINK_SOCK_DIAG socket: %s", strerror(errno));
+                char addrstr[INET6_ADDRSTRLEN];
+                strncpy(addrstr, address, sizeof(addrstr));
+                char *slash = strchr(addrstr, '/');
+                if (slash) {
+                    *slash = '\0';
                 }
+                destroySocketsOnAddress(addrstr);
             }
             if (iface && iface[0] && address && flags && scope) {
                 notifyAddressChanged(action, address, iface, flags, scope);
@@ -143,12 +279,93 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
     }
 }
 
-void NetlinkHandler::notify(int code, const char *format, ...) {
+void NetlinkHandler::onRtnetlinkEvent(const RtnetlinkEvent& event) {
+    switch (event.type) {
+        case RtnetlinkEvent::LINK_UPDATED:
+            mIfNames[event.ifindex] = event.ifname;
+            notifyInterfaceLinkChanged(event.ifname, event.isLinkUp());
+            break;
+
+        case RtnetlinkEvent::LINK_REMOVED:
+            mIfNames.erase(event.ifindex);
+            break;
+
+        case RtnetlinkEvent::ADDRESS_UPDATED:
+        case RtnetlinkEvent::ADDRESS_REMOVED: {
+            NetlinkEvent::Action action = (event.type == RtnetlinkEvent::ADDRESS_UPDATED) ?
+                    NetlinkEvent::Action::kAddressUpdated : NetlinkEvent::Action::kAddressRemoved;
+            if (action == NetlinkEvent::Action::kAddressRemoved) {
+                destroySocketsOnAddress(event.addrToString().c_str());
+            }
+            // When an interface is deleted, the kernel removes its addresses before it reports
+            // RTM_DELLINK. Check removals against the kernel so that, as before, they are not
+            // reported for interfaces that are already gone.
+            std::string iface;
+            if (!getIfName(event.ifindex, action == NetlinkEvent::Action::kAddressRemoved,
+                           &iface)) {
+                SLOGD("Unknown ifindex %d in address event", event.ifindex);
+                return;
+            }
+            const std::string flags = std::to_string(event.flags);
+            const std::string scope = std::to_string(event.scope);
+            notifyAddressChanged(action, event.prefixToString().c_str(), iface.c_str(),
+                                 flags.c_str(), scope.c_str());
+            break;
+        }
+
+        case RtnetlinkEvent::ROUTE_UPDATED:
+        case RtnetlinkEvent::ROUTE_REMOVED: {
+            std::string iface;
+            if (event.ifindex && !getIfName(event.ifindex, false, &iface)) {
+                SLOGD("Unknown ifindex %d in route event", event.ifindex);
+                return;
+            }
+            NetlinkEvent::Action action = (event.type == RtnetlinkEvent::ROUTE_UPDATED) ?
+                    NetlinkEvent::Action::kRouteUpdated : NetlinkEvent::Action::kRouteRemoved;
+            notifyRouteChange(action, event.prefixToString().c_str(),
+                              event.gatewayToString().c_str(), iface.c_str());
+            break;
+        }
+    }
+}
+
+bool NetlinkHandler::getIfName(int ifindex, bool refresh, std::string *ifname) {
+    auto it = mIfNames.find(ifindex);
+    if (!refresh && it != mIfNames.end()) {
+        *ifname = it->second;
+        return true;
+    }
+
+    char buf[IF_NAMESIZE];
+    if (!if_indextoname(ifindex, buf)) {
+        if (it != mIfNames.end()) {
+            mIfNames.erase(it);
+        }
+        return false;
+    }
+    *ifname = mIfNames[ifindex] = buf;
+    return true;
+}
+
+void NetlinkHandler::destroySocketsOnAddress(const char *addrstr) {
+    SockDiag sd;
+    if (sd.open()) {
+        int ret = sd.destroySockets(addrstr);
+        if (ret < 0) {
+            ALOGE("Error destroying sockets: %s", strerror(ret));
+        }
+    } else {
+        ALOGE("Error opening NETLINK_SOCK_DIAG socket: %s", strerror(errno));
+    }
+}
+
+void NetlinkHandler::notify(BroadcastCoalescer::EventType type, const std::string& key,
+                            int code, const char *format, ...) {
     char *msg;
     va_list args;
     va_start(args, format);
     if (vasprintf(&msg, format, args) >= 0) {
-        mNm->getBroadcaster()->sendBroadcast(code, msg, false);
+        mNm->getCoalescer()->notify(type, key, code, msg);
         free(msg);
     } else {
         SLOGE("Failed to send notification: vasprintf: %s", strerror(errno));
@@ -157,46 +374,56 @@ void NetlinkHandler::notify(int code, const char *format, ...) {
 }
 
 void NetlinkHandler::notifyInterfaceAdded(const char *name) {
-    notify(ResponseCode::InterfaceChange, "Iface added %s", name);
+    notify(BroadcastCoalescer::INTERFACE, "", ResponseCode::InterfaceChange,
+           "Iface added %s", name);
 }
 
 void NetlinkHandler::notifyInterfaceRemoved(const char *name) {
-    notify(ResponseCode::InterfaceChange, "Iface removed %s", name);
+    notify(BroadcastCoalescer::INTERFACE, "", ResponseCode::InterfaceChange,
+           "Iface removed %s", name);
 }
 
 void NetlinkHandler::notifyInterfaceChanged(const char *name, bool isUp) {
-    notify(ResponseCode::InterfaceChange,
+    notify(BroadcastCoalescer::INTERFACE, std::string("changed ") + name,
+           ResponseCode::InterfaceChange,
            "Iface changed %s %s", name, (isUp ? "up" : "down"));
 }
 
 void NetlinkHandler::notifyInterfaceLinkChanged(const char *name, bool isUp) {
-    notify(ResponseCode::InterfaceChange,
+    // Only the latest state of a flapping link is of interest.
+    notify(BroadcastCoalescer::INTERFACE, std::string("linkstate ") + (name ? name : ""),
+           ResponseCode::InterfaceChange,
            "Iface linkstate %s %s", name, (isUp ? "up" : "down"));
 }
 
 void NetlinkHandler::notifyQuotaLimitReached(const char *name, const char *iface) {
-    notify(ResponseCode::BandwidthControl, "limit alert %s %s", name, iface);
+    notify(BroadcastCoalescer::QUOTA, "", ResponseCode::BandwidthControl,
+           "limit alert %s %s", name, iface);
 }
 
 void NetlinkHandler::notifyInterfaceClassActivity(const char *name,
                                                   bool isActive,
                                                   const char *timestamp,
                                                   const char *uid) {
+    // Every transition is reported: the framework tracks radio power state from the sequence of
+    // active and idle events, so these are batched but never coalesced.
+    const std::string key;
     if (timestamp == NULL)
-        notify(ResponseCode::InterfaceClassActivity,
+        notify(BroadcastCoalescer::CLASS_ACTIVITY, key, ResponseCode::InterfaceClassActivity,
            "IfaceClass %s %s", isActive ? "active" : "idle", name);
     else if (uid != NULL && isActive)
-        notify(ResponseCode::InterfaceClassActivity,
+        notify(BroadcastCoalescer::CLASS_ACTIVITY, key, ResponseCode::InterfaceClassActivity,
            "IfaceClass active %s %s %s", name, timestamp, uid);
     else
-        notify(ResponseCode::InterfaceClassActivity,
+        notify(BroadcastCoalescer::CLASS_ACTIVITY, key, ResponseCode::InterfaceClassActivity,
            "IfaceClass %s %s %s", isActive ? "active" : "idle", name, timestamp);
 }
 
 void NetlinkHandler::notifyAddressChanged(NetlinkEvent::Action action, const char *addr,
                                           const char *iface, const char *flags,
                                           const char *scope) {
-    notify(ResponseCode::InterfaceAddressChange,
+    notify(BroadcastCoalescer::ADDRESS, std::string(addr) + " " + iface,
+           ResponseCode::InterfaceAddressChange,
            "Address %s %s %s %s %s",
            (action == NetlinkEvent::Action::kAddressUpdated) ? kUpdated : kRemoved,
            addr, iface, flags, scope);
@@ -205,13 +432,24 @@ void NetlinkHandler::notifyAddressChanged(NetlinkEvent::Action action, const cha
 void NetlinkHandler::notifyInterfaceDnsServers(const char *iface,
                                                const char *lifetime,
                                                const char *servers) {
-    notify(ResponseCode::InterfaceDnsInfo, "DnsInfo servers %s %s %s",
-           iface, lifetime, servers);
+    // Each RDNSS option is tracked separately by the framework, so only refreshes of the same
+    // servers on the same interface supersede each other.
+    std::string key = iface ? iface : "";
+    key += " ";
+    key += servers ? servers : "";
+    notify(BroadcastCoalescer::DNS_INFO, key, ResponseCode::InterfaceDnsInfo,
+           "DnsInfo servers %s %s %s", iface, lifetime, servers);
 }
 
 void NetlinkHandler::notifyRouteChange(NetlinkEvent::Action action, const char *route,
                                        const char *gateway, const char *iface) {
-    notify(ResponseCode::RouteChange,
+    // Repeated updates to the same route (e.g., RA refreshes) supersede each other.
+    std::string key = route;
+    key += " ";
+    key += gateway ? gateway : "";
+    key += " ";
+    key += iface ? iface : "";
+    notify(BroadcastCoalescer::ROUTE, key, ResponseCode::RouteChange,
            "Route %s %s%s%s%s%s",
            (action == NetlinkEvent::Action::kRouteUpdated) ? kUpdated : kRemoved,
            route,
@@ -222,5 +460,5 @@ void NetlinkHandler::notifyRouteChange(NetlinkEvent::Action action, const char *
 }
 
 void NetlinkHandler::notifyStrictCleartext(const char* uid, const char* hex) {
-    notify(ResponseCode::StrictCleartext, "%s %s", uid, hex);
+    notify(BroadcastCoalescer::STRICT, "", ResponseCode::StrictCleartext, "%s %s", uid, hex);
 }
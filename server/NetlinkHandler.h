@@ -17,24 +17,61 @@
 #ifndef _NETLINKHANDLER_H
 #define _NETLINKHANDLER_H
 
+#include <pthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include <sysutils/NetlinkEvent.h>
 #include <sysutils/NetlinkListener.h>
 #include "NetlinkManager.h"
+#include "RtnetlinkEvent.h"
 
+class DumpWriter;
+
+/*
+ * Receives netlink messages on the SocketListener thread and processes them on a separate worker
+ * thread. The listener thread only copies each datagram into a bounded queue, so that slow event
+ * processing (e.g., destroying sockets or broadcasting to clients) does not stop us from draining
+ * the kernel receive buffer during event storms. The queue is bounded both in messages and in
+ * bytes, and each queued message only takes as much memory as its actual length. stop() stops the
+ * listener first, and then lets the worker process everything that is still queued.
+ */
 class NetlinkHandler: public NetlinkListener {
     NetlinkManager *mNm;
 
 public:
-    NetlinkHandler(NetlinkManager *nm, int listenerSocket, int format);
+    NetlinkHandler(NetlinkManager *nm, const char *name, int listenerSocket, int netlinkFamily,
+                   int format);
     virtual ~NetlinkHandler();
 
     int start(void);
     int stop(void);
 
+    void dump(DumpWriter& dw);
+
+    // Maximum number of messages, and of bytes, received but not yet processed.
+    static const size_t kQueueCapacity = 512;
+    static const size_t kQueueMaxBytes = 1024 * 1024;
+    // How often a receive buffer overflow is logged, at most.
+    static constexpr std::chrono::seconds kOverflowLogInterval{10};
+
 protected:
+    virtual bool onDataAvailable(SocketClient *cli);
     virtual void onEvent(NetlinkEvent *evt);
+    // Fast path for link, address and route messages on NETLINK_ROUTE sockets. Acts on the
+    // binary event data, and only formats strings for the broadcast.
+    void onRtnetlinkEvent(const RtnetlinkEvent& event);
 
-    void notify(int code, const char *format, ...);
+    // Queues a broadcast for all framework clients. Pending broadcasts with the same type and a
+    // non-empty key are coalesced, so that only the latest one is sent.
+    void notify(BroadcastCoalescer::EventType type, const std::string& key, int code,
+                const char *format, ...);
     void notifyInterfaceAdded(const char *name);
     void notifyInterfaceRemoved(const char *name);
     void notifyInterfaceChanged(const char *name, bool isUp);
@@ -48,5 +85,44 @@ protected:
                                    const char *servers);
     void notifyRouteChange(NetlinkEvent::Action action, const char *route, const char *gateway, const char *iface);
     void notifyStrictCleartext(const char* uid, const char* hex);
+
+private:
+    static void *threadStart(void *handler);
+    void run();
+    void stopWorker();
+    // Looks up the name of an interface in mIfNames, or with if_indextoname() if it is not cached
+    // or |refresh| is true. Forgets interfaces that no longer exist.
+    bool getIfName(int ifindex, bool refresh, std::string *ifname);
+    void destroySocketsOnAddress(const char *addrstr);
+
+    const char *mName;
+    const int mNetlinkFamily;
+    const int mFormat;
+    char mBuffer[64 * 1024] __attribute__((aligned(4)));
+
+    // Ring of received messages. Each slot holds a buffer of exactly the message's length, and is
+    // emptied when the worker takes the message.
+    std::mutex mQueueLock;
+    std::condition_variable mQueueCv;
+    std::vector<std::vector<char>> mQueue;
+    size_t mQueueHead;
+    size_t mQueueSize;
+    size_t mQueueBytes;
+    bool mStopping;
+    pthread_t mThread;
+
+    // Interface names learned from RTM_NEWLINK, so that address and route events don't need an
+    // if_indextoname() call each. Only accessed by the worker thread.
+    std::map<int, std::string> mIfNames;
+
+    // Overflow accounting, reported by dump().
+    std::atomic<uint64_t> mReceived;
+    std::atomic<uint64_t> mQueueDrops;
+    std::atomic<uint64_t> mKernelDrops;
+    std::atomic<size_t> mMaxQueueSize;
+
+    // When an overflow was last logged, and the count then. Only accessed by the listener thread.
+    std::chrono::steady_clock::time_point mLastOverflowLog;
+    uint64_t mLoggedKernelDrops;
 };
 #endif
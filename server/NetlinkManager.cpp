@@ -41,6 +41,7 @@
 
 #include <arpa/inet.h>
 
+#include "DumpWriter.h"
 #include "NetlinkManager.h"
 #include "NetlinkHandler.h"
 
@@ -48,6 +49,7 @@
 
 const int NetlinkManager::NFLOG_QUOTA_GROUP = 1;
 const int NetlinkManager::NETFILTER_STRICT_GROUP = 2;
+const std::chrono::milliseconds NetlinkManager::BROADCAST_COALESCE_WINDOW(50);
 
 NetlinkManager *NetlinkManager::sInstance = NULL;
 
@@ -57,14 +59,18 @@ NetlinkManager *NetlinkManager::Instance() {
     return sInstance;
 }
 
-NetlinkManager::NetlinkManager() {
+NetlinkManager::NetlinkManager() :
+        mCoalescer(BROADCAST_COALESCE_WINDOW),
+        mWriter(BroadcastWriter::kDefaultMaxQueuedBytes) {
     mBroadcaster = NULL;
+    mCoalescer.setWriter(&mWriter);
+    mUeventHandler = mRouteHandler = mQuotaHandler = mStrictHandler = NULL;
 }
 
 NetlinkManager::~NetlinkManager() {
 }
 
-NetlinkHandler *NetlinkManager::setupSocket(int *sock, int netlinkFamily,
+NetlinkHandler *NetlinkManager::setupSocket(const char *name, int *sock, int netlinkFamily,
     int groups, int format, bool configNflog) {
 
     struct sockaddr_nl nladdr;
@@ -115,9 +121,10 @@ NetlinkHandler *NetlinkManager::setupSocket(int *sock, int netlinkFamily,
         }
     }
 
-    NetlinkHandler *handler = new NetlinkHandler(this, *sock, format);
+    NetlinkHandler *handler = new NetlinkHandler(this, name, *sock, netlinkFamily, format);
     if (handler->start()) {
-        ALOGE("Unable to start NetlinkHandler: %s", strerror(errno));
+        ALOGE("Unable to start %s NetlinkHandler: %s", name, strerror(errno));
+        delete handler;
         close(*sock);
         return NULL;
     }
@@ -126,12 +133,22 @@ NetlinkHandler *NetlinkManager::setupSocket(int *sock, int netlinkFamily,
 }
 
 int NetlinkManager::start() {
-    if ((mUeventHandler = setupSocket(&mUeventSock, NETLINK_KOBJECT_UEVENT,
+    if (mWriter.start()) {
+        ALOGE("Unable to start broadcast writer: %s", strerror(errno));
+        return -1;
+    }
+
+    if (mCoalescer.start()) {
+        ALOGE("Unable to start broadcast coalescer: %s", strerror(errno));
+        return -1;
+    }
+
+    if ((mUeventHandler = setupSocket("uevent", &mUeventSock, NETLINK_KOBJECT_UEVENT,
          0xffffffff, NetlinkListener::NETLINK_FORMAT_ASCII, false)) == NULL) {
         return -1;
     }
 
-    if ((mRouteHandler = setupSocket(&mRouteSock, NETLINK_ROUTE,
+    if ((mRouteHandler = setupSocket("route", &mRouteSock, NETLINK_ROUTE,
                                      RTMGRP_LINK |
                                      RTMGRP_IPV4_IFADDR |
                                      RTMGRP_IPV6_IFADDR |
@@ -141,13 +158,13 @@ int NetlinkManager::start() {
         return -1;
     }
 
-    if ((mQuotaHandler = setupSocket(&mQuotaSock, NETLINK_NFLOG,
+    if ((mQuotaHandler = setupSocket("quota", &mQuotaSock, NETLINK_NFLOG,
             NFLOG_QUOTA_GROUP, NetlinkListener::NETLINK_FORMAT_BINARY, false)) == NULL) {
         ALOGW("Unable to open qlog quota socket, check if xt_quota2 can send via UeventHandler");
         // TODO: return -1 once the emulator gets a new kernel.
     }
 
-    if ((mStrictHandler = setupSocket(&mStrictSock, NETLINK_NETFILTER,
+    if ((mStrictHandler = setupSocket("strict", &mStrictSock, NETLINK_NETFILTER,
             0, NetlinkListener::NETLINK_FORMAT_BINARY_UNICAST, true)) == NULL) {
         ALOGE("Unable to open strict socket");
         // TODO: return -1 once the emulator gets a new kernel.
@@ -207,5 +224,26 @@ int NetlinkManager::stop() {
         mStrictSock = -1;
     }
 
+    mCoalescer.stop();
+    mWriter.stop();
+
     return status;
 }
+
+void NetlinkManager::dump(DumpWriter& dw) {
+    dw.incIndent();
+    dw.println("NetlinkManager");
+
+    dw.incIndent();
+    for (NetlinkHandler *handler : { mUeventHandler, mRouteHandler, mQuotaHandler,
+                                     mStrictHandler }) {
+        if (handler) {
+            handler->dump(dw);
+        }
+    }
+    mCoalescer.dump(dw);
+    mWriter.dump(dw);
+    dw.decIndent();
+
+    dw.decIndent();
+}
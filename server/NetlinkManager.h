@@ -20,7 +20,11 @@
 #include <sysutils/SocketListener.h>
 #include <sysutils/NetlinkListener.h>
 
+#include "BroadcastCoalescer.h"
+#include "BroadcastWriter.h"
 
+
+class DumpWriter;
 class NetlinkHandler;
 
 class NetlinkManager {
@@ -29,6 +33,8 @@ private:
 
 private:
     SocketListener       *mBroadcaster;
+    BroadcastCoalescer   mCoalescer;
+    BroadcastWriter      mWriter;
     NetlinkHandler       *mUeventHandler;
     NetlinkHandler       *mRouteHandler;
     NetlinkHandler       *mQuotaHandler;
@@ -44,8 +50,14 @@ public:
     int start();
     int stop();
 
-    void setBroadcaster(SocketListener *sl) { mBroadcaster = sl; }
+    void dump(DumpWriter& dw);
+
+    void setBroadcaster(SocketListener *sl) {
+        mBroadcaster = sl;
+        mCoalescer.setListener(sl);
+    }
     SocketListener *getBroadcaster() { return mBroadcaster; }
+    BroadcastCoalescer *getCoalescer() { return &mCoalescer; }
 
     static NetlinkManager *Instance();
 
@@ -53,10 +65,12 @@ public:
     static const int NFLOG_QUOTA_GROUP;
     /* Group used by StrictController rules */
     static const int NETFILTER_STRICT_GROUP;
+    /* How long to hold broadcasts so that redundant events can be coalesced */
+    static const std::chrono::milliseconds BROADCAST_COALESCE_WINDOW;
 
 private:
     NetlinkManager();
-    NetlinkHandler* setupSocket(int *sock, int netlinkFamily, int groups,
+    NetlinkHandler* setupSocket(const char *name, int *sock, int netlinkFamily, int groups,
         int format, bool configNflog);
 };
 #endif
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_REQUEST_TABLE_H
+#define NETD_SERVER_REQUEST_TABLE_H
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * A table of in-flight requests, keyed by request id and owned by a client.
+ *
+ * Entries are stored in a slab of reusable slots. Each entry can be found either by request id,
+ * through a hash index, or by Handle, which indexes the slab directly and is cheap enough to use
+ * as an epoll key. Every slot has a generation that is bumped when its entry is erased, so a Handle
+ * to an erased entry never finds a later entry that reuses the slot. A second index tracks which
+ * entries each owner has, so that all of a client's entries can be erased when it goes away.
+ *
+ * Insertion, lookup and erasure are O(1). Not threadsafe; callers provide their own locking.
+ */
+template <typename Value, typename Owner>
+class RequestTable {
+public:
+    struct Handle {
+        uint32_t index;
+        uint32_t generation;
+
+        uint64_t toKey() const { return (static_cast<uint64_t>(generation) << 32) | index; }
+        static Handle fromKey(uint64_t key) {
+            return { static_cast<uint32_t>(key & 0xffffffff), static_cast<uint32_t>(key >> 32) };
+        }
+    };
+
+    RequestTable() = default;
+    RequestTable(const RequestTable&) = delete;
+    RequestTable& operator=(const RequestTable&) = delete;
+
+    // Adds an entry. Returns false, and does nothing, if the request id is already in use.
+    bool insert(int id, Owner owner, const Value& value, Handle* handle) {
+        if (mIndexById.find(id) != mIndexById.end()) {
+            return false;
+        }
+        uint32_t index;
+        if (!mFree.empty()) {
+            index = mFree.back();
+            mFree.pop_back();
+        } else {
+            index = mSlots.size();
+            mSlots.emplace_back();
+        }
+        Slot& slot = mSlots[index];
+        slot.used = true;
+        slot.id = id;
+        slot.owner = owner;
+        slot.value = value;
+        mIndexById[id] = index;
+        mIdsByOwner[owner].insert(id);
+        if (handle != nullptr) {
+            *handle = { index, slot.generation };
+        }
+        return true;
+    }
+
+    // Returns the entry for a request id, or null.
+    Value* find(int id) {
+        auto it = mIndexById.find(id);
+        return (it != mIndexById.end()) ? &mSlots[it->second].value : nullptr;
+    }
+
+    // Returns the entry for a handle, or null if it has been erased.
+    Value* get(Handle handle) {
+        if (handle.index >= mSlots.size()) {
+            return nullptr;
+        }
+        Slot& slot = mSlots[handle.index];
+        return (slot.used && slot.generation == handle.generation) ? &slot.value : nullptr;
+    }
+
+    // Removes the entry for a request id, moving it into *value if value is not null. Returns
+    // false if there is no such entry.
+    bool erase(int id, Value* value) {
+        auto it = mIndexById.find(id);
+        if (it == mIndexById.end()) {
+            return false;
+        }
+        const uint32_t index = it->second;
+        mIndexById.erase(it);
+
+        Slot& slot = mSlots[index];
+        auto owned = mIdsByOwner.find(slot.owner);
+        if (owned != mIdsByOwner.end()) {
+            owned->second.erase(id);
+            if (owned->second.empty()) {
+                mIdsByOwner.erase(owned);
+            }
+        }
+        release(index, value);
+        return true;
+    }
+
+    // Removes all entries that belong to an owner and returns them.
+    std::vector<Value> eraseOwnedBy(Owner owner) {
+        std::vector<Value> values;
+        auto owned = mIdsByOwner.find(owner);
+        if (owned == mIdsByOwner.end()) {
+            return values;
+        }
+        values.reserve(owned->second.size());
+        for (int id : owned->second) {
+            auto it = mIndexById.find(id);
+            const uint32_t index = it->second;
+            mIndexById.erase(it);
+            values.emplace_back();
+            release(index, &values.back());
+        }
+        mIdsByOwner.erase(owned);
+        return values;
+    }
+
+    size_t size() const { return mIndexById.size(); }
+    bool empty() const { return mIndexById.empty(); }
+
+private:
+    struct Slot {
+        uint32_t generation = 0;
+        bool used = false;
+        int id = 0;
+        Owner owner = Owner();
+        Value value = Value();
+    };
+
+    void release(uint32_t index, Value* value) {
+        Slot& slot = mSlots[index];
+        if (value != nullptr) {
+            *value = std::move(slot.value);
+        }
+        slot.value = Value();
+        slot.owner = Owner();
+        slot.used = false;
+        slot.generation++;
+        mFree.push_back(index);
+    }
+
+    std::vector<Slot> mSlots;
+    std::vector<uint32_t> mFree;
+    std::unordered_map<int, uint32_t> mIndexById;
+    std::unordered_map<Owner, std::unordered_set<int>> mIdsByOwner;
+};
+
+#endif  // NETD_SERVER_REQUEST_TABLE_H
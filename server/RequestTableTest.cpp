@@ -0,0 +1,98 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * RequestTableTest.cpp - unit tests for RequestTable.h
+ */
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "RequestTable.h"
+
+using Table = RequestTable<std::string, int>;
+
+TEST(RequestTableTest, TestInsertFindErase) {
+    Table table;
+    Table::Handle h1, h2;
+    EXPECT_TRUE(table.insert(100, 1, "discover", &h1));
+    EXPECT_TRUE(table.insert(101, 1, "resolve", &h2));
+    EXPECT_FALSE(table.insert(100, 2, "duplicate", nullptr));
+    EXPECT_EQ(2U, table.size());
+
+    ASSERT_NE(nullptr, table.find(100));
+    EXPECT_EQ("discover", *table.find(100));
+    ASSERT_NE(nullptr, table.get(h2));
+    EXPECT_EQ("resolve", *table.get(h2));
+    EXPECT_EQ(nullptr, table.find(102));
+
+    std::string value;
+    EXPECT_TRUE(table.erase(100, &value));
+    EXPECT_EQ("discover", value);
+    EXPECT_FALSE(table.erase(100, nullptr));
+    EXPECT_EQ(nullptr, table.find(100));
+    EXPECT_EQ(nullptr, table.get(h1));
+    EXPECT_EQ(1U, table.size());
+}
+
+TEST(RequestTableTest, TestStaleHandles) {
+    Table table;
+    Table::Handle old, reused;
+    ASSERT_TRUE(table.insert(100, 1, "first", &old));
+    ASSERT_TRUE(table.erase(100, nullptr));
+
+    // The slot is reused, even for the same request id, but the old handle does not find it.
+    ASSERT_TRUE(table.insert(100, 1, "second", &reused));
+    EXPECT_EQ(old.index, reused.index);
+    EXPECT_NE(old.generation, reused.generation);
+    EXPECT_EQ(nullptr, table.get(old));
+    EXPECT_EQ(nullptr, table.get(Table::Handle::fromKey(old.toKey())));
+    ASSERT_NE(nullptr, table.get(Table::Handle::fromKey(reused.toKey())));
+    EXPECT_EQ("second", *table.get(reused));
+
+    EXPECT_EQ(nullptr, table.get({ 1000, 0 }));
+}
+
+TEST(RequestTableTest, TestEraseOwnedBy) {
+    Table table;
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(table.insert(i, i % 2, std::to_string(i), nullptr));
+    }
+    // Erasing one entry individually keeps the owner index consistent.
+    ASSERT_TRUE(table.erase(3, nullptr));
+
+    std::vector<std::string> odd = table.eraseOwnedBy(1);
+    std::sort(odd.begin(), odd.end());
+    EXPECT_EQ(std::vector<std::string>({ "1", "5", "7", "9" }), odd);
+    EXPECT_EQ(5U, table.size());
+    EXPECT_EQ(nullptr, table.find(1));
+    ASSERT_NE(nullptr, table.find(2));
+
+    EXPECT_TRUE(table.eraseOwnedBy(1).empty());
+    EXPECT_EQ(5U, table.eraseOwnedBy(0).size());
+    EXPECT_TRUE(table.empty());
+}
+
+TEST(RequestTableTest, TestValuesAreReleased) {
+    RequestTable<std::shared_ptr<int>, int> table;
+    std::shared_ptr<int> value = std::make_shared<int>(42);
+    ASSERT_TRUE(table.insert(1, 1, value, nullptr));
+    EXPECT_EQ(2, value.use_count());
+    ASSERT_TRUE(table.erase(1, nullptr));
+    EXPECT_EQ(1, value.use_count());
+}
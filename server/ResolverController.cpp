@@ -25,6 +25,7 @@
 #include <net/if.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <arpa/nameser.h>
 
 // NOTE: <resolv_netid.h> is a private C library header that provides
 //       declarations for _resolv_set_nameservers_for_net and
@@ -35,20 +36,99 @@
 
 #include <android-base/strings.h>
 #include <android/net/INetd.h>
+#include <android/net/ResolverInfo.h>
 
 #include "DumpWriter.h"
 #include "ResolverController.h"
 #include "ResolverStats.h"
 
+namespace {
+
+// The resolver's configuration and stats for a network, as bionic stores them.
+struct RawResolverInfo {
+    int nscount = 0;
+    sockaddr_storage servers[MAXNS];
+    int dcount = 0;
+    char domains[MAXDNSRCH][MAXDNSRCHPATH];
+    __res_params params {};
+    __res_stats stats[MAXNS];
+    // Which servers are considered usable by the resolver.
+    bool usable[MAXNS] = {};
+};
+
+int getRawResolverInfo(unsigned netId, RawResolverInfo* info) {
+    int revision_id = android_net_res_stats_get_info_for_net(netId, &info->nscount, info->servers,
+            &info->dcount, info->domains, &info->params, info->stats);
+
+    // If the netId is unknown (which can happen for valid net IDs for which no DNS servers have
+    // yet been configured), there is no revision ID. In this case there is no data to return.
+    if (revision_id < 0) {
+        info->nscount = 0;
+        info->dcount = 0;
+        info->params = __res_params{};
+        return 0;
+    }
+
+    // Verify that the returned data is sane.
+    if (info->nscount < 0 || info->nscount > MAXNS || info->dcount < 0 ||
+            info->dcount > MAXDNSRCH) {
+        ALOGE("%s: nscount=%d, dcount=%d", __FUNCTION__, info->nscount, info->dcount);
+        return -ENOTRECOVERABLE;
+    }
+
+    android_net_res_stats_get_usable_servers(&info->params, info->stats, info->nscount,
+            info->usable);
+    return 0;
+}
+
+// Computes the stats that bionic does not aggregate from a server's samples.
+void getSampleStats(const __res_stats& stats, android::net::ResolverInfo::ServerStats* out) {
+    int32_t rtts[MAXNSSAMPLES];
+    int count = 0;
+    for (int i = 0; i < stats.sample_count && i < MAXNSSAMPLES; ++i) {
+        const __res_sample& sample = stats.samples[i];
+        switch (sample.rcode) {
+            // The same rcodes that android_net_res_stats_aggregate() counts as successes.
+            case ns_r_noerror:
+            case ns_r_notauth:
+            case ns_r_nxdomain:
+                rtts[count++] = sample.rtt;
+                out->lastSuccessTime = std::max<int64_t>(out->lastSuccessTime, sample.at);
+                break;
+            case RCODE_TIMEOUT:
+                out->lastTimeoutTime = std::max<int64_t>(out->lastTimeoutTime, sample.at);
+                break;
+            case RCODE_INTERNAL_ERROR:
+                break;
+            default:
+                out->lastErrorTime = std::max<int64_t>(out->lastErrorTime, sample.at);
+                break;
+        }
+    }
+    if (count > 0) {
+        std::sort(rtts, rtts + count);
+        out->rttP50 = rtts[(count - 1) * 50 / 100];
+        out->rttP90 = rtts[(count - 1) * 90 / 100];
+        out->rttMax = rtts[count - 1];
+    }
+}
+
+}  // namespace
+
 int ResolverController::setDnsServers(unsigned netId, const char* searchDomains,
         const char** servers, int numservers, const __res_params* params) {
     if (DBG) {
         ALOGD("setDnsServers netId = %u\n", netId);
     }
+    std::lock_guard<std::mutex> lock(mLock);
+    // Bionic's configuration no longer matches what was last set through the binder interface.
+    mConfigs.erase(netId);
     return -_resolv_set_nameservers_for_net(netId, servers, numservers, searchDomains, params);
 }
 
 int ResolverController::clearDnsServers(unsigned netId) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mConfigs.erase(netId);
     _resolv_set_nameservers_for_net(netId, NULL, 0, "", NULL);
     if (DBG) {
         ALOGD("clearDnsServers netId = %u\n", netId);
@@ -56,6 +136,14 @@ int ResolverController::clearDnsServers(unsigned netId) {
     return 0;
 }
 
+void ResolverController::removeNetwork(unsigned netId) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mConfigs.erase(netId);
+    if (DBG) {
+        ALOGD("removeNetwork netId = %u\n", netId);
+    }
+}
+
 int ResolverController::flushDnsCache(unsigned netId) {
     if (DBG) {
         ALOGD("flushDnsCache netId = %u\n", netId);
@@ -80,41 +168,22 @@ int ResolverController::getDnsInfo(unsigned netId, std::vector<std::string>* ser
             ResolverStats::STATS_USABLE == INetd::RESOLVER_STATS_USABLE &&
             ResolverStats::STATS_COUNT == INetd::RESOLVER_STATS_COUNT,
             "AIDL and ResolverStats.h out of sync");
-    int nscount = -1;
-    sockaddr_storage res_servers[MAXNS];
-    int dcount = -1;
-    char res_domains[MAXDNSRCH][MAXDNSRCHPATH];
-    __res_stats res_stats[MAXNS];
     servers->clear();
     domains->clear();
     *params = __res_params{};
     stats->clear();
-    int revision_id = android_net_res_stats_get_info_for_net(netId, &nscount, res_servers, &dcount,
-            res_domains, params, res_stats);
-
-    // If the netId is unknown (which can happen for valid net IDs for which no DNS servers have
-    // yet been configured), there is no revision ID. In this case there is no data to return.
-    if (revision_id < 0) {
-        return 0;
-    }
-
-    // Verify that the returned data is sane.
-    if (nscount < 0 || nscount > MAXNS || dcount < 0 || dcount > MAXDNSRCH) {
-        ALOGE("%s: nscount=%d, dcount=%d", __FUNCTION__, nscount, dcount);
-        return -ENOTRECOVERABLE;
+    RawResolverInfo info;
+    if (int ret = getRawResolverInfo(netId, &info)) {
+        return ret;
     }
-
-    // Determine which servers are considered usable by the resolver.
-    bool valid_servers[MAXNS];
-    std::fill_n(valid_servers, MAXNS, false);
-    android_net_res_stats_get_usable_servers(params, res_stats, nscount, valid_servers);
+    *params = info.params;
 
     // Convert the server sockaddr structures to std::string.
-    stats->resize(nscount);
-    for (int i = 0 ; i < nscount ; ++i) {
+    stats->resize(info.nscount);
+    for (int i = 0 ; i < info.nscount ; ++i) {
         char hbuf[NI_MAXHOST];
-        int rv = getnameinfo(reinterpret_cast<const sockaddr*>(&res_servers[i]),
-                sizeof(res_servers[i]), hbuf, sizeof(hbuf), nullptr, 0, NI_NUMERICHOST);
+        int rv = getnameinfo(reinterpret_cast<const sockaddr*>(&info.servers[i]),
+                sizeof(info.servers[i]), hbuf, sizeof(hbuf), nullptr, 0, NI_NUMERICHOST);
         std::string server_str;
         if (rv == 0) {
             server_str.assign(hbuf);
@@ -124,15 +193,15 @@ int ResolverController::getDnsInfo(unsigned netId, std::vector<std::string>* ser
         }
         servers->push_back(std::move(server_str));
         android::net::ResolverStats& cur_stats = (*stats)[i];
-        android_net_res_stats_aggregate(&res_stats[i], &cur_stats.successes, &cur_stats.errors,
+        android_net_res_stats_aggregate(&info.stats[i], &cur_stats.successes, &cur_stats.errors,
                 &cur_stats.timeouts, &cur_stats.internal_errors, &cur_stats.rtt_avg,
                 &cur_stats.last_sample_time);
-        cur_stats.usable = valid_servers[i];
+        cur_stats.usable = info.usable[i];
     }
 
     // Convert the stack-allocated search domain strings to std::string.
-    for (int i = 0 ; i < dcount ; ++i) {
-        domains->push_back(res_domains[i]);
+    for (int i = 0 ; i < info.dcount ; ++i) {
+        domains->push_back(info.domains[i]);
     }
     return 0;
 }
@@ -146,28 +215,72 @@ int ResolverController::setResolverConfiguration(int32_t netId,
         return -EINVAL;
     }
 
+    DnsConfig config;
+    config.servers = servers;
+    if (!domains.empty()) {
+        config.domains = domains[0];
+        for (size_t i = 1 ; i < domains.size() ; ++i) {
+            config.domains += " " + domains[i];
+        }
+    }
+    config.params.sample_validity = params[INetd::RESOLVER_PARAMS_SAMPLE_VALIDITY];
+    config.params.success_threshold = params[INetd::RESOLVER_PARAMS_SUCCESS_THRESHOLD];
+    config.params.min_samples = params[INetd::RESOLVER_PARAMS_MIN_SAMPLES];
+    config.params.max_samples = params[INetd::RESOLVER_PARAMS_MAX_SAMPLES];
+
+    // The framework resends the whole configuration whenever any link property changes. Only
+    // pass it on to bionic if something it cares about changed: bionic flushes the cache and the
+    // stats when the servers change, but keeps them when only the search domains or params do.
+    std::lock_guard<std::mutex> lock(mLock);
+    NetworkConfig& current = mConfigs[netId];
+    const int changed = diffConfig(current.hasConfig ? &current.config : nullptr, config);
+    if (DBG) {
+        ALOGD("setResolverConfiguration netId = %d, changed = 0x%x\n", netId, changed);
+    }
+
+    if (changed == 0) {
+        current.unchanged++;
+        return 0;
+    }
+
+    // Lookups in progress keep using the configuration they started with; bionic copies it into
+    // each lookup's resolver state.
     auto server_count = std::min<size_t>(MAXNS, servers.size());
     std::vector<const char*> server_ptrs;
     for (size_t i = 0 ; i < server_count ; ++i) {
         server_ptrs.push_back(servers[i].c_str());
     }
-
-    std::string domains_str;
-    if (!domains.empty()) {
-        domains_str = domains[0];
-        for (size_t i = 1 ; i < domains.size() ; ++i) {
-            domains_str += " " + domains[i];
-        }
+    int ret = -_resolv_set_nameservers_for_net(netId, server_ptrs.data(), server_ptrs.size(),
+            config.domains.c_str(), &config.params);
+    if (ret == 0) {
+        current.hasConfig = true;
+        current.config = config;
+        current.applied++;
+    } else {
+        // We don't know what state bionic is in, so don't skip the next update.
+        current.hasConfig = false;
     }
+    return ret;
+}
 
-    __res_params res_params;
-    res_params.sample_validity = params[INetd::RESOLVER_PARAMS_SAMPLE_VALIDITY];
-    res_params.success_threshold = params[INetd::RESOLVER_PARAMS_SUCCESS_THRESHOLD];
-    res_params.min_samples = params[INetd::RESOLVER_PARAMS_MIN_SAMPLES];
-    res_params.max_samples = params[INetd::RESOLVER_PARAMS_MAX_SAMPLES];
-
-    return setDnsServers(netId, domains_str.c_str(), server_ptrs.data(), server_ptrs.size(),
-            &res_params);
+int ResolverController::diffConfig(const DnsConfig* oldConfig, const DnsConfig& newConfig) {
+    if (oldConfig == nullptr) {
+        return CONFIG_SERVERS_CHANGED | CONFIG_DOMAINS_CHANGED | CONFIG_PARAMS_CHANGED;
+    }
+    int changed = 0;
+    if (oldConfig->servers != newConfig.servers) {
+        changed |= CONFIG_SERVERS_CHANGED;
+    }
+    if (oldConfig->domains != newConfig.domains) {
+        changed |= CONFIG_DOMAINS_CHANGED;
+    }
+    const __res_params& a = oldConfig->params;
+    const __res_params& b = newConfig.params;
+    if (a.sample_validity != b.sample_validity || a.success_threshold != b.success_threshold ||
+            a.min_samples != b.min_samples || a.max_samples != b.max_samples) {
+        changed |= CONFIG_PARAMS_CHANGED;
+    }
+    return changed;
 }
 
 int ResolverController::getResolverInfo(int32_t netId, std::vector<std::string>* servers,
@@ -193,6 +306,45 @@ int ResolverController::getResolverInfo(int32_t netId, std::vector<std::string>*
     return 0;
 }
 
+int ResolverController::getResolverInfo(int32_t netId, android::net::ResolverInfo* info) {
+    using android::net::INetd;
+    using android::net::ResolverInfo;
+    RawResolverInfo raw;
+    if (int ret = getRawResolverInfo(netId, &raw)) {
+        return ret;
+    }
+
+    info->netId = netId;
+    info->servers.resize(raw.nscount);
+    for (int i = 0 ; i < raw.nscount ; ++i) {
+        ResolverInfo::Server& server = info->servers[i];
+        server.addr = raw.servers[i];
+        ResolverInfo::ServerStats& s = server.stats;
+        s = ResolverInfo::ServerStats();
+        time_t last_sample_time;
+        android_net_res_stats_aggregate(&raw.stats[i], &s.successes, &s.errors, &s.timeouts,
+                &s.internalErrors, &s.rttAvg, &last_sample_time);
+        s.lastSampleTime = last_sample_time;
+        getSampleStats(raw.stats[i], &s);
+        s.usable = raw.usable[i];
+    }
+    info->domains.assign(raw.domains, raw.domains + raw.dcount);
+
+    info->params.resize(INetd::RESOLVER_PARAMS_COUNT);
+    info->params[INetd::RESOLVER_PARAMS_SAMPLE_VALIDITY] = raw.params.sample_validity;
+    info->params[INetd::RESOLVER_PARAMS_SUCCESS_THRESHOLD] = raw.params.success_threshold;
+    info->params[INetd::RESOLVER_PARAMS_MIN_SAMPLES] = raw.params.min_samples;
+    info->params[INetd::RESOLVER_PARAMS_MAX_SAMPLES] = raw.params.max_samples;
+
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mConfigs.find(netId);
+    if (it != mConfigs.end()) {
+        info->configUpdatesApplied = it->second.applied;
+        info->configUpdatesUnchanged = it->second.unchanged;
+    }
+    return 0;
+}
+
 void ResolverController::dump(DumpWriter& dw, unsigned netId) {
     // No lock needed since Bionic's resolver locks all accessed data structures internally.
     using android::net::ResolverStats;
@@ -243,6 +395,14 @@ void ResolverController::dump(DumpWriter& dw, unsigned netId) {
                     static_cast<unsigned>(params.min_samples),
                     static_cast<unsigned>(params.max_samples));
         }
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            auto it = mConfigs.find(netId);
+            if (it != mConfigs.end()) {
+                dw.println("Configuration updates: %u applied, %u unchanged",
+                        it->second.applied, it->second.unchanged);
+            }
+        }
     }
     dw.decIndent();
 }
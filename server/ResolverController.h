@@ -17,15 +17,20 @@
 #ifndef _RESOLVER_CONTROLLER_H_
 #define _RESOLVER_CONTROLLER_H_
 
+#include <map>
+#include <mutex>
+#include <string>
 #include <vector>
 #include <netinet/in.h>
 #include <linux/in.h>
 
-struct __res_params;
+#include <resolv_params.h>
+
 class DumpWriter;
 
 namespace android {
 namespace net {
+class ResolverInfo;
 struct ResolverStats;
 }  // namespace net
 }  // namespace android
@@ -42,6 +47,10 @@ public:
 
     int clearDnsServers(unsigned netid);
 
+    // Forgets everything known about a network that was destroyed, after bionic dropped its
+    // configuration, so that a network created later with the same netId is configured in full.
+    void removeNetwork(unsigned netId);
+
     int flushDnsCache(unsigned netid);
 
     int getDnsInfo(unsigned netId, std::vector<std::string>* servers,
@@ -56,7 +65,42 @@ public:
     int getResolverInfo(int32_t netId, std::vector<std::string>* servers,
             std::vector<std::string>* domains, std::vector<int32_t>* params,
             std::vector<int32_t>* stats);
+
+    // Returns the same information as getDnsInfo(), plus additional stats computed from the
+    // resolver's samples, without converting addresses to strings.
+    int getResolverInfo(int32_t netId, android::net::ResolverInfo* info);
+
     void dump(DumpWriter& dw, unsigned netId);
+
+private:
+    // A network's configuration as last requested through setResolverConfiguration().
+    struct DnsConfig {
+        std::vector<std::string> servers;
+        std::string domains;
+        __res_params params;
+    };
+
+    // What changed between two configurations.
+    enum {
+        CONFIG_SERVERS_CHANGED = 1 << 0,
+        CONFIG_DOMAINS_CHANGED = 1 << 1,
+        CONFIG_PARAMS_CHANGED = 1 << 2,
+    };
+    static int diffConfig(const DnsConfig* oldConfig, const DnsConfig& newConfig);
+
+    struct NetworkConfig {
+        // False if the configuration in bionic is not known, e.g., because an update failed.
+        bool hasConfig = false;
+        DnsConfig config;
+        // Updates that were skipped because nothing changed, and updates that were applied.
+        unsigned unchanged = 0;
+        unsigned applied = 0;
+    };
+
+    // Protects mConfigs, and serializes configuration changes so that comparing against the
+    // current configuration and replacing it is atomic.
+    std::mutex mLock;
+    std::map<unsigned, NetworkConfig> mConfigs;
 };
 
 #endif /* _RESOLVER_CONTROLLER_H_ */
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <linux/if_addr.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <algorithm>
+
+#define LOG_TAG "Netd"
+
+#include <cutils/log.h>
+
+#include "RtnetlinkEvent.h"
+
+namespace {
+
+size_t addrLen(int family) {
+    switch (family) {
+        case AF_INET:  return sizeof(in_addr);
+        case AF_INET6: return sizeof(in6_addr);
+        default:       return 0;
+    }
+}
+
+std::string toString(int family, const uint8_t *addr) {
+    char buf[INET6_ADDRSTRLEN] = "";
+    inet_ntop(family, addr, buf, sizeof(buf));
+    return buf;
+}
+
+bool isHandled(uint16_t type) {
+    switch (type) {
+        case RTM_NEWLINK:
+        case RTM_DELLINK:
+        case RTM_NEWADDR:
+        case RTM_DELADDR:
+        case RTM_NEWROUTE:
+        case RTM_DELROUTE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool parseLink(const nlmsghdr *nh, RtnetlinkEvent *event) {
+    const ifinfomsg *ifi = reinterpret_cast<const ifinfomsg *>(NLMSG_DATA(nh));
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi))) {
+        return false;
+    }
+    if (ifi->ifi_flags & IFF_LOOPBACK) {
+        return false;
+    }
+
+    event->type = (nh->nlmsg_type == RTM_NEWLINK) ? RtnetlinkEvent::LINK_UPDATED :
+                                                    RtnetlinkEvent::LINK_REMOVED;
+    event->family = ifi->ifi_family;
+    event->ifindex = ifi->ifi_index;
+    event->flags = ifi->ifi_flags;
+
+    int len = IFLA_PAYLOAD(nh);
+    for (const rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) {
+            strlcpy(event->ifname, reinterpret_cast<const char *>(RTA_DATA(rta)),
+                    std::min(sizeof(event->ifname), static_cast<size_t>(RTA_PAYLOAD(rta))));
+            return true;
+        }
+    }
+    // Like NetlinkEvent, ignore new links without a name. Removals are still reported so that
+    // callers can forget about the ifindex.
+    return nh->nlmsg_type == RTM_DELLINK;
+}
+
+bool parseAddress(const nlmsghdr *nh, RtnetlinkEvent *event) {
+    const ifaddrmsg *ifa = reinterpret_cast<const ifaddrmsg *>(NLMSG_DATA(nh));
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa))) {
+        return false;
+    }
+
+    const size_t alen = addrLen(ifa->ifa_family);
+    if (alen == 0) {
+        return false;
+    }
+
+    bool haveAddress = false;
+    // IFA_FLAGS, if present, holds all the flags. ifa_flags only holds the lower 8 bits.
+    unsigned flags = ifa->ifa_flags;
+    int len = IFA_PAYLOAD(nh);
+    for (const rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFA_ADDRESS && RTA_PAYLOAD(rta) >= alen) {
+            // Only look at the first address, because we only support notifying one change at a
+            // time.
+            if (!haveAddress) {
+                memcpy(event->addr, RTA_DATA(rta), alen);
+                haveAddress = true;
+            }
+        } else if (rta->rta_type == IFA_FLAGS && RTA_PAYLOAD(rta) >= sizeof(uint32_t)) {
+            uint32_t value;
+            memcpy(&value, RTA_DATA(rta), sizeof(value));
+            flags = value;
+        }
+    }
+    if (!haveAddress) {
+        return false;
+    }
+
+    event->type = (nh->nlmsg_type == RTM_NEWADDR) ? RtnetlinkEvent::ADDRESS_UPDATED :
+                                                    RtnetlinkEvent::ADDRESS_REMOVED;
+    event->family = ifa->ifa_family;
+    event->ifindex = ifa->ifa_index;
+    event->flags = flags;
+    event->prefixlen = ifa->ifa_prefixlen;
+    event->scope = ifa->ifa_scope;
+    return true;
+}
+
+bool parseRoute(const nlmsghdr *nh, RtnetlinkEvent *event) {
+    const rtmsg *rtm = reinterpret_cast<const rtmsg *>(NLMSG_DATA(nh));
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm))) {
+        return false;
+    }
+
+    if (// Ignore static routes we've set up ourselves.
+        (rtm->rtm_protocol != RTPROT_KERNEL && rtm->rtm_protocol != RTPROT_RA) ||
+        // We're only interested in global unicast routes.
+        (rtm->rtm_scope != RT_SCOPE_UNIVERSE) ||
+        (rtm->rtm_type != RTN_UNICAST) ||
+        // We don't support source routing.
+        (rtm->rtm_src_len != 0) ||
+        // Cloned routes aren't real routes.
+        (rtm->rtm_flags & RTM_F_CLONED)) {
+        return false;
+    }
+
+    const size_t alen = addrLen(rtm->rtm_family);
+    if (alen == 0) {
+        return false;
+    }
+
+    event->type = (nh->nlmsg_type == RTM_NEWROUTE) ? RtnetlinkEvent::ROUTE_UPDATED :
+                                                     RtnetlinkEvent::ROUTE_REMOVED;
+    event->family = rtm->rtm_family;
+    event->prefixlen = rtm->rtm_dst_len;
+
+    // Currently we only support: destination, (one) next hop, ifindex.
+    bool hasDst = false;
+    int len = RTM_PAYLOAD(nh);
+    for (const rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+            case RTA_DST:
+                if (hasDst) continue;
+                if (RTA_PAYLOAD(rta) < alen) return false;
+                memcpy(event->addr, RTA_DATA(rta), alen);
+                hasDst = true;
+                break;
+            case RTA_GATEWAY:
+                if (event->hasGateway) continue;
+                if (RTA_PAYLOAD(rta) < alen) return false;
+                memcpy(event->gateway, RTA_DATA(rta), alen);
+                event->hasGateway = true;
+                break;
+            case RTA_OIF:
+                if (event->ifindex) continue;
+                if (RTA_PAYLOAD(rta) < sizeof(int)) return false;
+                memcpy(&event->ifindex, RTA_DATA(rta), sizeof(int));
+                break;
+            default:
+                break;
+        }
+    }
+
+    // If there's no RTA_DST attribute, then:
+    // - If the prefix length is zero, it's the default route (the address is already all zeros).
+    // - If the prefix length is nonzero, there's something we don't understand. Ignore the event.
+    if (!hasDst && event->prefixlen != 0) {
+        return false;
+    }
+
+    // A useful route must have at least either a gateway or an interface.
+    return event->hasGateway || event->ifindex != 0;
+}
+
+}  // namespace
+
+bool RtnetlinkEvent::isLinkUp() const {
+    return (flags & IFF_LOWER_UP) != 0;
+}
+
+std::string RtnetlinkEvent::addrToString() const {
+    return toString(family, addr);
+}
+
+std::string RtnetlinkEvent::prefixToString() const {
+    return addrToString() + "/" + std::to_string(prefixlen);
+}
+
+std::string RtnetlinkEvent::gatewayToString() const {
+    return hasGateway ? toString(family, gateway) : "";
+}
+
+bool RtnetlinkEvent::parse(const char *buf, size_t len, std::vector<RtnetlinkEvent> *events) {
+    events->clear();
+
+    // Check that we understand every message before we decode any of them.
+    size_t remaining = len;
+    for (const nlmsghdr *nh = reinterpret_cast<const nlmsghdr *>(buf);
+         NLMSG_OK(nh, remaining) && nh->nlmsg_type != NLMSG_DONE;
+         nh = NLMSG_NEXT(nh, remaining)) {
+        if (!isHandled(nh->nlmsg_type)) {
+            return false;
+        }
+    }
+
+    remaining = len;
+    for (const nlmsghdr *nh = reinterpret_cast<const nlmsghdr *>(buf);
+         NLMSG_OK(nh, remaining) && nh->nlmsg_type != NLMSG_DONE;
+         nh = NLMSG_NEXT(nh, remaining)) {
+        RtnetlinkEvent event;
+        memset(&event, 0, sizeof(event));
+
+        bool ok;
+        switch (nh->nlmsg_type) {
+            case RTM_NEWLINK:
+            case RTM_DELLINK:
+                ok = parseLink(nh, &event);
+                break;
+            case RTM_NEWADDR:
+            case RTM_DELADDR:
+                ok = parseAddress(nh, &event);
+                break;
+            default:
+                ok = parseRoute(nh, &event);
+                break;
+        }
+        if (ok) {
+            events->push_back(event);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_RTNETLINK_EVENT_H
+#define NETD_SERVER_RTNETLINK_EVENT_H
+
+#include <net/if.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * A link, address or route change decoded directly from a binary rtnetlink message.
+ *
+ * Unlike NetlinkEvent, which converts every message into "KEY=value" strings, this keeps the
+ * data in binary form so that handlers can act on it without any string parsing. Messages are
+ * filtered exactly as NetlinkEvent filters them.
+ */
+struct RtnetlinkEvent {
+    enum Type {
+        LINK_UPDATED,
+        LINK_REMOVED,
+        ADDRESS_UPDATED,
+        ADDRESS_REMOVED,
+        ROUTE_UPDATED,
+        ROUTE_REMOVED,
+    };
+
+    Type type;
+    int family;
+    // Interface index of the link or address, or the route's output interface (0 if none).
+    int ifindex;
+    // Link: ifi_flags. Address: IFA_FLAGS if present, otherwise ifa_flags.
+    unsigned flags;
+    // Links only.
+    char ifname[IFNAMSIZ];
+    // Address, or route destination.
+    uint8_t addr[16];
+    uint8_t prefixlen;
+    // Addresses only.
+    uint8_t scope;
+    // Routes only.
+    bool hasGateway;
+    uint8_t gateway[16];
+
+    bool isLinkUp() const;
+
+    // Text representations used in broadcasts: "2001:db8::1", "2001:db8::1/64", "fe80::1".
+    std::string addrToString() const;
+    std::string prefixToString() const;
+    std::string gatewayToString() const;
+
+    // Decodes all messages in a datagram received on a NETLINK_ROUTE socket. Returns false, without
+    // decoding anything, if the datagram contains any message that is not a link, address or route
+    // message, so that the caller can fall back to NetlinkEvent.
+    static bool parse(const char *buf, size_t len, std::vector<RtnetlinkEvent> *events);
+};
+
+#endif  // NETD_SERVER_RTNETLINK_EVENT_H
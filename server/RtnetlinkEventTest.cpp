@@ -0,0 +1,212 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * RtnetlinkEventTest.cpp - unit tests for RtnetlinkEvent.cpp
+ */
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <string.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "RtnetlinkEvent.h"
+
+namespace {
+
+// Builds a datagram containing rtnetlink messages.
+class MessageBuilder {
+public:
+    template <typename T>
+    MessageBuilder& begin(uint16_t type, const T& hdr) {
+        mStart = mBuf.size();
+        nlmsghdr nlh = { .nlmsg_len = 0, .nlmsg_type = type };
+        append(&nlh, sizeof(nlh));
+        append(&hdr, sizeof(hdr));
+        return *this;
+    }
+
+    MessageBuilder& attr(uint16_t type, const void *data, size_t len) {
+        rtattr rta = { .rta_len = static_cast<unsigned short>(RTA_LENGTH(len)),
+                       .rta_type = type };
+        append(&rta, sizeof(rta));
+        append(data, len);
+        return *this;
+    }
+
+    MessageBuilder& attr(uint16_t type, int family, const char *addrstr) {
+        uint8_t addr[16];
+        EXPECT_EQ(1, inet_pton(family, addrstr, addr));
+        return attr(type, addr, (family == AF_INET) ? 4 : 16);
+    }
+
+    MessageBuilder& end() {
+        reinterpret_cast<nlmsghdr *>(&mBuf[mStart])->nlmsg_len = mBuf.size() - mStart;
+        return *this;
+    }
+
+    bool parse(std::vector<RtnetlinkEvent> *events) {
+        return RtnetlinkEvent::parse(mBuf.data(), mBuf.size(), events);
+    }
+
+private:
+    void append(const void *data, size_t len) {
+        const char *p = reinterpret_cast<const char *>(data);
+        mBuf.insert(mBuf.end(), p, p + len);
+        mBuf.resize(NLMSG_ALIGN(mBuf.size()));
+    }
+
+    std::vector<char> mBuf;
+    size_t mStart = 0;
+};
+
+rtmsg routeMsg(int family, uint8_t dstLen, uint8_t protocol) {
+    rtmsg rtm = {};
+    rtm.rtm_family = family;
+    rtm.rtm_dst_len = dstLen;
+    rtm.rtm_protocol = protocol;
+    rtm.rtm_scope = RT_SCOPE_UNIVERSE;
+    rtm.rtm_type = RTN_UNICAST;
+    return rtm;
+}
+
+}  // namespace
+
+TEST(RtnetlinkEventTest, TestLink) {
+    ifinfomsg ifi = {};
+    ifi.ifi_index = 7;
+    ifi.ifi_flags = IFF_UP | IFF_LOWER_UP;
+    const char name[] = "wlan0";
+
+    MessageBuilder b;
+    b.begin(RTM_NEWLINK, ifi).attr(IFLA_IFNAME, name, sizeof(name)).end();
+    std::vector<RtnetlinkEvent> events;
+    ASSERT_TRUE(b.parse(&events));
+    ASSERT_EQ(1U, events.size());
+    EXPECT_EQ(RtnetlinkEvent::LINK_UPDATED, events[0].type);
+    EXPECT_EQ(7, events[0].ifindex);
+    EXPECT_STREQ("wlan0", events[0].ifname);
+    EXPECT_TRUE(events[0].isLinkUp());
+
+    // Loopback is ignored.
+    ifi.ifi_flags |= IFF_LOOPBACK;
+    MessageBuilder lo;
+    lo.begin(RTM_NEWLINK, ifi).attr(IFLA_IFNAME, "lo", 3).end();
+    ASSERT_TRUE(lo.parse(&events));
+    EXPECT_EQ(0U, events.size());
+}
+
+TEST(RtnetlinkEventTest, TestAddress) {
+    ifaddrmsg ifa = {};
+    ifa.ifa_family = AF_INET6;
+    ifa.ifa_prefixlen = 64;
+    ifa.ifa_flags = 0x80;
+    ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+    ifa.ifa_index = 12;
+
+    MessageBuilder b;
+    b.begin(RTM_DELADDR, ifa).attr(IFA_ADDRESS, AF_INET6, "2001:db8::1").end();
+    std::vector<RtnetlinkEvent> events;
+    ASSERT_TRUE(b.parse(&events));
+    ASSERT_EQ(1U, events.size());
+    EXPECT_EQ(RtnetlinkEvent::ADDRESS_REMOVED, events[0].type);
+    EXPECT_EQ(12, events[0].ifindex);
+    EXPECT_EQ(0x80U, events[0].flags);
+    EXPECT_EQ("2001:db8::1", events[0].addrToString());
+    EXPECT_EQ("2001:db8::1/64", events[0].prefixToString());
+}
+
+TEST(RtnetlinkEventTest, TestAddressFlagsAttribute) {
+    ifaddrmsg ifa = {};
+    ifa.ifa_family = AF_INET6;
+    ifa.ifa_prefixlen = 64;
+    ifa.ifa_flags = IFA_F_PERMANENT;
+    ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+    ifa.ifa_index = 12;
+    // Flags above bit 7 only fit in IFA_FLAGS, which is preferred over ifa_flags.
+    const uint32_t flags = IFA_F_PERMANENT | IFA_F_MANAGETEMPADDR;
+
+    // The attribute can come after the address, and only the first address counts.
+    MessageBuilder b;
+    b.begin(RTM_NEWADDR, ifa)
+            .attr(IFA_ADDRESS, AF_INET6, "2001:db8::1")
+            .attr(IFA_ADDRESS, AF_INET6, "2001:db8::2")
+            .attr(IFA_FLAGS, &flags, sizeof(flags))
+            .end();
+    std::vector<RtnetlinkEvent> events;
+    ASSERT_TRUE(b.parse(&events));
+    ASSERT_EQ(1U, events.size());
+    EXPECT_EQ(RtnetlinkEvent::ADDRESS_UPDATED, events[0].type);
+    EXPECT_EQ(flags, events[0].flags);
+    EXPECT_EQ("2001:db8::1", events[0].addrToString());
+}
+
+TEST(RtnetlinkEventTest, TestRoutes) {
+    int oif = 3;
+    MessageBuilder b;
+    // Default route via a gateway.
+    b.begin(RTM_NEWROUTE, routeMsg(AF_INET6, 0, RTPROT_RA))
+            .attr(RTA_GATEWAY, AF_INET6, "fe80::1")
+            .attr(RTA_OIF, &oif, sizeof(oif))
+            .end();
+    // Directly-connected prefix.
+    b.begin(RTM_DELROUTE, routeMsg(AF_INET, 24, RTPROT_KERNEL))
+            .attr(RTA_DST, AF_INET, "192.0.2.0")
+            .attr(RTA_OIF, &oif, sizeof(oif))
+            .end();
+    // Static routes set up by netd are ignored.
+    b.begin(RTM_NEWROUTE, routeMsg(AF_INET, 24, RTPROT_STATIC))
+            .attr(RTA_DST, AF_INET, "198.51.100.0")
+            .attr(RTA_OIF, &oif, sizeof(oif))
+            .end();
+    // Routes with neither a gateway nor an interface are ignored.
+    b.begin(RTM_NEWROUTE, routeMsg(AF_INET, 24, RTPROT_KERNEL))
+            .attr(RTA_DST, AF_INET, "203.0.113.0")
+            .end();
+
+    std::vector<RtnetlinkEvent> events;
+    ASSERT_TRUE(b.parse(&events));
+    ASSERT_EQ(2U, events.size());
+
+    EXPECT_EQ(RtnetlinkEvent::ROUTE_UPDATED, events[0].type);
+    EXPECT_EQ("::/0", events[0].prefixToString());
+    EXPECT_EQ("fe80::1", events[0].gatewayToString());
+    EXPECT_EQ(3, events[0].ifindex);
+
+    EXPECT_EQ(RtnetlinkEvent::ROUTE_REMOVED, events[1].type);
+    EXPECT_EQ("192.0.2.0/24", events[1].prefixToString());
+    EXPECT_EQ("", events[1].gatewayToString());
+    EXPECT_EQ(3, events[1].ifindex);
+}
+
+TEST(RtnetlinkEventTest, TestUnhandledMessageFallsBack) {
+    ifaddrmsg ifa = {};
+    ifa.ifa_family = AF_INET;
+    ifa.ifa_prefixlen = 24;
+    nduseroptmsg ndm = {};
+
+    MessageBuilder b;
+    b.begin(RTM_NEWADDR, ifa).attr(IFA_ADDRESS, AF_INET, "192.0.2.1").end();
+    b.begin(RTM_NEWNDUSEROPT, ndm).end();
+    std::vector<RtnetlinkEvent> events;
+    EXPECT_FALSE(b.parse(&events));
+    EXPECT_EQ(0U, events.size());
+}
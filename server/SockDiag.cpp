@@ -28,6 +28,7 @@
 
 #define LOG_TAG "Netd"
 
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <cutils/log.h>
 
@@ -321,24 +322,37 @@ int SockDiag::destroySockets(const char *addrstr) {
     return mSocketsDestroyed;
 }
 
-int SockDiag::destroyLiveSockets(DumpCallback destroyFilter, const char *what,
+int SockDiag::destroyLiveSockets(int family, DumpCallback destroyFilter, const char *what,
                                  iovec *iov, int iovcnt) {
     int proto = IPPROTO_TCP;
+    const char *familyName = (family == AF_INET) ? "IPv4" : "IPv6";
+    uint32_t states = (1 << TCP_ESTABLISHED) | (1 << TCP_SYN_SENT) | (1 << TCP_SYN_RECV);
+    if (int ret = sendDumpRequest(proto, family, states, iov, iovcnt)) {
+        ALOGE("Failed to dump %s sockets for %s: %s", familyName, what, strerror(-ret));
+        return ret;
+    }
+    if (int ret = readDiagMsg(proto, destroyFilter)) {
+        ALOGE("Failed to destroy %s sockets for %s: %s", familyName, what, strerror(-ret));
+        return ret;
+    }
+    return 0;
+}
 
-    for (const int family : {AF_INET, AF_INET6}) {
-        const char *familyName = (family == AF_INET) ? "IPv4" : "IPv6";
-        uint32_t states = (1 << TCP_ESTABLISHED) | (1 << TCP_SYN_SENT) | (1 << TCP_SYN_RECV);
-        if (int ret = sendDumpRequest(proto, family, states, iov, iovcnt)) {
-            ALOGE("Failed to dump %s sockets for %s: %s", familyName, what, strerror(-ret));
-            return ret;
-        }
-        if (int ret = readDiagMsg(proto, destroyFilter)) {
-            ALOGE("Failed to destroy %s sockets for %s: %s", familyName, what, strerror(-ret));
-            return ret;
-        }
+int SockDiag::destroyLiveSockets(DumpCallback destroyFilter, const char *what,
+                                 iovec *iov, int iovcnt) {
+    // One family after the other, on the same pair of sockets. Time each, for the log.
+    Stopwatch s;
+    int ret = destroyLiveSockets(AF_INET, destroyFilter, what, iov, iovcnt);
+    const float v4Time = s.timeTaken();
+    float v6Time = 0;
+    if (!ret) {
+        Stopwatch s6;
+        ret = destroyLiveSockets(AF_INET6, destroyFilter, what, iov, iovcnt);
+        v6Time = s6.timeTaken();
     }
 
-    return 0;
+    mPhaseTimes = android::base::StringPrintf("IPv4 %.1f ms, IPv6 %.1f ms", v4Time, v6Time);
+    return ret;
 }
 
 int SockDiag::destroySockets(uint8_t proto, const uid_t uid, bool excludeLoopback) {
@@ -398,9 +412,10 @@ int SockDiag::destroySockets(const UidRanges& uidRanges, const std::set<uid_t>&
     std::sort(skipUidStrings.begin(), skipUidStrings.end());
 
     if (mSocketsDestroyed > 0) {
-        ALOGI("Destroyed %d sockets for %s skip={%s} in %.1f ms",
+        ALOGI("Destroyed %d sockets for %s skip={%s} in %.1f ms (%s)",
               mSocketsDestroyed, uidRanges.toString().c_str(),
-              android::base::Join(skipUidStrings, " ").c_str(), s.timeTaken());
+              android::base::Join(skipUidStrings, " ").c_str(), s.timeTaken(),
+              mPhaseTimes.c_str());
     }
 
     return 0;
@@ -491,8 +506,8 @@ int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permiss
     }
 
     if (mSocketsDestroyed > 0) {
-        ALOGI("Destroyed %d sockets for netId %d permission=%d in %.1f ms",
-              mSocketsDestroyed, netId, permission, s.timeTaken());
+        ALOGI("Destroyed %d sockets for netId %d permission=%d in %.1f ms (%s)",
+              mSocketsDestroyed, netId, permission, s.timeTaken(), mPhaseTimes.c_str());
     }
 
     return 0;
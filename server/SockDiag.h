@@ -26,6 +26,7 @@
 
 #include <functional>
 #include <set>
+#include <string>
 
 #include "Permission.h"
 #include "UidRanges.h"
@@ -72,9 +73,13 @@ class SockDiag {
     int mSock;
     int mWriteSock;
     int mSocketsDestroyed;
+    // How long each family took in the last destroyLiveSockets call, for logging.
+    std::string mPhaseTimes;
     int sendDumpRequest(uint8_t proto, uint8_t family, uint32_t states, iovec *iov, int iovcnt);
     int destroySockets(uint8_t proto, int family, const char *addrstr);
     int destroyLiveSockets(DumpCallback destroy, const char *what, iovec *iov, int iovcnt);
+    int destroyLiveSockets(int family, DumpCallback destroy, const char *what,
+                           iovec *iov, int iovcnt);
     bool hasSocks() { return mSock != -1 && mWriteSock != -1; }
     void closeSocks() { close(mSock); close(mWriteSock); mSock = mWriteSock = -1; }
     static bool isLoopbackSocket(const inet_diag_msg *msg);
@@ -279,6 +279,7 @@ enum MicroBenchmarkTestType {
     UID_EXCLUDE_LOOPBACK,
     UIDRANGE,
     UIDRANGE_EXCLUDE_LOOPBACK,
+    UIDRANGE_DUALSTACK,
     PERMISSION,
 };
 
@@ -290,6 +291,7 @@ const char *testTypeName(MicroBenchmarkTestType mode) {
         TO_STRING_TYPE(UID_EXCLUDE_LOOPBACK);
         TO_STRING_TYPE(UIDRANGE);
         TO_STRING_TYPE(UIDRANGE_EXCLUDE_LOOPBACK);
+        TO_STRING_TYPE(UIDRANGE_DUALSTACK);
         TO_STRING_TYPE(PERMISSION);
     }
 #undef TO_STRING_TYPE
@@ -327,6 +329,7 @@ protected:
     constexpr static int MAX_SOCKETS = 500;
     constexpr static int ADDRESS_SOCKETS = 500;
     constexpr static int UID_SOCKETS = 50;
+    constexpr static int DUALSTACK_SOCKETS = 500;
     constexpr static int PERMISSION_SOCKETS = 16;
 
     constexpr static uid_t START_UID = 8000;  // START_UID + number of sockets must be <= 9999.
@@ -346,6 +349,8 @@ protected:
         case UIDRANGE:
         case UIDRANGE_EXCLUDE_LOOPBACK:
             return UID_SOCKETS;
+        case UIDRANGE_DUALSTACK:
+            return DUALSTACK_SOCKETS;
         case PERMISSION:
             return ARRAY_SIZE(permissionTestcases);
         }
@@ -357,7 +362,8 @@ protected:
         case UID:
         case UID_EXCLUDE_LOOPBACK:
         case UIDRANGE:
-        case UIDRANGE_EXCLUDE_LOOPBACK: {
+        case UIDRANGE_EXCLUDE_LOOPBACK:
+        case UIDRANGE_DUALSTACK: {
             uid_t uid = START_UID + i;
             return fchown(s, uid, -1);
         }
@@ -399,6 +405,13 @@ protected:
                 ret = mSd.destroySockets(uidRanges, skipUids, excludeLoopback);
                 break;
             }
+            case UIDRANGE_DUALSTACK: {
+                const char *uidRangeStrings[] = { "8000-8499" };
+                UidRanges uidRanges;
+                uidRanges.parseFrom(ARRAY_SIZE(uidRangeStrings), (char **) uidRangeStrings);
+                ret = mSd.destroySockets(uidRanges, {}, false);
+                break;
+            }
             case PERMISSION: {
                 ret = mSd.destroySocketsLackingPermission(TEST_NETID, PERMISSION_NETWORK, false);
                 break;
@@ -411,6 +424,7 @@ protected:
         MicroBenchmarkTestType mode = GetParam();
         switch (mode) {
             case ADDRESS:
+            case UIDRANGE_DUALSTACK:
                 return true;
             case UID:
                 return i == CLOSE_UID - START_UID;
@@ -474,6 +488,9 @@ TEST_P(SockDiagMicroBenchmarkTest, TestMicroBenchmark) {
     uint16_t port = bindAndListen(listensocket);
     ASSERT_NE(0, port) << "Can't bind to server port";
     sockaddr_in6 server = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+    // Half of the clients connect over IPv4, so that both families have sockets to destroy.
+    sockaddr_in server4 = { .sin_family = AF_INET, .sin_port = htons(port),
+                            .sin_addr = { htonl(INADDR_LOOPBACK) } };
 
     using ms = std::chrono::duration<float, std::ratio<1, 1000>>;
 
@@ -484,9 +501,11 @@ TEST_P(SockDiagMicroBenchmarkTest, TestMicroBenchmark) {
 
     auto start = std::chrono::steady_clock::now();
     for (int i = 0; i < numSockets; i++) {
-        int s = socket(AF_INET6, SOCK_STREAM, 0);
+        const bool ipv4 = (mode == UIDRANGE_DUALSTACK) && (i % 2);
+        int s = socket(ipv4 ? AF_INET : AF_INET6, SOCK_STREAM, 0);
         clientlen = sizeof(client);
-        ASSERT_EQ(0, connect(s, (sockaddr *) &server, sizeof(server)))
+        ASSERT_EQ(0, ipv4 ? connect(s, (sockaddr *) &server4, sizeof(server4)) :
+                            connect(s, (sockaddr *) &server, sizeof(server)))
             << "Connecting socket " << i << " failed " << strerror(errno);
         ASSERT_EQ(0, modifySocketForTest(s, i));
         serversockets[i] = accept(listensocket, (sockaddr *) &client, &clientlen);
@@ -533,4 +552,4 @@ constexpr int SockDiagMicroBenchmarkTest::CLOSE_UID;
 INSTANTIATE_TEST_CASE_P(Address, SockDiagMicroBenchmarkTest,
                         testing::Values(ADDRESS, UID, UIDRANGE,
                                         UID_EXCLUDE_LOOPBACK, UIDRANGE_EXCLUDE_LOOPBACK,
-                                        PERMISSION));
+                                        UIDRANGE_DUALSTACK, PERMISSION));
@@ -40,16 +40,22 @@
 #include <netutils/ifc.h>
 #include <private/android_filesystem_config.h>
 #include "wifi.h"
+#include "NetdConstants.h"
 #include "ResponseCode.h"
 
 #include "SoftapController.h"
-#include <dirent.h>
 
 using android::base::StringPrintf;
 using android::base::WriteStringToFile;
 
 #ifdef LIBWPA_CLIENT_EXISTS
-#include <dirent.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#include <algorithm>
+
 #include "wpa_ctrl.h"
 #endif
 
@@ -61,104 +67,317 @@ static const char HOSTAPD_CONF_FILE[]    = "/data/misc/wifi/hostapd.conf";
 static const char HOSTAPD_BIN_FILE[]    = "/system/bin/hostapd";
 static const char HOSTAPD_SOCKETS_DIR[]    = "/data/misc/wifi/sockets";
 static const char WIFI_HOSTAPD_GLOBAL_CTRL_IFACE[] = "/data/misc/wifi/hostapd/global";
+#ifdef LIBWPA_CLIENT_EXISTS
+// hostapd puts its control sockets here, as set by setSoftap().
+static const char HOSTAPD_CTRL_DIR[]    = "/data/misc/wifi/hostapd";
+static const char HOSTAPD_CTRL_PARENT_DIR[]    = "/data/misc/wifi";
+static constexpr std::chrono::seconds HOSTAPD_ATTACH_TIMEOUT{3};
 
-SoftapController::SoftapController()
-    : mPid(0) {}
+enum { EVENT_STOP, EVENT_WAKE, EVENT_INOTIFY, EVENT_CONTROL };
+#endif
 
-SoftapController::~SoftapController() {
+namespace {
+
+// The client side of wpa_ctrl binds its sockets in HOSTAPD_SOCKETS_DIR.
+void ensureSocketsDir() {
+    if (mkdir(HOSTAPD_SOCKETS_DIR, S_IRWXU|S_IRWXG) == 0) {
+        chown(HOSTAPD_SOCKETS_DIR, AID_WIFI, AID_WIFI);
+        chmod(HOSTAPD_SOCKETS_DIR, S_IRWXU|S_IRWXG);
+    } else if (errno != EEXIST) {
+        ALOGE("Cannot create %s (%s)", HOSTAPD_SOCKETS_DIR, strerror(errno));
+    }
 }
 
+}  // namespace
+
 #ifdef LIBWPA_CLIENT_EXISTS
-void *SoftapController::threadStart(void *obj){
-    SoftapController *me = reinterpret_cast<SoftapController *>(obj);
-    struct wpa_ctrl *ctrl;
-    int count = 0;
+SoftapController::SoftapController()
+    : mPid(0), mEpollFd(-1), mInotifyFd(-1), mStopFd(-1), mWakeFd(-1), mDirWatch(-1),
+      mParentWatch(-1), mWaiting(false), mAttachPending(false), mSession(0), mCtrl(NULL) {}
 
-    ALOGD("SoftapController::threadStart...");
+SoftapController::~SoftapController() {
+    if (mStopFd != -1) {
+        uint64_t one = 1;
+        write(mStopFd, &one, sizeof(one));
+        pthread_join(mThread, NULL);
+        close(mStopFd);
+        close(mWakeFd);
+        close(mInotifyFd);
+        close(mEpollFd);
+    }
+    if (mCtrl != NULL) {
+        wpa_ctrl_close(mCtrl);
+    }
+}
 
-    DIR *dir = NULL;
+int SoftapController::startEventThreadLocked() {
+    if (mStopFd != -1) {
+        return 0;
+    }
 
-    dir = opendir(HOSTAPD_SOCKETS_DIR);
-    if (NULL == dir && errno == ENOENT) {
-        mkdir(HOSTAPD_SOCKETS_DIR, S_IRWXU|S_IRWXG|S_IRWXO);
-        chown(HOSTAPD_SOCKETS_DIR, AID_WIFI, AID_WIFI);
-        chmod(HOSTAPD_SOCKETS_DIR, S_IRWXU|S_IRWXG);
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    mStopFd = eventfd(0, EFD_CLOEXEC);
+    mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int ret = 0;
+    if (mEpollFd == -1 || mInotifyFd == -1 || mStopFd == -1 || mWakeFd == -1) {
+        ret = errno;
     } else {
-         if (dir != NULL) { /* Directory already exists */
-             ALOGD("%s already exists", HOSTAPD_SOCKETS_DIR);
-             closedir(dir);
-         }
-         if (errno == EACCES) {
-             ALOGE("Cant open %s , check permissions ", HOSTAPD_SOCKETS_DIR);
-         }
-    }
-    chmod(HOSTAPD_DHCP_DIR, S_IRWXU|S_IRWXG|S_IRWXO);
-
-    ctrl = wpa_ctrl_open(hostapd_unix_file.c_str());
-    while (ctrl == NULL) {
-        /*
-         * Try to connect to hostapd via wpa_ctrl interface.
-         * During conneciton process, it is possible that hostapd
-         * has station connected to it.
-         * Set sleep time to a appropriate value to lower the
-         * ratio that miss the STA-CONNECTED msg from hostapd
-         */
-        usleep(20000);
-        ctrl = wpa_ctrl_open(hostapd_unix_file.c_str());
-        if (ctrl != NULL || count >= 150) {
-            break;
+        epoll_event inotifyEvent = { .events = EPOLLIN, .data = { .u32 = EVENT_INOTIFY } };
+        epoll_event stopEvent = { .events = EPOLLIN, .data = { .u32 = EVENT_STOP } };
+        epoll_event wakeEvent = { .events = EPOLLIN, .data = { .u32 = EVENT_WAKE } };
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mInotifyFd, &inotifyEvent) == -1 ||
+            epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mStopFd, &stopEvent) == -1 ||
+            epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &wakeEvent) == -1) {
+            ret = errno;
+        } else {
+            ret = pthread_create(&mThread, NULL, SoftapController::threadStart, this);
         }
-        count ++;
     }
-    if (count == 150 && ctrl == NULL) {
-        ALOGE("Connection to hostapd Error.");
-        return NULL;
+    if (ret != 0) {
+        ALOGE("Cannot start hostapd event thread (%s)", strerror(ret));
+        for (int* fd : { &mEpollFd, &mInotifyFd, &mStopFd, &mWakeFd }) {
+            if (*fd != -1) {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+        return -1;
     }
+    return 0;
+}
+
+void SoftapController::watchControlSocketLocked() {
+    closeControlLocked(false);
+    stopWatchingLocked();
+    mSession++;
+    mWaiting = true;
+    mDeadline = Clock::now() + HOSTAPD_ATTACH_TIMEOUT;
+
+    // hostapd creates its control directory if needed, so wait for that too.
+    mParentWatch = inotify_add_watch(mInotifyFd, HOSTAPD_CTRL_PARENT_DIR,
+                                     IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    if (mParentWatch == -1) {
+        ALOGE("Cannot watch %s (%s)", HOSTAPD_CTRL_PARENT_DIR, strerror(errno));
+    }
+    watchControlDirLocked();
+}
+
+void SoftapController::watchControlDirLocked() {
+    if (mDirWatch != -1) {
+        return;
+    }
+    mDirWatch = inotify_add_watch(mInotifyFd, HOSTAPD_CTRL_DIR,
+                                  IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    if (mDirWatch == -1) {
+        if (errno != ENOENT) {
+            ALOGE("Cannot watch %s (%s)", HOSTAPD_CTRL_DIR, strerror(errno));
+        }
+        return;
+    }
+    if (mParentWatch != -1) {
+        inotify_rm_watch(mInotifyFd, mParentWatch);
+        mParentWatch = -1;
+    }
+    // The socket may have been created before the watch was added.
+    requestAttachLocked();
+}
 
+void SoftapController::stopWatchingLocked() {
+    mWaiting = false;
+    mAttachPending = false;
+    for (int* wd : { &mDirWatch, &mParentWatch }) {
+        if (*wd != -1) {
+            inotify_rm_watch(mInotifyFd, *wd);
+            *wd = -1;
+        }
+    }
+}
+
+void SoftapController::requestAttachLocked() {
+    mAttachPending = true;
+    uint64_t one = 1;
+    write(mWakeFd, &one, sizeof(one));
+}
+
+void SoftapController::tryAttach(const std::string& path, unsigned session) {
+    struct wpa_ctrl *ctrl = wpa_ctrl_open(path.c_str());
+    if (ctrl == NULL) {
+        // hostapd is not listening yet. Wait for inotify to say it is.
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        if (!mWaiting || session != mSession) {
+            wpa_ctrl_close(ctrl);
+            return;
+        }
+        stopWatchingLocked();
+    }
+
+    // Waits for hostapd's reply, which it only sends once its event loop is running.
     if (wpa_ctrl_attach(ctrl) != 0) {
         wpa_ctrl_close(ctrl);
         ALOGE("Attach to hostapd Error.");
-        return NULL;
+        return;
     }
 
-    while (me->mHostapdFlag) {
-        int res = 0;
-        char buf[256];
-        char dest_str[300];
-        while (wpa_ctrl_pending(ctrl)) {
-            size_t len = sizeof(buf) - 1;
-            res = wpa_ctrl_recv(ctrl, buf, &len);
-            if (res == 0) {
-                buf[len] = '\0';
-                ALOGD("Get event from hostapd (%s)", buf);
-                memset(dest_str, 0x0, sizeof(dest_str));
-                snprintf(dest_str, sizeof(dest_str), "IfaceMessage active %s", buf);
-                me->mSocketClient->sendMsg(ResponseCode::InterfaceMessage, dest_str, false);
-            } else {
-                break;
+    std::unique_lock<std::mutex> lock(mLock);
+    if (session != mSession) {
+        // The softap was stopped or restarted meanwhile.
+        lock.unlock();
+        wpa_ctrl_detach(ctrl);
+        wpa_ctrl_close(ctrl);
+        return;
+    }
+    epoll_event event = { .events = EPOLLIN, .data = { .u32 = EVENT_CONTROL } };
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, wpa_ctrl_get_fd(ctrl), &event) == -1) {
+        ALOGE("Cannot wait for hostapd events (%s)", strerror(errno));
+        lock.unlock();
+        wpa_ctrl_detach(ctrl);
+        wpa_ctrl_close(ctrl);
+        return;
+    }
+    mCtrl = ctrl;
+    ALOGD("Attached to hostapd on %s", path.c_str());
+
+    // Stations may have connected before the attach.
+    handleControlEventsLocked();
+}
+
+void SoftapController::closeControlLocked(bool detach) {
+    if (mCtrl == NULL) {
+        return;
+    }
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, wpa_ctrl_get_fd(mCtrl), NULL);
+    if (detach) {
+        wpa_ctrl_detach(mCtrl);
+    }
+    wpa_ctrl_close(mCtrl);
+    mCtrl = NULL;
+}
+
+void SoftapController::handleInotifyLocked() {
+    // inotify events are aligned for struct inotify_event.
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+    std::string socketName = hostapd_unix_file.substr(hostapd_unix_file.rfind('/') + 1);
+    std::string dirName = strrchr(HOSTAPD_CTRL_DIR, '/') + 1;
+
+    ssize_t len;
+    while ((len = read(mInotifyFd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *event = reinterpret_cast<struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+            if (!mWaiting || event->len == 0) {
+                continue;
+            }
+            if (event->wd == mParentWatch && dirName == event->name) {
+                watchControlDirLocked();
+            } else if (event->wd == mDirWatch && socketName == event->name) {
+                mAttachPending = true;
             }
         }
+    }
+}
 
-        if (res < 0) {
-            break;
+void SoftapController::handleControlEventsLocked() {
+    while (mCtrl != NULL && wpa_ctrl_pending(mCtrl) > 0) {
+        char buf[256];
+        size_t len = sizeof(buf) - 1;
+        if (wpa_ctrl_recv(mCtrl, buf, &len) != 0) {
+            ALOGE("Cannot receive hostapd event (%s)", strerror(errno));
+            closeControlLocked(false);
+            return;
+        }
+        buf[len] = '\0';
+        ALOGD("Get event from hostapd (%s)", buf);
+        if (mSocketClient != NULL) {
+            std::string msg = StringPrintf("IfaceMessage active %s", buf);
+            mSocketClient->sendMsg(ResponseCode::InterfaceMessage, msg.c_str(), false);
         }
-        sleep(2);
     }
+}
 
-    wpa_ctrl_detach(ctrl);
-    wpa_ctrl_close(ctrl);
-
+void *SoftapController::threadStart(void *obj) {
+    reinterpret_cast<SoftapController *>(obj)->run();
     return NULL;
 }
+
+void SoftapController::run() {
+    while (true) {
+        int timeoutMs = -1;
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+            if (mWaiting) {
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        mDeadline - Clock::now());
+                timeoutMs = std::max<int>(0, remaining.count() + 1);
+            }
+        }
+
+        epoll_event events[3];
+        int n = TEMP_FAILURE_RETRY(epoll_wait(mEpollFd, events, ARRAY_SIZE(events), timeoutMs));
+        if (n == -1) {
+            ALOGE("epoll_wait failed (%s)", strerror(errno));
+            return;
+        }
+
+        std::string path;
+        unsigned session;
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+            for (int i = 0; i < n; i++) {
+                switch (events[i].data.u32) {
+                    case EVENT_STOP:
+                        return;
+                    case EVENT_WAKE: {
+                        uint64_t count;
+                        read(mWakeFd, &count, sizeof(count));
+                        break;
+                    }
+                    case EVENT_INOTIFY:
+                        handleInotifyLocked();
+                        break;
+                    case EVENT_CONTROL:
+                        handleControlEventsLocked();
+                        break;
+                }
+            }
+            if (mWaiting && Clock::now() >= mDeadline) {
+                ALOGE("Connection to hostapd Error.");
+                stopWatchingLocked();
+            }
+            if (!mAttachPending) {
+                continue;
+            }
+            mAttachPending = false;
+            path = hostapd_unix_file;
+            session = mSession;
+        }
+        tryAttach(path, session);
+    }
+}
+#else
+SoftapController::SoftapController()
+    : mPid(0) {}
+
+SoftapController::~SoftapController() {
+}
 #endif
 
 int SoftapController::startSoftap(bool global_ctrl_iface, SocketClient *socketClient,
     const char *ifname) {
     pid_t pid = 1;
-    DIR *dir = NULL;
     int ret;
 
-    mSocketClient = socketClient;
+    {
+#ifdef LIBWPA_CLIENT_EXISTS
+        // The event thread forwards hostapd events to the client.
+        std::lock_guard<std::mutex> guard(mLock);
+#endif
+        mSocketClient = socketClient;
+    }
     if (mPid) {
         ALOGE("SoftAP is already running");
         return ResponseCode::SoftapStatusResult;
@@ -193,33 +412,26 @@ int SoftapController::startSoftap(bool global_ctrl_iface, SocketClient *socketCl
     } else {
         mPid = pid;
         ALOGD("SoftAP started successfully");
-        usleep(AP_BSS_START_DELAY);
-        dir = opendir(HOSTAPD_SOCKETS_DIR);
-        if (NULL == dir && errno == ENOENT) {
-            mkdir(HOSTAPD_SOCKETS_DIR, S_IRWXU|S_IRWXG|S_IRWXO);
-            chown(HOSTAPD_SOCKETS_DIR, AID_WIFI, AID_WIFI);
-            chmod(HOSTAPD_SOCKETS_DIR, S_IRWXU|S_IRWXG);
-        } else {
-            if (dir != NULL) { /* Directory already exists */
-                ALOGD("%s already exists", HOSTAPD_SOCKETS_DIR);
-                closedir(dir);
+        ensureSocketsDir();
+#ifdef LIBWPA_CLIENT_EXISTS
+        chmod(HOSTAPD_DHCP_DIR, S_IRWXU|S_IRWXG|S_IRWXO);
+        {
+            // The event thread reads the control socket path.
+            std::lock_guard<std::mutex> guard(mLock);
+            if (ifname != NULL) {
+                hostapd_unix_file = StringPrintf("/data/misc/wifi/hostapd/%s", ifname);
             }
-            if (errno == EACCES) {
-                ALOGE("Cant open %s , check permissions ", HOSTAPD_SOCKETS_DIR);
+            // Watch before sleeping, so that events sent as soon as hostapd is up are not missed.
+            if (mSocketClient != NULL && startEventThreadLocked() == 0) {
+                watchControlSocketLocked();
             }
         }
+#else
         if (ifname != NULL) {
-            std:: string wbuf(StringPrintf("/data/misc/wifi/hostapd/%s",ifname));
-            hostapd_unix_file = wbuf;
-        }
-#ifdef LIBWPA_CLIENT_EXISTS
-        mHostapdFlag = true;
-        if (mSocketClient != NULL) {
-            if ((mThreadErr = pthread_create(&mThread, NULL, SoftapController::threadStart, this)) != 0) {
-                ALOGE("pthread_create failed for hostapd listen socket (%s)", strerror(errno));
-            }
+            hostapd_unix_file = StringPrintf("/data/misc/wifi/hostapd/%s", ifname);
         }
 #endif
+        usleep(AP_BSS_START_DELAY);
     }
     return ResponseCode::SoftapStatusResult;
 }
@@ -232,9 +444,12 @@ int SoftapController::stopSoftap() {
     }
 
 #ifdef LIBWPA_CLIENT_EXISTS
-    mHostapdFlag = false;
-    if (mThreadErr == 0) {
-        pthread_join(mThread, NULL);
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        stopWatchingLocked();
+        closeControlLocked(true);
+        mSession++;
+        mSocketClient = NULL;
     }
 #endif
 
@@ -23,6 +23,16 @@
 #include <sysutils/SocketListener.h>
 #include <sys/socket.h>
 
+#ifdef LIBWPA_CLIENT_EXISTS
+#include <pthread.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+struct wpa_ctrl;
+#endif
+
 #define SOFTAP_MAX_BUFFER_SIZE	4096
 #define AP_BSS_START_DELAY	200000
 #define AP_BSS_STOP_DELAY	500000
@@ -42,15 +52,49 @@ public:
     int fwReloadSoftap(int argc, char *argv[]);
 private:
     SocketClient *mSocketClient;
-#ifdef LIBWPA_CLIENT_EXISTS
-    pthread_t mThread;
-    int mThreadErr;
-    bool mHostapdFlag;
-#endif
     pid_t mPid;
     bool generatePsk(char *ssid, char *passphrase, char *psk);
 #ifdef LIBWPA_CLIENT_EXISTS
+    typedef std::chrono::steady_clock Clock;
+
+    /*
+     * hostapd events are forwarded to mSocketClient by a single thread, started along with the
+     * first softap. The thread learns from inotify when hostapd creates its control socket,
+     * attaches right away, and then waits in epoll for events. Attaching waits for hostapd's
+     * reply, so it is done without holding mLock.
+     */
+    int startEventThreadLocked();
+    // Waits for the control socket to appear, if it is not there already.
+    void watchControlSocketLocked();
+    void watchControlDirLocked();
+    void stopWatchingLocked();
+    // Has the thread try to attach, in case the control socket is there.
+    void requestAttachLocked();
+    // Attaches to the control socket at path, unless the softap it was for has been stopped or
+    // restarted by then. Called without mLock.
+    void tryAttach(const std::string& path, unsigned session);
+    void closeControlLocked(bool detach);
+    void handleInotifyLocked();
+    void handleControlEventsLocked();
     static void *threadStart(void *obj);
+    void run();
+
+    std::mutex mLock;
+    int mEpollFd;
+    int mInotifyFd;
+    int mStopFd;
+    int mWakeFd;
+    // Watches on the control directory, and on its parent until the directory exists.
+    int mDirWatch;
+    int mParentWatch;
+    // Whether the thread waits for the control socket, and until when.
+    bool mWaiting;
+    Clock::time_point mDeadline;
+    bool mAttachPending;
+    // Changes whenever a softap starts or stops.
+    unsigned mSession;
+    struct wpa_ctrl *mCtrl;
+    pthread_t mThread;
 #endif
 };
 
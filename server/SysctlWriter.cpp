@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LOG_TAG "SysctlWriter"
+#include <cutils/log.h>
+
+#include "SysctlWriter.h"
+
+namespace {
+
+const char DEFAULT_INTERFACE[] = "default";
+
+// Parameters that only netd writes and that the kernel never changes, so a cached value can be
+// trusted. Everything else is always written. In particular, the kernel sets disable_ipv6 when
+// duplicate address detection fails on the link-local address, RAs change mtu and hop_limit,
+// use_tempaddr becomes -1 when temporary addresses can't be generated, and writes to "all" change
+// forwarding and disable_ipv6 on every interface. Other processes with access to /proc/sys, e.g., a
+// vendor daemon, can write accept_ra and accept_dad directly.
+const char* const CACHEABLE_NAMES[] = {
+    "accept_ra_rt_table",
+    "base_reachable_time_ms",
+    "dad_transmits",
+    "optimistic_dad",
+    "use_oif_addrs_only",
+    "use_optimistic",
+};
+
+bool isCacheable(const std::string& name) {
+    for (const char* cacheableName : CACHEABLE_NAMES) {
+        if (name == cacheableName) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool isInterfaceDirectory(const dirent* d) {
+    return d->d_type == DT_DIR && d->d_name[0] != '.' &&
+           strcmp(d->d_name, DEFAULT_INTERFACE) != 0 && strcmp(d->d_name, "all") != 0;
+}
+
+}  // namespace
+
+unsigned (*SysctlWriter::ifindexFunction)(const char*) = SysctlWriter::getIfindex;
+
+SysctlWriter::SysctlWriter() {
+}
+
+SysctlWriter::~SysctlWriter() {
+    for (const auto& entry : mDirectoryFds) {
+        close(entry.second);
+    }
+}
+
+unsigned SysctlWriter::getIfindex(const char* interface) {
+    // Unlike if_nametoindex, reuse one socket for the ioctl.
+    static const int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strlcpy(ifr.ifr_name, interface, sizeof(ifr.ifr_name));
+    if (sock == -1 || ioctl(sock, SIOCGIFINDEX, &ifr) == -1) {
+        return 0;
+    }
+    return ifr.ifr_ifindex;
+}
+
+int SysctlWriter::set(const std::string& interface, const std::vector<Setting>& settings) {
+    std::lock_guard<std::mutex> guard(mLock);
+    return setLocked(interface, settings, true);
+}
+
+int SysctlWriter::setUncached(const std::string& interface, const Setting& setting) {
+    std::lock_guard<std::mutex> guard(mLock);
+    mInterfaces[interface].values.erase(setting.directory + "/" + setting.name);
+    return writeLocked(setting.directory, interface, setting.name, setting.value);
+}
+
+void SysctlWriter::setOnAllInterfaces(const std::vector<Setting>& settings) {
+    // Group the settings by directory, keeping their order within each directory.
+    std::vector<std::string> directories;
+    std::map<std::string, std::vector<Setting>> byDirectory;
+    for (const Setting& setting : settings) {
+        std::vector<Setting>& group = byDirectory[setting.directory];
+        if (group.empty()) {
+            directories.push_back(setting.directory);
+        }
+        group.push_back(setting);
+    }
+
+    std::lock_guard<std::mutex> guard(mLock);
+    for (const std::string& directory : directories) {
+        const std::vector<Setting>& group = byDirectory[directory];
+        setLocked(DEFAULT_INTERFACE, group, false);
+
+        int fd = getDirectoryFdLocked(directory);
+        if (fd >= 0) {
+            fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            if (fd == -1) {
+                fd = -errno;
+            }
+        }
+        DIR* dir = (fd < 0) ? nullptr : fdopendir(fd);
+        if (!dir) {
+            const int err = (fd < 0) ? -fd : errno;
+            if (fd >= 0) {
+                close(fd);
+            }
+            ALOGE("Can't list %s: %s", directory.c_str(), strerror(err));
+            continue;
+        }
+        // The duplicate shares its offset with the cached descriptor.
+        rewinddir(dir);
+        dirent* d;
+        while ((d = readdir(dir))) {
+            if (isInterfaceDirectory(d)) {
+                setLocked(d->d_name, group, false);
+            }
+        }
+        closedir(dir);
+    }
+}
+
+int SysctlWriter::setLocked(const std::string& interface, const std::vector<Setting>& settings,
+                            bool stopOnError) {
+    InterfaceValues& cached = mInterfaces[interface];
+    bool ifindexChecked = false;
+    auto checkIfindex = [&]() {
+        if (ifindexChecked) {
+            return;
+        }
+        ifindexChecked = true;
+        unsigned ifindex = ifindexFunction(interface.c_str());
+        if (cached.ifindex != ifindex) {
+            cached.ifindex = ifindex;
+            cached.values.clear();
+        }
+    };
+
+    int firstError = 0;
+    for (const Setting& setting : settings) {
+        const bool cacheable = isCacheable(setting.name);
+        const std::string key = setting.directory + "/" + setting.name;
+        if (cacheable) {
+            auto it = cached.values.find(key);
+            if (it != cached.values.end() && it->second == setting.value) {
+                // Only trust the value if the interface was not created again since.
+                checkIfindex();
+                if (cached.values.count(key)) {
+                    continue;
+                }
+            }
+        }
+        int ret = writeLocked(setting.directory, interface, setting.name, setting.value);
+        if (ret) {
+            ALOGE("Failed to write %s to %s/%s/%s: %s", setting.value.c_str(),
+                  setting.directory.c_str(), interface.c_str(), setting.name.c_str(),
+                  strerror(-ret));
+            // The value in the kernel is no longer known.
+            cached.values.erase(key);
+            if (stopOnError) {
+                return ret;
+            }
+            if (!firstError) {
+                firstError = ret;
+            }
+            continue;
+        }
+        if (cacheable) {
+            if (cached.values.empty()) {
+                checkIfindex();
+            }
+            cached.values[key] = setting.value;
+        }
+    }
+    return firstError;
+}
+
+int SysctlWriter::writeLocked(const std::string& directory, const std::string& interface,
+                              const std::string& name, const std::string& value) {
+    int dirFd = getDirectoryFdLocked(directory);
+    if (dirFd < 0) {
+        return dirFd;
+    }
+    const std::string path = interface + "/" + name;
+    int fd = openat(dirFd, path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -errno;
+    }
+    ssize_t written = TEMP_FAILURE_RETRY(::write(fd, value.c_str(), value.size()));
+    int ret = (written == -1) ? -errno : (written != (ssize_t) value.size()) ? -EIO : 0;
+    close(fd);
+    return ret;
+}
+
+int SysctlWriter::getDirectoryFdLocked(const std::string& directory) {
+    auto it = mDirectoryFds.find(directory);
+    if (it != mDirectoryFds.end()) {
+        return it->second;
+    }
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return -errno;
+    }
+    mDirectoryFds[directory] = fd;
+    return fd;
+}
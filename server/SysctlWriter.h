@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_SYSCTL_WRITER_H
+#define NETD_SERVER_SYSCTL_WRITER_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Writes per-interface files of the form <directory>/<interface>/<name>, such as
+ * /proc/sys/net/ipv6/conf/wlan0/accept_ra.
+ *
+ * Each directory is opened once, and files are opened relative to it with openat. For the few
+ * parameters that only netd writes and the kernel never changes, such as use_optimistic, the writer
+ * remembers what it wrote to each interface and skips writing the same value again. All other
+ * parameters are always written. The values of an interface are forgotten when its ifindex
+ * changes, so that an interface that was removed and created again under the same name is written
+ * in full. The ifindex is only looked up when the first value is cached, and once per call that
+ * would skip a write because of a cached value, so writing other parameters costs no ioctl.
+ */
+class SysctlWriter {
+public:
+    struct Setting {
+        // e.g., "/proc/sys/net/ipv6/conf".
+        std::string directory;
+        std::string name;
+        std::string value;
+    };
+
+    SysctlWriter();
+    ~SysctlWriter();
+
+    // Writes |settings| to |interface| in order, skipping cached values as described above. Stops at
+    // the first failure. Returns 0 or a negative errno.
+    int set(const std::string& interface, const std::vector<Setting>& settings);
+
+    // Writes |setting| to |interface| even if it is cached, e.g., because a client asked for it
+    // explicitly and may have changed it by other means. Returns 0 or a negative errno.
+    int setUncached(const std::string& interface, const Setting& setting);
+
+    // Writes |settings| to "default", which is used by interfaces created in the future, and to all
+    // the interfaces that currently exist. Lists each directory once. Failures are logged.
+    void setOnAllInterfaces(const std::vector<Setting>& settings);
+
+protected:
+    friend class SysctlWriterTest;
+
+    // Returns the ifindex of |interface|, or 0 if it does not exist.
+    static unsigned (*ifindexFunction)(const char* interface);
+
+private:
+    struct InterfaceValues {
+        unsigned ifindex;
+        // Keyed by "<directory>/<name>".
+        std::map<std::string, std::string> values;
+    };
+
+    static unsigned getIfindex(const char* interface);
+
+    int setLocked(const std::string& interface, const std::vector<Setting>& settings,
+                  bool stopOnError);
+    int writeLocked(const std::string& directory, const std::string& interface,
+                    const std::string& name, const std::string& value);
+    // Returns a file descriptor for |directory|, or a negative errno.
+    int getDirectoryFdLocked(const std::string& directory);
+
+    std::mutex mLock;
+    std::map<std::string, int> mDirectoryFds;
+    std::map<std::string, InterfaceValues> mInterfaces;
+};
+
+#endif  // NETD_SERVER_SYSCTL_WRITER_H
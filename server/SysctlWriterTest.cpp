@@ -0,0 +1,239 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SysctlWriterTest.cpp - unit tests for SysctlWriter.cpp
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+
+#include "SysctlWriter.h"
+
+using android::base::ReadFileToString;
+using android::base::WriteStringToFile;
+
+class SysctlWriterTest : public ::testing::Test {
+public:
+    SysctlWriterTest() {
+        SysctlWriter::ifindexFunction = fakeIfindex;
+        sIfindex = 1;
+        sIfindexLookups = 0;
+        char tmpl[] = "/data/local/tmp/sysctlwriterXXXXXX";
+        char* dir = mkdtemp(tmpl);
+        if (!dir) {
+            strcpy(tmpl, "/tmp/sysctlwriterXXXXXX");
+            dir = mkdtemp(tmpl);
+        }
+        mRoot = dir ? dir : "";
+    }
+
+    ~SysctlWriterTest() {
+        for (auto it = mPaths.rbegin(); it != mPaths.rend(); ++it) {
+            remove(it->c_str());
+        }
+        rmdir(mRoot.c_str());
+    }
+
+protected:
+    typedef SysctlWriter::Setting Setting;
+
+    static unsigned fakeIfindex(const char*) {
+        sIfindexLookups++;
+        return sIfindex;
+    }
+
+    // Creates <root>/<directory>/<interface>/<name> containing "-", like a sysctl file that
+    // already exists. Returns <root>/<directory>.
+    std::string createFile(const std::string& directory, const std::string& interface,
+                           const std::string& name) {
+        std::string path = mRoot;
+        for (const std::string& component : { directory, interface }) {
+            path += "/" + component;
+            if (mkdir(path.c_str(), 0700) == 0) {
+                mPaths.push_back(path);
+            }
+        }
+        path += "/" + name;
+        EXPECT_TRUE(WriteStringToFile("-", path));
+        mPaths.push_back(path);
+        return mRoot + "/" + directory;
+    }
+
+    std::string readFile(const std::string& directory, const std::string& interface,
+                         const std::string& name) {
+        std::string value;
+        EXPECT_TRUE(ReadFileToString(directory + "/" + interface + "/" + name, &value));
+        return value;
+    }
+
+    void writeFile(const std::string& directory, const std::string& interface,
+                   const std::string& name, const std::string& value) {
+        EXPECT_TRUE(WriteStringToFile(value, directory + "/" + interface + "/" + name));
+    }
+
+    static unsigned sIfindex;
+    static int sIfindexLookups;
+    std::string mRoot;
+    std::vector<std::string> mPaths;
+    SysctlWriter mWriter;
+};
+
+unsigned SysctlWriterTest::sIfindex;
+int SysctlWriterTest::sIfindexLookups;
+
+TEST_F(SysctlWriterTest, TestSkipsUnchangedValues) {
+    ASSERT_FALSE(mRoot.empty());
+    const std::string conf = createFile("conf", "wlan0", "use_optimistic");
+    createFile("conf", "wlan0", "dad_transmits");
+
+    EXPECT_EQ(0, mWriter.set("wlan0", {
+        { conf, "use_optimistic", "1" },
+        { conf, "dad_transmits", "2" },
+    }));
+    EXPECT_EQ("1", readFile(conf, "wlan0", "use_optimistic"));
+    EXPECT_EQ("2", readFile(conf, "wlan0", "dad_transmits"));
+
+    // Values that were already written are not written again.
+    writeFile(conf, "wlan0", "use_optimistic", "x");
+    writeFile(conf, "wlan0", "dad_transmits", "x");
+    EXPECT_EQ(0, mWriter.set("wlan0", {
+        { conf, "use_optimistic", "1" },
+        { conf, "dad_transmits", "0" },
+    }));
+    EXPECT_EQ("x", readFile(conf, "wlan0", "use_optimistic"));
+    EXPECT_EQ("0", readFile(conf, "wlan0", "dad_transmits"));
+
+    // Settings are applied in order, so a value can be toggled.
+    EXPECT_EQ(0, mWriter.set("wlan0", {
+        { conf, "dad_transmits", "2" },
+        { conf, "dad_transmits", "0" },
+    }));
+    EXPECT_EQ("0", readFile(conf, "wlan0", "dad_transmits"));
+
+    // An interface that was created again starts from scratch.
+    sIfindex = 2;
+    EXPECT_EQ(0, mWriter.set("wlan0", { { conf, "use_optimistic", "1" } }));
+    EXPECT_EQ("1", readFile(conf, "wlan0", "use_optimistic"));
+}
+
+TEST_F(SysctlWriterTest, TestAlwaysWritesKernelMutableValues) {
+    ASSERT_FALSE(mRoot.empty());
+    const std::string conf = mRoot + "/conf";
+    const std::vector<Setting> settings = {
+        { conf, "disable_ipv6", "0" },
+        { conf, "accept_ra", "2" },
+        { conf, "accept_dad", "1" },
+        { conf, "use_tempaddr", "2" },
+        { conf, "mtu", "1280" },
+        { conf, "hop_limit", "64" },
+        // Parameters the writer does not know about are not cached either.
+        { conf, "accept_ra_defrtr", "1" },
+    };
+    for (const Setting& setting : settings) {
+        createFile("conf", "wlan0", setting.name);
+    }
+    EXPECT_EQ(0, mWriter.set("wlan0", settings));
+
+    // The kernel, or another process, changed them behind the writer's back.
+    for (const Setting& setting : settings) {
+        writeFile(conf, "wlan0", setting.name, "x");
+    }
+    EXPECT_EQ(0, mWriter.set("wlan0", settings));
+    for (const Setting& setting : settings) {
+        EXPECT_EQ(setting.value, readFile(conf, "wlan0", setting.name)) << setting.name;
+    }
+
+    // Nothing was cached, so there was no need to look up the ifindex.
+    EXPECT_EQ(0, sIfindexLookups);
+}
+
+TEST_F(SysctlWriterTest, TestSetUncached) {
+    ASSERT_FALSE(mRoot.empty());
+    const std::string conf = createFile("conf", "wlan0", "use_optimistic");
+    EXPECT_EQ(0, mWriter.set("wlan0", { { conf, "use_optimistic", "1" } }));
+
+    // Written even though the same value is cached.
+    writeFile(conf, "wlan0", "use_optimistic", "x");
+    EXPECT_EQ(0, mWriter.setUncached("wlan0", { conf, "use_optimistic", "1" }));
+    EXPECT_EQ("1", readFile(conf, "wlan0", "use_optimistic"));
+
+    // And it is forgotten, so a cached write afterwards is not skipped.
+    EXPECT_EQ(0, mWriter.setUncached("wlan0", { conf, "use_optimistic", "0" }));
+    EXPECT_EQ(0, mWriter.set("wlan0", { { conf, "use_optimistic", "1" } }));
+    EXPECT_EQ("1", readFile(conf, "wlan0", "use_optimistic"));
+
+    EXPECT_EQ(-ENOENT, mWriter.setUncached("wlan0", { conf, "nonexistent", "0" }));
+}
+
+TEST_F(SysctlWriterTest, TestStopsAtFirstFailure) {
+    ASSERT_FALSE(mRoot.empty());
+    const std::string conf = createFile("conf", "rmnet0", "accept_ra");
+    createFile("conf", "rmnet0", "disable_ipv6");
+
+    EXPECT_EQ(-ENOENT, mWriter.set("rmnet0", {
+        { conf, "disable_ipv6", "1" },
+        { conf, "nonexistent", "0" },
+        { conf, "accept_ra", "0" },
+    }));
+    EXPECT_EQ("1", readFile(conf, "rmnet0", "disable_ipv6"));
+    EXPECT_EQ("-", readFile(conf, "rmnet0", "accept_ra"));
+
+    EXPECT_EQ(-ENOENT, mWriter.set("rmnet1", { { conf, "accept_ra", "0" } }));
+    EXPECT_EQ(-ENOENT, mWriter.set("rmnet0", { { mRoot + "/nonexistent", "accept_ra", "0" } }));
+}
+
+TEST_F(SysctlWriterTest, TestSetOnAllInterfaces) {
+    ASSERT_FALSE(mRoot.empty());
+    const std::string conf = createFile("conf", "default", "accept_ra");
+    for (const char* interface : { "all", "wlan0", "rmnet0" }) {
+        createFile("conf", interface, "accept_ra");
+        createFile("conf", interface, "use_optimistic");
+    }
+    createFile("conf", "default", "use_optimistic");
+    const std::string neigh = createFile("neigh", "default", "base_reachable_time_ms");
+    createFile("neigh", "wlan0", "base_reachable_time_ms");
+
+    const std::vector<Setting> settings = {
+        { conf, "accept_ra", "2" },
+        { neigh, "base_reachable_time_ms", "15000" },
+        { conf, "use_optimistic", "1" },
+    };
+    mWriter.setOnAllInterfaces(settings);
+    for (const char* interface : { "default", "wlan0", "rmnet0" }) {
+        EXPECT_EQ("2", readFile(conf, interface, "accept_ra"));
+        EXPECT_EQ("1", readFile(conf, interface, "use_optimistic"));
+    }
+    EXPECT_EQ("-", readFile(conf, "all", "accept_ra"));
+    EXPECT_EQ("15000", readFile(neigh, "default", "base_reachable_time_ms"));
+    EXPECT_EQ("15000", readFile(neigh, "wlan0", "base_reachable_time_ms"));
+
+    // The directories are listed again each time.
+    createFile("conf", "usb0", "accept_ra");
+    createFile("conf", "usb0", "use_optimistic");
+    mWriter.setOnAllInterfaces(settings);
+    EXPECT_EQ("2", readFile(conf, "usb0", "accept_ra"));
+    EXPECT_EQ("1", readFile(conf, "usb0", "use_optimistic"));
+}
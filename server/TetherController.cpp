@@ -63,11 +63,14 @@ bool writeToFile(const char* filename, const char* value) {
 }
 
 bool configureForIPv6Router(const char *interface) {
-    return (InterfaceController::setEnableIPv6(interface, 0) == 0)
-            && (InterfaceController::setAcceptIPv6Ra(interface, 0) == 0)
-            && (InterfaceController::setAcceptIPv6Dad(interface, 0) == 0)
-            && (InterfaceController::setIPv6DadTransmits(interface, "0") == 0)
-            && (InterfaceController::setEnableIPv6(interface, 1) == 0);
+    // Disabling and enabling IPv6 again clears the addresses the interface had as a client.
+    return InterfaceController::setIPv6Parameters(interface, {
+        { "disable_ipv6", "1" },
+        { "accept_ra", "0" },
+        { "accept_dad", "0" },
+        { "dad_transmits", "0" },
+        { "disable_ipv6", "0" },
+    }) == 0;
 }
 
 void configureForIPv6Client(const char *interface) {
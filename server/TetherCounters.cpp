@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_acct.h>
+#include <linux/netlink.h>
+
+#define LOG_TAG "TetherCounters"
+#include <android-base/stringprintf.h>
+#include <cutils/log.h>
+
+#include "NatController.h"
+#include "TetherCounters.h"
+
+using android::base::StringPrintf;
+
+typedef BandwidthController::TetherStats TetherStats;
+
+const char* TetherCounters::OBJECT_PREFIX = "tether_";
+
+namespace {
+
+const size_t NETLINK_BUFFER_SIZE = 8192;
+
+// Checks that the nfacct match can be used in the counting chain, without leaving anything there.
+std::string makeProbeCommands(const std::string& name) {
+    std::string rule = StringPrintf("%s -m nfacct --nfacct-name %s -j RETURN\n",
+                                    NatController::LOCAL_TETHER_COUNTERS_CHAIN, name.c_str());
+    return "*filter\n-A " + rule + "-D " + rule + "COMMIT\n";
+}
+
+}  // namespace
+
+int (*TetherCounters::sendRequestFunction)(uint16_t, uint16_t, const std::string&,
+                                           std::map<std::string, Counter>*) =
+        TetherCounters::sendRequest;
+int (*TetherCounters::execIptablesRestore)(IptablesTarget, const std::string&) =
+        ::execIptablesRestore;
+
+TetherCounters::TetherCounters() : mEnabled(false) {
+}
+
+int TetherCounters::init() {
+    std::lock_guard<std::mutex> guard(mLock);
+    mEnabled = false;
+    mPairs.clear();
+
+    std::map<std::string, Counter> leftovers;
+    if (sendRequestFunction(NFNL_MSG_ACCT_GET, NLM_F_DUMP, "", &leftovers)) {
+        ALOGI("nfacct not available, tether counters are read from iptables");
+        return 0;
+    }
+    for (const auto& object : leftovers) {
+        if (int ret = sendRequestFunction(NFNL_MSG_ACCT_DEL, NLM_F_ACK, object.first, nullptr)) {
+            ALOGE("Cannot delete nfacct object %s: %s", object.first.c_str(), strerror(-ret));
+        }
+    }
+
+    std::string probe = std::string(OBJECT_PREFIX) + "probe";
+    if (sendRequestFunction(NFNL_MSG_ACCT_NEW, NLM_F_ACK | NLM_F_CREATE | NLM_F_EXCL, probe,
+                            nullptr)) {
+        ALOGI("Cannot create nfacct objects, tether counters are read from iptables");
+        return 0;
+    }
+    int ret = execIptablesRestore(V4V6, makeProbeCommands(probe));
+    sendRequestFunction(NFNL_MSG_ACCT_DEL, NLM_F_ACK, probe, nullptr);
+    if (ret) {
+        ALOGI("nfacct match not available, tether counters are read from iptables");
+        return 0;
+    }
+
+    mEnabled = true;
+    return 0;
+}
+
+bool TetherCounters::isEnabled() {
+    std::lock_guard<std::mutex> guard(mLock);
+    return mEnabled;
+}
+
+std::string TetherCounters::makeObjectName(size_t id, bool rx) const {
+    return StringPrintf("%s%zu_%s", OBJECT_PREFIX, id, rx ? "rx" : "tx");
+}
+
+std::string TetherCounters::getCountingMatch(const std::string& inIface,
+                                             const std::string& outIface) {
+    std::lock_guard<std::mutex> guard(mLock);
+    if (!mEnabled) {
+        return "";
+    }
+
+    // As in BandwidthController::addForwardChainStats(), traffic from the internal interface to
+    // the external one is rx, and traffic back to the internal interface is tx.
+    for (size_t i = 0; i < mPairs.size(); i++) {
+        bool rx = mPairs[i].first == inIface && mPairs[i].second == outIface;
+        bool tx = mPairs[i].first == outIface && mPairs[i].second == inIface;
+        if (tx || rx) {
+            return "-m nfacct --nfacct-name " + makeObjectName(i + 1, rx);
+        }
+    }
+
+    // The first direction a pair is seen in is the one from the internal interface.
+    size_t id = mPairs.size() + 1;
+    for (bool rx : { true, false }) {
+        // Replacing resets the counters of an object that survived init().
+        if (int ret = sendRequestFunction(NFNL_MSG_ACCT_NEW,
+                                          NLM_F_ACK | NLM_F_CREATE | NLM_F_REPLACE,
+                                          makeObjectName(id, rx), nullptr)) {
+            // getTetherStats() only reads pairs that have objects, so this pair would be missing
+            // from tether stats. The counting rules count by themselves too, so read all pairs
+            // from iptables instead.
+            ALOGE("Cannot create nfacct object %s: %s, tether counters are read from iptables",
+                  makeObjectName(id, rx).c_str(), strerror(-ret));
+            mEnabled = false;
+            return "";
+        }
+    }
+    mPairs.push_back({ inIface, outIface });
+    return "-m nfacct --nfacct-name " + makeObjectName(id, true);
+}
+
+int TetherCounters::getTetherStats(std::vector<TetherStats>* statsList) {
+    std::lock_guard<std::mutex> guard(mLock);
+    if (!mEnabled) {
+        return 0;
+    }
+
+    // All counters come from the same dump, so they are consistent with each other.
+    std::map<std::string, Counter> counters;
+    if (int ret = sendRequestFunction(NFNL_MSG_ACCT_GET, NLM_F_DUMP, "", &counters)) {
+        ALOGE("Cannot dump nfacct objects: %s", strerror(-ret));
+        return ret;
+    }
+    makeStatsLocked(counters, statsList);
+    return 0;
+}
+
+void TetherCounters::makeStatsLocked(const std::map<std::string, Counter>& counters,
+                                     std::vector<TetherStats>* statsList) const {
+    for (size_t i = 0; i < mPairs.size(); i++) {
+        auto rx = counters.find(makeObjectName(i + 1, true));
+        auto tx = counters.find(makeObjectName(i + 1, false));
+        if (rx == counters.end() || tx == counters.end()) {
+            continue;
+        }
+        statsList->push_back(TetherStats(mPairs[i].first, mPairs[i].second,
+                                         rx->second.bytes, rx->second.packets,
+                                         tx->second.bytes, tx->second.packets));
+    }
+}
+
+bool TetherCounters::parseAcctMessage(const nlmsghdr* nlh, std::string* name, Counter* counter) {
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(nfgenmsg))) {
+        return false;
+    }
+    bool haveName = false, havePackets = false, haveBytes = false;
+
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(nfgenmsg));
+    for (const nlattr* nla = reinterpret_cast<const nlattr*>(
+                 reinterpret_cast<const uint8_t*>(NLMSG_DATA(nlh)) + NLMSG_ALIGN(sizeof(nfgenmsg)));
+         len >= (int) sizeof(nlattr) && nla->nla_len >= sizeof(nlattr) && nla->nla_len <= len;
+         len -= NLA_ALIGN(nla->nla_len),
+         nla = reinterpret_cast<const nlattr*>(
+                 reinterpret_cast<const uint8_t*>(nla) + NLA_ALIGN(nla->nla_len))) {
+        const char* data = reinterpret_cast<const char*>(nla) + NLA_HDRLEN;
+        size_t dataLen = nla->nla_len - NLA_HDRLEN;
+        uint64_t value;
+        switch (nla->nla_type & NLA_TYPE_MASK) {
+            case NFACCT_NAME:
+                name->assign(data, strnlen(data, dataLen));
+                haveName = true;
+                break;
+            case NFACCT_PKTS:
+            case NFACCT_BYTES:
+                if (dataLen < sizeof(value)) {
+                    return false;
+                }
+                memcpy(&value, data, sizeof(value));
+                if ((nla->nla_type & NLA_TYPE_MASK) == NFACCT_PKTS) {
+                    counter->packets = be64toh(value);
+                    havePackets = true;
+                } else {
+                    counter->bytes = be64toh(value);
+                    haveBytes = true;
+                }
+                break;
+        }
+    }
+    return haveName && havePackets && haveBytes;
+}
+
+int TetherCounters::sendRequest(uint16_t type, uint16_t flags, const std::string& name,
+                                std::map<std::string, Counter>* dump) {
+    if (name.size() >= NFACCT_NAME_MAX) {
+        return -ENAMETOOLONG;
+    }
+    int sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if (sock == -1) {
+        return -errno;
+    }
+
+    struct {
+        nlmsghdr nlh;
+        nfgenmsg nfg;
+        nlattr nla;
+        char name[NFACCT_NAME_MAX];
+    } request;
+    memset(&request, 0, sizeof(request));
+    size_t len = NLMSG_LENGTH(sizeof(nfgenmsg));
+    if (!name.empty()) {
+        request.nla.nla_type = NFACCT_NAME;
+        request.nla.nla_len = NLA_HDRLEN + name.size() + 1;
+        memcpy(request.name, name.c_str(), name.size());
+        len += NLA_ALIGN(request.nla.nla_len);
+    }
+    request.nlh.nlmsg_len = len;
+    request.nlh.nlmsg_type = (NFNL_SUBSYS_ACCT << 8) | type;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+    request.nfg.nfgen_family = AF_UNSPEC;
+    request.nfg.version = NFNETLINK_V0;
+
+    if (send(sock, &request, len, 0) != (ssize_t) len) {
+        int ret = -errno;
+        close(sock);
+        return ret;
+    }
+
+    char buf[NETLINK_BUFFER_SIZE];
+    int ret = 0;
+    bool done = false;
+    while (!done) {
+        ssize_t bytesread = TEMP_FAILURE_RETRY(recv(sock, buf, sizeof(buf), 0));
+        if (bytesread <= 0) {
+            ret = bytesread ? -errno : -EIO;
+            break;
+        }
+        uint32_t remaining = bytesread;
+        for (const nlmsghdr* nlh = reinterpret_cast<const nlmsghdr*>(buf);
+             !done && NLMSG_OK(nlh, remaining); nlh = NLMSG_NEXT(nlh, remaining)) {
+            if (nlh->nlmsg_type == NLMSG_DONE) {
+                done = true;
+            } else if (nlh->nlmsg_type == NLMSG_ERROR) {
+                ret = reinterpret_cast<const nlmsgerr*>(NLMSG_DATA(nlh))->error;
+                done = true;
+            } else if (dump) {
+                std::string objectName;
+                Counter counter;
+                if (parseAcctMessage(nlh, &objectName, &counter) &&
+                    !objectName.compare(0, strlen(OBJECT_PREFIX), OBJECT_PREFIX)) {
+                    (*dump)[objectName] = counter;
+                }
+            }
+        }
+    }
+
+    close(sock);
+    return ret;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_TETHER_COUNTERS_H
+#define NETD_SERVER_TETHER_COUNTERS_H
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BandwidthController.h"
+#include "NetdConstants.h"
+
+struct nlmsghdr;
+
+/*
+ * Named netfilter accounting objects (nfacct) that count the traffic of each tethered interface
+ * pair.
+ *
+ * Each pair gets an ID the first time NAT is enabled on it, and two objects named after the ID,
+ * one per direction. The tether counting rules of NatController reference them with the nfacct
+ * match. The objects are shared by IPv4 and IPv6, and like the rules, they stay once created, so
+ * the counters of a pair keep growing across tethering sessions.
+ *
+ * getTetherStats() reads all of them with a single netlink dump, which replaces listing and
+ * parsing the counting chain. If the kernel lacks nfacct or the nfacct match, or a pair's objects
+ * cannot be created, this is disabled and the counting rules count by themselves as before.
+ */
+class TetherCounters {
+public:
+    TetherCounters();
+
+    // Removes the objects of a previous netd and checks whether nfacct works. Call after the
+    // counting chain has been flushed, since objects that rules use cannot be deleted.
+    int init();
+    bool isEnabled();
+
+    // Returns the iptables match that counts traffic from inIface to outIface, creating the pair's
+    // objects if needed, or an empty string if counting is disabled. Disables counting if the
+    // objects cannot be created.
+    std::string getCountingMatch(const std::string& inIface, const std::string& outIface);
+
+    // Appends the counters of every pair that ever had any.
+    int getTetherStats(std::vector<BandwidthController::TetherStats>* statsList);
+
+    static const char* OBJECT_PREFIX;
+
+protected:
+    friend class TetherCountersTest;
+
+    struct Counter {
+        uint64_t packets;
+        uint64_t bytes;
+    };
+
+    // Parses one NFNL_MSG_ACCT_NEW message of a dump. Returns false if it is not complete.
+    static bool parseAcctMessage(const nlmsghdr* nlh, std::string* name, Counter* counter);
+    // Turns counters read from the kernel into stats, by object name.
+    void makeStatsLocked(const std::map<std::string, Counter>& counters,
+                         std::vector<BandwidthController::TetherStats>* statsList) const;
+
+    // Sends one nfacct request and waits for the result. For dumps, collects the objects whose
+    // names start with OBJECT_PREFIX.
+    static int sendRequest(uint16_t type, uint16_t flags, const std::string& name,
+                           std::map<std::string, Counter>* dump);
+    static int (*sendRequestFunction)(uint16_t, uint16_t, const std::string&,
+                                      std::map<std::string, Counter>*);
+    static int (*execIptablesRestore)(IptablesTarget target, const std::string& commands);
+
+private:
+    std::string makeObjectName(size_t id, bool rx) const;
+
+    std::mutex mLock;
+    bool mEnabled;
+    // Internal and external interface of each pair, indexed by ID - 1.
+    std::vector<std::pair<std::string, std::string>> mPairs;
+};
+
+#endif  // NETD_SERVER_TETHER_COUNTERS_H
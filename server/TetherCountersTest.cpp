@@ -0,0 +1,236 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * TetherCountersTest.cpp - unit tests for TetherCounters.cpp
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_acct.h>
+#include <linux/netlink.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "IptablesBaseTest.h"
+#include "TetherCounters.h"
+
+typedef BandwidthController::TetherStats TetherStats;
+
+class TetherCountersTest : public IptablesBaseTest {
+public:
+    TetherCountersTest() {
+        TetherCounters::sendRequestFunction = fakeSendRequest;
+        TetherCounters::execIptablesRestore = fakeExecIptablesRestore;
+        sRequests.clear();
+        sObjects.clear();
+        sFailDumps = false;
+        sFailCreates = false;
+    }
+
+protected:
+    typedef TetherCounters::Counter Counter;
+
+    static int fakeSendRequest(uint16_t type, uint16_t flags, const std::string& name,
+                               std::map<std::string, Counter>* dump) {
+        sRequests.push_back(describeRequest(type, flags, name));
+        switch (type) {
+            case NFNL_MSG_ACCT_GET:
+                if (sFailDumps) {
+                    return -EPROTONOSUPPORT;
+                }
+                *dump = sObjects;
+                return 0;
+            case NFNL_MSG_ACCT_NEW:
+                if (sFailCreates) {
+                    return -ENOMEM;
+                }
+                sObjects[name] = { 0, 0 };
+                return 0;
+            case NFNL_MSG_ACCT_DEL:
+                sObjects.erase(name);
+                return 0;
+        }
+        return -EINVAL;
+    }
+
+    static std::string describeRequest(uint16_t type, uint16_t flags, const std::string& name) {
+        std::string request = (type == NFNL_MSG_ACCT_NEW) ? "new" :
+                              (type == NFNL_MSG_ACCT_DEL) ? "del" : "get";
+        // These flags mean something else in dump requests.
+        if (type == NFNL_MSG_ACCT_NEW && (flags & NLM_F_REPLACE)) {
+            request += " replace";
+        }
+        if (type == NFNL_MSG_ACCT_NEW && (flags & NLM_F_EXCL)) {
+            request += " excl";
+        }
+        return name.empty() ? request : request + " " + name;
+    }
+
+    void expectRequests(const std::vector<std::string>& expected) {
+        EXPECT_EQ(expected, sRequests);
+        sRequests.clear();
+    }
+
+    static bool parse(const nlmsghdr* nlh, std::string* name, Counter* counter) {
+        return TetherCounters::parseAcctMessage(nlh, name, counter);
+    }
+
+    static std::vector<std::string> sRequests;
+    static std::map<std::string, Counter> sObjects;
+    static bool sFailDumps;
+    static bool sFailCreates;
+    TetherCounters mCounters;
+};
+
+std::vector<std::string> TetherCountersTest::sRequests;
+std::map<std::string, TetherCounters::Counter> TetherCountersTest::sObjects;
+bool TetherCountersTest::sFailDumps;
+bool TetherCountersTest::sFailCreates;
+
+TEST_F(TetherCountersTest, TestInitRemovesLeftovers) {
+    sObjects["tether_1_rx"] = { 1, 100 };
+    sObjects["tether_1_tx"] = { 2, 200 };
+    EXPECT_EQ(0, mCounters.init());
+    EXPECT_TRUE(mCounters.isEnabled());
+    EXPECT_TRUE(sObjects.empty());
+    expectRequests({
+        "get",
+        "del tether_1_rx",
+        "del tether_1_tx",
+        "new excl tether_probe",
+        "del tether_probe",
+    });
+    expectIptablesRestoreCommands(std::vector<std::string>{
+        "*filter\n"
+        "-A natctrl_tether_counters -m nfacct --nfacct-name tether_probe -j RETURN\n"
+        "-D natctrl_tether_counters -m nfacct --nfacct-name tether_probe -j RETURN\n"
+        "COMMIT\n",
+    });
+}
+
+TEST_F(TetherCountersTest, TestDisabledWithoutNfacct) {
+    sFailDumps = true;
+    EXPECT_EQ(0, mCounters.init());
+    EXPECT_FALSE(mCounters.isEnabled());
+    EXPECT_EQ("", mCounters.getCountingMatch("wlan0", "rmnet0"));
+
+    std::vector<TetherStats> stats;
+    EXPECT_EQ(0, mCounters.getTetherStats(&stats));
+    EXPECT_TRUE(stats.empty());
+}
+
+TEST_F(TetherCountersTest, TestPairsOwnObjects) {
+    ASSERT_EQ(0, mCounters.init());
+    sRequests.clear();
+    sRestoreCmds.clear();
+
+    // The first direction a pair is seen in goes from its internal interface. Like in
+    // natctrl_tether_counters, that direction is rx.
+    EXPECT_EQ("-m nfacct --nfacct-name tether_1_rx",
+              mCounters.getCountingMatch("wlan0", "rmnet0"));
+    EXPECT_EQ("-m nfacct --nfacct-name tether_1_tx",
+              mCounters.getCountingMatch("rmnet0", "wlan0"));
+    EXPECT_EQ("-m nfacct --nfacct-name tether_2_rx",
+              mCounters.getCountingMatch("usb0", "rmnet0"));
+    EXPECT_EQ("-m nfacct --nfacct-name tether_2_tx",
+              mCounters.getCountingMatch("rmnet0", "usb0"));
+    // A pair keeps its objects.
+    EXPECT_EQ("-m nfacct --nfacct-name tether_1_rx",
+              mCounters.getCountingMatch("wlan0", "rmnet0"));
+    expectRequests({
+        "new replace tether_1_rx",
+        "new replace tether_1_tx",
+        "new replace tether_2_rx",
+        "new replace tether_2_tx",
+    });
+
+    sObjects["tether_1_rx"] = { 10, 1000 };
+    sObjects["tether_1_tx"] = { 20, 2000 };
+    sObjects["tether_2_rx"] = { 30, 3000 };
+    sObjects["tether_2_tx"] = { 40, 4000 };
+    std::vector<TetherStats> stats;
+    EXPECT_EQ(0, mCounters.getTetherStats(&stats));
+    expectRequests({ "get" });
+    ASSERT_EQ(2U, stats.size());
+    EXPECT_EQ("wlan0", stats[0].intIface);
+    EXPECT_EQ("rmnet0", stats[0].extIface);
+    EXPECT_EQ(1000, stats[0].rxBytes);
+    EXPECT_EQ(10, stats[0].rxPackets);
+    EXPECT_EQ(2000, stats[0].txBytes);
+    EXPECT_EQ(20, stats[0].txPackets);
+    EXPECT_EQ("usb0", stats[1].intIface);
+    EXPECT_EQ(3000, stats[1].rxBytes);
+    EXPECT_EQ(4000, stats[1].txBytes);
+
+    // A failed dump is reported rather than returning partial stats.
+    sFailDumps = true;
+    stats.clear();
+    EXPECT_NE(0, mCounters.getTetherStats(&stats));
+    EXPECT_TRUE(stats.empty());
+}
+
+TEST_F(TetherCountersTest, TestDisabledWhenObjectsCannotBeCreated) {
+    ASSERT_EQ(0, mCounters.init());
+    EXPECT_EQ("-m nfacct --nfacct-name tether_1_rx",
+              mCounters.getCountingMatch("wlan0", "rmnet0"));
+
+    // Otherwise the new pair would be missing from the stats, so all pairs are read from iptables.
+    sFailCreates = true;
+    EXPECT_EQ("", mCounters.getCountingMatch("usb0", "rmnet0"));
+    EXPECT_FALSE(mCounters.isEnabled());
+    EXPECT_EQ("", mCounters.getCountingMatch("wlan0", "rmnet0"));
+}
+
+TEST_F(TetherCountersTest, TestParseAcctMessage) {
+    struct {
+        nlmsghdr nlh;
+        nfgenmsg nfg;
+        nlattr nameAttr;
+        char name[12];
+        nlattr pktsAttr;
+        uint8_t pkts[8];
+        nlattr bytesAttr;
+        uint8_t bytes[8];
+    } msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.nlh.nlmsg_len = sizeof(msg);
+    msg.nlh.nlmsg_type = (NFNL_SUBSYS_ACCT << 8) | NFNL_MSG_ACCT_NEW;
+    msg.nameAttr = { NLA_HDRLEN + 12, NFACCT_NAME };
+    strcpy(msg.name, "tether_1_rx");
+    msg.pktsAttr = { NLA_HDRLEN + 8, NFACCT_PKTS };
+    uint64_t value = htobe64(5);
+    memcpy(msg.pkts, &value, sizeof(value));
+    msg.bytesAttr = { NLA_HDRLEN + 8, NFACCT_BYTES };
+    value = htobe64(0x100000000ULL);
+    memcpy(msg.bytes, &value, sizeof(value));
+
+    std::string name;
+    Counter counter;
+    ASSERT_TRUE(parse(&msg.nlh, &name, &counter));
+    EXPECT_EQ("tether_1_rx", name);
+    EXPECT_EQ(5U, counter.packets);
+    EXPECT_EQ(0x100000000ULL, counter.bytes);
+
+    // Without its counters, an object is ignored.
+    msg.nlh.nlmsg_len = sizeof(msg) - sizeof(msg.bytesAttr) - sizeof(msg.bytes);
+    EXPECT_FALSE(parse(&msg.nlh, &name, &counter));
+}
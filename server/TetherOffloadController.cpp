@@ -0,0 +1,686 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <linux/netlink.h>
+
+#define LOG_TAG "TetherOffloadController"
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <logwrap/logwrap.h>
+
+#include "ConnmarkFlags.h"
+#include "DumpWriter.h"
+#include "TetherOffloadController.h"
+
+using android::base::StringPrintf;
+using android::base::WriteStringToFile;
+
+typedef BandwidthController::TetherStats TetherStats;
+
+const char* TetherOffloadController::LOCAL_FORWARD = "offload_FORWARD";
+const char* TetherOffloadController::LOCAL_TABLE = "netd_tether_offload";
+
+namespace {
+
+const char NFT_PATH[] = "/system/bin/nft";
+const char CONNTRACK_ACCT_PATH[] = "/proc/sys/net/netfilter/nf_conntrack_acct";
+
+const uint32_t OFFLOAD_MARK_MASK =
+        ConnmarkFlags::TETHER_OFFLOAD | ConnmarkFlags::TETHER_OFFLOAD_PAIR_MASK;
+const int EVENT_RCVBUF_SIZE = 1024 * 1024;
+const size_t NETLINK_BUFFER_SIZE = 32768;
+// How long an ended flow is remembered. Conntrack only lists a flow for a moment after its destroy
+// event, and a destroy event is at most a socket buffer behind the dump that found the flow gone.
+const std::chrono::seconds ENDED_FLOW_LIFETIME(60);
+// Bounds mEndedFlows if flows end faster than they are forgotten. Forgetting a flow early only
+// matters if conntrack still lists it, or if its destroy event is still queued.
+const size_t MAX_ENDED_FLOWS = 4096;
+
+int execNftScript(const std::string& script) {
+    const char* argv[] = {
+        NFT_PATH,
+        "-f",
+        "-",  // Read the script from stdin.
+    };
+    AndroidForkExecvpOption opt[1] = {
+        {
+            .opt_type = FORK_EXECVP_OPTION_INPUT,
+            .opt_input.input = reinterpret_cast<const uint8_t*>(script.c_str()),
+            .opt_input.input_len = script.size(),
+        }
+    };
+
+    int status = 0;
+    int res = android_fork_execvp_ext(
+            ARRAY_SIZE(argv), (char**)argv, &status, false /* ignore_int_quit */, LOG_NONE,
+            false /* abbreviated */, NULL /* file_path */, opt, ARRAY_SIZE(opt));
+    if (res || status) {
+        ALOGE("%s failed with res=%d, status=%d", argv[0], res, status);
+        return -1;
+    }
+    return 0;
+}
+
+// A script that removes the table, whether or not it exists.
+std::string makeDeleteScript() {
+    return StringPrintf("table inet %s {}\ndelete table inet %s\n",
+                        TetherOffloadController::LOCAL_TABLE, TetherOffloadController::LOCAL_TABLE);
+}
+
+void parseCounters(const nlattr* nested, uint64_t* packets, uint64_t* bytes) {
+    int len = nested->nla_len - NLA_HDRLEN;
+    for (const nlattr* nla = reinterpret_cast<const nlattr*>(
+                 reinterpret_cast<const uint8_t*>(nested) + NLA_HDRLEN);
+         len >= (int) sizeof(nlattr) && nla->nla_len >= sizeof(nlattr) && nla->nla_len <= len;
+         len -= NLA_ALIGN(nla->nla_len),
+         nla = reinterpret_cast<const nlattr*>(
+                 reinterpret_cast<const uint8_t*>(nla) + NLA_ALIGN(nla->nla_len))) {
+        if (nla->nla_len < NLA_HDRLEN + sizeof(uint64_t)) {
+            continue;
+        }
+        uint64_t value;
+        memcpy(&value, reinterpret_cast<const uint8_t*>(nla) + NLA_HDRLEN, sizeof(value));
+        switch (nla->nla_type & NLA_TYPE_MASK) {
+            case CTA_COUNTERS_PACKETS:
+                *packets = be64toh(value);
+                break;
+            case CTA_COUNTERS_BYTES:
+                *bytes = be64toh(value);
+                break;
+        }
+    }
+}
+
+void addCounters(const TetherStats& from, TetherStats* to) {
+    to->rxBytes += from.rxBytes;
+    to->rxPackets += from.rxPackets;
+    to->txBytes += from.txBytes;
+    to->txPackets += from.txPackets;
+}
+
+uint64_t subtract(uint64_t a, uint64_t b) {
+    return a > b ? a - b : 0;
+}
+
+}  // namespace
+
+int (*TetherOffloadController::execNft)(const std::string&) = execNftScript;
+int (*TetherOffloadController::execIptablesRestore)(IptablesTarget, const std::string&) =
+        ::execIptablesRestore;
+
+TetherOffloadController::TetherOffloadController()
+        : mEnabled(false), mLostEvents(0), mFlowsEndedWithoutEvent(0), mEventSock(-1),
+          mStopFd(-1) {
+}
+
+TetherOffloadController::~TetherOffloadController() {
+    if (mStopFd != -1) {
+        uint64_t one = 1;
+        write(mStopFd, &one, sizeof(one));
+        pthread_join(mThread, NULL);
+        close(mStopFd);
+    }
+    if (mEventSock != -1) {
+        close(mEventSock);
+    }
+}
+
+int TetherOffloadController::setupIptablesHooks() {
+    std::lock_guard<std::mutex> guard(mLock);
+
+    // Remove whatever a previous instance of netd left behind.
+    bool haveNft = access(NFT_PATH, X_OK) == 0;
+    if (haveNft) {
+        execNft(makeDeleteScript());
+    }
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("persist.tether.offload", value, "0");
+    if (strcmp(value, "1")) {
+        return 0;
+    }
+    if (!haveNft) {
+        ALOGI("%s not found, not offloading tethered flows", NFT_PATH);
+        return 0;
+    }
+    return enableLocked();
+}
+
+int TetherOffloadController::enableLocked() {
+    // Creating and deleting a flowtable in one transaction tells whether the kernel supports
+    // flowtables without leaving anything behind. Offloaded packets are only accounted in
+    // conntrack when the flowtable has counters, so kernels that lack them don't qualify.
+    std::string probe = StringPrintf(
+            "table inet %s {\n"
+            "    flowtable ft {\n"
+            "        hook ingress priority 0\n"
+            "        devices = { \"lo\" }\n"
+            "        counter\n"
+            "    }\n"
+            "}\n"
+            "delete table inet %s\n", LOCAL_TABLE, LOCAL_TABLE);
+    if (execNft(probe)) {
+        ALOGI("Flowtable counters not supported, not offloading tethered flows");
+        return 0;
+    }
+    if (!WriteStringToFile("1", CONNTRACK_ACCT_PATH)) {
+        ALOGE("Cannot enable conntrack accounting: %s", strerror(errno));
+        return 0;
+    }
+
+    mEventSock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if (mEventSock == -1) {
+        ALOGE("Cannot open conntrack socket: %s", strerror(errno));
+        return -1;
+    }
+    // Destroy events come in bursts when many flows time out together.
+    setsockopt(mEventSock, SOL_SOCKET, SO_RCVBUFFORCE, &EVENT_RCVBUF_SIZE,
+               sizeof(EVENT_RCVBUF_SIZE));
+    sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = 1 << (NFNLGRP_CONNTRACK_DESTROY - 1),
+    };
+    if (bind(mEventSock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+        ALOGE("Cannot subscribe to conntrack events: %s", strerror(errno));
+        close(mEventSock);
+        mEventSock = -1;
+        return -1;
+    }
+
+    mStopFd = eventfd(0, EFD_CLOEXEC);
+    if (mStopFd == -1) {
+        ALOGE("Cannot create eventfd: %s", strerror(errno));
+        return -1;
+    }
+    if (int ret = pthread_create(&mThread, NULL, TetherOffloadController::threadStart, this)) {
+        ALOGE("Cannot start conntrack event thread: %s", strerror(ret));
+        close(mStopFd);
+        mStopFd = -1;
+        return -1;
+    }
+
+    ALOGI("Offloading tethered flows");
+    mEnabled = true;
+    return 0;
+}
+
+bool TetherOffloadController::isEnabled() {
+    std::lock_guard<std::mutex> guard(mLock);
+    return mEnabled;
+}
+
+int TetherOffloadController::addPair(const char* intIface, const char* extIface) {
+    std::lock_guard<std::mutex> guard(mLock);
+    if (!mEnabled) {
+        return 0;
+    }
+    if (!isIfaceName(intIface) || !isIfaceName(extIface)) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    auto it = std::find_if(mPairs.begin(), mPairs.end(), [&](const Pair& p) {
+        return p.intIface == intIface && p.extIface == extIface;
+    });
+    if (it == mPairs.end()) {
+        if (mPairs.size() >= ConnmarkFlags::TETHER_OFFLOAD_PAIR_MASK) {
+            ALOGE("Too many interface pairs, not offloading %s -> %s", intIface, extIface);
+            errno = ENOSPC;
+            return -1;
+        }
+        TetherStats zero(intIface, extIface, 0, 0, 0, 0);
+        mPairs.push_back({ intIface, extIface, false, zero, zero });
+        it = mPairs.end() - 1;
+    }
+    if (it->active) {
+        return 0;
+    }
+
+    it->active = true;
+    if (applyLocked(true)) {
+        it->active = false;
+        applyLocked(false);
+        return -1;
+    }
+    return 0;
+}
+
+int TetherOffloadController::removePair(const char* intIface, const char* extIface) {
+    std::lock_guard<std::mutex> guard(mLock);
+    if (!mEnabled) {
+        return 0;
+    }
+
+    for (Pair& p : mPairs) {
+        if (p.intIface == intIface && p.extIface == extIface && p.active) {
+            p.active = false;
+            return applyLocked(false);
+        }
+    }
+    return 0;
+}
+
+std::string TetherOffloadController::makeRulesetLocked() const {
+    // Declaring the table first makes the delete work even if it does not exist yet. nft applies
+    // the whole script in one transaction, so there is no moment without the rules.
+    std::string ruleset = makeDeleteScript();
+
+    std::vector<std::string> devices;
+    std::string rules;
+    for (size_t i = 0; i < mPairs.size(); i++) {
+        const Pair& p = mPairs[i];
+        if (!p.active) {
+            continue;
+        }
+        for (const std::string& iface : { p.intIface, p.extIface }) {
+            if (std::find(devices.begin(), devices.end(), iface) == devices.end()) {
+                devices.push_back(iface);
+            }
+        }
+        uint32_t mark = ConnmarkFlags::TETHER_OFFLOAD | (i + 1);
+        rules += StringPrintf(
+                "        meta l4proto { tcp, udp } ct state new ct mark and 0x%x == 0 "
+                "iifname \"%s\" oifname \"%s\" ct mark set ct mark and 0x%x or 0x%x\n",
+                ConnmarkFlags::TETHER_OFFLOAD, p.intIface.c_str(), p.extIface.c_str(),
+                ~OFFLOAD_MARK_MASK, mark);
+        rules += StringPrintf(
+                "        meta l4proto { tcp, udp } ct state established "
+                "ct mark and 0x%x == 0x%x flow add @ft\n", OFFLOAD_MARK_MASK, mark);
+    }
+    if (devices.empty()) {
+        return ruleset;
+    }
+
+    std::string deviceList;
+    for (const std::string& iface : devices) {
+        deviceList += StringPrintf("%s\"%s\"", deviceList.empty() ? "" : ", ", iface.c_str());
+    }
+    // Priority -1 runs before the iptables filter table, so the mark is set by the time
+    // offload_FORWARD looks at it.
+    // Without counter, conntrack stops accounting a flow once it is offloaded.
+    ruleset += StringPrintf(
+            "table inet %s {\n"
+            "    flowtable ft {\n"
+            "        hook ingress priority 0\n"
+            "        devices = { %s }\n"
+            "        counter\n"
+            "    }\n"
+            "    chain forward {\n"
+            "        type filter hook forward priority -1; policy accept;\n"
+            "%s"
+            "    }\n"
+            "}\n", LOCAL_TABLE, deviceList.c_str(), rules.c_str());
+    return ruleset;
+}
+
+std::string TetherOffloadController::makeIptablesRulesLocked() const {
+    // Marked flows are counted by conntrack, so they skip natctrl_tether_counters. NAT is enabled
+    // on their pair, so natctrl_FORWARD would have accepted them anyway.
+    std::string commands = StringPrintf("*filter\n-F %s\n", LOCAL_FORWARD);
+    for (size_t i = 0; i < mPairs.size(); i++) {
+        if (mPairs[i].active) {
+            uint32_t mark = ConnmarkFlags::TETHER_OFFLOAD | (i + 1);
+            commands += StringPrintf("-A %s -m connmark --mark 0x%x/0x%x -j ACCEPT\n",
+                                     LOCAL_FORWARD, mark, OFFLOAD_MARK_MASK);
+        }
+    }
+    commands += "COMMIT\n";
+    return commands;
+}
+
+int TetherOffloadController::applyLocked(bool adding) {
+    std::string ruleset = makeRulesetLocked();
+    std::string commands = makeIptablesRulesLocked();
+    if (adding) {
+        if (execIptablesRestore(V4V6, commands) || execNft(ruleset)) {
+            return -1;
+        }
+    } else {
+        if (execNft(ruleset) || execIptablesRestore(V4V6, commands)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+bool TetherOffloadController::parseConntrackMessage(const nlmsghdr* nlh, Flow* flow) {
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(nfgenmsg))) {
+        return false;
+    }
+    *flow = Flow();
+    bool haveMark = false;
+    bool haveCounters = false;
+
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(nfgenmsg));
+    for (const nlattr* nla = reinterpret_cast<const nlattr*>(
+                 reinterpret_cast<const uint8_t*>(NLMSG_DATA(nlh)) + NLMSG_ALIGN(sizeof(nfgenmsg)));
+         len >= (int) sizeof(nlattr) && nla->nla_len >= sizeof(nlattr) && nla->nla_len <= len;
+         len -= NLA_ALIGN(nla->nla_len),
+         nla = reinterpret_cast<const nlattr*>(
+                 reinterpret_cast<const uint8_t*>(nla) + NLA_ALIGN(nla->nla_len))) {
+        switch (nla->nla_type & NLA_TYPE_MASK) {
+            case CTA_ID: {
+                if (nla->nla_len < NLA_HDRLEN + sizeof(uint32_t)) {
+                    return false;
+                }
+                uint32_t id;
+                memcpy(&id, reinterpret_cast<const uint8_t*>(nla) + NLA_HDRLEN, sizeof(id));
+                flow->id = ntohl(id);
+                break;
+            }
+            case CTA_MARK: {
+                if (nla->nla_len < NLA_HDRLEN + sizeof(uint32_t)) {
+                    return false;
+                }
+                uint32_t mark;
+                memcpy(&mark, reinterpret_cast<const uint8_t*>(nla) + NLA_HDRLEN, sizeof(mark));
+                flow->mark = ntohl(mark);
+                haveMark = true;
+                break;
+            }
+            case CTA_COUNTERS_ORIG:
+                parseCounters(nla, &flow->origPackets, &flow->origBytes);
+                haveCounters = true;
+                break;
+            case CTA_COUNTERS_REPLY:
+                parseCounters(nla, &flow->replyPackets, &flow->replyBytes);
+                haveCounters = true;
+                break;
+        }
+    }
+    return haveMark && haveCounters;
+}
+
+size_t TetherOffloadController::getPairIdLocked(const Flow& flow) const {
+    if (!(flow.mark & ConnmarkFlags::TETHER_OFFLOAD)) {
+        return 0;
+    }
+    size_t id = flow.mark & ConnmarkFlags::TETHER_OFFLOAD_PAIR_MASK;
+    return id <= mPairs.size() ? id : 0;
+}
+
+void TetherOffloadController::forgetEndedFlowsLocked(Clock::time_point now) {
+    while (!mEndedOrder.empty()) {
+        const auto& oldest = mEndedOrder.front();
+        auto it = mEndedFlows.find(oldest.second);
+        // The entry is stale if the conntrack ID was reused by a flow that ended later.
+        bool current = it != mEndedFlows.end() && it->second.at == oldest.first;
+        if (current && now - oldest.first < ENDED_FLOW_LIFETIME &&
+                mEndedFlows.size() < MAX_ENDED_FLOWS) {
+            break;
+        }
+        if (current) {
+            mEndedFlows.erase(it);
+        }
+        mEndedOrder.pop_front();
+    }
+}
+
+void TetherOffloadController::endFlowLocked(const Flow& flow, Clock::time_point now) {
+    size_t id = getPairIdLocked(flow);
+    if (id == 0) {
+        return;
+    }
+    Flow counted = flow;
+    if (flow.id) {
+        mLiveFlows.erase(flow.id);
+        auto it = mEndedFlows.find(flow.id);
+        if (it != mEndedFlows.end()) {
+            // The flow was counted as it was at the last dump, or its event came twice. Only add
+            // the traffic that was not counted yet.
+            Flow& before = it->second.counted;
+            counted.origPackets = subtract(flow.origPackets, before.origPackets);
+            counted.origBytes = subtract(flow.origBytes, before.origBytes);
+            counted.replyPackets = subtract(flow.replyPackets, before.replyPackets);
+            counted.replyBytes = subtract(flow.replyBytes, before.replyBytes);
+            before.origPackets = std::max(before.origPackets, flow.origPackets);
+            before.origBytes = std::max(before.origBytes, flow.origBytes);
+            before.replyPackets = std::max(before.replyPackets, flow.replyPackets);
+            before.replyBytes = std::max(before.replyBytes, flow.replyBytes);
+        } else {
+            forgetEndedFlowsLocked(now);
+            mEndedFlows[flow.id] = { now, flow };
+            mEndedOrder.emplace_back(now, flow.id);
+        }
+    }
+    // The original direction goes from the tethered client to the upstream network, which
+    // natctrl_tether_counters counts as rx, like BandwidthController.
+    TetherStats counters("", "", counted.origBytes, counted.origPackets, counted.replyBytes,
+                         counted.replyPackets);
+    addCounters(counters, &mPairs[id - 1].ended);
+}
+
+void TetherOffloadController::updateLiveFlowsLocked(const std::vector<Flow>& listed,
+                                                    Clock::time_point now) {
+    std::map<uint32_t, Flow> live;
+    for (const Flow& flow : listed) {
+        if (flow.id && getPairIdLocked(flow) && !mEndedFlows.count(flow.id)) {
+            live[flow.id] = flow;
+        }
+    }
+    live.swap(mLiveFlows);
+
+    // A flow that the previous dump listed and that is gone now either ended while destroy events
+    // were dropped, or its event has not been read yet. In the latter case, endFlowLocked() adds
+    // the rest of its traffic when the event is read.
+    for (const auto& entry : live) {
+        if (!mLiveFlows.count(entry.first)) {
+            endFlowLocked(entry.second, now);
+            mFlowsEndedWithoutEvent++;
+        }
+    }
+}
+
+std::vector<TetherStats> TetherOffloadController::getTotalsLocked() const {
+    std::vector<TetherStats> totals;
+    for (const Pair& p : mPairs) {
+        totals.push_back(p.ended);
+    }
+    for (const auto& entry : mLiveFlows) {
+        const Flow& flow = entry.second;
+        size_t id = getPairIdLocked(flow);
+        if (id) {
+            TetherStats counters("", "", flow.origBytes, flow.origPackets, flow.replyBytes,
+                                 flow.replyPackets);
+            addCounters(counters, &totals[id - 1]);
+        }
+    }
+    return totals;
+}
+
+int TetherOffloadController::syncLiveFlowsLocked() {
+    std::vector<Flow> flows;
+    if (dumpLiveFlows(&flows)) {
+        return -1;
+    }
+    updateLiveFlowsLocked(flows, Clock::now());
+    return 0;
+}
+
+int TetherOffloadController::getTetherStats(std::vector<TetherStats>* statsList) {
+    std::lock_guard<std::mutex> guard(mLock);
+
+    if (mEnabled && !mPairs.empty() && syncLiveFlowsLocked()) {
+        // Count the live flows as the last dump found them. The clamping below keeps the counters
+        // from going down.
+        ALOGE("Cannot dump conntrack: %s", strerror(errno));
+    }
+    std::vector<TetherStats> totals = getTotalsLocked();
+
+    for (size_t i = 0; i < mPairs.size(); i++) {
+        TetherStats& reported = mPairs[i].reported;
+        // A flow that has ended but whose destroy event has not been read yet is in neither set.
+        reported.rxBytes = std::max(reported.rxBytes, totals[i].rxBytes);
+        reported.rxPackets = std::max(reported.rxPackets, totals[i].rxPackets);
+        reported.txBytes = std::max(reported.txBytes, totals[i].txBytes);
+        reported.txPackets = std::max(reported.txPackets, totals[i].txPackets);
+        statsList->push_back(reported);
+    }
+    return 0;
+}
+
+int TetherOffloadController::dumpLiveFlows(std::vector<Flow>* flows) {
+    int sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if (sock == -1) {
+        return -1;
+    }
+
+    // Only dump the entries that have the offload bit in their mark.
+    struct {
+        nlmsghdr nlh;
+        nfgenmsg nfg;
+        nlattr markAttr;
+        uint32_t mark;
+        nlattr maskAttr;
+        uint32_t mask;
+    } request = {
+        .nlh = {
+            .nlmsg_len = sizeof(request),
+            .nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET,
+            .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+        },
+        .nfg = {
+            .nfgen_family = AF_UNSPEC,
+            .version = NFNETLINK_V0,
+        },
+        .markAttr = { NLA_HDRLEN + sizeof(uint32_t), CTA_MARK },
+        .mark = htonl(ConnmarkFlags::TETHER_OFFLOAD),
+        .maskAttr = { NLA_HDRLEN + sizeof(uint32_t), CTA_MARK_MASK },
+        .mask = htonl(ConnmarkFlags::TETHER_OFFLOAD),
+    };
+    if (send(sock, &request, sizeof(request), 0) != sizeof(request)) {
+        int saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+
+    std::vector<char> buf(NETLINK_BUFFER_SIZE);
+    int ret = 0;
+    bool done = false;
+    while (!done) {
+        ssize_t bytesread = TEMP_FAILURE_RETRY(recv(sock, buf.data(), buf.size(), 0));
+        if (bytesread <= 0) {
+            ret = -1;
+            break;
+        }
+        uint32_t len = bytesread;
+        for (const nlmsghdr* nlh = reinterpret_cast<const nlmsghdr*>(buf.data());
+             !done && NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type == NLMSG_DONE) {
+                done = true;
+            } else if (nlh->nlmsg_type == NLMSG_ERROR) {
+                const nlmsgerr* err = reinterpret_cast<const nlmsgerr*>(NLMSG_DATA(nlh));
+                errno = -err->error;
+                ret = -1;
+                done = true;
+            } else {
+                Flow flow;
+                if (parseConntrackMessage(nlh, &flow) && flow.id) {
+                    flows->push_back(flow);
+                }
+            }
+        }
+    }
+
+    int saved = errno;
+    close(sock);
+    errno = saved;
+    return ret;
+}
+
+void* TetherOffloadController::threadStart(void* obj) {
+    reinterpret_cast<TetherOffloadController*>(obj)->run();
+    return NULL;
+}
+
+void TetherOffloadController::run() {
+    std::vector<char> buf(NETLINK_BUFFER_SIZE);
+    pollfd fds[] = {
+        { mEventSock, POLLIN, 0 },
+        { mStopFd, POLLIN, 0 },
+    };
+    while (true) {
+        if (TEMP_FAILURE_RETRY(poll(fds, ARRAY_SIZE(fds), -1)) == -1) {
+            ALOGE("poll failed: %s", strerror(errno));
+            return;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+        ssize_t bytesread = TEMP_FAILURE_RETRY(recv(mEventSock, buf.data(), buf.size(),
+                                                    MSG_DONTWAIT));
+        if (bytesread == -1) {
+            if (errno == ENOBUFS) {
+                // Find the flows whose events were dropped before more of them end.
+                std::lock_guard<std::mutex> guard(mLock);
+                mLostEvents++;
+                if (syncLiveFlowsLocked()) {
+                    ALOGE("Cannot dump conntrack after losing events: %s", strerror(errno));
+                }
+            }
+            continue;
+        }
+
+        std::lock_guard<std::mutex> guard(mLock);
+        Clock::time_point now = Clock::now();
+        uint32_t len = bytesread;
+        for (const nlmsghdr* nlh = reinterpret_cast<const nlmsghdr*>(buf.data());
+             NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            Flow flow;
+            if (parseConntrackMessage(nlh, &flow)) {
+                endFlowLocked(flow, now);
+            }
+        }
+    }
+}
+
+void TetherOffloadController::dump(DumpWriter& dw) {
+    std::lock_guard<std::mutex> guard(mLock);
+    dw.println("Tether offload: %s", mEnabled ? "enabled" : "disabled");
+    if (!mEnabled) {
+        return;
+    }
+    dw.incIndent();
+    for (size_t i = 0; i < mPairs.size(); i++) {
+        const Pair& p = mPairs[i];
+        dw.println("%zu: %s -> %s%s rx=%" PRId64 "/%" PRId64 " tx=%" PRId64 "/%" PRId64, i + 1,
+                   p.intIface.c_str(), p.extIface.c_str(), p.active ? "" : " (inactive)",
+                   p.reported.rxBytes, p.reported.rxPackets, p.reported.txBytes,
+                   p.reported.txPackets);
+    }
+    dw.println("Live flows: %zu, recently ended flows: %zu", mLiveFlows.size(),
+               mEndedFlows.size());
+    dw.println("Lost conntrack events: %" PRIu64 ", flows ended without an event: %" PRIu64,
+               mLostEvents, mFlowsEndedWithoutEvent);
+    dw.decIndent();
+}
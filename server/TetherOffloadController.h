@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_TETHER_OFFLOAD_CONTROLLER_H
+#define NETD_SERVER_TETHER_OFFLOAD_CONTROLLER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BandwidthController.h"
+#include "NetdConstants.h"
+
+class DumpWriter;
+struct nlmsghdr;
+
+/*
+ * Software fast path for tethered traffic.
+ *
+ * Without it, every forwarded packet goes through the FORWARD chains, conntrack and NAT. Where
+ * the kernel and the nft tool support flowtables, this installs an nftables table that adds
+ * established TCP and UDP flows of each tethered interface pair to a flowtable. The kernel then
+ * forwards the rest of the flow's packets from the ingress hook, bypassing iptables.
+ *
+ * Offloaded packets never reach natctrl_tether_counters, so they are counted with conntrack
+ * accounting instead. The first packet of each flow gets a ct mark identifying its interface
+ * pair. Those flows skip the iptables counters through offload_FORWARD. Their traffic is the sum
+ * of the counters of the flows that have ended, taken from conntrack destroy events, and of the
+ * live flows, taken from a conntrack dump. A flow whose destroy event was already counted can
+ * still be listed by the dump for a while, so the dump skips the conntrack IDs of ended flows.
+ * getTetherStats() returns these totals as TetherStats, and BandwidthController adds them to the
+ * iptables counters.
+ *
+ * If the kernel drops destroy events because the socket buffer is full, conntrack is dumped again
+ * right away. The flows that the previous dump listed and that are gone are counted as they were
+ * at that dump, so only their traffic since then is lost. If the destroy event of such a flow
+ * turns up after all, only the rest of its traffic is added.
+ *
+ * Only flows opened from the tethered side are offloaded, so inbound filtering is unchanged.
+ * Offloaded packets do not reach bw_FORWARD either, so interface quotas and alerts only see the
+ * first packets of each flow. For that reason the fast path is off unless persist.tether.offload
+ * is set to 1. Without it, or without flowtable support, this does nothing and tethering uses
+ * iptables as before.
+ */
+class TetherOffloadController {
+public:
+    TetherOffloadController();
+    ~TetherOffloadController();
+
+    // Probes for flowtable support and, if it is there, enables the fast path. Call after the
+    // offload_FORWARD chain has been created.
+    int setupIptablesHooks();
+    bool isEnabled();
+
+    // Called when NAT is enabled or disabled on a pair of interfaces. Does nothing if the fast
+    // path is not enabled.
+    int addPair(const char* intIface, const char* extIface);
+    int removePair(const char* intIface, const char* extIface);
+
+    // Appends the traffic of the offloaded flows of each pair that ever had any. The counters are
+    // cumulative and never decrease.
+    int getTetherStats(std::vector<BandwidthController::TetherStats>* statsList);
+
+    void dump(DumpWriter& dw);
+
+    static const char* LOCAL_FORWARD;
+    static const char* LOCAL_TABLE;
+
+protected:
+    friend class TetherOffloadControllerTest;
+
+    // The counters of one conntrack entry.
+    struct Flow {
+        // The conntrack ID, or 0 if the message had none.
+        uint32_t id = 0;
+        uint32_t mark = 0;
+        uint64_t origPackets = 0;
+        uint64_t origBytes = 0;
+        uint64_t replyPackets = 0;
+        uint64_t replyBytes = 0;
+    };
+
+    struct Pair {
+        std::string intIface;
+        std::string extIface;
+        bool active;
+        // Traffic of the flows that have ended.
+        BandwidthController::TetherStats ended;
+        // What getTetherStats() last returned, which it never goes below.
+        BandwidthController::TetherStats reported;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    // Parses an IPCTNL_MSG_CT_NEW or IPCTNL_MSG_CT_DELETE message. Returns false if it has no
+    // mark or no counters.
+    static bool parseConntrackMessage(const nlmsghdr* nlh, Flow* flow);
+    // Adds the traffic of a flow that has ended to the ended counters of its pair, if any.
+    void endFlowLocked(const Flow& flow, Clock::time_point now);
+    // Replaces the live flows with the ones a conntrack dump listed. Flows that are gone without a
+    // destroy event are ended with the counters they had at the previous dump.
+    void updateLiveFlowsLocked(const std::vector<Flow>& listed, Clock::time_point now);
+    // The ended counters of each pair plus the traffic of its live flows.
+    std::vector<BandwidthController::TetherStats> getTotalsLocked() const;
+
+    // Probes for flowtable support and starts counting offloaded flows, regardless of
+    // persist.tether.offload.
+    int enableLocked();
+
+    std::string makeRulesetLocked() const;
+    std::string makeIptablesRulesLocked() const;
+    // Adding a pair installs the iptables rules before the ruleset that marks its flows, and
+    // removing one does the reverse, so marked flows are never counted twice.
+    int applyLocked(bool adding);
+
+    static int (*execNft)(const std::string& script);
+    static int (*execIptablesRestore)(IptablesTarget target, const std::string& commands);
+
+private:
+    // What has been counted for a flow that ended, and when it ended.
+    struct EndedFlow {
+        Clock::time_point at;
+        Flow counted;
+    };
+
+    static void* threadStart(void* obj);
+    void run();
+    // Lists the live offloaded flows that have a conntrack ID.
+    static int dumpLiveFlows(std::vector<Flow>* flows);
+    int syncLiveFlowsLocked();
+    size_t getPairIdLocked(const Flow& flow) const;
+    void forgetEndedFlowsLocked(Clock::time_point now);
+
+    std::mutex mLock;
+    bool mEnabled;
+    // Indexed by pair ID - 1. Pairs are never removed, so that their counters stick.
+    std::vector<Pair> mPairs;
+    uint64_t mLostEvents;
+    // Flows that ended while destroy events were dropped, or before their event was read.
+    uint64_t mFlowsEndedWithoutEvent;
+    // The flows that the last conntrack dump listed and that have not ended since, by conntrack ID.
+    std::map<uint32_t, Flow> mLiveFlows;
+    // Recently ended flows by conntrack ID, and the order they ended in. They are forgotten after a
+    // while, by which time conntrack no longer lists them and their destroy event has been read.
+    std::map<uint32_t, EndedFlow> mEndedFlows;
+    std::deque<std::pair<Clock::time_point, uint32_t>> mEndedOrder;
+    // Receives conntrack destroy events.
+    int mEventSock;
+    // Written to stop the event thread.
+    int mStopFd;
+    pthread_t mThread;
+};
+
+#endif  // NETD_SERVER_TETHER_OFFLOAD_CONTROLLER_H
@@ -0,0 +1,589 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * TetherOffloadControllerTest.cpp - unit tests for TetherOffloadController.cpp
+ */
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <linux/netlink.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <gtest/gtest.h>
+
+#include "ConnmarkFlags.h"
+#include "IptablesBaseTest.h"
+#include "TetherOffloadController.h"
+
+using android::base::StringPrintf;
+using android::base::WriteStringToFile;
+
+typedef BandwidthController::TetherStats TetherStats;
+
+namespace {
+
+const uint32_t kPair1Mark = ConnmarkFlags::TETHER_OFFLOAD | 1;
+const uint32_t kPair2Mark = ConnmarkFlags::TETHER_OFFLOAD | 2;
+
+// Builds a netlink message out of attributes.
+class ConntrackMessage {
+public:
+    ConntrackMessage() : mBuf(NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(nfgenmsg))) {}
+
+    void addId(uint32_t id) {
+        id = htonl(id);
+        addAttr(&mBuf, CTA_ID, &id, sizeof(id));
+    }
+
+    void addMark(uint32_t mark) {
+        mark = htonl(mark);
+        addAttr(&mBuf, CTA_MARK, &mark, sizeof(mark));
+    }
+
+    void addCounters(uint16_t type, uint64_t packets, uint64_t bytes) {
+        std::vector<uint8_t> nested;
+        packets = htobe64(packets);
+        bytes = htobe64(bytes);
+        addAttr(&nested, CTA_COUNTERS_PACKETS, &packets, sizeof(packets));
+        addAttr(&nested, CTA_COUNTERS_BYTES, &bytes, sizeof(bytes));
+        addAttr(&mBuf, type | NLA_F_NESTED, nested.data(), nested.size());
+    }
+
+    const nlmsghdr* get() {
+        nlmsghdr* nlh = reinterpret_cast<nlmsghdr*>(mBuf.data());
+        nlh->nlmsg_len = mBuf.size();
+        nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_DELETE;
+        return nlh;
+    }
+
+private:
+    static void addAttr(std::vector<uint8_t>* buf, uint16_t type, const void* data, size_t len) {
+        nlattr nla = { (uint16_t) (NLA_HDRLEN + len), type };
+        size_t pos = buf->size();
+        buf->resize(pos + NLA_HDRLEN + NLA_ALIGN(len));
+        memcpy(buf->data() + pos, &nla, sizeof(nla));
+        memcpy(buf->data() + pos + NLA_HDRLEN, data, len);
+    }
+
+    std::vector<uint8_t> mBuf;
+};
+
+// Returns an fd that refers to the calling thread's network namespace.
+int openNetns() {
+    std::string path = StringPrintf("/proc/self/task/%d/ns/net", gettid());
+    return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+// Moves the calling thread into a new network namespace and returns an fd that refers to it.
+int newNetns() {
+    if (unshare(CLONE_NEWNET) == -1) {
+        return -1;
+    }
+    return openNetns();
+}
+
+// Returns the calling thread to the network namespace it started in, and closes the fds of the
+// namespaces and sockets it used, when the test ends.
+class NetnsCleanup {
+public:
+    NetnsCleanup() : mOrigNs(openNetns()) {}
+
+    ~NetnsCleanup() {
+        setns(mOrigNs, CLONE_NEWNET);
+        close(mOrigNs);
+        for (int fd : mFds) {
+            close(fd);
+        }
+    }
+
+    int add(int fd) {
+        if (fd != -1) {
+            mFds.push_back(fd);
+        }
+        return fd;
+    }
+
+private:
+    const int mOrigNs;
+    std::vector<int> mFds;
+};
+
+bool runCommand(const std::string& command) {
+    return system(command.c_str()) == 0;
+}
+
+// Returns the packet counter of the first rule of an iptables chain, or -1.
+int64_t firstRulePackets(const char* chain) {
+    std::string command = StringPrintf("/system/bin/iptables -w -nvx -L %s", chain);
+    FILE* f = popen(command.c_str(), "r");
+    if (f == nullptr) {
+        return -1;
+    }
+    char line[256];
+    int64_t packets = -1;
+    // Skip the chain name and the column headers.
+    for (int i = 0; fgets(line, sizeof(line), f); i++) {
+        if (i == 2 && sscanf(line, "%" SCNd64, &packets) != 1) {
+            packets = -1;
+        }
+    }
+    pclose(f);
+    return packets;
+}
+
+}  // namespace
+
+class TetherOffloadControllerTest : public IptablesBaseTest {
+public:
+    TetherOffloadControllerTest() {
+        TetherOffloadController::execNft = fakeExecNft;
+        TetherOffloadController::execIptablesRestore = fakeExecIptablesRestore;
+        sNftScripts.clear();
+        sOrder.clear();
+        setEnabled(true);
+    }
+
+protected:
+    typedef TetherOffloadController::Flow Flow;
+
+    void setEnabled(bool enabled) {
+        mOffloadCtrl.mEnabled = enabled;
+    }
+
+    static int fakeExecNft(const std::string& script) {
+        sNftScripts.push_back(script);
+        sOrder += "n";
+        return 0;
+    }
+
+    static int fakeExecIptablesRestore(IptablesTarget target, const std::string& commands) {
+        sOrder += "i";
+        return IptablesBaseTest::fakeExecIptablesRestore(target, commands);
+    }
+
+    // Runs nft and iptables-restore for real.
+    static void useRealExec() {
+        TetherOffloadController::execNft = sRealExecNft;
+        TetherOffloadController::execIptablesRestore = sRealExecIptablesRestore;
+    }
+
+    // Enables the fast path as setupIptablesHooks() does when persist.tether.offload is set.
+    int enable() {
+        std::lock_guard<std::mutex> guard(mOffloadCtrl.mLock);
+        setEnabled(false);
+        return mOffloadCtrl.enableLocked();
+    }
+
+    void expectNftScripts(const std::vector<std::string>& expected) {
+        EXPECT_EQ(expected, sNftScripts);
+        sNftScripts.clear();
+    }
+
+    static Flow makeFlow(uint32_t mark, uint64_t origBytes, uint64_t replyBytes,
+                         uint32_t id = 0) {
+        Flow flow;
+        flow.id = id;
+        flow.mark = mark;
+        flow.origPackets = 1;
+        flow.origBytes = origBytes;
+        flow.replyPackets = 2;
+        flow.replyBytes = replyBytes;
+        return flow;
+    }
+
+    // Counts a flow as ended, as a destroy event would.
+    void addFlow(uint32_t mark, uint64_t origBytes, uint64_t replyBytes, uint32_t id = 0) {
+        mOffloadCtrl.endFlowLocked(makeFlow(mark, origBytes, replyBytes, id), mNow);
+    }
+
+    // Replaces the live flows with the given ones, as a conntrack dump would, and returns the
+    // traffic of each pair.
+    std::vector<TetherStats> addLiveFlows(const std::vector<Flow>& flows) {
+        mOffloadCtrl.updateLiveFlowsLocked(flows, mNow);
+        return getTotals();
+    }
+
+    std::vector<TetherStats> getTotals() {
+        return mOffloadCtrl.getTotalsLocked();
+    }
+
+    uint64_t flowsEndedWithoutEvent() {
+        return mOffloadCtrl.mFlowsEndedWithoutEvent;
+    }
+
+    bool isEndedFlow(uint32_t id) {
+        return mOffloadCtrl.mEndedFlows.count(id);
+    }
+
+    static bool parse(const nlmsghdr* nlh, Flow* flow) {
+        return TetherOffloadController::parseConntrackMessage(nlh, flow);
+    }
+
+    static int (*const sRealExecNft)(const std::string& script);
+    static int (*const sRealExecIptablesRestore)(IptablesTarget target,
+                                                 const std::string& commands);
+    static std::vector<std::string> sNftScripts;
+    static std::string sOrder;
+    TetherOffloadController::Clock::time_point mNow = TetherOffloadController::Clock::now();
+    TetherOffloadController mOffloadCtrl;
+};
+
+int (*const TetherOffloadControllerTest::sRealExecNft)(const std::string&) =
+        TetherOffloadController::execNft;
+int (*const TetherOffloadControllerTest::sRealExecIptablesRestore)(IptablesTarget,
+                                                                   const std::string&) =
+        TetherOffloadController::execIptablesRestore;
+std::vector<std::string> TetherOffloadControllerTest::sNftScripts;
+std::string TetherOffloadControllerTest::sOrder;
+
+TEST_F(TetherOffloadControllerTest, TestAddAndRemovePairs) {
+    const std::string kDelete =
+            "table inet netd_tether_offload {}\n"
+            "delete table inet netd_tether_offload\n";
+    const std::string kPair1Rules =
+            "        meta l4proto { tcp, udp } ct state new ct mark and 0x4000000 == 0 "
+            "iifname \"wlan0\" oifname \"rmnet0\" "
+            "ct mark set ct mark and 0xfbff0000 or 0x4000001\n"
+            "        meta l4proto { tcp, udp } ct state established "
+            "ct mark and 0x400ffff == 0x4000001 flow add @ft\n";
+    const std::string kPair2Rules =
+            "        meta l4proto { tcp, udp } ct state new ct mark and 0x4000000 == 0 "
+            "iifname \"rndis0\" oifname \"rmnet0\" "
+            "ct mark set ct mark and 0xfbff0000 or 0x4000002\n"
+            "        meta l4proto { tcp, udp } ct state established "
+            "ct mark and 0x400ffff == 0x4000002 flow add @ft\n";
+    auto table = [&](const std::string& devices, const std::string& rules) {
+        return kDelete +
+                "table inet netd_tether_offload {\n"
+                "    flowtable ft {\n"
+                "        hook ingress priority 0\n"
+                "        devices = { " + devices + " }\n"
+                "        counter\n"
+                "    }\n"
+                "    chain forward {\n"
+                "        type filter hook forward priority -1; policy accept;\n" +
+                rules +
+                "    }\n"
+                "}\n";
+    };
+
+    EXPECT_EQ(0, mOffloadCtrl.addPair("wlan0", "rmnet0"));
+    EXPECT_EQ(0, mOffloadCtrl.addPair("rndis0", "rmnet0"));
+    // Adding a pair twice does nothing.
+    EXPECT_EQ(0, mOffloadCtrl.addPair("rndis0", "rmnet0"));
+    expectNftScripts({
+        table("\"wlan0\", \"rmnet0\"", kPair1Rules),
+        table("\"wlan0\", \"rmnet0\", \"rndis0\"", kPair1Rules + kPair2Rules),
+    });
+    expectIptablesRestoreCommands(std::vector<std::string>{
+        "*filter\n"
+        "-F offload_FORWARD\n"
+        "-A offload_FORWARD -m connmark --mark 0x4000001/0x400ffff -j ACCEPT\n"
+        "COMMIT\n",
+        "*filter\n"
+        "-F offload_FORWARD\n"
+        "-A offload_FORWARD -m connmark --mark 0x4000001/0x400ffff -j ACCEPT\n"
+        "-A offload_FORWARD -m connmark --mark 0x4000002/0x400ffff -j ACCEPT\n"
+        "COMMIT\n",
+    });
+
+    // The pair keeps its ID when it comes back.
+    EXPECT_EQ(0, mOffloadCtrl.removePair("wlan0", "rmnet0"));
+    EXPECT_EQ(0, mOffloadCtrl.removePair("rndis0", "rmnet0"));
+    EXPECT_EQ(0, mOffloadCtrl.addPair("wlan0", "rmnet0"));
+    expectNftScripts({
+        table("\"rndis0\", \"rmnet0\"", kPair2Rules),
+        kDelete,
+        table("\"wlan0\", \"rmnet0\"", kPair1Rules),
+    });
+    expectIptablesRestoreCommands(std::vector<std::string>{
+        "*filter\n"
+        "-F offload_FORWARD\n"
+        "-A offload_FORWARD -m connmark --mark 0x4000002/0x400ffff -j ACCEPT\n"
+        "COMMIT\n",
+        "*filter\n"
+        "-F offload_FORWARD\n"
+        "COMMIT\n",
+        "*filter\n"
+        "-F offload_FORWARD\n"
+        "-A offload_FORWARD -m connmark --mark 0x4000001/0x400ffff -j ACCEPT\n"
+        "COMMIT\n",
+    });
+
+    // The iptables rules are installed before any flow of the pair is marked, and stay until no
+    // more flows are.
+    EXPECT_EQ("inin" "nini" "in", sOrder);
+}
+
+TEST_F(TetherOffloadControllerTest, TestDisabledDoesNothing) {
+    setEnabled(false);
+    EXPECT_EQ(0, mOffloadCtrl.addPair("wlan0", "rmnet0"));
+    EXPECT_EQ(0, mOffloadCtrl.removePair("wlan0", "rmnet0"));
+    expectNftScripts({});
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+
+    std::vector<TetherStats> stats;
+    EXPECT_EQ(0, mOffloadCtrl.getTetherStats(&stats));
+    EXPECT_TRUE(stats.empty());
+}
+
+TEST_F(TetherOffloadControllerTest, TestInvalidInterfaceNames) {
+    EXPECT_EQ(-1, mOffloadCtrl.addPair("wlan0\" }", "rmnet0"));
+    EXPECT_EQ(-1, mOffloadCtrl.addPair("wlan0", "rmnet0;"));
+    expectNftScripts({});
+}
+
+TEST_F(TetherOffloadControllerTest, TestParseConntrackMessage) {
+    ConntrackMessage msg;
+    msg.addId(1234);
+    msg.addMark(kPair1Mark);
+    msg.addCounters(CTA_COUNTERS_ORIG, 10, 1000);
+    msg.addCounters(CTA_COUNTERS_REPLY, 20, 30000);
+
+    Flow flow;
+    ASSERT_TRUE(parse(msg.get(), &flow));
+    EXPECT_EQ(1234U, flow.id);
+    EXPECT_EQ(kPair1Mark, flow.mark);
+    EXPECT_EQ(10U, flow.origPackets);
+    EXPECT_EQ(1000U, flow.origBytes);
+    EXPECT_EQ(20U, flow.replyPackets);
+    EXPECT_EQ(30000U, flow.replyBytes);
+
+    // Without accounting, there is nothing to count.
+    ConntrackMessage noCounters;
+    noCounters.addMark(kPair1Mark);
+    EXPECT_FALSE(parse(noCounters.get(), &flow));
+
+    // Attributes that run past the end of the message are not read.
+    ConntrackMessage truncated;
+    truncated.addMark(kPair1Mark);
+    truncated.addCounters(CTA_COUNTERS_ORIG, 10, 1000);
+    nlmsghdr* nlh = const_cast<nlmsghdr*>(truncated.get());
+    nlh->nlmsg_len -= 8;
+    EXPECT_FALSE(parse(nlh, &flow));
+}
+
+TEST_F(TetherOffloadControllerTest, TestCountsEndedFlows) {
+    EXPECT_EQ(0, mOffloadCtrl.addPair("wlan0", "rmnet0"));
+    EXPECT_EQ(0, mOffloadCtrl.addPair("rndis0", "rmnet0"));
+    EXPECT_EQ(0, mOffloadCtrl.removePair("rndis0", "rmnet0"));
+
+    addFlow(kPair1Mark, 100, 2000);
+    addFlow(kPair1Mark, 300, 4000);
+    addFlow(kPair2Mark, 5, 6);
+    // Flows that are not offloaded, or whose pair is unknown, are not counted here.
+    addFlow(1, 7, 8);
+    addFlow(ConnmarkFlags::TETHER_OFFLOAD | 3, 9, 10);
+    addFlow(ConnmarkFlags::TETHER_OFFLOAD, 11, 12);
+
+    // Live flows are only dumped when the fast path is on.
+    setEnabled(false);
+    std::vector<TetherStats> stats;
+    EXPECT_EQ(0, mOffloadCtrl.getTetherStats(&stats));
+    ASSERT_EQ(2U, stats.size());
+
+    // Like in natctrl_tether_counters, traffic from the tethered client to upstream is rx.
+    EXPECT_EQ("wlan0", stats[0].intIface);
+    EXPECT_EQ("rmnet0", stats[0].extIface);
+    EXPECT_EQ(400, stats[0].rxBytes);
+    EXPECT_EQ(2, stats[0].rxPackets);
+    EXPECT_EQ(6000, stats[0].txBytes);
+    EXPECT_EQ(4, stats[0].txPackets);
+
+    // The counters of inactive pairs stick.
+    EXPECT_EQ("rndis0", stats[1].intIface);
+    EXPECT_EQ(5, stats[1].rxBytes);
+    EXPECT_EQ(6, stats[1].txBytes);
+}
+
+TEST_F(TetherOffloadControllerTest, TestEndedFlowsAreNotCountedTwice) {
+    EXPECT_EQ(0, mOffloadCtrl.addPair("wlan0", "rmnet0"));
+    addFlow(kPair1Mark, 100, 2000, 7);
+
+    // A dump that still lists the ended flow only counts the other live flows.
+    std::vector<TetherStats> totals = addLiveFlows({
+        makeFlow(kPair1Mark, 90, 1900, 7),
+        makeFlow(kPair1Mark, 10, 20, 8),
+    });
+    ASSERT_EQ(1U, totals.size());
+    EXPECT_EQ(110, totals[0].rxBytes);
+    EXPECT_EQ(2020, totals[0].txBytes);
+}
+
+TEST_F(TetherOffloadControllerTest, TestLostDestroyEvents) {
+    EXPECT_EQ(0, mOffloadCtrl.addPair("wlan0", "rmnet0"));
+    addLiveFlows({
+        makeFlow(kPair1Mark, 100, 200, 1),
+        makeFlow(kPair1Mark, 10, 20, 2),
+    });
+
+    // Flow 1 ended, but its destroy event was dropped. It is counted as the previous dump found it.
+    std::vector<TetherStats> totals = addLiveFlows({ makeFlow(kPair1Mark, 30, 40, 2) });
+    ASSERT_EQ(1U, totals.size());
+    EXPECT_EQ(130, totals[0].rxBytes);
+    EXPECT_EQ(240, totals[0].txBytes);
+    EXPECT_EQ(1U, flowsEndedWithoutEvent());
+
+    // If the event was only late, the rest of the flow's traffic is added once.
+    addFlow(kPair1Mark, 150, 250, 1);
+    addFlow(kPair1Mark, 150, 250, 1);
+    totals = getTotals();
+    EXPECT_EQ(180, totals[0].rxBytes);
+    EXPECT_EQ(290, totals[0].txBytes);
+
+    // A destroy event ends a live flow, which the next dump no longer counts twice.
+    addFlow(kPair1Mark, 35, 45, 2);
+    totals = addLiveFlows({});
+    EXPECT_EQ(185, totals[0].rxBytes);
+    EXPECT_EQ(295, totals[0].txBytes);
+    EXPECT_EQ(1U, flowsEndedWithoutEvent());
+}
+
+TEST_F(TetherOffloadControllerTest, TestForgetsEndedFlowsByAge) {
+    EXPECT_EQ(0, mOffloadCtrl.addPair("wlan0", "rmnet0"));
+    addFlow(kPair1Mark, 1, 1, 1);
+    mNow += std::chrono::seconds(30);
+    addFlow(kPair1Mark, 1, 1, 2);
+
+    // Only the flows that ended long enough ago are forgotten.
+    mNow += std::chrono::seconds(31);
+    addFlow(kPair1Mark, 1, 1, 3);
+    EXPECT_FALSE(isEndedFlow(1));
+    EXPECT_TRUE(isEndedFlow(2));
+    EXPECT_TRUE(isEndedFlow(3));
+
+    // A conntrack ID that is listed again after being forgotten belongs to a new flow.
+    std::vector<TetherStats> totals = addLiveFlows({
+        makeFlow(kPair1Mark, 10, 10, 1),
+        makeFlow(kPair1Mark, 10, 10, 2),
+    });
+    EXPECT_EQ(13, totals[0].rxBytes);
+}
+
+// Forwards UDP traffic between two network namespaces through a third one that offloads it, and
+// checks that the traffic bypasses iptables and is still counted.
+TEST_F(TetherOffloadControllerTest, TestDatapath) {
+    if (access("/system/bin/nft", X_OK)) {
+        std::cout << "Skipping: nft not found" << std::endl;
+        return;
+    }
+    useRealExec();
+
+    NetnsCleanup cleanup;
+    const int clientNs = cleanup.add(newNetns());
+    if (clientNs == -1 && errno == EINVAL) {
+        std::cout << "Skipping: network namespaces not supported" << std::endl;
+        return;
+    }
+    ASSERT_NE(-1, clientNs) << strerror(errno);
+    const int serverNs = cleanup.add(newNetns());
+    ASSERT_NE(-1, serverNs) << strerror(errno);
+    const int routerNs = cleanup.add(newNetns());
+    ASSERT_NE(-1, routerNs) << strerror(errno);
+
+    // The router forwards between 192.168.55.0/24 on tc0 and 192.168.56.0/24 on ts0.
+    ASSERT_TRUE(runCommand("ip link set lo up"));
+    ASSERT_TRUE(runCommand("ip link add tc0 type veth peer name tc1"));
+    ASSERT_TRUE(runCommand("ip link add ts0 type veth peer name ts1"));
+    ASSERT_TRUE(runCommand(StringPrintf("ip link set tc1 netns /proc/%d/fd/%d", getpid(),
+                                        clientNs)));
+    ASSERT_TRUE(runCommand(StringPrintf("ip link set ts1 netns /proc/%d/fd/%d", getpid(),
+                                        serverNs)));
+    ASSERT_TRUE(runCommand("ip addr add 192.168.55.1/24 dev tc0 && ip link set tc0 up"));
+    ASSERT_TRUE(runCommand("ip addr add 192.168.56.1/24 dev ts0 && ip link set ts0 up"));
+    ASSERT_TRUE(WriteStringToFile("1", "/proc/sys/net/ipv4/ip_forward"));
+    for (const char* iptables : { "iptables", "ip6tables" }) {
+        ASSERT_TRUE(runCommand(StringPrintf("%s -w -N offload_FORWARD", iptables)));
+        ASSERT_TRUE(runCommand(StringPrintf("%s -w -A FORWARD -j offload_FORWARD", iptables)));
+    }
+
+    ASSERT_EQ(0, setns(clientNs, CLONE_NEWNET));
+    ASSERT_TRUE(runCommand("ip addr add 192.168.55.2/24 dev tc1 && ip link set tc1 up && "
+                           "ip route add default via 192.168.55.1"));
+    const int client = cleanup.add(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    ASSERT_NE(-1, client);
+
+    ASSERT_EQ(0, setns(serverNs, CLONE_NEWNET));
+    ASSERT_TRUE(runCommand("ip addr add 192.168.56.2/24 dev ts1 && ip link set ts1 up && "
+                           "ip route add default via 192.168.56.1"));
+    const int server = cleanup.add(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    ASSERT_NE(-1, server);
+    sockaddr_in serverAddr = { .sin_family = AF_INET };
+    inet_pton(AF_INET, "192.168.56.2", &serverAddr.sin_addr);
+    ASSERT_EQ(0, bind(server, reinterpret_cast<sockaddr*>(&serverAddr), sizeof(serverAddr)));
+    socklen_t len = sizeof(serverAddr);
+    ASSERT_EQ(0, getsockname(server, reinterpret_cast<sockaddr*>(&serverAddr), &len));
+
+    ASSERT_EQ(0, setns(routerNs, CLONE_NEWNET));
+    ASSERT_EQ(0, enable());
+    if (!mOffloadCtrl.isEnabled()) {
+        std::cout << "Skipping: flowtable counters not supported" << std::endl;
+        return;
+    }
+    ASSERT_EQ(0, mOffloadCtrl.addPair("tc0", "ts0"));
+
+    // The server echoes every packet, so that the flow is established after the first one.
+    const timeval timeout = { .tv_sec = 1 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(server, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    const int kPackets = 20;
+    const size_t kPayloadSize = 1000;
+    char buf[kPayloadSize] = {};
+    for (int i = 0; i < kPackets; i++) {
+        ASSERT_EQ((ssize_t) kPayloadSize,
+                  sendto(client, buf, kPayloadSize, 0, reinterpret_cast<sockaddr*>(&serverAddr),
+                         sizeof(serverAddr)));
+        sockaddr_in from;
+        socklen_t fromLen = sizeof(from);
+        ASSERT_EQ((ssize_t) kPayloadSize, recvfrom(server, buf, sizeof(buf), 0,
+                                                   reinterpret_cast<sockaddr*>(&from), &fromLen));
+        ASSERT_EQ((ssize_t) kPayloadSize, sendto(server, buf, kPayloadSize, 0,
+                                                 reinterpret_cast<sockaddr*>(&from), fromLen));
+        ASSERT_EQ((ssize_t) kPayloadSize, recv(client, buf, sizeof(buf), 0));
+    }
+
+    // Only the packets before the flow was offloaded went through offload_FORWARD.
+    int64_t iptablesPackets = firstRulePackets("offload_FORWARD");
+    EXPECT_LE(0, iptablesPackets);
+    EXPECT_GT(2 * kPackets, iptablesPackets);
+
+    // Conntrack still counts all of them, including the IP and UDP headers.
+    std::vector<TetherStats> stats;
+    ASSERT_EQ(0, mOffloadCtrl.getTetherStats(&stats));
+    ASSERT_EQ(1U, stats.size());
+    EXPECT_EQ("tc0", stats[0].intIface);
+    EXPECT_EQ("ts0", stats[0].extIface);
+    EXPECT_EQ(kPackets, stats[0].rxPackets);
+    EXPECT_EQ(kPackets * (int64_t) (kPayloadSize + 28), stats[0].rxBytes);
+    EXPECT_EQ(kPackets, stats[0].txPackets);
+    EXPECT_EQ(kPackets * (int64_t) (kPayloadSize + 28), stats[0].txBytes);
+}
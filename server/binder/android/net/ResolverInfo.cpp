@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android/net/ResolverInfo.h"
+
+#include <netinet/in.h>
+#include <string.h>
+
+#include <binder/Parcel.h>
+#include <utils/Errors.h>
+
+using android::BAD_VALUE;
+using android::Parcel;
+using android::status_t;
+
+namespace android {
+
+namespace net {
+
+namespace {
+
+// Size of the sockaddr for the given family, or 0 if it is not an IP family.
+size_t sockaddrSize(sa_family_t family) {
+    switch (family) {
+        case AF_INET:  return sizeof(sockaddr_in);
+        case AF_INET6: return sizeof(sockaddr_in6);
+        default:       return 0;
+    }
+}
+
+status_t writeServerStats(Parcel* parcel, const ResolverInfo::ServerStats& s) {
+    const int32_t ints[] = {
+        s.successes, s.errors, s.timeouts, s.internalErrors,
+        s.rttAvg, s.rttP50, s.rttP90, s.rttMax,
+    };
+    for (int32_t i : ints) {
+        if (status_t err = parcel->writeInt32(i)) {
+            return err;
+        }
+    }
+    const int64_t times[] = {
+        s.lastSampleTime, s.lastSuccessTime, s.lastErrorTime, s.lastTimeoutTime,
+    };
+    for (int64_t t : times) {
+        if (status_t err = parcel->writeInt64(t)) {
+            return err;
+        }
+    }
+    return parcel->writeBool(s.usable);
+}
+
+status_t readServerStats(const Parcel* parcel, ResolverInfo::ServerStats* s) {
+    int32_t* ints[] = {
+        &s->successes, &s->errors, &s->timeouts, &s->internalErrors,
+        &s->rttAvg, &s->rttP50, &s->rttP90, &s->rttMax,
+    };
+    for (int32_t* i : ints) {
+        if (status_t err = parcel->readInt32(i)) {
+            return err;
+        }
+    }
+    int64_t* times[] = {
+        &s->lastSampleTime, &s->lastSuccessTime, &s->lastErrorTime, &s->lastTimeoutTime,
+    };
+    for (int64_t* t : times) {
+        if (status_t err = parcel->readInt64(t)) {
+            return err;
+        }
+    }
+    return parcel->readBool(&s->usable);
+}
+
+}  // namespace
+
+status_t ResolverInfo::writeToParcel(Parcel* parcel) const {
+    /*
+     * Keep implementation in sync with readFromParcel() below and with the Java
+     * implementation used by the framework.
+     */
+    if (status_t err = parcel->writeInt32(netId)) {
+        return err;
+    }
+    if (status_t err = parcel->writeInt32(servers.size())) {
+        return err;
+    }
+    for (const Server& server : servers) {
+        // Each sockaddr is written as it is, in a byte array of its exact size.
+        const int8_t* bytes = reinterpret_cast<const int8_t*>(&server.addr);
+        const std::vector<int8_t> addr(bytes, bytes + sockaddrSize(server.addr.ss_family));
+        if (status_t err = parcel->writeByteVector(addr)) {
+            return err;
+        }
+        if (status_t err = writeServerStats(parcel, server.stats)) {
+            return err;
+        }
+    }
+    if (status_t err = parcel->writeUtf8VectorAsUtf16Vector(domains)) {
+        return err;
+    }
+    if (status_t err = parcel->writeInt32Vector(params)) {
+        return err;
+    }
+    if (status_t err = parcel->writeInt32(configUpdatesApplied)) {
+        return err;
+    }
+    return parcel->writeInt32(configUpdatesUnchanged);
+}
+
+status_t ResolverInfo::readFromParcel(const Parcel* parcel) {
+    if (status_t err = parcel->readInt32(&netId)) {
+        return err;
+    }
+    int32_t count;
+    if (status_t err = parcel->readInt32(&count)) {
+        return err;
+    }
+    if (count < 0) {
+        return BAD_VALUE;
+    }
+    servers.clear();
+    for (int32_t i = 0; i < count; i++) {
+        std::vector<int8_t> addr;
+        if (status_t err = parcel->readByteVector(&addr)) {
+            return err;
+        }
+        Server server;
+        memset(&server.addr, 0, sizeof(server.addr));
+        if (addr.size() < sizeof(sa_family_t) || addr.size() > sizeof(server.addr)) {
+            return BAD_VALUE;
+        }
+        memcpy(&server.addr, addr.data(), addr.size());
+        if (addr.size() != sockaddrSize(server.addr.ss_family)) {
+            return BAD_VALUE;
+        }
+        if (status_t err = readServerStats(parcel, &server.stats)) {
+            return err;
+        }
+        servers.push_back(server);
+    }
+    if (status_t err = parcel->readUtf8VectorFromUtf16Vector(&domains)) {
+        return err;
+    }
+    if (status_t err = parcel->readInt32Vector(&params)) {
+        return err;
+    }
+    if (status_t err = parcel->readInt32(&configUpdatesApplied)) {
+        return err;
+    }
+    return parcel->readInt32(&configUpdatesUnchanged);
+}
+
+}  // namespace net
+
+}  // namespace android
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_ANDROID_NET_RESOLVER_INFO_H
+#define NETD_SERVER_ANDROID_NET_RESOLVER_INFO_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+#include <binder/Parcelable.h>
+
+namespace android {
+
+namespace net {
+
+/*
+ * The resolver configuration and per-server stats of one network, as returned by
+ * INetd::getResolverInfoForNetwork().
+ *
+ * Servers are carried as raw sockaddrs, and stats as plain integers, so that building one of these
+ * requires no string formatting.
+ */
+class ResolverInfo : public Parcelable {
+public:
+    struct ServerStats {
+        // Outcomes of the queries in the resolver's sample window.
+        int32_t successes = 0;
+        int32_t errors = 0;
+        int32_t timeouts = 0;
+        int32_t internalErrors = 0;
+        // RTTs of the successful queries in the sample window, in ms, or -1 if there are none.
+        int32_t rttAvg = -1;
+        int32_t rttP50 = -1;
+        int32_t rttP90 = -1;
+        int32_t rttMax = -1;
+        // Times in seconds since the epoch of the most recent sample of each kind, or 0 if none.
+        int64_t lastSampleTime = 0;
+        int64_t lastSuccessTime = 0;
+        int64_t lastErrorTime = 0;
+        int64_t lastTimeoutTime = 0;
+        // Whether the resolver currently considers the server usable.
+        bool usable = false;
+    };
+
+    struct Server {
+        // A sockaddr_in or sockaddr_in6.
+        sockaddr_storage addr;
+        ServerStats stats;
+    };
+
+    ResolverInfo() = default;
+    virtual ~ResolverInfo() = default;
+
+    status_t writeToParcel(Parcel* parcel) const override;
+    status_t readFromParcel(const Parcel* parcel) override;
+
+    int32_t netId = 0;
+    std::vector<Server> servers;
+    std::vector<std::string> domains;
+    // Resolver params, indexed by INetd::RESOLVER_PARAMS_*.
+    std::vector<int32_t> params;
+    // Number of setResolverConfiguration() calls that changed the configuration, and that were
+    // skipped because they did not change anything, since the network was last configured by other
+    // means.
+    int32_t configUpdatesApplied = 0;
+    int32_t configUpdatesUnchanged = 0;
+};
+
+}  // namespace net
+
+}  // namespace android
+
+#endif  // NETD_SERVER_ANDROID_NET_RESOLVER_INFO_H
@@ -79,6 +79,9 @@ int main() {
     };
 
     gCtls = new android::net::Controllers();
+    if (gCtls->clatdCtrl.start()) {
+        ALOGE("Unable to start clatd supervisor (%s)", strerror(errno));
+    }
     CommandListener cl;
     nm->setBroadcaster((SocketListener *) &cl);
 
@@ -90,7 +93,16 @@ int main() {
     // Set local DNS mode, to prevent bionic from proxying
     // back to this service, recursively.
     setenv("ANDROID_DNS_MODE", "local", 1);
-    DnsProxyListener dpl(&gCtls->netCtrl, &gCtls->eventReporter);
+    if (gCtls->dnsEventReporter.start()) {
+        ALOGE("Unable to start DnsEventReporter (%s)", strerror(errno));
+        exit(1);
+    }
+    if (gCtls->dnsPrefetcher.start()) {
+        ALOGE("Unable to start DnsPrefetcher (%s)", strerror(errno));
+        exit(1);
+    }
+    DnsProxyListener dpl(&gCtls->netCtrl, &gCtls->eventReporter, &gCtls->dnsEventReporter,
+                         &gCtls->dnsPrefetcher, &gCtls->dnsAddressSorter);
     if (dpl.startListener()) {
         ALOGE("Unable to start DnsProxyListener (%s)", strerror(errno));
         exit(1);
@@ -102,7 +114,7 @@ int main() {
         exit(1);
     }
 
-    FwmarkServer fwmarkServer(&gCtls->netCtrl, &gCtls->eventReporter);
+    FwmarkServer fwmarkServer(&gCtls->netCtrl, &gCtls->eventReporter, &gCtls->dnsAddressSorter);
     if (fwmarkServer.startListener()) {
         ALOGE("Unable to start FwmarkServer (%s)", strerror(errno));
         exit(1);
@@ -619,6 +619,95 @@ TEST_F(BinderTest, TestInterfaceAddRemoveAddress) {
     }
 }
 
+TEST_F(BinderTest, TestInterfaceAddRemoveAddresses) {
+    const std::vector<std::string> addrStrings = {
+        "192.0.2.1", "2001:db8::1", "2001:db8::4", "192.not.an.ip", "2001:db8::2",
+    };
+    const std::vector<int32_t> prefixLengths = { 24, 64, 129, 24, 128 };
+    const std::vector<int32_t> expectSuccess = { true, true, false, false, true };
+
+    std::vector<int32_t> results;
+    binder::Status status = mNetd->interfaceAddAddresses(
+            sTunIfName, addrStrings, prefixLengths, &results);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+    ASSERT_EQ(addrStrings.size(), results.size());
+    for (size_t i = 0; i < addrStrings.size(); i++) {
+        if (expectSuccess[i]) {
+            EXPECT_EQ(0, results[i]) << addrStrings[i];
+            EXPECT_TRUE(interfaceHasAddress(sTunIfName, addrStrings[i].c_str(), prefixLengths[i]));
+        } else {
+            EXPECT_NE(0, results[i]) << addrStrings[i];
+        }
+    }
+
+    status = mNetd->interfaceDelAddresses(sTunIfName, addrStrings, prefixLengths, &results);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+    ASSERT_EQ(addrStrings.size(), results.size());
+    for (size_t i = 0; i < addrStrings.size(); i++) {
+        EXPECT_EQ(expectSuccess[i], results[i] == 0) << addrStrings[i];
+        EXPECT_FALSE(interfaceHasAddress(sTunIfName, addrStrings[i].c_str(), -1));
+    }
+
+    // Mismatched arguments are rejected as a whole.
+    status = mNetd->interfaceAddAddresses(sTunIfName, addrStrings, { 24 }, &results);
+    ASSERT_EQ(binder::Status::EX_SERVICE_SPECIFIC, status.exceptionCode());
+    EXPECT_EQ(EINVAL, status.serviceSpecificErrorCode());
+}
+
+namespace {
+
+// Returns the flags of |ifname| and sets |mtu| to its MTU, or returns -1.
+int getLinkConfig(const std::string& ifname, int *mtu) {
+    int s = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (s == -1) return -1;
+    struct ifreq ifr = {};
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname.c_str());
+    int flags = -1;
+    if (ioctl(s, SIOCGIFFLAGS, &ifr) == 0) {
+        flags = ifr.ifr_flags;
+        if (ioctl(s, SIOCGIFMTU, &ifr) == 0) {
+            *mtu = ifr.ifr_mtu;
+        } else {
+            flags = -1;
+        }
+    }
+    close(s);
+    return flags;
+}
+
+}  // namespace
+
+TEST_F(BinderTest, TestInterfaceSetLinkConfig) {
+    int mtu;
+    const int originalFlags = getLinkConfig(sTunIfName, &mtu);
+    ASSERT_NE(-1, originalFlags);
+    const int originalMtu = mtu;
+
+    std::vector<int32_t> results;
+    binder::Status status = mNetd->interfaceSetLinkConfig(sTunIfName, 1280, IFF_UP, 0, &results);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+    EXPECT_EQ(std::vector<int32_t>({ 0, 0 }), results);
+    EXPECT_TRUE(getLinkConfig(sTunIfName, &mtu) & IFF_UP);
+    EXPECT_EQ(1280, mtu);
+
+    // Each part reports its own result.
+    status = mNetd->interfaceSetLinkConfig(sTunIfName, 1000000, 0, IFF_UP, &results);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+    ASSERT_EQ(static_cast<size_t>(INetd::LINK_CONFIG_RESULT_SIZE), results.size());
+    EXPECT_NE(0, results[INetd::LINK_CONFIG_RESULT_MTU]);
+    EXPECT_EQ(0, results[INetd::LINK_CONFIG_RESULT_FLAGS]);
+    EXPECT_FALSE(getLinkConfig(sTunIfName, &mtu) & IFF_UP);
+    EXPECT_EQ(1280, mtu);
+
+    status = mNetd->interfaceSetLinkConfig("nonexistent0", 1280, 0, 0, &results);
+    ASSERT_EQ(binder::Status::EX_SERVICE_SPECIFIC, status.exceptionCode());
+    EXPECT_EQ(ENODEV, status.serviceSpecificErrorCode());
+
+    status = mNetd->interfaceSetLinkConfig(sTunIfName, originalMtu, originalFlags & IFF_UP,
+                                           ~originalFlags & IFF_UP, &results);
+    EXPECT_TRUE(status.isOk()) << status.exceptionMessage();
+}
+
 TEST_F(BinderTest, TestSetProcSysNet) {
     static const struct TestData {
         const int family;
@@ -50,8 +50,10 @@
 #include "dns_responder_client.h"
 #include "resolv_params.h"
 #include "ResolverStats.h"
+#include "ResponseCode.h"
 
 #include "android/net/INetd.h"
+#include "android/net/ResolverInfo.h"
 #include "android/net/metrics/INetdEventListener.h"
 #include "binder/IServiceManager.h"
 
@@ -126,6 +128,102 @@ class AddrInfo {
     int error_;
 };
 
+// A client of the dnsproxyd getaddrinfostream command that parses the frames it receives.
+class GetAddrInfoStream {
+  public:
+    struct Frame {
+        int code;
+        // For DnsProxyPartialResult, the family and the addresses.
+        int family;
+        std::vector<std::string> addrs;
+        // For DnsProxyOperationFailed, the getaddrinfo error.
+        int32_t error;
+    };
+
+    GetAddrInfoStream() : fd_(socket_local_client("dnsproxyd", ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                                  SOCK_STREAM)) {}
+    ~GetAddrInfoStream() {
+        if (fd_ != -1) close(fd_);
+    }
+
+    bool start(const char* host, unsigned netId) {
+        // Hints of -1 mean no hints, i.e., both families.
+        const std::string cmd = StringPrintf("getaddrinfostream %s ^ -1 -1 -1 -1 %u", host, netId);
+        return fd_ != -1 && write(fd_, cmd.c_str(), cmd.size() + 1) == (ssize_t) cmd.size() + 1;
+    }
+
+    bool readFrame(Frame* frame) {
+        char code[4];
+        if (!readFully(code, sizeof(code)) || code[3] != '\0') return false;
+        frame->code = strtol(code, nullptr, 10);
+        frame->family = AF_UNSPEC;
+        frame->addrs.clear();
+        frame->error = 0;
+        switch (frame->code) {
+            case ResponseCode::DnsProxyPartialResult:
+                return readBE32(&frame->family) && readAddrinfoList(&frame->addrs);
+            case ResponseCode::DnsProxyQueryResult:
+                return readAddrinfoList(&frame->addrs);
+            case ResponseCode::DnsProxyOperationFailed: {
+                int32_t len;
+                return readBE32(&len) && len == sizeof(frame->error) &&
+                        readFully(&frame->error, sizeof(frame->error));
+            }
+            default:
+                return false;
+        }
+    }
+
+  private:
+    bool readFully(void* buf, size_t len) {
+        char* p = reinterpret_cast<char*>(buf);
+        while (len > 0) {
+            ssize_t n = TEMP_FAILURE_RETRY(read(fd_, p, len));
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    bool readBE32(int32_t* value) {
+        uint32_t be;
+        if (!readFully(&be, sizeof(be))) return false;
+        *value = ntohl(be);
+        return true;
+    }
+
+    bool readLenAndData(std::vector<char>* data) {
+        int32_t len;
+        if (!readBE32(&len) || len < 0 || len > 1024) return false;
+        data->resize(len);
+        return readFully(data->data(), len);
+    }
+
+    bool readAddrinfoList(std::vector<std::string>* addrs) {
+        while (true) {
+            int32_t more;
+            if (!readBE32(&more)) return false;
+            if (!more) return true;
+            int32_t flags, family, socktype, protocol;
+            std::vector<char> addr, canonname;
+            if (!readBE32(&flags) || !readBE32(&family) || !readBE32(&socktype) ||
+                    !readBE32(&protocol) || !readLenAndData(&addr) ||
+                    !readLenAndData(&canonname)) {
+                return false;
+            }
+            char host[NI_MAXHOST];
+            if (addr.empty() || getnameinfo(reinterpret_cast<const sockaddr*>(addr.data()),
+                    addr.size(), host, sizeof(host), nullptr, 0, NI_NUMERICHOST) != 0) {
+                return false;
+            }
+            addrs->push_back(host);
+        }
+    }
+
+    int fd_;
+};
+
 class ResolverTest : public ::testing::Test, public DnsResponderClient {
 private:
     int mOriginalMetricsLevel;
@@ -364,9 +462,110 @@ TEST_F(ResolverTest, GetHostByName_Binder) {
     EXPECT_TRUE(UnorderedCompareArray(res_servers, servers));
     EXPECT_TRUE(UnorderedCompareArray(res_domains, domains));
 
+    // The structured variant returns the same information.
+    android::net::ResolverInfo info;
+    ASSERT_TRUE(mNetdSrv->getResolverInfoForNetwork(TEST_NETID, &info).isOk());
+    EXPECT_EQ(TEST_NETID, info.netId);
+    EXPECT_EQ(res_domains, info.domains);
+    ASSERT_EQ(res_servers.size(), info.servers.size());
+    for (size_t i = 0; i < info.servers.size(); i++) {
+        char host[NI_MAXHOST];
+        const sockaddr* addr = reinterpret_cast<const sockaddr*>(&info.servers[i].addr);
+        ASSERT_EQ(0, getnameinfo(addr, sizeof(info.servers[i].addr), host, sizeof(host),
+                                 nullptr, 0, NI_NUMERICHOST));
+        EXPECT_EQ(res_servers[i], host);
+        const android::net::ResolverInfo::ServerStats& s = info.servers[i].stats;
+        EXPECT_EQ(res_stats[i].successes, s.successes);
+        EXPECT_EQ(res_stats[i].timeouts, s.timeouts);
+        EXPECT_EQ(res_stats[i].rtt_avg, s.rttAvg);
+        EXPECT_LE(s.rttP50, s.rttP90);
+        EXPECT_LE(s.rttP90, s.rttMax);
+        EXPECT_EQ(res_stats[i].usable, s.usable);
+    }
+    ASSERT_EQ(static_cast<size_t>(INetd::RESOLVER_PARAMS_COUNT), info.params.size());
+    EXPECT_EQ(res_params.sample_validity, info.params[INetd::RESOLVER_PARAMS_SAMPLE_VALIDITY]);
+    EXPECT_EQ(res_params.max_samples, info.params[INetd::RESOLVER_PARAMS_MAX_SAMPLES]);
+
     ASSERT_NO_FATAL_FAILURE(ShutdownDNSServers(&dns));
 }
 
+TEST_F(ResolverTest, ReconfigureKeepsCache) {
+    const char* listen_addr = "127.0.0.3";
+    const char* listen_srv = "53";
+    const char* host_name = "cached.example.com.";
+    test::DNSResponder dns(listen_addr, listen_srv, 250, ns_rcode::ns_r_servfail, 1.0);
+    dns.addMapping(host_name, ns_type::ns_t_a, "1.2.3.4");
+    ASSERT_TRUE(dns.startServer());
+    std::vector<std::string> servers = { listen_addr };
+    std::vector<std::string> domains = { "example.com" };
+    ASSERT_TRUE(SetResolversForNetwork(servers, domains, mDefaultParams_Binder));
+
+    dns.clearQueries();
+    const hostent* result = gethostbyname("cached");
+    ASSERT_FALSE(result == nullptr);
+    EXPECT_EQ(1U, GetNumQueriesForType(dns, ns_type::ns_t_a, host_name));
+
+    // Resending the same configuration is skipped, and changing only the search domains is
+    // applied. Both keep the cache.
+    android::net::ResolverInfo before;
+    ASSERT_TRUE(mNetdSrv->getResolverInfoForNetwork(TEST_NETID, &before).isOk());
+    ASSERT_TRUE(SetResolversForNetwork(servers, domains, mDefaultParams_Binder));
+    android::net::ResolverInfo after;
+    ASSERT_TRUE(mNetdSrv->getResolverInfoForNetwork(TEST_NETID, &after).isOk());
+    EXPECT_EQ(before.configUpdatesUnchanged + 1, after.configUpdatesUnchanged);
+    EXPECT_EQ(before.configUpdatesApplied, after.configUpdatesApplied);
+
+    domains.push_back("example.net");
+    ASSERT_TRUE(SetResolversForNetwork(servers, domains, mDefaultParams_Binder));
+    ASSERT_TRUE(mNetdSrv->getResolverInfoForNetwork(TEST_NETID, &after).isOk());
+    EXPECT_EQ(before.configUpdatesUnchanged + 1, after.configUpdatesUnchanged);
+    EXPECT_EQ(before.configUpdatesApplied + 1, after.configUpdatesApplied);
+    ASSERT_EQ(2U, after.domains.size());
+    EXPECT_EQ("example.net", after.domains[1]);
+
+    result = gethostbyname("cached.example.com");
+    ASSERT_FALSE(result == nullptr);
+    EXPECT_EQ("1.2.3.4", ToString(result));
+    EXPECT_EQ(1U, GetNumQueriesForType(dns, ns_type::ns_t_a, host_name));
+
+    dns.stopServer();
+}
+
+TEST_F(ResolverTest, RecreatedNetworkIsConfigured) {
+    const char* listen_addr = "127.0.0.3";
+    const char* listen_srv = "53";
+    const char* host_name = "recreated.example.com.";
+    test::DNSResponder dns(listen_addr, listen_srv, 250, ns_rcode::ns_r_servfail, 1.0);
+    dns.addMapping(host_name, ns_type::ns_t_a, "1.2.3.5");
+    ASSERT_TRUE(dns.startServer());
+    std::vector<std::string> servers = { listen_addr };
+    std::vector<std::string> domains = { "example.com" };
+    ASSERT_TRUE(SetResolversForNetwork(servers, domains, mDefaultParams_Binder));
+
+    // Destroying the network drops its configuration, so the same configuration must be applied
+    // in full to a new network with the same netId, e.g., when wifi reconnects.
+    TearDownOemNetwork(mOemNetId);
+    mOemNetId = SetupOemNetwork();
+    ASSERT_EQ(TEST_NETID, mOemNetId);
+    ASSERT_TRUE(SetResolversForNetwork(servers, domains, mDefaultParams_Binder));
+
+    std::vector<std::string> res_servers;
+    std::vector<std::string> res_domains;
+    __res_params res_params;
+    std::vector<ResolverStats> res_stats;
+    ASSERT_TRUE(GetResolverInfo(&res_servers, &res_domains, &res_params, &res_stats));
+    EXPECT_EQ(servers, res_servers);
+    EXPECT_EQ(domains, res_domains);
+
+    dns.clearQueries();
+    const hostent* result = gethostbyname("recreated");
+    ASSERT_FALSE(result == nullptr);
+    EXPECT_EQ("1.2.3.5", ToString(result));
+    EXPECT_EQ(1U, GetNumQueriesForType(dns, ns_type::ns_t_a, host_name));
+
+    dns.stopServer();
+}
+
 TEST_F(ResolverTest, GetAddrInfo) {
     addrinfo* result = nullptr;
 
@@ -444,6 +643,44 @@ TEST_F(ResolverTest, GetAddrInfo) {
     dns2.stopServer();
 }
 
+TEST_F(ResolverTest, GetAddrInfoStream) {
+    const char* listen_addr = "127.0.0.16";
+    const char* listen_srv = "53";
+    const char* host_name = "stream.example.com.";
+    test::DNSResponder dns(listen_addr, listen_srv, 250, ns_rcode::ns_r_servfail, 1.0);
+    dns.addMapping(host_name, ns_type::ns_t_a, "1.2.3.4");
+    dns.addMapping(host_name, ns_type::ns_t_aaaa, "::1.2.3.4");
+    ASSERT_TRUE(dns.startServer());
+    std::vector<std::string> servers = { listen_addr };
+    ASSERT_TRUE(SetResolversForNetwork(servers, mDefaultSearchDomains, mDefaultParams_Binder));
+
+    // One partial result per family, in whichever order the lookups finish, then the end.
+    GetAddrInfoStream stream;
+    ASSERT_TRUE(stream.start("stream.example.com", TEST_NETID));
+    std::vector<int> families;
+    GetAddrInfoStream::Frame frame;
+    for (int i = 0; i < 2; i++) {
+        ASSERT_TRUE(stream.readFrame(&frame));
+        ASSERT_EQ(ResponseCode::DnsProxyPartialResult, frame.code);
+        families.push_back(frame.family);
+        const char* expected = (frame.family == AF_INET6) ? "::1.2.3.4" : "1.2.3.4";
+        EXPECT_EQ(std::vector<std::string>({ expected }), frame.addrs);
+    }
+    EXPECT_TRUE(UnorderedCompareArray(families, std::vector<int>({ AF_INET, AF_INET6 })));
+    ASSERT_TRUE(stream.readFrame(&frame));
+    EXPECT_EQ(ResponseCode::DnsProxyQueryResult, frame.code);
+    EXPECT_TRUE(frame.addrs.empty());
+
+    // A name that does not resolve in either family fails like getaddrinfo does.
+    GetAddrInfoStream failing;
+    ASSERT_TRUE(failing.start("nonexistent.example.com", TEST_NETID));
+    ASSERT_TRUE(failing.readFrame(&frame));
+    EXPECT_EQ(ResponseCode::DnsProxyOperationFailed, frame.code);
+    EXPECT_NE(0, frame.error);
+
+    dns.stopServer();
+}
+
 TEST_F(ResolverTest, GetAddrInfoV4) {
     addrinfo* result = nullptr;
 